@@ -0,0 +1,251 @@
+// Bloom filters of the tokens of blocks. A keyword query skips the blocks
+// which filters don't contain its tokens.
+
+
+#define _GNU_SOURCE                 // M_LN2
+#include <stdio.h>
+#include <stdlib.h>			// exit(), calloc()
+#include <string.h>			// memset(), strncmp()
+#include <ctype.h>			// isalnum(), isxdigit()
+#include <math.h>			// log(), ceil()
+#include "extract_time_blk_bz2.h"
+#include "blk_bloom.h"
+
+
+static void insert_hash(bloom_builder *, unsigned long long);
+static void set_hash_bits(unsigned char *, int, int, unsigned long long);
+static bool is_uuid(const char *, int);
+
+
+int parse_bloom_tokens(const char *str)
+{
+    const char *names[] = {"uuid", "num", "word"};
+    const int classes[] = {BLOOM_TOKEN_UUID, BLOOM_TOKEN_NUM,
+                           BLOOM_TOKEN_WORD};
+    int tokens = 0, len, i;
+
+    while (*str != '\0')
+    {
+        len = strcspn(str, ",");
+
+        for (i = 0; i < 3; i++)
+            if (strlen(names[i]) == len && strncmp(str, names[i], len) == 0)
+                break;
+        if (i == 3)
+            return 0;
+
+        tokens |= classes[i];
+        str += len + (str[len] == ',');
+    }
+
+    return tokens;
+}
+
+
+bool is_token_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_' || c == '-';
+}
+
+
+int token_class(const char *token, int len)
+{
+    if (is_uuid(token, len))
+        return BLOOM_TOKEN_UUID;
+
+    for (int i = 0; i < len; i++)
+        if (isdigit((unsigned char)token[i]))
+            return BLOOM_TOKEN_NUM;
+
+    return BLOOM_TOKEN_WORD;
+}
+
+
+// FNV-1a
+unsigned long long hash_token(const char *token, int len)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+
+    for (int i = 0; i < len; i++)
+    {
+        hash ^= (unsigned char)token[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+
+void add_bloom_tokens(bloom_builder *builder, const char *str, int len,
+                      int tokens)
+{
+    int start, end;
+
+    for (start = 0; start < len; start = end + 1)
+    {
+        while (start < len && !is_token_char(str[start]))
+            start++;
+        for (end = start; end < len && is_token_char(str[end]); end++)
+            ;
+
+        if (end - start >= BLOOM_MIN_TOKEN_LEN &&
+            (token_class(str + start, end - start) & tokens))
+            insert_hash(builder, hash_token(str + start, end - start));
+    }
+}
+
+
+int bloom_filter_size(const bloom_builder *builder, const bloom_opts *opts)
+{
+    // m = -n * ln(p) / ln(2)^2 bits
+    double bits = ceil(-(double)builder->n_hashes * log(opts->fp_rate) /
+                       (M_LN2 * M_LN2));
+    double size = ceil(bits / 8);
+
+    if (size < 8)
+        size = 8;
+    if (size > opts->max_size)
+        size = opts->max_size;
+
+    return size;
+}
+
+
+// k = -log2(p)
+int bloom_hashes(double fp_rate)
+{
+    int n_hashes = (int)(-log(fp_rate) / M_LN2 + 0.5);
+
+    return n_hashes < 1 ? 1 : n_hashes;
+}
+
+
+void fill_bloom_filter(const bloom_builder *builder, unsigned char *filter,
+                       int size, int n_hashes)
+{
+    memset(filter, 0, size);
+
+    for (unsigned long i = 0; i < builder->size; i++)
+        if (builder->hashes[i] != 0)
+            set_hash_bits(filter, size, n_hashes, builder->hashes[i]);
+}
+
+
+void add_bloom_filter_tokens(unsigned char *filter, int size, int n_hashes,
+                             const char *str, int len, int tokens)
+{
+    bloom_builder builder = {0};
+
+    add_bloom_tokens(&builder, str, len, tokens);
+
+    for (unsigned long i = 0; i < builder.size; i++)
+        if (builder.hashes[i] != 0)
+            set_hash_bits(filter, size, n_hashes, builder.hashes[i]);
+
+    free_bloom_builder(&builder);
+}
+
+
+void reset_bloom_builder(bloom_builder *builder)
+{
+    if (builder->hashes != NULL)
+        memset(builder->hashes, 0, builder->size * sizeof(unsigned long long));
+    builder->n_hashes = 0;
+}
+
+
+void free_bloom_builder(bloom_builder *builder)
+{
+    free(builder->hashes);
+    memset(builder, 0, sizeof(*builder));
+}
+
+
+bool bloom_may_contain(const unsigned char *filter, int size, int n_hashes,
+                       unsigned long long hash)
+{
+    unsigned long long n_bits = (unsigned long long)size * 8;
+    // Double hashing: the bits are h1 + i * h2
+    unsigned long long h1 = hash & 0xffffffff, h2 = (hash >> 32) | 1, bit;
+
+    for (int i = 0; i < n_hashes; i++)
+    {
+        bit = (h1 + i * h2) % n_bits;
+        if (!(filter[bit / 8] & (1 << (bit % 8))))
+            return false;
+    }
+
+    return true;
+}
+
+
+static void set_hash_bits(unsigned char *filter, int size, int n_hashes,
+                          unsigned long long hash)
+{
+    unsigned long long n_bits = (unsigned long long)size * 8;
+    unsigned long long h1 = hash & 0xffffffff, h2 = (hash >> 32) | 1, bit;
+
+    for (int i = 0; i < n_hashes; i++)
+    {
+        bit = (h1 + i * h2) % n_bits;
+        filter[bit / 8] |= 1 << (bit % 8);
+    }
+}
+
+
+// Inserts a hash to an open addressing table which is kept at most half full.
+// 0 marks an empty slot.
+static void insert_hash(bloom_builder *builder, unsigned long long hash)
+{
+    unsigned long long *old_hashes = builder->hashes;
+    unsigned long old_size = builder->size, slot;
+
+    if (hash == 0)
+        hash = 1;
+
+    if ((builder->n_hashes + 1) * 2 > builder->size)
+    {
+        builder->size = builder->size ? builder->size * 2 : 4096;
+        if ((builder->hashes = calloc(builder->size,
+                                      sizeof(unsigned long long))) == NULL)
+        {
+            error_print("Can't allocate memory for %lu token hashes",
+                        builder->size);
+            fatal_exit();
+        }
+
+        builder->n_hashes = 0;
+        for (unsigned long i = 0; i < old_size; i++)
+            if (old_hashes[i] != 0)
+                insert_hash(builder, old_hashes[i]);
+        free(old_hashes);
+    }
+
+    for (slot = hash % builder->size; builder->hashes[slot] != 0;
+         slot = (slot + 1) % builder->size)
+        if (builder->hashes[slot] == hash)
+            return;
+
+    builder->hashes[slot] = hash;
+    builder->n_hashes++;
+}
+
+
+static bool is_uuid(const char *token, int len)
+{
+    if (len != 36)
+        return false;
+
+    for (int i = 0; i < len; i++)
+    {
+        if (i == 8 || i == 13 || i == 18 || i == 23)
+        {
+            if (token[i] != '-')
+                return false;
+        }
+        else if (!isxdigit((unsigned char)token[i]))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,63 @@
+#ifndef __BLK_BLOOM_H__
+#define __BLK_BLOOM_H__
+
+#include <stdbool.h>        // bool type
+
+// Classes of tokens which are added to the Bloom filters of blocks. A token
+// is a maximal run of letters, digits, '_' and '-' chars.
+// UUIDs (8-4-4-4-12 hex digits)
+#define BLOOM_TOKEN_UUID 0x1
+// tokens with a digit: numbers, hex and numeric IDs
+#define BLOOM_TOKEN_NUM  0x2
+// tokens without digits
+#define BLOOM_TOKEN_WORD 0x4
+#define BLOOM_TOKEN_ALL  (BLOOM_TOKEN_UUID | BLOOM_TOKEN_NUM | BLOOM_TOKEN_WORD)
+// Shorter tokens are in most of the blocks, they aren't added
+#define BLOOM_MIN_TOKEN_LEN 3
+#define DEF_BLOOM_FP_RATE 0.01
+#define DEF_BLOOM_MAX_SIZE (64 * 1024)
+
+// Parameters of the Bloom filters of an index build
+typedef struct
+{
+    // BLOOM_TOKEN_* classes of added tokens
+    int tokens;
+    // the false positive rate of a filter, it defines the amount of hashes
+    // and the size of a filter per token
+    double fp_rate;
+    // the maximal size of a filter of one block in bytes. A filter of a
+    // block with more tokens has a higher false positive rate.
+    int max_size;
+} bloom_opts;
+
+// A set of distinct token hashes of a block
+typedef struct
+{
+    unsigned long long *hashes;
+    unsigned long n_hashes, size;
+} bloom_builder;
+
+// Parses a comma separated list of token classes (uuid,num,word). Returns 0
+// on an unknown class.
+int parse_bloom_tokens(const char *);
+bool is_token_char(char);
+// Returns the BLOOM_TOKEN_* class of a token
+int token_class(const char *, int);
+unsigned long long hash_token(const char *, int);
+// Adds the tokens of a string of the classes to a set
+void add_bloom_tokens(bloom_builder *, const char *, int, int);
+// The size in bytes of a filter of the tokens of a set
+int bloom_filter_size(const bloom_builder *, const bloom_opts *);
+// The amount of hashes of a token for a false positive rate
+int bloom_hashes(double);
+// Sets the bits of all the tokens of a set in a filter of size bytes
+void fill_bloom_filter(const bloom_builder *, unsigned char *, int, int);
+// Sets the bits of the tokens of a string of the classes in a filter
+void add_bloom_filter_tokens(unsigned char *, int, int, const char *, int,
+                             int);
+void reset_bloom_builder(bloom_builder *);
+void free_bloom_builder(bloom_builder *);
+// Checks if a filter of size bytes can contain a token with the hash
+bool bloom_may_contain(const unsigned char *, int, int, unsigned long long);
+
+#endif
@@ -0,0 +1,158 @@
+// Cache of uncompressed blocks which is shared by threads.
+
+
+#include <stdlib.h>			// exit(), malloc()
+#include <string.h>			// memcpy()
+#include <pthread.h>
+#include "blk_cache.h"
+
+
+static cached_blk * find_cached_blk(blk_cache *, dev_t, ino_t,
+                                    unsigned long long);
+static void evict_cached_blks(blk_cache *, unsigned long long);
+
+
+void init_blk_cache(blk_cache *cache, unsigned long long max_bytes)
+{
+    memset(cache, 0, sizeof(*cache));
+    cache->max_bytes = max_bytes;
+    pthread_mutex_init(&cache->lock, NULL);
+}
+
+
+bool get_cached_blk(blk_cache *cache, dev_t dev, ino_t ino,
+                    unsigned long long blk_pos, decoded_blk_cache *blk)
+{
+    cached_blk *cached;
+    char *new_data;
+
+    pthread_mutex_lock(&cache->lock);
+
+    if ((cached = find_cached_blk(cache, dev, ino, blk_pos)) == NULL)
+    {
+        pthread_mutex_unlock(&cache->lock);
+        return false;
+    }
+
+    // A block which can't be copied is uncompressed by a query itself
+    if (cached->len > blk->size)
+    {
+        if ((new_data = realloc(blk->data, cached->len)) == NULL)
+        {
+            pthread_mutex_unlock(&cache->lock);
+            return false;
+        }
+        blk->data = new_data;
+        blk->size = cached->len;
+    }
+
+    memcpy(blk->data, cached->data, cached->len);
+    blk->len = cached->len;
+    blk->blk_pos = blk_pos;
+    cached->used = ++cache->tick;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return true;
+}
+
+
+bool put_cached_blk(blk_cache *cache, dev_t dev, ino_t ino,
+                    const decoded_blk_cache *blk)
+{
+    cached_blk *cached;
+    cached_blk *new_blks;
+    int new_size;
+    char *data;
+
+    // A block which is larger than a cache isn't cached
+    if ((unsigned long long)blk->len > cache->max_bytes)
+        return false;
+
+    // A block is copied out of the lock
+    if ((data = malloc(blk->len)) == NULL)
+        return false;
+    memcpy(data, blk->data, blk->len);
+
+    pthread_mutex_lock(&cache->lock);
+
+    // Another query has already added a block
+    if (find_cached_blk(cache, dev, ino, blk->blk_pos) != NULL)
+    {
+        pthread_mutex_unlock(&cache->lock);
+        free(data);
+        return true;
+    }
+
+    evict_cached_blks(cache, cache->max_bytes - blk->len);
+
+    if (cache->n_blks == cache->size)
+    {
+        new_size = cache->size ? cache->size * 2 : 64;
+        if ((new_blks = realloc(cache->blks, new_size * sizeof(cached_blk)))
+            == NULL)
+        {
+            pthread_mutex_unlock(&cache->lock);
+            free(data);
+            return false;
+        }
+        cache->blks = new_blks;
+        cache->size = new_size;
+    }
+
+    cached = &cache->blks[cache->n_blks++];
+    cached->dev = dev;
+    cached->ino = ino;
+    cached->blk_pos = blk->blk_pos;
+    cached->data = data;
+    cached->len = blk->len;
+    cached->used = ++cache->tick;
+    cache->bytes += blk->len;
+
+    pthread_mutex_unlock(&cache->lock);
+
+    return true;
+}
+
+
+void free_blk_cache(blk_cache *cache)
+{
+    for (int i = 0; i < cache->n_blks; i++)
+        free(cache->blks[i].data);
+
+    free(cache->blks);
+    pthread_mutex_destroy(&cache->lock);
+    memset(cache, 0, sizeof(*cache));
+}
+
+
+static cached_blk * find_cached_blk(blk_cache *cache, dev_t dev, ino_t ino,
+                                    unsigned long long blk_pos)
+{
+    for (int i = 0; i < cache->n_blks; i++)
+        if (cache->blks[i].blk_pos == blk_pos && cache->blks[i].ino == ino &&
+            cache->blks[i].dev == dev)
+            return &cache->blks[i];
+
+    return NULL;
+}
+
+
+// Evicts the least recently used blocks till the size of the rest is not
+// over max_bytes
+static void evict_cached_blks(blk_cache *cache, unsigned long long max_bytes)
+{
+    int lru;
+
+    while (cache->bytes > max_bytes && cache->n_blks > 0)
+    {
+        lru = 0;
+        for (int i = 1; i < cache->n_blks; i++)
+            if (cache->blks[i].used < cache->blks[lru].used)
+                lru = i;
+
+        cache->bytes -= cache->blks[lru].len;
+        free(cache->blks[lru].data);
+        cache->blks[lru] = cache->blks[--cache->n_blks];
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef __BLK_CACHE_H__
+#define __BLK_CACHE_H__
+
+#include <stdbool.h>        // bool type
+#include <sys/types.h>      // dev_t, ino_t
+#include <pthread.h>
+#include "bz2_archive.h"
+
+// An uncompressed block of a file
+typedef struct
+{
+    // a file is identified by its device and inode, so the handles of one
+    // file share its blocks
+    dev_t dev;
+    ino_t ino;
+    // absolute bit position of a block
+    unsigned long long blk_pos;
+    char *data;
+    int len;
+    // a tick of the last use of a block
+    unsigned long long used;
+} cached_blk;
+
+// Uncompressed blocks which are shared by the queries of all the handles of
+// a daemon. The least recently used blocks are evicted when the size of the
+// blocks is over max_bytes. A cache holds a few hundred blocks, so it's an
+// unsorted array.
+typedef struct
+{
+    cached_blk *blks;
+    int n_blks, size;
+    unsigned long long bytes, max_bytes;
+    unsigned long long tick;
+    pthread_mutex_t lock;
+} blk_cache;
+
+void init_blk_cache(blk_cache *, unsigned long long);
+// Copies a block of a file from a cache to a decoded block. Returns false if
+// a block isn't in a cache or there is no memory for a copy.
+bool get_cached_blk(blk_cache *, dev_t, ino_t, unsigned long long,
+                    decoded_blk_cache *);
+// Adds a copy of a decoded block of a file to a cache. Returns false if a
+// block isn't cached (it's too large or there is no memory), a query goes on
+// without it.
+bool put_cached_blk(blk_cache *, dev_t, ino_t, const decoded_blk_cache *);
+void free_blk_cache(blk_cache *);
+
+#endif
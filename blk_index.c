@@ -0,0 +1,1276 @@
+// Index of the blocks of a bz2 file: positions, timestamps, line counts,
+// uncompressed sizes and Bloom filters of tokens of all the blocks.
+
+
+#define _XOPEN_SOURCE 700	// pthread_cond_timedwait(), clock_gettime()
+#include <stdio.h>
+#include <stdlib.h>			// exit(), malloc()
+#include <string.h>			// memchr(), memcmp()
+#include <errno.h>			// strerror()
+#include <fcntl.h>			// open()
+#include <unistd.h>			// close(), read(), write()
+#include <stdint.h>			// uint32_t, uint64_t
+#include <sys/stat.h>		// stat()
+#include <sys/file.h>		// flock()
+#include <setjmp.h>
+#include <pthread.h>
+#include "extract_time_blk_bz2.h"
+#include "micro-bunzip.h"
+#include "bz2_archive.h"
+#include "blk_writer.h"
+#include "blk_index.h"
+
+
+// A header of an index file. It's followed by n_blks blk_index_entry
+// structures and blooms_size bytes of Bloom filters. The file is read on the
+// same machine where it was written, so the structures are saved as is.
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    // sizeof(blk_index_entry), an index of another build isn't used
+    uint32_t entry_size;
+    uint32_t complete;
+    uint32_t bloom_hashes;
+    uint32_t bloom_tokens;
+    uint32_t reserved;
+    uint64_t n_blks;
+    uint64_t blooms_size;
+    int64_t file_size;
+    int64_t file_mtime;
+    // describe_dt_locator() of the locator which found the timestamps
+    char locator[BLK_INDEX_LOCATOR_SIZE];
+} blk_index_header;
+
+// Blocks found by a scan of a part of a file
+typedef struct
+{
+    int fd;
+    // bytes [start, end) of a file, a block belongs to a part where the first
+    // byte of its magic number is
+    off_t start, end;
+    unsigned long long *blk_poss;
+    unsigned long n_blks, size;
+    pthread_t thread;
+    // a decoder of a thread, it's freed even after a fatal error
+    bunzip_data *bd;
+    // a scan was stopped by a fatal error
+    bool failed;
+} index_scan_part;
+
+// A Bloom filter of a block which is being built. A line which crosses blocks
+// belongs to the block where it starts, so the tokens of the first fragment
+// of the next block are added to a filter when all the blocks are done.
+typedef struct
+{
+    unsigned char *filter;
+    int size;
+    // the first fragment of a block (till the first newline char) and the
+    // last token chars of a block
+    char *first;
+    int first_len, first_size;
+    char *tail;
+    int tail_len, tail_size;
+    // the first fragment is ended by a newline char in a block
+    bool first_complete;
+} index_bloom;
+
+typedef struct index_builder index_builder;
+
+// A thread which uncompresses blocks. It takes blocks from the beginning of
+// its own range of entries. A thread without blocks steals the second half of
+// the range of the thread with the most blocks left.
+typedef struct
+{
+    index_builder *builder;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    // entries [next, end) which are not taken yet
+    unsigned long next, end;
+    // a decoder, the tokens of a block and a line which crosses output
+    // buffers. They're freed by a thread even after a fatal error.
+    bunzip_data *bd;
+    bloom_builder tokens;
+    char *line;
+    int line_size;
+} index_worker;
+
+struct index_builder
+{
+    blk_index *index;
+    // a descriptor of an indexed file which is shared by the threads (blocks
+    // are read by pread())
+    int fd;
+    const dt_locator *loc;
+    // parameters of Bloom filters and the filters of the blocks (NULL if
+    // filters aren't built)
+    const bloom_opts *bloom;
+    index_bloom *blooms;
+    int bloom_hashes;
+    index_worker *workers;
+    int n_workers;
+    pthread_mutex_t lock;
+    // signaled when all the blocks are indexed or a thread failed
+    pthread_cond_t finished;
+    blk_index_progress progress;
+    // a thread was stopped by a fatal error, the other threads stop too
+    bool failed;
+};
+
+
+static bool scan_blk_poss(blk_index *, int, int);
+static void * scan_part_worker(void *);
+static void * index_worker_main(void *);
+static bool take_entry(index_worker *, unsigned long *);
+static bool steal_entries(index_worker *, unsigned long *);
+static void index_blk(index_worker *, unsigned long);
+static void index_line(blk_index_entry *, const dt_locator *, const char *,
+                       int);
+static void build_blk_bloom(index_builder *, unsigned long, bloom_builder *);
+static void finish_blk_blooms(index_builder *);
+static void fail_blk_index_build(index_builder *);
+static bool save_blk_index(const blk_index *, const char *,
+                           const dt_locator *);
+static bool merge_blk_entries(blk_index *, const blk_index *);
+static char * alloc_index_path(const char *, const char *);
+static int lock_blk_index(const char *, char **);
+static void unlock_blk_index(int, char *);
+static bunzip_data * open_blk_decoder(int);
+static void close_blk_decoder(bunzip_data *);
+static double elapsed_since(const struct timespec *);
+
+
+void build_blk_index(blk_index *index, const char *path,
+                     const dt_locator *loc, int n_threads,
+                     const bloom_opts *bloom, blk_index_progress_cb progress_cb)
+{
+    index_builder builder = {0};
+    struct stat file_stat;
+    struct timespec start_time, deadline;
+    unsigned long blks_per_worker;
+    int n_started;
+
+    memset(index, 0, sizeof(*index));
+    builder.index = index;
+
+    if ((builder.fd = open(path, O_RDONLY)) < 0)
+    {
+        error_print("Can't open the file %s\n%s", path, strerror(errno));
+        fatal_exit();
+    }
+
+    if (fstat(builder.fd, &file_stat) != 0)
+    {
+        error_print("Can't stat the file %s\n%s", path, strerror(errno));
+        fail_blk_index_build(&builder);
+    }
+    index->file_size = file_stat.st_size;
+    index->file_mtime = file_stat.st_mtime;
+    index->complete = true;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+
+    if (n_threads < 1)
+        n_threads = 1;
+
+    if (!scan_blk_poss(index, builder.fd, n_threads))
+        fail_blk_index_build(&builder);
+
+    if (index->n_blks == 0)
+    {
+        error_print("There are no bz2 blocks in the file %s", path);
+        fail_blk_index_build(&builder);
+    }
+
+    if (n_threads > index->n_blks)
+        n_threads = index->n_blks;
+
+    builder.loc = loc;
+    builder.bloom = bloom;
+    builder.n_workers = n_threads;
+    builder.progress.n_blks = index->n_blks;
+
+    if (bloom != NULL)
+    {
+        if ((builder.blooms = calloc(index->n_blks, sizeof(index_bloom))) ==
+            NULL)
+        {
+            error_print("Can't allocate memory for %lu Bloom filters",
+                        index->n_blks);
+            fail_blk_index_build(&builder);
+        }
+        builder.bloom_hashes = bloom_hashes(bloom->fp_rate);
+    }
+
+    if ((builder.workers = calloc(n_threads, sizeof(index_worker))) == NULL)
+    {
+        error_print("Can't allocate memory for %d threads", n_threads);
+        fail_blk_index_build(&builder);
+    }
+    pthread_mutex_init(&builder.lock, NULL);
+    pthread_cond_init(&builder.finished, NULL);
+
+    // Every thread starts from an equal range of blocks
+    blks_per_worker = index->n_blks / n_threads;
+    for (int i = 0; i < n_threads; i++)
+    {
+        builder.workers[i].builder = &builder;
+        builder.workers[i].next = i * blks_per_worker;
+        builder.workers[i].end = i == n_threads - 1 ? index->n_blks :
+                                 (i + 1) * blks_per_worker;
+        pthread_mutex_init(&builder.workers[i].lock, NULL);
+    }
+
+    // The threads which were started before a failure are stopped
+    for (n_started = 0; n_started < n_threads; n_started++)
+        if (pthread_create(&builder.workers[n_started].thread, NULL,
+                           index_worker_main, &builder.workers[n_started])
+            != 0)
+        {
+            error_print("%s", "Can't create a thread");
+            pthread_mutex_lock(&builder.lock);
+            builder.failed = true;
+            pthread_mutex_unlock(&builder.lock);
+            break;
+        }
+
+    // Report the progress about once a second till all the blocks are done
+    pthread_mutex_lock(&builder.lock);
+    while (builder.progress.n_done < builder.progress.n_blks &&
+           !builder.failed)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec++;
+        pthread_cond_timedwait(&builder.finished, &builder.lock, &deadline);
+
+        builder.progress.elapsed = elapsed_since(&start_time);
+        if (progress_cb != NULL)
+            progress_cb(&builder.progress);
+    }
+    pthread_mutex_unlock(&builder.lock);
+
+    for (int i = 0; i < n_threads; i++)
+    {
+        if (i < n_started)
+            pthread_join(builder.workers[i].thread, NULL);
+        pthread_mutex_destroy(&builder.workers[i].lock);
+    }
+    pthread_mutex_destroy(&builder.lock);
+    pthread_cond_destroy(&builder.finished);
+
+    // A fatal error of a thread is passed to the calling thread
+    if (builder.failed)
+        fail_blk_index_build(&builder);
+
+    if (bloom != NULL)
+        finish_blk_blooms(&builder);
+
+    for (unsigned long i = 1; i < index->n_blks; i++)
+    {
+        index->blks[i].lines_before = index->blks[i - 1].lines_before +
+                                      index->blks[i - 1].n_lines;
+        index->blks[i].offset = index->blks[i - 1].offset +
+                                index->blks[i - 1].size;
+    }
+
+    free(builder.workers);
+    close(builder.fd);
+}
+
+
+// Frees what a failed build has allocated and passes a fatal error to the
+// caller. The threads of a build are already stopped.
+static void fail_blk_index_build(index_builder *builder)
+{
+    if (builder->blooms != NULL)
+        for (unsigned long i = 0; i < builder->index->n_blks; i++)
+        {
+            free(builder->blooms[i].filter);
+            free(builder->blooms[i].first);
+            free(builder->blooms[i].tail);
+        }
+
+    free(builder->blooms);
+    free(builder->workers);
+    free_blk_index(builder->index);
+    close(builder->fd);
+
+    fatal_exit();
+}
+
+
+// Finds the positions of all the blocks. Parts of a file are scanned for
+// magic numbers by separate threads. Returns false if a thread failed.
+static bool scan_blk_poss(blk_index *index, int fd, int n_parts)
+{
+    index_scan_part parts[n_parts];
+    off_t part_size;
+    unsigned long n_blks = 0;
+    int n_started;
+    bool failed = false;
+
+    // Small parts aren't worth a thread
+    part_size = index->file_size / n_parts;
+    if (part_size < BUFFER_SIZE * 16)
+    {
+        n_parts = 1;
+        part_size = index->file_size;
+    }
+
+    memset(parts, 0, sizeof(parts));
+    for (n_started = 0; n_started < n_parts; n_started++)
+    {
+        parts[n_started].fd = fd;
+        parts[n_started].start = n_started * part_size;
+        parts[n_started].end = n_started == n_parts - 1 ? index->file_size :
+                               (n_started + 1) * part_size;
+
+        if (pthread_create(&parts[n_started].thread, NULL, scan_part_worker,
+                           &parts[n_started]) != 0)
+        {
+            error_print("%s", "Can't create a thread");
+            failed = true;
+            break;
+        }
+    }
+
+    for (int i = 0; i < n_started; i++)
+    {
+        pthread_join(parts[i].thread, NULL);
+        n_blks += parts[i].n_blks;
+        failed |= parts[i].failed;
+    }
+
+    if (!failed &&
+        (index->blks = calloc(n_blks ? n_blks : 1, sizeof(blk_index_entry)))
+        == NULL)
+    {
+        error_print("Can't allocate memory for %lu index entries", n_blks);
+        failed = true;
+    }
+
+    if (failed)
+    {
+        for (int i = 0; i < n_started; i++)
+            free(parts[i].blk_poss);
+        return false;
+    }
+
+    // Parts are in the order of a file, so the positions are sorted
+    for (int i = 0; i < n_parts; i++)
+    {
+        for (unsigned long j = 0; j < parts[i].n_blks; j++)
+            index->blks[index->n_blks++].blk_pos = parts[i].blk_poss[j];
+
+        free(parts[i].blk_poss);
+    }
+
+    return true;
+}
+
+
+static void * scan_part_worker(void *arg)
+{
+    index_scan_part *part = arg;
+    unsigned long long blk_pos;
+    unsigned long long *new_poss;
+    jmp_buf trap;
+
+    // A fatal error of a thread fails the build in the calling thread
+    if (setjmp(trap) != 0)
+    {
+        part->failed = true;
+        goto scan_part_worker_finish;
+    }
+    error_trap = &trap;
+
+    part->bd = open_blk_decoder(part->fd);
+
+    for (blk_pos = find_blk_from(part->bd, part->start);
+         blk_pos != BLK_NOT_FOUND && blk_pos / 8 < part->end;
+         blk_pos = find_blk_from(part->bd, blk_pos / 8 + 1))
+    {
+        if (part->n_blks == part->size)
+        {
+            part->size = part->size ? part->size * 2 : 1024;
+            if ((new_poss = realloc(part->blk_poss, part->size *
+                                    sizeof(unsigned long long))) == NULL)
+            {
+                error_print("Can't allocate memory for %lu block positions",
+                            part->size);
+                fatal_exit();
+            }
+            part->blk_poss = new_poss;
+        }
+
+        part->blk_poss[part->n_blks++] = blk_pos;
+    }
+
+scan_part_worker_finish:
+    error_trap = NULL;
+    if (part->bd != NULL)
+        close_blk_decoder(part->bd);
+
+    return NULL;
+}
+
+
+static void * index_worker_main(void *arg)
+{
+    index_worker *worker = arg;
+    index_builder *builder = worker->builder;
+    blk_index *index = builder->index;
+    blk_index_entry *entry;
+    unsigned long entry_num;
+    unsigned long long end_pos;
+    jmp_buf trap;
+
+    // A fatal error of a thread fails the build in the calling thread
+    if (setjmp(trap) != 0)
+    {
+        pthread_mutex_lock(&builder->lock);
+        builder->failed = true;
+        pthread_cond_signal(&builder->finished);
+        pthread_mutex_unlock(&builder->lock);
+        goto index_worker_finish;
+    }
+    error_trap = &trap;
+
+    worker->bd = open_blk_decoder(builder->fd);
+
+    while (take_entry(worker, &entry_num))
+    {
+        entry = &index->blks[entry_num];
+        index_blk(worker, entry_num);
+
+        end_pos = entry_num + 1 < index->n_blks ?
+                  index->blks[entry_num + 1].blk_pos : index->file_size * 8;
+
+        pthread_mutex_lock(&builder->lock);
+        builder->progress.n_done++;
+        builder->progress.compressed_bytes += (end_pos - entry->blk_pos) / 8;
+        builder->progress.uncompressed_bytes += entry->size;
+        if (builder->progress.n_done == builder->progress.n_blks)
+            pthread_cond_signal(&builder->finished);
+        pthread_mutex_unlock(&builder->lock);
+    }
+
+index_worker_finish:
+    error_trap = NULL;
+    if (worker->bd != NULL)
+        close_blk_decoder(worker->bd);
+    free_bloom_builder(&worker->tokens);
+    free(worker->line);
+
+    return NULL;
+}
+
+
+// Takes the next entry of a worker's own range or steals one. Nothing is
+// taken after a thread failed.
+static bool take_entry(index_worker *worker, unsigned long *entry_num)
+{
+    bool taken = false, failed;
+
+    pthread_mutex_lock(&worker->builder->lock);
+    failed = worker->builder->failed;
+    pthread_mutex_unlock(&worker->builder->lock);
+    if (failed)
+        return false;
+
+    pthread_mutex_lock(&worker->lock);
+    if (worker->next < worker->end)
+    {
+        *entry_num = worker->next++;
+        taken = true;
+    }
+    pthread_mutex_unlock(&worker->lock);
+
+    return taken || steal_entries(worker, entry_num);
+}
+
+
+// Moves the second half of the range of the worker with the most entries left
+// to an idle worker. Returns false if there is nothing to steal.
+static bool steal_entries(index_worker *thief, unsigned long *entry_num)
+{
+    index_builder *builder = thief->builder;
+    index_worker *victim;
+    unsigned long left, max_left, stolen_start, stolen_end;
+
+    for (;;)
+    {
+        // A range can be changed by its owner right after it was measured,
+        // so it's checked again under the lock of a victim
+        victim = NULL;
+        max_left = 0;
+        for (int i = 0; i < builder->n_workers; i++)
+        {
+            pthread_mutex_lock(&builder->workers[i].lock);
+            left = builder->workers[i].end - builder->workers[i].next;
+            pthread_mutex_unlock(&builder->workers[i].lock);
+
+            if (left > max_left)
+            {
+                max_left = left;
+                victim = &builder->workers[i];
+            }
+        }
+
+        if (victim == NULL)
+            return false;
+
+        pthread_mutex_lock(&victim->lock);
+        left = victim->end - victim->next;
+        if (left == 0)
+        {
+            // The range was taken by its owner or by another thief
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        stolen_end = victim->end;
+        stolen_start = victim->end - (left + 1) / 2;
+        victim->end = stolen_start;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&thief->lock);
+        thief->next = stolen_start + 1;
+        thief->end = stolen_end;
+        pthread_mutex_unlock(&thief->lock);
+
+        *entry_num = stolen_start;
+
+        return true;
+    }
+}
+
+
+/* Uncompresses a whole block, counts its lines and bytes, finds its
+   timestamps and collects its tokens for a Bloom filter. The line counts and
+   the minimal/maximal timestamps need all the lines of a block, so the
+   tail-only probes of a search are not used here. */
+static void index_blk(index_worker *worker, unsigned long entry_num)
+{
+    index_builder *builder = worker->builder;
+    bunzip_data *bd = worker->bd;
+    bloom_builder *tokens = &worker->tokens;
+    blk_index_entry *entry = &builder->index->blks[entry_num];
+    const dt_locator *loc = builder->loc;
+    index_bloom *bloom = builder->blooms != NULL ?
+                         &builder->blooms[entry_num] : NULL;
+    int status;
+    int gotcount;
+    char obuf[BUFFER_SIZE * 8];
+    // the length of a line in worker->line which crosses output buffers
+    int line_len = 0;
+    // a first fragment of a block wasn't skipped yet
+    bool is_first_line = entry->blk_pos != FIRST_BLK_POS;
+    const char *obuf_pos, *obuf_end, *nl;
+    int tail_start;
+
+    seek_bits(bd, entry->blk_pos);
+
+    if (bloom != NULL)
+        reset_bloom_builder(tokens);
+
+    if ((status = get_next_block(bd)))
+    {
+        error_print("Uncompressing the block %llu returned %s",
+                    entry->blk_pos, bunzip_errors[-status]);
+        fatal_exit();
+    }
+
+    /* Init the CRC for writing */
+    bd->writeCRC = 0xffffffffUL;
+
+    /* Zero this so the current byte from before the seek is not written */
+    bd->writeCopies = 0;
+
+    while ((gotcount = read_bunzip(bd, obuf, sizeof(obuf))) > 0)
+    {
+        entry->size += gotcount;
+        obuf_end = obuf + gotcount;
+
+        for (obuf_pos = obuf; obuf_pos < obuf_end; obuf_pos = nl + 1)
+        {
+            nl = memchr(obuf_pos, '\n', obuf_end - obuf_pos);
+
+            // The end of a line is in the next buffer. Save its beginning.
+            if (nl == NULL)
+            {
+                if (!is_first_line)
+                    append_to_line(&worker->line, &line_len,
+                                   &worker->line_size, obuf_pos,
+                                   obuf_end - obuf_pos);
+                else if (bloom != NULL)
+                    append_to_line(&bloom->first, &bloom->first_len,
+                                   &bloom->first_size, obuf_pos,
+                                   obuf_end - obuf_pos);
+                break;
+            }
+
+            entry->n_lines++;
+
+            // The tokens of the first fragment are added to the filter of
+            // the previous block
+            if (is_first_line)
+            {
+                is_first_line = false;
+                if (bloom != NULL)
+                {
+                    append_to_line(&bloom->first, &bloom->first_len,
+                                   &bloom->first_size, obuf_pos,
+                                   nl - obuf_pos);
+                    bloom->first_complete = true;
+                }
+                continue;
+            }
+
+            if (line_len == 0)
+            {
+                // A whole line is in obuf, no need to copy it
+                index_line(entry, loc, obuf_pos, nl - obuf_pos);
+                if (bloom != NULL)
+                    add_bloom_tokens(tokens, obuf_pos, nl - obuf_pos,
+                                     builder->bloom->tokens);
+            }
+            else
+            {
+                append_to_line(&worker->line, &line_len, &worker->line_size,
+                               obuf_pos, nl - obuf_pos);
+                index_line(entry, loc, worker->line, line_len);
+                if (bloom != NULL)
+                    add_bloom_tokens(tokens, worker->line, line_len,
+                                     builder->bloom->tokens);
+                line_len = 0;
+            }
+        }
+    }
+
+    if (gotcount < 0)
+    {
+        error_print("Uncompressing the block %llu returned %s",
+                    entry->blk_pos, bunzip_errors[-gotcount]);
+        fatal_exit();
+    }
+
+    // The last fragment of a block is the beginning of a line
+    if (line_len > 0)
+    {
+        index_line(entry, loc, worker->line, line_len);
+        if (bloom != NULL)
+            add_bloom_tokens(tokens, worker->line, line_len,
+                             builder->bloom->tokens);
+    }
+
+    entry->flags |= BLK_INDEX_STATS;
+
+    if (bloom != NULL)
+    {
+        // A token can be continued in the next block
+        for (tail_start = line_len;
+             tail_start > 0 && is_token_char(worker->line[tail_start - 1]);
+             tail_start--)
+            ;
+        append_to_line(&bloom->tail, &bloom->tail_len, &bloom->tail_size,
+                       worker->line + tail_start, line_len - tail_start);
+
+        build_blk_bloom(builder, entry_num, tokens);
+    }
+}
+
+
+// Updates the timestamps of a block by a timestamp of a line
+static void index_line(blk_index_entry *entry, const dt_locator *loc,
+                       const char *line, int line_len)
+{
+    char dt_str[DT_STR_SIZE] = {0};
+    time_t dt_time_t;
+
+    if (!loc->find(loc, line, line_len, dt_str, &dt_time_t))
+        return;
+
+    if (!(entry->flags & BLK_INDEX_FIRST))
+    {
+        entry->flags |= BLK_INDEX_FIRST | BLK_INDEX_LAST;
+        entry->first_dt_time_t = entry->min_dt_time_t =
+            entry->max_dt_time_t = dt_time_t;
+        store_dt_str(entry->first_dt_str, dt_str);
+    }
+
+    entry->last_dt_time_t = dt_time_t;
+    store_dt_str(entry->last_dt_str, dt_str);
+
+    if (dt_time_t < entry->min_dt_time_t)
+        entry->min_dt_time_t = dt_time_t;
+    if (dt_time_t > entry->max_dt_time_t)
+        entry->max_dt_time_t = dt_time_t;
+}
+
+
+// Builds the Bloom filter of the tokens of a block
+static void build_blk_bloom(index_builder *builder, unsigned long entry_num,
+                            bloom_builder *tokens)
+{
+    index_bloom *bloom = &builder->blooms[entry_num];
+
+    bloom->size = bloom_filter_size(tokens, builder->bloom);
+    if ((bloom->filter = malloc(bloom->size)) == NULL)
+    {
+        error_print("Can't allocate %d bytes for a Bloom filter", bloom->size);
+        fatal_exit();
+    }
+
+    fill_bloom_filter(tokens, bloom->filter, bloom->size,
+                      builder->bloom_hashes);
+}
+
+
+// Adds the tokens of the lines which cross blocks to the filters of the
+// blocks where they start and moves the filters to the index
+static void finish_blk_blooms(index_builder *builder)
+{
+    blk_index *index = builder->index;
+    index_bloom *bloom, *next;
+    char *line = NULL;
+    int line_len = 0, line_size = 0;
+    unsigned long long offset = 0;
+
+    for (unsigned long i = 0; i < index->n_blks; i++)
+    {
+        bloom = &builder->blooms[i];
+        next = i + 1 < index->n_blks ? &builder->blooms[i + 1] : NULL;
+
+        // A line which is longer than the next block has no filter, its
+        // tokens can be in any of the next blocks
+        if (next != NULL && !next->first_complete)
+        {
+            free(bloom->filter);
+            bloom->filter = NULL;
+            continue;
+        }
+
+        if (next != NULL)
+        {
+            line_len = 0;
+            append_to_line(&line, &line_len, &line_size, bloom->tail,
+                           bloom->tail_len);
+            append_to_line(&line, &line_len, &line_size, next->first,
+                           next->first_len);
+            add_bloom_filter_tokens(bloom->filter, bloom->size,
+                                    builder->bloom_hashes, line, line_len,
+                                    builder->bloom->tokens);
+        }
+
+        index->blks[i].bloom_offset = offset;
+        index->blks[i].bloom_size = bloom->size;
+        index->blks[i].flags |= BLK_INDEX_BLOOM;
+        offset += bloom->size;
+    }
+
+    if ((index->blooms = malloc(offset ? offset : 1)) == NULL)
+    {
+        error_print("Can't allocate %llu bytes for Bloom filters", offset);
+        fatal_exit();
+    }
+    index->blooms_size = offset;
+    index->bloom_hashes = builder->bloom_hashes;
+    index->bloom_tokens = builder->bloom->tokens;
+
+    for (unsigned long i = 0; i < index->n_blks; i++)
+    {
+        bloom = &builder->blooms[i];
+        if (bloom->filter != NULL)
+            memcpy(index->blooms + index->blks[i].bloom_offset, bloom->filter,
+                   bloom->size);
+
+        free(bloom->filter);
+        free(bloom->first);
+        free(bloom->tail);
+    }
+
+    free(line);
+    free(builder->blooms);
+    builder->blooms = NULL;
+}
+
+
+bool read_blk_index(blk_index *index, const char *path, const dt_locator *loc)
+{
+    blk_index_header header;
+    struct stat file_stat, index_stat;
+    char locator[BLK_INDEX_LOCATOR_SIZE];
+    char *index_path;
+    size_t blks_size;
+    int fd;
+    bool valid = false;
+
+    memset(index, 0, sizeof(*index));
+
+    if (stat(path, &file_stat) != 0)
+        return false;
+
+    if ((index_path = alloc_index_path(path, "")) == NULL)
+        return false;
+    fd = open(index_path, O_RDONLY);
+    free(index_path);
+    if (fd < 0)
+        return false;
+
+    describe_dt_locator(loc, locator, sizeof(locator));
+
+    if (fstat(fd, &index_stat) != 0 ||
+        read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, BLK_INDEX_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != BLK_INDEX_VERSION ||
+        header.entry_size != sizeof(blk_index_entry) ||
+        header.file_size != file_stat.st_size ||
+        header.file_mtime != file_stat.st_mtime ||
+        strncmp(header.locator, locator, sizeof(locator)) != 0 ||
+        header.n_blks == 0 ||
+        header.n_blks > index_stat.st_size / sizeof(blk_index_entry) ||
+        index_stat.st_size != sizeof(header) +
+                              header.n_blks * sizeof(blk_index_entry) +
+                              header.blooms_size)
+    {
+        debug_print("the index of %s is outdated or of another locator", path);
+        goto read_blk_index_finish;
+    }
+
+    // The caller can hold the lock of an index, so a failure leaves a file
+    // without an index instead of a fatal error
+    blks_size = header.n_blks * sizeof(blk_index_entry);
+    if ((index->blks = malloc(blks_size)) == NULL)
+    {
+        debug_print("can't allocate memory for %llu index entries of %s",
+                    (unsigned long long)header.n_blks, path);
+        goto read_blk_index_finish;
+    }
+
+    if (read(fd, index->blks, blks_size) != blks_size)
+    {
+        free(index->blks);
+        index->blks = NULL;
+        goto read_blk_index_finish;
+    }
+
+    if (header.blooms_size > 0)
+    {
+        if ((index->blooms = malloc(header.blooms_size)) == NULL)
+        {
+            debug_print("can't allocate %llu bytes for Bloom filters of %s",
+                        (unsigned long long)header.blooms_size, path);
+            free_blk_index(index);
+            goto read_blk_index_finish;
+        }
+
+        if (read(fd, index->blooms, header.blooms_size) != header.blooms_size)
+        {
+            free_blk_index(index);
+            goto read_blk_index_finish;
+        }
+
+        index->blooms_size = header.blooms_size;
+        index->bloom_hashes = header.bloom_hashes;
+        index->bloom_tokens = header.bloom_tokens;
+    }
+
+    index->n_blks = header.n_blks;
+    index->complete = header.complete;
+    index->file_size = header.file_size;
+    index->file_mtime = header.file_mtime;
+    valid = true;
+
+read_blk_index_finish:
+
+    close(fd);
+
+    return valid;
+}
+
+
+bool write_blk_index(const blk_index *index, const char *path,
+                     const dt_locator *loc)
+{
+    char *lock_path;
+    int lock_fd, save_errno;
+    bool saved;
+
+    // A concurrent query shouldn't replace a new index by its update of the
+    // old one
+    lock_fd = lock_blk_index(path, &lock_path);
+    saved = save_blk_index(index, path, loc);
+    save_errno = errno;
+    unlock_blk_index(lock_fd, lock_path);
+    errno = save_errno;
+
+    return saved;
+}
+
+
+void update_blk_index(const blk_index *learned, const char *path,
+                      const dt_locator *loc)
+{
+    blk_index index;
+    struct stat file_stat;
+    char *lock_path;
+    int lock_fd;
+
+    if ((lock_fd = lock_blk_index(path, &lock_path)) < 0)
+        return;
+
+    // The index could be updated by another query since it was read. An
+    // index of another version of a file or of another locator is replaced.
+    if (!read_blk_index(&index, path, loc))
+    {
+        if (stat(path, &file_stat) != 0)
+        {
+            unlock_blk_index(lock_fd, lock_path);
+            return;
+        }
+        index.file_size = file_stat.st_size;
+        index.file_mtime = file_stat.st_mtime;
+    }
+
+    if (!merge_blk_entries(&index, learned))
+        debug_print("can't update the index of %s: %s", path, strerror(errno));
+    else if (!save_blk_index(&index, path, loc))
+        debug_print("can't update the index of %s: %s", path, strerror(errno));
+
+    free_blk_index(&index);
+    unlock_blk_index(lock_fd, lock_path);
+}
+
+
+// Adds the entries of learned to an index. Timestamps which an index has
+// already are kept, entries of an index build aren't changed. Returns false if
+// there is no memory for the entries (it's called under the lock of an index).
+static bool merge_blk_entries(blk_index *index, const blk_index *learned)
+{
+    blk_index_entry *blks;
+    const blk_index_entry *learned_entry;
+    blk_index_entry *entry;
+    unsigned long i = 0, j = 0, n_blks = 0;
+
+    if ((blks = calloc(index->n_blks + learned->n_blks + 1,
+                       sizeof(blk_index_entry))) == NULL)
+        return false;
+
+    // Both lists are sorted by blk_pos
+    while (i < index->n_blks || j < learned->n_blks)
+    {
+        if (j == learned->n_blks ||
+            (i < index->n_blks &&
+             index->blks[i].blk_pos < learned->blks[j].blk_pos))
+        {
+            blks[n_blks++] = index->blks[i++];
+            continue;
+        }
+
+        learned_entry = &learned->blks[j++];
+        entry = &blks[n_blks++];
+
+        if (i < index->n_blks &&
+            index->blks[i].blk_pos == learned_entry->blk_pos)
+            *entry = index->blks[i++];
+        else
+            entry->blk_pos = learned_entry->blk_pos;
+
+        if (entry->flags & BLK_INDEX_STATS)
+            continue;
+
+        if (!(entry->flags & BLK_INDEX_FIRST) &&
+            (learned_entry->flags & BLK_INDEX_FIRST))
+        {
+            entry->first_dt_time_t = learned_entry->first_dt_time_t;
+            store_dt_str(entry->first_dt_str, learned_entry->first_dt_str);
+            entry->flags |= BLK_INDEX_FIRST;
+        }
+
+        if (!(entry->flags & BLK_INDEX_LAST) &&
+            (learned_entry->flags & BLK_INDEX_LAST))
+        {
+            entry->last_dt_time_t = learned_entry->last_dt_time_t;
+            store_dt_str(entry->last_dt_str, learned_entry->last_dt_str);
+            entry->flags |= BLK_INDEX_LAST;
+        }
+    }
+
+    free(index->blks);
+    index->blks = blks;
+    index->n_blks = n_blks;
+
+    return true;
+}
+
+
+// Writes an index to a temporary file and renames it to the index file.
+// Returns false on an error, errno is set.
+static bool save_blk_index(const blk_index *index, const char *path,
+                           const dt_locator *loc)
+{
+    blk_index_header header = {0};
+    char *index_path, *tmp_path;
+    char tmp_ext[64];
+    ssize_t blks_size = index->n_blks * sizeof(blk_index_entry);
+    int fd;
+    bool saved = false;
+
+    memcpy(header.magic, BLK_INDEX_MAGIC, sizeof(header.magic));
+    header.version = BLK_INDEX_VERSION;
+    header.entry_size = sizeof(blk_index_entry);
+    header.complete = index->complete;
+    header.n_blks = index->n_blks;
+    header.blooms_size = index->blooms_size;
+    header.bloom_hashes = index->bloom_hashes;
+    header.bloom_tokens = index->bloom_tokens;
+    header.file_size = index->file_size;
+    header.file_mtime = index->file_mtime;
+    describe_dt_locator(loc, header.locator, sizeof(header.locator));
+
+    // A temporary file of every process and thread is unique
+    sprintf(tmp_ext, ".tmp.%d.%lx", (int)getpid(),
+            (unsigned long)pthread_self());
+    if ((index_path = alloc_index_path(path, "")) == NULL ||
+        (tmp_path = alloc_index_path(path, tmp_ext)) == NULL)
+    {
+        free(index_path);
+        errno = ENOMEM;
+        return false;
+    }
+
+    if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        goto save_blk_index_finish;
+
+    // A crash leaves a temporary file, never a partially written index
+    if (write(fd, &header, sizeof(header)) != sizeof(header) ||
+        write(fd, index->blks, blks_size) != blks_size ||
+        write(fd, index->blooms, index->blooms_size) != index->blooms_size ||
+        fsync(fd) != 0)
+    {
+        close(fd);
+        unlink(tmp_path);
+        goto save_blk_index_finish;
+    }
+
+    if (close(fd) != 0 || rename(tmp_path, index_path) != 0)
+    {
+        unlink(tmp_path);
+        goto save_blk_index_finish;
+    }
+
+    saved = true;
+
+save_blk_index_finish:
+
+    free(tmp_path);
+    free(index_path);
+
+    return saved;
+}
+
+
+// Locks the index of a file by flock() of a lock file next to it. The index
+// file itself can't be locked because it's replaced by rename(). The lock file
+// is removed by unlock_blk_index(), so a lock of a file which was removed
+// meanwhile is taken again. Returns a file descriptor of a lock file and its
+// path (it's freed by unlock_blk_index()) or -1 if it can't be created.
+static int lock_blk_index(const char *path, char **lock_path)
+{
+    struct stat fd_stat, path_stat;
+    int fd;
+
+    if ((*lock_path = alloc_index_path(path, ".lock")) == NULL)
+        return -1;
+
+    while ((fd = open(*lock_path, O_RDWR | O_CREAT, 0644)) >= 0)
+    {
+        if (flock(fd, LOCK_EX) != 0 || fstat(fd, &fd_stat) != 0)
+        {
+            close(fd);
+            fd = -1;
+            break;
+        }
+
+        if (stat(*lock_path, &path_stat) == 0 &&
+            path_stat.st_dev == fd_stat.st_dev &&
+            path_stat.st_ino == fd_stat.st_ino)
+            break;
+
+        close(fd);
+    }
+
+    if (fd < 0)
+    {
+        free(*lock_path);
+        *lock_path = NULL;
+    }
+
+    return fd;
+}
+
+
+// Removes the lock file before the unlock, the queries which wait for it
+// retry with a new one
+static void unlock_blk_index(int lock_fd, char *lock_path)
+{
+    if (lock_fd < 0)
+        return;
+
+    unlink(lock_path);
+    free(lock_path);
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+}
+
+
+const blk_index_entry * find_blk_index_entry(const blk_index *index,
+                                             unsigned long long blk_pos)
+{
+    unsigned long low = 0, high = index->n_blks, mid;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (index->blks[mid].blk_pos == blk_pos)
+            return &index->blks[mid];
+        if (index->blks[mid].blk_pos < blk_pos)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return NULL;
+}
+
+
+const blk_index_entry * find_blk_index_line(const blk_index *index,
+                                            unsigned long long line_num)
+{
+    unsigned long low = 0, high = index->n_blks, mid;
+
+    // The last block which has less than line_num newline chars before it.
+    // Blocks without newline chars have the same lines_before as the next
+    // one, so they are skipped.
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (index->blks[mid].lines_before < line_num)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return &index->blks[low > 0 ? low - 1 : 0];
+}
+
+
+const blk_index_entry * find_blk_index_offset(const blk_index *index,
+                                              unsigned long long offset)
+{
+    unsigned long low = 0, high = index->n_blks, mid;
+
+    // The last block which starts at or before offset
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        if (index->blks[mid].offset <= offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return &index->blks[low > 0 ? low - 1 : 0];
+}
+
+
+bool has_blk_index_stats(const blk_index *index)
+{
+    if (!index->complete)
+        return false;
+
+    for (unsigned long i = 0; i < index->n_blks; i++)
+        if (!(index->blks[i].flags & BLK_INDEX_STATS))
+            return false;
+
+    return true;
+}
+
+
+void free_blk_index(blk_index *index)
+{
+    free(index->blks);
+    free(index->blooms);
+    index->blks = NULL;
+    index->blooms = NULL;
+    index->n_blks = 0;
+    index->blooms_size = 0;
+}
+
+
+char * blk_index_path(const char *path)
+{
+    char *index_path;
+
+    if ((index_path = alloc_index_path(path, "")) == NULL)
+    {
+        error_print("%s", "Can't allocate memory for a file name");
+        fatal_exit();
+    }
+
+    return index_path;
+}
+
+
+// Returns the path of the index of a file with an extension (e.g. of a lock
+// file) or NULL if there is no memory. The reading and the saving of an index
+// run under its lock, so they fail instead of a fatal error.
+static char * alloc_index_path(const char *path, const char *ext)
+{
+    char *index_path;
+
+    if ((index_path = malloc(strlen(path) + sizeof(BLK_INDEX_SUFFIX) +
+                             strlen(ext))) == NULL)
+        return NULL;
+
+    sprintf(index_path, "%s%s%s", path, BLK_INDEX_SUFFIX, ext);
+
+    return index_path;
+}
+
+
+// Every thread needs its own decoder state. The descriptor is shared, the
+// decoder reads it by pread() only.
+static bunzip_data * open_blk_decoder(int fd)
+{
+    bunzip_data *bd = NULL;
+    int status;
+
+    if ((status = start_bunzip(&bd, fd, 0, 0)))
+    {
+        error_print("start_bunzip() returned: %s", bunzip_errors[-status]);
+        if (bd != NULL)
+            close_blk_decoder(bd);
+        fatal_exit();
+    }
+
+    return bd;
+}
+
+
+static void close_blk_decoder(bunzip_data *bd)
+{
+    free(bd->dbuf);
+    free(bd);
+}
+
+
+static double elapsed_since(const struct timespec *start_time)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start_time->tv_sec) +
+           (now.tv_nsec - start_time->tv_nsec) / 1e9;
+}
@@ -0,0 +1,130 @@
+#ifndef __BLK_INDEX_H__
+#define __BLK_INDEX_H__
+
+#include <stdbool.h>        // bool type
+#include <time.h>           // time_t
+#include <sys/types.h>      // off_t
+#include "dt_locator.h"
+#include "blk_bloom.h"
+
+// An index file is saved next to a bz2 file with this suffix
+#define BLK_INDEX_SUFFIX ".idx"
+#define BLK_INDEX_MAGIC "ETBZIDX1"
+#define BLK_INDEX_VERSION 5
+// Max size of a locator description in an index header (+ null char)
+#define BLK_INDEX_LOCATOR_SIZE 128
+
+// Flags of an index entry: which of its fields are set
+// the first timestamp (first_dt_time_t, first_dt_str)
+#define BLK_INDEX_FIRST 0x1
+// the last timestamp (last_dt_time_t, last_dt_str)
+#define BLK_INDEX_LAST  0x2
+// n_lines and size. A block was uncompressed by an index build, so if it has
+// no BLK_INDEX_FIRST it has no timestamp, otherwise min/max are set too.
+#define BLK_INDEX_STATS 0x4
+// a Bloom filter of the tokens of the lines which start in a block
+// (bloom_offset, bloom_size)
+#define BLK_INDEX_BLOOM 0x8
+
+// What is known about one block of a file. Timestamps are found by the same
+// rules as the probes of a search: the first line fragment of a block belongs
+// to the previous block (except the first block of a file), the last fragment
+// is a line of this block. An entry which was added by a query has only the
+// timestamps which its search has found.
+typedef struct
+{
+    // absolute bit position of a block
+    unsigned long long blk_pos;
+    // timestamps of the first and the last lines which have one and the
+    // minimal and maximal timestamps of a block (they differ from the first
+    // and the last ones if lines are not in the order of time)
+    time_t first_dt_time_t, last_dt_time_t, min_dt_time_t, max_dt_time_t;
+    // amount of newline chars in an uncompressed block
+    unsigned long long n_lines;
+    // size of an uncompressed block
+    unsigned long long size;
+    // amount of newline chars in all the previous blocks of a file (a
+    // complete index only), i.e. the number of the line which is continued at
+    // the beginning of a block is lines_before + 1
+    unsigned long long lines_before;
+    // offset of a block in the uncompressed data of a file (a complete index
+    // only)
+    unsigned long long offset;
+    // a filter in the blooms of an index
+    unsigned long long bloom_offset;
+    int bloom_size;
+    // BLK_INDEX_* flags
+    int flags;
+    char first_dt_str[DT_STR_SIZE], last_dt_str[DT_STR_SIZE];
+} blk_index_entry;
+
+// Index of the blocks of a file sorted by blk_pos
+typedef struct
+{
+    blk_index_entry *blks;
+    unsigned long n_blks;
+    // all the blocks of a file are in the index (it was built by
+    // build_blk_index()), otherwise only the blocks seen by queries
+    int complete;
+    // size and modification time of an indexed file. An index of a file which
+    // was changed is not used.
+    off_t file_size;
+    time_t file_mtime;
+    // Bloom filters of the blocks with BLK_INDEX_BLOOM, every filter has
+    // bloom_hashes hashes of the tokens of bloom_tokens classes
+    unsigned char *blooms;
+    unsigned long long blooms_size;
+    int bloom_hashes, bloom_tokens;
+} blk_index;
+
+// A state of an index build. It's passed to a progress callback about once a
+// second and when a build is finished.
+typedef struct
+{
+    unsigned long n_blks, n_done;
+    // compressed and uncompressed bytes of the indexed blocks
+    unsigned long long compressed_bytes, uncompressed_bytes;
+    // seconds since the start of a build
+    double elapsed;
+} blk_index_progress;
+
+typedef void (*blk_index_progress_cb)(const blk_index_progress *);
+
+// Builds an index of a file by n_threads threads. At first the file is split
+// to n_threads parts which are scanned for block magic numbers at the same
+// time, then the blocks are uncompressed by work stealing threads. Bloom
+// filters of blocks are built if bloom_opts isn't NULL. progress_cb can be
+// NULL.
+void build_blk_index(blk_index *, const char *, const dt_locator *, int,
+                     const bloom_opts *, blk_index_progress_cb);
+// Reads the index of a file. Returns false if there is no index or it was
+// built for another version of a file or with another locator.
+bool read_blk_index(blk_index *, const char *, const dt_locator *);
+// Saves the index of a file to a temporary file and renames it to the index
+// file, so a reader never sees a partially written index. Returns false if an
+// index can't be saved, errno is set.
+bool write_blk_index(const blk_index *, const char *, const dt_locator *);
+// Adds timestamps of blocks which were found by a query to the index of a
+// file. The index is re-read under a lock of the index, so updates of
+// concurrent queries are merged. Updating is skipped silently if an index
+// can't be written (e.g. a directory is read only).
+void update_blk_index(const blk_index *, const char *, const dt_locator *);
+// Returns the entry of a block at blk_pos or NULL if it's not in the index
+const blk_index_entry * find_blk_index_entry(const blk_index *,
+                                             unsigned long long);
+// Returns the entry of a block which has the newline char of the line number
+// line_num (from 1) of a complete index. The last block is returned if a
+// file has less lines.
+const blk_index_entry * find_blk_index_line(const blk_index *,
+                                            unsigned long long);
+// Returns the entry of a block which has the uncompressed byte at offset of a
+// complete index. The last block is returned if a file is shorter.
+const blk_index_entry * find_blk_index_offset(const blk_index *,
+                                              unsigned long long);
+// Checks if all the blocks of a complete index have stats
+bool has_blk_index_stats(const blk_index *);
+void free_blk_index(blk_index *);
+// returns the index file name of a file (the result should be freed)
+char * blk_index_path(const char *);
+
+#endif
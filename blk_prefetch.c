@@ -0,0 +1,36 @@
+// Read-ahead of the compressed blocks of a file.
+
+
+#include <string.h>			// memset()
+#include <fcntl.h>			// posix_fadvise()
+#include "blk_prefetch.h"
+
+
+void init_blk_prefetcher(blk_prefetcher *prefetcher, int fd)
+{
+    memset(prefetcher, 0, sizeof(*prefetcher));
+    prefetcher->fd = fd;
+}
+
+
+void prefetch_bytes(blk_prefetcher *prefetcher, off_t start, off_t end)
+{
+    // A jump to another part of a file (the next range or a block after the
+    // skipped ones) drops the previous request
+    if (start < prefetcher->advised_start || start > prefetcher->advised_end)
+        prefetcher->advised_start = prefetcher->advised_end = start;
+
+    if (end <= prefetcher->advised_end)
+        return;
+
+    advise_bytes(prefetcher->fd, prefetcher->advised_end, end);
+    prefetcher->advised_bytes += end - prefetcher->advised_end;
+    prefetcher->advised_end = end;
+}
+
+
+void advise_bytes(int fd, off_t start, off_t end)
+{
+    if (end > start)
+        posix_fadvise(fd, start, end - start, POSIX_FADV_WILLNEED);
+}
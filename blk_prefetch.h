@@ -0,0 +1,31 @@
+#ifndef __BLK_PREFETCH_H__
+#define __BLK_PREFETCH_H__
+
+#include <sys/types.h>      // off_t
+
+// Default amount of blocks which are read ahead of an extraction
+#define DEF_READ_AHEAD 4
+
+// Advises the kernel to read the compressed bytes of the next blocks of a file
+// ahead of a decoder (posix_fadvise(WILLNEED)), so the reads of the next blocks
+// are overlapped with the decoding of the current one. The decoder reads them
+// by pread() as usual.
+typedef struct
+{
+    int fd;
+    // bytes [advised_start, advised_end) were already advised
+    off_t advised_start, advised_end;
+    // bytes which were advised
+    unsigned long long advised_bytes;
+} blk_prefetcher;
+
+void init_blk_prefetcher(blk_prefetcher *, int);
+// Requests the bytes [start, end) of a file. Bytes which were already advised
+// are skipped, a request which isn't continued from the previous one replaces
+// it.
+void prefetch_bytes(blk_prefetcher *, off_t, off_t);
+// Advises the kernel to read the bytes [start, end) of a file in background
+// (posix_fadvise(WILLNEED)), e.g. for the probes of a binary search
+void advise_bytes(int, off_t, off_t);
+
+#endif
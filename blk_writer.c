@@ -0,0 +1,696 @@
+// Writer of uncompressed blocks with optional exact trimming by time range
+// and content filtering.
+
+
+#define _GNU_SOURCE                 // vmsplice(), F_SETPIPE_SZ, memrchr()
+#include <stdio.h>
+#include <stdlib.h>			// exit(), realloc()
+#include <string.h>			// memchr(), memcpy()
+#include <unistd.h>			// write()
+#include <errno.h>			// strerror()
+#include <fcntl.h>			// open()
+#include <limits.h>			// PATH_MAX
+#include <sys/stat.h>		// fstat()
+#include <sys/uio.h>		// vmsplice()
+#include "extract_time_blk_bz2.h"
+#include "blk_writer.h"
+
+
+static void write_lines(blk_writer *, const char *, int);
+static void write_line(blk_writer *, const char *, int);
+static bool is_line_in_range(blk_writer *, const char *, int);
+static bool is_line_num_in_range(blk_writer *);
+static void output_line(blk_writer *, const char *, int);
+static bool grep_line(blk_writer *, const char *, int);
+static const char * skip_grep_lines(blk_writer *, const char *, const char *);
+static void push_ctx_line(blk_writer *, const char *, int);
+static void flush_obuf(blk_writer *);
+static void init_out_buf(blk_writer *);
+static void flush_out_buf(blk_writer *);
+static char * alloc_out_buf(void);
+
+// Pages which were passed to a pipe by vmsplice() are read from the memory
+// of a buffer till a reader takes them, so a buffer is reused only after the
+// other one was passed. The buffers are never freed. Writers of pipes are
+// used by the main thread only.
+static char *pipe_bufs[2];
+static int pipe_buf_num;
+
+
+void init_blk_writer(blk_writer *writer, int fd, const dt_locator *loc,
+                     bool exact, time_t from_time_t, time_t to_time_t)
+{
+    memset(writer, 0, sizeof(*writer));
+
+    writer->fd = fd;
+    writer->loc = loc;
+    writer->exact = exact;
+    writer->from_time_t = from_time_t;
+    writer->to_time_t = to_time_t;
+
+    if (exact && (writer->obuf = malloc(WRITER_BUFFER_SIZE)) == NULL)
+    {
+        error_print("Can't allocate %d bytes for an output buffer",
+                    WRITER_BUFFER_SIZE);
+        fatal_exit();
+    }
+
+    if (!exact)
+        init_out_buf(writer);
+}
+
+
+void init_blk_line_writer(blk_writer *writer, const dt_locator *loc,
+                          time_t from_time_t, time_t to_time_t,
+                          blk_line_cb_t line_cb, void *cb_arg)
+{
+    init_blk_writer(writer, -1, loc, true, from_time_t, to_time_t);
+
+    writer->line_cb = line_cb;
+    writer->cb_arg = cb_arg;
+}
+
+
+void set_blk_writer_grep(blk_writer *writer, const grep_filter *grep)
+{
+    int context = grep->context;
+
+    writer->grep = grep;
+
+    if ((writer->grep_hits = calloc(grep->n_patterns, sizeof(char *))) ==
+        NULL ||
+        (writer->obuf == NULL &&
+         (writer->obuf = malloc(WRITER_BUFFER_SIZE)) == NULL) ||
+        (context > 0 &&
+         ((writer->ctx_lines = calloc(context, sizeof(char *))) == NULL ||
+          (writer->ctx_lens = calloc(context, sizeof(int))) == NULL ||
+          (writer->ctx_sizes = calloc(context, sizeof(int))) == NULL)))
+    {
+        error_print("%s", "Can't allocate memory for a content filter");
+        fatal_exit();
+    }
+}
+
+
+void set_blk_writer_lines(blk_writer *writer, unsigned long long line_num,
+                          unsigned long long from_line,
+                          unsigned long long to_line)
+{
+    writer->by_line_num = true;
+    writer->line_num = line_num;
+    writer->from_line = from_line;
+    writer->to_line = to_line;
+}
+
+
+void set_blk_writer_bytes(blk_writer *writer, unsigned long long skip,
+                          unsigned long long len)
+{
+    writer->by_bytes = true;
+    writer->skip_bytes = skip;
+    writer->bytes_left = len;
+}
+
+
+void blk_writer_write(blk_writer *writer, const char *buf, int len)
+{
+    char *out;
+    int out_size;
+
+    if (!writer->exact && writer->grep == NULL)
+    {
+        while (len > 0)
+        {
+            out = blk_writer_buffer(writer, &out_size);
+            if (out_size > len)
+                out_size = len;
+
+            memcpy(out, buf, out_size);
+            blk_writer_commit(writer, out_size);
+            buf += out_size;
+            len -= out_size;
+        }
+        return;
+    }
+
+    write_lines(writer, buf, len);
+}
+
+
+void blk_writer_skip_blk(blk_writer *writer, bool has_last_time,
+                         time_t last_time_t)
+{
+    writer->line_len = 0;
+    writer->skip_first_line = true;
+    writer->first_line_only = false;
+    writer->blk_done = false;
+    writer->ctx_gap = true;
+
+    // Lines without a timestamp at the beginning of the next block get the
+    // timestamp of the last line of a skipped one
+    if (has_last_time)
+    {
+        writer->line_time_t = last_time_t;
+        writer->has_line_time = true;
+
+        if (writer->exact &&
+            last_time_t > writer->to_time_t + writer->max_skew)
+            writer->done = true;
+    }
+}
+
+
+void blk_writer_counted_blk(blk_writer *writer, time_t last_time_t)
+{
+    writer->line_len = 0;
+    writer->skip_first_line = false;
+    writer->line_continued = true;
+    writer->line_time_t = last_time_t;
+    writer->has_line_time = true;
+}
+
+
+char * blk_writer_buffer(blk_writer *writer, int *size)
+{
+    // A small rest of a buffer isn't worth a read_bunzip() call, but only
+    // full buffers are passed by vmsplice()
+    if (writer->out_len == WRITER_OUT_BUFFER_SIZE ||
+        (!writer->use_vmsplice &&
+         WRITER_OUT_BUFFER_SIZE - writer->out_len < BUFFER_SIZE))
+        flush_out_buf(writer);
+
+    *size = WRITER_OUT_BUFFER_SIZE - writer->out_len;
+
+    return writer->out_buf + writer->out_len;
+}
+
+
+void blk_writer_commit(blk_writer *writer, int len)
+{
+    int skip;
+
+    // The lines of a content filter are searched in the decoded buffer, only
+    // the matched ones are copied to the output
+    if (writer->grep != NULL)
+    {
+        write_lines(writer, writer->out_buf + writer->out_len, len);
+        return;
+    }
+
+    // The excess of the first and the last blocks of a byte range is
+    // dropped from the buffer
+    if (writer->by_bytes)
+    {
+        skip = writer->skip_bytes < len ? writer->skip_bytes : len;
+        if (skip > 0)
+        {
+            memmove(writer->out_buf + writer->out_len,
+                    writer->out_buf + writer->out_len + skip, len - skip);
+            len -= skip;
+            writer->skip_bytes -= skip;
+        }
+
+        if (len > writer->bytes_left)
+            len = writer->bytes_left;
+        writer->bytes_left -= len;
+        if (writer->bytes_left == 0)
+            writer->done = true;
+    }
+
+    writer->out_len += len;
+}
+
+
+void blk_writer_flush(blk_writer *writer)
+{
+    if (!writer->exact && writer->grep == NULL)
+    {
+        flush_out_buf(writer);
+        return;
+    }
+
+    // The last line of a file without a newline char
+    if (writer->line_len > 0)
+    {
+        write_line(writer, writer->line, writer->line_len);
+        writer->line_len = 0;
+    }
+
+    flush_obuf(writer);
+}
+
+
+void free_blk_writer(blk_writer *writer)
+{
+    free(writer->line);
+    free(writer->obuf);
+    if (!writer->use_vmsplice)
+        free(writer->out_buf);
+    writer->line = writer->obuf = writer->out_buf = NULL;
+
+    for (int i = 0; writer->grep != NULL && i < writer->grep->context; i++)
+        free(writer->ctx_lines[i]);
+    free(writer->ctx_lines);
+    free(writer->ctx_lens);
+    free(writer->ctx_sizes);
+    free(writer->grep_hits);
+    writer->ctx_lines = NULL;
+    writer->grep_hits = NULL;
+}
+
+
+// Splits data to lines, a line which crosses buffers is stitched
+static void write_lines(blk_writer *writer, const char *buf, int len)
+{
+    const char *buf_pos, *buf_end, *nl;
+
+    buf_end = buf + len;
+
+    // The cached occurrences of patterns are in the previous buffer
+    if (writer->grep != NULL)
+        memset(writer->grep_hits, 0, writer->grep->n_patterns * sizeof(char *));
+
+    if (writer->skip_first_line)
+    {
+        if ((nl = memchr(buf, '\n', len)) == NULL)
+            return;
+        buf = nl + 1;
+        writer->skip_first_line = false;
+    }
+
+    for (buf_pos = buf; buf_pos < buf_end; buf_pos = nl + 1)
+    {
+        // Without the exact mode the timestamps of lines aren't needed, so
+        // the lines without a match are skipped by one search of a buffer
+        if (writer->grep != NULL && !writer->exact && writer->line_len == 0 &&
+            writer->ctx_after == 0)
+            buf_pos = skip_grep_lines(writer, buf_pos, buf_end);
+
+        nl = memchr(buf_pos, '\n', buf_end - buf_pos);
+
+        // The end of a line is in the next buffer. Save its beginning.
+        if (nl == NULL)
+        {
+            append_to_line(&writer->line, &writer->line_len,
+                           &writer->line_size, buf_pos, buf_end - buf_pos);
+            break;
+        }
+
+        if (writer->line_len == 0)
+        {
+            write_line(writer, buf_pos, nl - buf_pos);
+        }
+        else
+        {
+            append_to_line(&writer->line, &writer->line_len,
+                           &writer->line_size, buf_pos, nl - buf_pos);
+            write_line(writer, writer->line, writer->line_len);
+            writer->line_len = 0;
+        }
+
+        if (writer->first_line_only)
+        {
+            writer->blk_done = true;
+            return;
+        }
+    }
+}
+
+
+// Writes a line (without '\n') if its timestamp is within the time range
+// (any line without the exact mode) or its number is within the line range
+// and it passes a content filter
+static void write_line(blk_writer *writer, const char *line, int line_len)
+{
+    if (writer->by_line_num)
+    {
+        if (!is_line_num_in_range(writer))
+            return;
+    }
+    else if (writer->exact && !is_line_in_range(writer, line, line_len))
+        return;
+
+    if (writer->grep != NULL && !grep_line(writer, line, line_len))
+        return;
+
+    output_line(writer, line, line_len);
+}
+
+
+// Checks if the timestamp of a line is within the time range. A line without
+// a timestamp gets the timestamp of the previous line.
+static bool is_line_in_range(blk_writer *writer, const char *line,
+                             int line_len)
+{
+    char dt_str[DT_STR_SIZE];
+    time_t line_time_t;
+
+    // The beginning of a continued line was counted with the previous block
+    if (writer->line_continued)
+        writer->line_continued = false;
+    else if (writer->loc->find(writer->loc, line, line_len, dt_str,
+                               &line_time_t))
+    {
+        writer->line_time_t = line_time_t;
+        writer->has_line_time = true;
+    }
+
+    // A fragment of a line before the first timestamp belongs to a line of
+    // a previous block, which is out of the range
+    if (!writer->has_line_time)
+        return false;
+
+    if (writer->line_time_t > writer->to_time_t)
+    {
+        if (writer->line_time_t > writer->to_time_t + writer->max_skew)
+            writer->done = true;
+        return false;
+    }
+
+    return writer->line_time_t >= writer->from_time_t;
+}
+
+
+// Counts a line and checks if its number is within the line range
+static bool is_line_num_in_range(blk_writer *writer)
+{
+    writer->line_num++;
+
+    if (writer->line_num >= writer->to_line)
+        writer->done = true;
+
+    return writer->line_num >= writer->from_line &&
+           writer->line_num <= writer->to_line;
+}
+
+
+// Writes a line to the output buffer or passes it to the line callback
+static void output_line(blk_writer *writer, const char *line, int line_len)
+{
+    if (writer->line_cb != NULL)
+    {
+        writer->line_cb(line, line_len, writer->line_time_t, writer->cb_arg);
+        return;
+    }
+
+    if (writer->obuf_len + line_len + 1 > WRITER_BUFFER_SIZE)
+        flush_obuf(writer);
+
+    // A line which doesn't fit to the output buffer is written directly
+    if (line_len + 1 > WRITER_BUFFER_SIZE)
+    {
+        write_all(writer->fd, line, line_len);
+        write_all(writer->fd, "\n", 1);
+        return;
+    }
+
+    memcpy(writer->obuf + writer->obuf_len, line, line_len);
+    writer->obuf_len += line_len;
+    writer->obuf[writer->obuf_len++] = '\n';
+}
+
+
+// Checks a line by a content filter. A matched line is preceded by the lines
+// of its context which were kept in the ring and followed by the next
+// context lines. Returns true if a line is written.
+static bool grep_line(blk_writer *writer, const char *line, int line_len)
+{
+    int ctx_line_num;
+
+    if (!grep_match_line(writer->grep, line, line_len))
+    {
+        if (writer->ctx_after > 0)
+        {
+            writer->ctx_after--;
+            return true;
+        }
+
+        push_ctx_line(writer, line, line_len);
+        return false;
+    }
+
+    if (writer->ctx_gap && writer->has_written && writer->grep->context > 0)
+        output_line(writer, "--", 2);
+
+    for (int i = 0; i < writer->ctx_n; i++)
+    {
+        ctx_line_num = (writer->ctx_first + i) % writer->grep->context;
+        output_line(writer, writer->ctx_lines[ctx_line_num],
+                    writer->ctx_lens[ctx_line_num]);
+    }
+
+    writer->ctx_first = writer->ctx_n = 0;
+    writer->ctx_gap = false;
+    writer->ctx_after = writer->grep->context;
+    writer->has_written = true;
+
+    return true;
+}
+
+
+// Skips the lines of [buf, buf_end) before the first candidate of a match,
+// the last of them are kept for the context of a match. Returns the start of
+// the line with a candidate or of the last incomplete line.
+static const char * skip_grep_lines(blk_writer *writer, const char *buf,
+                                    const char *buf_end)
+{
+    const char *cand, *skip_end, *line_start, *nl;
+    const char *ctx_start[writer->grep->context + 1];
+    int n_ctx = 0;
+
+    cand = find_grep_candidate(writer->grep, writer->grep_hits, buf, buf_end);
+    if (cand == buf)
+        return buf;
+
+    // Skip all the complete lines if there is no candidate
+    nl = memrchr(buf, '\n', (cand != NULL ? cand : buf_end) - buf);
+    if (nl == NULL)
+        return buf;
+    skip_end = nl + 1;
+
+    // Find the starts of the last context lines backward
+    line_start = skip_end;
+    while (n_ctx <= writer->grep->context && line_start > buf)
+    {
+        nl = memrchr(buf, '\n', line_start - 1 - buf);
+        line_start = nl != NULL ? nl + 1 : buf;
+        ctx_start[n_ctx++] = line_start;
+    }
+
+    // Lines before the context are dropped
+    if (n_ctx > writer->grep->context)
+    {
+        writer->ctx_first = writer->ctx_n = 0;
+        writer->ctx_gap = true;
+        n_ctx--;
+    }
+
+    for (int i = n_ctx - 1; i >= 0; i--)
+    {
+        line_start = ctx_start[i];
+        nl = i > 0 ? ctx_start[i - 1] - 1 : skip_end - 1;
+        push_ctx_line(writer, line_start, nl - line_start);
+    }
+
+    return skip_end;
+}
+
+
+// Adds a line to the ring of context lines, the oldest one is dropped if the
+// ring is full
+static void push_ctx_line(blk_writer *writer, const char *line, int line_len)
+{
+    int context = writer->grep->context;
+    int ctx_line_num;
+
+    if (context == 0)
+    {
+        writer->ctx_gap = true;
+        return;
+    }
+
+    if (writer->ctx_n == context)
+    {
+        ctx_line_num = writer->ctx_first;
+        writer->ctx_first = (writer->ctx_first + 1) % context;
+        writer->ctx_gap = true;
+    }
+    else
+        ctx_line_num = (writer->ctx_first + writer->ctx_n++) % context;
+
+    writer->ctx_lens[ctx_line_num] = 0;
+    append_to_line(&writer->ctx_lines[ctx_line_num],
+                   &writer->ctx_lens[ctx_line_num],
+                   &writer->ctx_sizes[ctx_line_num], line, line_len);
+}
+
+
+static void flush_obuf(blk_writer *writer)
+{
+    if (writer->line_cb != NULL)
+        return;
+
+    write_all(writer->fd, writer->obuf, writer->obuf_len);
+    writer->obuf_len = 0;
+}
+
+
+// A pipe gets the buffers by vmsplice() if its capacity can be limited to the
+// size of a buffer, other files are written by write()
+static void init_out_buf(blk_writer *writer)
+{
+    struct stat fd_stat;
+
+    if (fstat(writer->fd, &fd_stat) == 0 && S_ISFIFO(fd_stat.st_mode) &&
+        fcntl(writer->fd, F_SETPIPE_SZ, WRITER_OUT_BUFFER_SIZE) ==
+        WRITER_OUT_BUFFER_SIZE)
+    {
+        for (int i = 0; i < 2; i++)
+            if (pipe_bufs[i] == NULL)
+                pipe_bufs[i] = alloc_out_buf();
+
+        writer->use_vmsplice = true;
+        writer->out_buf = pipe_bufs[pipe_buf_num];
+        return;
+    }
+
+    writer->out_buf = alloc_out_buf();
+}
+
+
+static void flush_out_buf(blk_writer *writer)
+{
+    struct iovec iov = {writer->out_buf, writer->out_len};
+    ssize_t written;
+
+    // A pipe holds one full buffer at most, so when a full buffer was passed
+    // the pages of the previous one were taken by a reader. The rest of
+    // output is copied, it would leave the pages of a partial buffer in a
+    // pipe.
+    if (!writer->use_vmsplice || writer->out_len < WRITER_OUT_BUFFER_SIZE)
+    {
+        write_all(writer->fd, writer->out_buf, writer->out_len);
+        writer->out_len = 0;
+        return;
+    }
+
+    while (iov.iov_len > 0)
+    {
+        if ((written = vmsplice(writer->fd, &iov, 1, 0)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            error_print("vmsplice() to fd %d returned an error: %s",
+                        writer->fd, strerror(errno));
+            fatal_exit();
+        }
+
+        iov.iov_base = (char *)iov.iov_base + written;
+        iov.iov_len -= written;
+    }
+
+    // The pages of this buffer can be still in a pipe
+    pipe_buf_num ^= 1;
+    writer->out_buf = pipe_bufs[pipe_buf_num];
+    writer->out_len = 0;
+}
+
+
+static char * alloc_out_buf(void)
+{
+    void *buf;
+
+    if (posix_memalign(&buf, sysconf(_SC_PAGESIZE), WRITER_OUT_BUFFER_SIZE))
+    {
+        error_print("Can't allocate %d bytes for an output buffer",
+                    WRITER_OUT_BUFFER_SIZE);
+        fatal_exit();
+    }
+
+    return buf;
+}
+
+
+void write_all(int fd, const char *buf, int len)
+{
+    int written;
+
+    while (len > 0)
+    {
+        if ((written = write(fd, buf, len)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            error_print("write() to fd %d returned an error: %s",
+                        fd, strerror(errno));
+            fatal_exit();
+        }
+
+        buf += written;
+        len -= written;
+    }
+}
+
+
+// Opens an output file of a range number range_num. The first "%d" in a
+// pattern is replaced by range_num, otherwise ".range_num" is appended.
+int open_range_output(const char *pattern, int range_num)
+{
+    char file_name[PATH_MAX];
+    const char *num_pos;
+    int fd;
+
+    if ((num_pos = strstr(pattern, "%d")) != NULL)
+        snprintf(file_name, sizeof(file_name), "%.*s%d%s",
+                 (int)(num_pos - pattern), pattern, range_num, num_pos + 2);
+    else
+        snprintf(file_name, sizeof(file_name), "%s.%d", pattern, range_num);
+
+    if ((fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    {
+	    error_print("Can't open the output file %s\n%s\n",
+                    file_name, strerror(errno));
+	    fatal_exit();
+    }
+
+    return fd;
+}
+
+
+void write_range_header(int fd, const time_range *range)
+{
+    char header[BUFFER_SIZE];
+
+    snprintf(header, sizeof(header), "==> %s - %s <==\n", range->from,
+             range->to);
+    write_all(fd, header, strlen(header));
+}
+
+
+// Appends len chars of src to a growing line buffer up to MAX_LINE_SIZE
+void append_to_line(char **line, int *line_len, int *line_size,
+                    const char *src, int len)
+{
+    if (*line_len + len > MAX_LINE_SIZE)
+        len = MAX_LINE_SIZE - *line_len;
+    if (len <= 0)
+        return;
+
+    if (*line_len + len > *line_size)
+    {
+        *line_size = *line_size ? *line_size : BUFFER_SIZE;
+        while (*line_size < *line_len + len)
+            *line_size *= 2;
+
+        if ((*line = realloc(*line, *line_size)) == NULL)
+        {
+            error_print("Can't allocate %d bytes for a line", *line_size);
+            fatal_exit();
+        }
+    }
+
+    memcpy(*line + *line_len, src, len);
+    *line_len += len;
+}
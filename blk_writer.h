@@ -0,0 +1,142 @@
+#ifndef __BLK_WRITER_H__
+#define __BLK_WRITER_H__
+
+#include <stdbool.h>        // bool type
+#include <time.h>           // time_t
+#include "dt_locator.h"
+#include "time_range.h"
+#include "grep_filter.h"
+#include "blk_index.h"
+
+// Size of an output buffer of the exact mode
+#define WRITER_BUFFER_SIZE (64 * 1024)
+// Size of an output buffer of whole blocks. It's the capacity of a pipe which
+// is written by vmsplice() too (the default limit of unprivileged users).
+#define WRITER_OUT_BUFFER_SIZE (1024 * 1024)
+
+// Callback which gets the lines of the exact mode instead of an output file.
+// A line isn't null terminated and has no newline char. line_time_t is its
+// timestamp (or the timestamp of a previous line).
+typedef void (*blk_line_cb_t)(const char *line, int line_len,
+                              time_t line_time_t, void *cb_arg);
+// Callback which counts the lines that end in a block by its index entry
+// instead of uncompressing it. prev_entry is the entry of the previous block
+// (NULL for the first block of a file), line_len is the length of the line
+// of the previous block which is continued in this one. Returns false if a
+// block can't be counted by its entry.
+typedef bool (*blk_count_cb_t)(const blk_index_entry *entry,
+                               const blk_index_entry *prev_entry,
+                               int line_len, void *cb_arg);
+
+// Writer of uncompressed blocks to an output file descriptor. By default the
+// data is written as is, i.e. whole blocks. In the exact mode only the lines
+// which timestamps are within [from_time_t, to_time_t] are written. Lines
+// without a timestamp (e.g. stack traces) get the timestamp of the previous
+// line, lines which cross blocks are stitched.
+typedef struct
+{
+    int fd;
+    bool exact;
+    const dt_locator *loc;
+    time_t from_time_t, to_time_t;
+    // timestamps of lines can be out of order by up to max_skew seconds, so
+    // only a line after to_time_t + max_skew ends a range
+    int max_skew;
+    // a line which crosses output buffers or blocks
+    char *line;
+    int line_len, line_size;
+    // timestamp of the last line which had one
+    time_t line_time_t;
+    bool has_line_time;
+    // a line after to_time_t was seen, the rest of data isn't needed
+    bool done;
+    // output buffer of the exact mode
+    char *obuf;
+    int obuf_len;
+    // if set, the lines are passed to it instead of fd
+    blk_line_cb_t line_cb;
+    void *cb_arg;
+    // if set, blocks which are known from an index are passed to it instead
+    // of their lines
+    blk_count_cb_t count_cb;
+    // the first line fragment of the next data ends a line which was counted
+    // by count_cb, it keeps the timestamp of the counted block
+    bool line_continued;
+    // page aligned output buffer of whole blocks which read_bunzip() fills
+    // directly (blk_writer_buffer())
+    char *out_buf;
+    int out_len;
+    // fd is a pipe which gets the pages of out_buf by vmsplice()
+    bool use_vmsplice;
+    // if set, only the lines which match it (and their context) are written
+    const grep_filter *grep;
+    // the next occurrences of the patterns in a buffer (find_grep_candidate())
+    const char **grep_hits;
+    // a ring of the last lines before a match (--context)
+    char **ctx_lines;
+    int *ctx_lens, *ctx_sizes;
+    int ctx_first, ctx_n;
+    // amount of lines after a match which are still written
+    int ctx_after;
+    // lines were dropped since the last written one, so a "--" separator is
+    // written before the next context
+    bool ctx_gap;
+    bool has_written;
+    // the first line fragment of the next data belongs to a line of a skipped
+    // block, it's dropped
+    bool skip_first_line;
+    // only the end of a line of a previous block is needed from a block,
+    // blk_done is set when it's written
+    bool first_line_only;
+    bool blk_done;
+    // the lines are chosen by their numbers instead of timestamps (--lines),
+    // line_num is the number of the last line
+    bool by_line_num;
+    unsigned long long line_num, from_line, to_line;
+    // whole blocks are trimmed to a byte range (--bytes): skip_bytes are
+    // dropped, then bytes_left are written
+    bool by_bytes;
+    unsigned long long skip_bytes, bytes_left;
+} blk_writer;
+
+void init_blk_writer(blk_writer *, int, const dt_locator *, bool, time_t,
+                     time_t);
+// a writer of the exact mode which passes the lines to a callback
+void init_blk_line_writer(blk_writer *, const dt_locator *, time_t, time_t,
+                          blk_line_cb_t, void *);
+// Writes only the lines which match a content filter. A filter is searched
+// in whole buffers, the lines before its first candidate are skipped at once.
+void set_blk_writer_grep(blk_writer *, const grep_filter *);
+// Writes the lines [from_line, to_line] (numbers from 1) instead of a time
+// range. line_num is the number of the line before the first data.
+void set_blk_writer_lines(blk_writer *, unsigned long long, unsigned long long,
+                          unsigned long long);
+// Writes only len bytes after the first skip bytes of the data of whole
+// blocks
+void set_blk_writer_bytes(blk_writer *, unsigned long long, unsigned long long);
+void blk_writer_write(blk_writer *, const char *, int);
+// Notifies a writer that a block which can't match a content filter wasn't
+// uncompressed. The timestamp of its last line is set if it's known.
+void blk_writer_skip_blk(blk_writer *, bool, time_t);
+// Notifies a writer that a block was counted by count_cb. The timestamp of
+// its last line is taken by the line which is continued in the next block.
+void blk_writer_counted_blk(blk_writer *, time_t);
+// Returns the free space of the output buffer of whole blocks and its size,
+// data which is put there is written by blk_writer_commit() (or filtered by a
+// content filter)
+char * blk_writer_buffer(blk_writer *, int *);
+void blk_writer_commit(blk_writer *, int);
+// writes the rest of buffered data
+void blk_writer_flush(blk_writer *);
+void free_blk_writer(blk_writer *);
+// appends chars to a growing line buffer (lines are truncated to
+// MAX_LINE_SIZE)
+void append_to_line(char **, int *, int *, const char *, int);
+// write() which repeats on partial writes and exits on an error
+void write_all(int, const char *, int);
+// opens an output file of a range for --split-output
+int open_range_output(const char *, int);
+// writes a "==> FROM - TO <==" line before a range
+void write_range_header(int, const time_range *);
+
+#endif
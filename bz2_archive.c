@@ -0,0 +1,1822 @@
+// Search of time ranges in a bz2 file by the timestamps of its blocks and
+// uncompressing of the found blocks
+//
+// dt - abbreviation for datetime
+
+
+#define _GNU_SOURCE			// strptime()
+#include <stdio.h>
+#include <stdlib.h>			// exit()
+#include <fcntl.h>
+#include <sys/stat.h>		// fstat()
+#include <unistd.h>			// pread()
+#include <time.h>			// strptime(), tm structure
+#include <stdbool.h>		// bool type
+#include <errno.h>			// strerror()
+#include <string.h>			// strstr()
+#include <stdint.h>         // intmax_t
+#include "micro-bunzip.h"
+#include "extract_time_blk_bz2.h"
+#include "dt_locator.h"
+#include "blk_writer.h"
+#include "time_range.h"
+#include "grep_filter.h"
+#include "bz2_archive.h"
+
+
+// State of a search of a block's first/last timestamp by a line callback
+typedef struct
+{
+    const dt_locator *loc;
+    // found datetime substring (DT_STR_SIZE bytes) and its epoch value
+    char *dt_str;
+    time_t dt_time_t;
+    bool found;
+} dt_probe;
+
+
+static int uncompress_last_2_buffers_of_blk(unsigned long long, bunzip_data *,
+                                            char *);
+static bool first_dt_line_cb(const char *, int, void *);
+static bool last_dt_line_cb(const char *, int, void *);
+static bool probe_first_dt_in_blk(unsigned long long, bunzip_data *,
+                                  const dt_locator *, char *, time_t *);
+static bool probe_last_dt_in_blk(unsigned long long, bunzip_data *,
+                                 const dt_locator *, char *, time_t *);
+static bool probe_last_2_buffers_of_blk(unsigned long long, bunzip_data *,
+                                        const dt_locator *, char *, time_t *);
+static unsigned long long find_prev_blk_pos(bunzip_data *, unsigned long long);
+static const char * get_dt_str_from_neighbour_blks(unsigned long long,
+                                                   bunzip_data *,
+                                                   const dt_locator *, char *,
+                                                   time_t *);
+static const char * get_first_dt_str_from_bz2_blk(unsigned long long,
+                                                  bunzip_data *,
+                                                  const dt_locator *, char *,
+                                                  time_t *);
+static const char * get_last_dt_str_from_bz2_blk(unsigned long long,
+                                                 bunzip_data *,
+                                                 const dt_locator *, char *,
+                                                 time_t *);
+static unsigned long count_range_blks(bz2_archive *, unsigned long long,
+                                      unsigned long long, bool *);
+static unsigned long long opt_from_bin_search(off_t, off_t, time_t,
+                                              bz2_archive *, const char *,
+                                              char *);
+static int uncompress_blk(unsigned long long, bunzip_data *, blk_writer *,
+                          decoded_blk_cache *);
+static unsigned long long opt_from_first_blk_search(unsigned long long,
+                                                    bz2_archive *, time_t);
+static unsigned long long find_last_blk_pos(bunzip_data *);
+static char * get_str(char *, int *, char *);
+static blk_bounds * get_blk_bounds(blk_bounds_cache *, unsigned long long);
+static void cache_decoded_data(decoded_blk_cache *, const char *, int);
+static bool write_filtered_blk(bz2_archive *, unsigned long long,
+                               blk_writer *, bool);
+static void advise_next_probes(bz2_archive *, off_t, off_t, off_t);
+static bool is_blk_rejected(const bz2_archive *, const grep_filter *,
+                            const blk_index_entry *);
+static void use_blk_index(bz2_archive *);
+static void save_blk_bounds(bz2_archive *);
+static void anchor_archive_years(bz2_archive *);
+
+
+// Opens an input bz2 file and finds its first and last dates
+void open_archive(bz2_archive *ar, const char *input_file,
+                  const dt_locator *loc)
+{
+    open_archive_file(ar, input_file, loc);
+    read_archive_dates(ar);
+}
+
+
+// Opens an input bz2 file without a search of its first and last dates
+void open_archive_file(bz2_archive *ar, const char *input_file,
+                       const dt_locator *loc)
+{
+    int ifd, status;
+
+    memset(ar, 0, sizeof(*ar));
+    ar->path = input_file;
+    ar->loc = *loc;
+    ar->decoded_cache.blk_pos = BLK_NOT_FOUND;
+    ar->read_ahead = DEF_READ_AHEAD;
+
+    // Open an input bz2 file
+    if ((ifd = open(input_file, O_RDONLY)) < 0)
+    {
+	    error_print("Can't open the file %s\n%s\n",
+                    input_file, strerror(errno));
+	    fatal_exit();
+    }
+
+    // Check if the input file is in bzip2 format, prepare bd structure for
+    // work.
+    if ((status = start_bunzip(&ar->bd, ifd, 0, 0)))
+    {
+        error_print("start_bunzip() returned: %s\n", bunzip_errors[-status]);
+        // nothing is left open for release_archive()
+        if (ar->bd != NULL)
+            free(ar->bd->dbuf);
+        free(ar->bd);
+        ar->bd = NULL;
+        close(ifd);
+	    fatal_exit();
+    }
+
+    // Define a file size
+    ar->file_size = get_file_size(ar->bd);
+
+    init_blk_prefetcher(&ar->prefetcher, ifd);
+
+    // Timestamps of the blocks which were indexed or seen by previous queries
+    if (read_blk_index(&ar->index, input_file, &ar->loc))
+        use_blk_index(ar);
+}
+
+
+// Fills the cache of block bounds by the index, so the searches of a query
+// don't uncompress the known blocks. Indexed blocks without a timestamp are
+// left unknown, their bounds are found by neighbour blocks as usual.
+static void use_blk_index(bz2_archive *ar)
+{
+    blk_bounds *bounds;
+    blk_index_entry *entry;
+
+    if ((ar->bounds_cache.blks = calloc(ar->index.n_blks, sizeof(blk_bounds)))
+        == NULL)
+    {
+        error_print("Can't allocate memory for %lu block bounds",
+                    ar->index.n_blks);
+        fatal_exit();
+    }
+    ar->bounds_cache.size = ar->index.n_blks;
+
+    // Index entries are sorted by blk_pos as well as the cache
+    for (unsigned long i = 0; i < ar->index.n_blks; i++)
+    {
+        entry = &ar->index.blks[i];
+        if (!(entry->flags & (BLK_INDEX_FIRST | BLK_INDEX_LAST)))
+            continue;
+
+        bounds = &ar->bounds_cache.blks[ar->bounds_cache.n_blks++];
+        bounds->blk_pos = entry->blk_pos;
+        bounds->has_first = entry->flags & BLK_INDEX_FIRST;
+        bounds->has_last = entry->flags & BLK_INDEX_LAST;
+        store_dt_str(bounds->first_dt_str, entry->first_dt_str);
+        store_dt_str(bounds->last_dt_str, entry->last_dt_str);
+        bounds->first_dt_time_t = entry->first_dt_time_t;
+        bounds->last_dt_time_t = entry->last_dt_time_t;
+    }
+
+    debug_print("%lu blocks are in the index", ar->index.n_blks);
+}
+
+
+// Saves block bounds which were found by a query to the index of a file
+static void save_blk_bounds(bz2_archive *ar)
+{
+    blk_index learned = {0};
+    blk_bounds *bounds;
+    blk_index_entry *entry;
+
+    if (!ar->bounds_cache.changed)
+        return;
+
+    if ((learned.blks = calloc(ar->bounds_cache.n_blks,
+                               sizeof(blk_index_entry))) == NULL)
+    {
+        error_print("Can't allocate memory for %d index entries",
+                    ar->bounds_cache.n_blks);
+        fatal_exit();
+    }
+
+    for (int i = 0; i < ar->bounds_cache.n_blks; i++)
+    {
+        bounds = &ar->bounds_cache.blks[i];
+        if (!bounds->has_first && !bounds->has_last)
+            continue;
+
+        entry = &learned.blks[learned.n_blks++];
+        entry->blk_pos = bounds->blk_pos;
+        if (bounds->has_first)
+        {
+            entry->flags |= BLK_INDEX_FIRST;
+            entry->first_dt_time_t = bounds->first_dt_time_t;
+            store_dt_str(entry->first_dt_str, bounds->first_dt_str);
+        }
+        if (bounds->has_last)
+        {
+            entry->flags |= BLK_INDEX_LAST;
+            entry->last_dt_time_t = bounds->last_dt_time_t;
+            store_dt_str(entry->last_dt_str, bounds->last_dt_str);
+        }
+    }
+
+    update_blk_index(&learned, ar->path, &ar->loc);
+    free_blk_index(&learned);
+}
+
+
+// Finds the first and the last dates of an opened file
+void read_archive_dates(bz2_archive *ar)
+{
+    // get the first datetime substring from the first block of a file
+    get_blk_first_dt(ar, FIRST_BLK_POS, ar->first_date,
+                     &ar->first_date_time_t);
+    debug_print("file_first_date (block %d) is: %s", FIRST_BLK_POS,
+                ar->first_date);
+
+    // get the last datetime value from the last block of a file
+    ar->last_blk_pos = find_last_blk_pos(ar->bd);
+    get_blk_last_dt(ar, ar->last_blk_pos, ar->last_date,
+                    &ar->last_date_time_t);
+    debug_print("file_last_date (block %llu) is: %s\n", ar->last_blk_pos,
+                ar->last_date);
+
+    if (is_dt_fmt_without_year(ar->loc.dt_fmt) && !ar->loc.year_anchored)
+        anchor_archive_years(ar);
+}
+
+
+// Infers the years of timestamps of a format without a year by the first and
+// the last dates of a file. The epoch values of the dates and of the cached
+// block bounds which were found before are converted again, the bounds of an
+// index already have them.
+static void anchor_archive_years(bz2_archive *ar)
+{
+    struct stat file_stat;
+    blk_bounds *bounds;
+
+    if (fstat(ar->bd->in_fd, &file_stat) != 0)
+    {
+        error_print("Can't get the modification time of %s\n%s", ar->path,
+                    strerror(errno));
+        fatal_exit();
+    }
+
+    set_dt_year_anchor(&ar->loc, ar->first_date, ar->last_date,
+                       file_stat.st_mtime);
+    if (!ar->loc.year_anchored)
+        return;
+
+    convert_loc_dt_to_epoch(&ar->loc, ar->first_date, &ar->first_date_time_t);
+    convert_loc_dt_to_epoch(&ar->loc, ar->last_date, &ar->last_date_time_t);
+
+    for (int i = 0; i < ar->bounds_cache.n_blks; i++)
+    {
+        bounds = &ar->bounds_cache.blks[i];
+        if (bounds->has_first)
+            convert_loc_dt_to_epoch(&ar->loc, bounds->first_dt_str,
+                                    &bounds->first_dt_time_t);
+        if (bounds->has_last)
+            convert_loc_dt_to_epoch(&ar->loc, bounds->last_dt_str,
+                                    &bounds->last_dt_time_t);
+    }
+
+    debug_print("the first date is in %d, a new year %s",
+                ar->loc.first_year + 1900,
+                ar->loc.year_rollover ? "follows" : "doesn't follow");
+}
+
+
+// Closes a file and frees everything which was allocated for it
+void close_archive(bz2_archive *ar)
+{
+    save_blk_bounds(ar);
+
+    if (ar->io_stats)
+        fprintf(stderr, "%s: %.1f MB read, %.3f s I/O wait, %.1f MB read"
+                " ahead\n", ar->path, ar->bd->io_bytes / 1e6,
+                ar->bd->io_wait_ns / 1e9, ar->prefetcher.advised_bytes / 1e6);
+
+    release_archive(ar);
+}
+
+
+// Frees an archive without saving anything. It can be called after a fatal
+// error in the middle of open_archive() or of a query, an archive which isn't
+// open (bd is NULL) is skipped.
+void release_archive(bz2_archive *ar)
+{
+    if (ar->bd == NULL)
+        return;
+
+    close(ar->bd->in_fd);
+    free(ar->bd->dbuf);
+    free(ar->bd);
+    free(ar->bounds_cache.blks);
+    free(ar->decoded_cache.data);
+    free_blk_index(&ar->index);
+    ar->bd = NULL;
+}
+
+
+// Returns cached bounds of a block with the absolute position blk_pos. Bounds
+// of a block which wasn't seen yet are added as unknown. A returned pointer is
+// valid till the next call.
+static blk_bounds * get_blk_bounds(blk_bounds_cache *cache,
+                                   unsigned long long blk_pos)
+{
+    int low = 0, high = cache->n_blks - 1, mid;
+    blk_bounds *new_blks;
+
+    while (low <= high)
+    {
+        mid = low + (high - low) / 2;
+        if (cache->blks[mid].blk_pos == blk_pos)
+            return &cache->blks[mid];
+        if (cache->blks[mid].blk_pos < blk_pos)
+            low = mid + 1;
+        else
+            high = mid - 1;
+    }
+
+    if (cache->n_blks == cache->size)
+    {
+        cache->size = cache->size ? cache->size * 2 : 64;
+        if ((new_blks = realloc(cache->blks, cache->size * sizeof(blk_bounds)))
+            == NULL)
+        {
+            error_print("Can't allocate memory for %d block bounds",
+                        cache->size);
+            fatal_exit();
+        }
+        cache->blks = new_blks;
+    }
+
+    // Insert unknown bounds to the position low to keep the cache sorted
+    memmove(&cache->blks[low + 1], &cache->blks[low],
+            (cache->n_blks - low) * sizeof(blk_bounds));
+    memset(&cache->blks[low], 0, sizeof(blk_bounds));
+    cache->blks[low].blk_pos = blk_pos;
+    cache->n_blks++;
+
+    return &cache->blks[low];
+}
+
+
+// The same as get_first_dt_str_from_bz2_blk() but a block is uncompressed only
+// if its first timestamp isn't cached yet
+const char * get_blk_first_dt(bz2_archive *ar, unsigned long long blk_pos,
+                              char *first_dt_str, time_t *first_dt_time_t)
+{
+    blk_bounds *bounds;
+
+    bounds = get_blk_bounds(&ar->bounds_cache, blk_pos);
+
+    if (!bounds->has_first)
+    {
+        get_first_dt_str_from_bz2_blk(blk_pos, ar->bd, &ar->loc,
+                                      bounds->first_dt_str,
+                                      &bounds->first_dt_time_t);
+        bounds->has_first = true;
+        ar->bounds_cache.changed = true;
+    }
+
+    store_dt_str(first_dt_str, bounds->first_dt_str);
+    *first_dt_time_t = bounds->first_dt_time_t;
+
+    return first_dt_str;
+}
+
+
+// The same as get_last_dt_str_from_bz2_blk() but a block is uncompressed only
+// if its last timestamp isn't cached yet
+const char * get_blk_last_dt(bz2_archive *ar, unsigned long long blk_pos,
+                             char *last_dt_str, time_t *last_dt_time_t)
+{
+    blk_bounds *bounds;
+
+    bounds = get_blk_bounds(&ar->bounds_cache, blk_pos);
+
+    if (!bounds->has_last)
+    {
+        get_last_dt_str_from_bz2_blk(blk_pos, ar->bd, &ar->loc,
+                                     bounds->last_dt_str,
+                                     &bounds->last_dt_time_t);
+        bounds->has_last = true;
+        ar->bounds_cache.changed = true;
+    }
+
+    store_dt_str(last_dt_str, bounds->last_dt_str);
+    *last_dt_time_t = bounds->last_dt_time_t;
+
+    return last_dt_str;
+}
+
+
+// Writes an uncompressed block to a writer. A block which was the last one
+// uncompressed by a previous range isn't uncompressed again.
+int write_blk(bz2_archive *ar, unsigned long long blk_pos, blk_writer *writer)
+{
+    decoded_blk_cache *cache = &ar->decoded_cache;
+
+    if (cache->enabled && cache->blk_pos == blk_pos)
+    {
+        blk_writer_write(writer, cache->data, cache->len);
+        return 0;
+    }
+
+    return uncompress_blk(blk_pos, ar->bd, writer,
+                          cache->enabled ? cache : NULL);
+}
+
+
+// Searches for the first block of a time range. low is a byte from which the
+// search starts. It's updated for the next range, which can't start earlier.
+// Returns an absolute position of a block.
+unsigned long long find_range_first_blk(bz2_archive *ar,
+                                        const time_range *range, off_t *low)
+{
+    // bit position of start of a block where opt_from string was found
+    unsigned long long opt_from_pos;
+    // first datetime substring which is started from a newline and was found in
+    // an output buffer.
+    char first_dt_str_in_outbuf[DT_STR_SIZE];
+    // lines of the range can be in the blocks of earlier timestamps
+    time_t from_time_t = range->from_time_t - ar->max_skew;
+    const blk_index_entry *entry;
+
+
+    // Search a block where opt_f is located
+    opt_from_pos = opt_from_bin_search(*low, ar->file_size, from_time_t,
+                                       ar, range->from, first_dt_str_in_outbuf);
+
+    debug_print("opt_from_pos = %llu", opt_from_pos);
+
+    if (opt_from_pos != FIRST_BLK_POS)
+    {
+        // Search for the very first block where opt_f is located
+        opt_from_pos = opt_from_first_blk_search(opt_from_pos, ar,
+                                                 from_time_t);
+    }
+
+    // The blocks which maximal timestamps in a complete index are before the
+    // range have none of its lines
+    if (ar->max_skew > 0 && ar->index.complete &&
+        (entry = find_blk_index_entry(&ar->index, opt_from_pos)) != NULL)
+    {
+        while (entry + 1 < ar->index.blks + ar->index.n_blks &&
+               (entry->flags & BLK_INDEX_FIRST) &&
+               entry->max_dt_time_t < range->from_time_t)
+            entry++;
+
+        opt_from_pos = entry->blk_pos;
+    }
+
+    *low = opt_from_pos / 8;
+
+    return opt_from_pos;
+}
+
+
+// Requests the compressed bytes of ar->read_ahead blocks after the block at
+// blk_pos. Their ends are taken from a complete index, otherwise the size of
+// a block is estimated by the distance from the previous block. The indexed
+// blocks which the Bloom filters of grep reject (NULL if all the blocks are
+// written) aren't requested unless the previous block is written, the end of
+// its last line is uncompressed from them.
+void prefetch_next_blks(bz2_archive *ar, unsigned long long blk_pos,
+                        unsigned long long prev_blk_pos,
+                        const grep_filter *grep)
+{
+    blk_index *index = &ar->index;
+    unsigned long low = 0, high = index->n_blks, mid;
+    off_t blk_size, end;
+
+    if (ar->read_ahead == 0)
+        return;
+
+    if (index->complete)
+    {
+        while (low < high)
+        {
+            mid = low + (high - low) / 2;
+            if (index->blks[mid].blk_pos <= blk_pos)
+                low = mid + 1;
+            else
+                high = mid;
+        }
+
+        // low is the entry of the next block
+        for (unsigned long i = low; i < low + ar->read_ahead &&
+                                    i < index->n_blks; i++)
+        {
+            if (i > 0 && is_blk_rejected(ar, grep, &index->blks[i]) &&
+                is_blk_rejected(ar, grep, &index->blks[i - 1]))
+                continue;
+
+            end = i + 1 < index->n_blks ?
+                  index->blks[i + 1].blk_pos / 8 + 1 : ar->file_size;
+            prefetch_bytes(&ar->prefetcher, index->blks[i].blk_pos / 8, end);
+        }
+        return;
+    }
+
+    blk_size = prev_blk_pos != BLK_NOT_FOUND && prev_blk_pos < blk_pos ?
+               (blk_pos - prev_blk_pos) / 8 : PROBE_READ_AHEAD_SIZE;
+    end = blk_pos / 8 + blk_size * (ar->read_ahead + 1);
+    if (end > ar->file_size)
+        end = ar->file_size;
+
+    prefetch_bytes(&ar->prefetcher, blk_pos / 8, end);
+}
+
+
+// Checks if the Bloom filter of an indexed block shows that none of its lines
+// match grep (NULL matches all the lines). The context of matches needs all the
+// lines.
+static bool is_blk_rejected(const bz2_archive *ar, const grep_filter *grep,
+                            const blk_index_entry *entry)
+{
+    return grep != NULL && grep->context == 0 && ar->index.blooms != NULL &&
+           (entry->flags & BLK_INDEX_BLOOM) &&
+           !grep_may_match_blk(grep, ar->index.blooms + entry->bloom_offset,
+                               entry->bloom_size, ar->index.bloom_hashes,
+                               ar->index.bloom_tokens);
+}
+
+
+// Advises the kernel to read the bytes of both probes which can follow a
+// probe of a binary search at mid, so the next probe doesn't wait for a disk.
+// The probes of an indexed file are mostly answered by the index.
+static void advise_next_probes(bz2_archive *ar, off_t low, off_t mid,
+                               off_t high)
+{
+    off_t next_mid;
+
+    if (ar->read_ahead == 0 || ar->index.complete)
+        return;
+
+    if (mid > low)
+    {
+        next_mid = low + (mid - 1 - low) / 2;
+        advise_bytes(ar->bd->in_fd, next_mid, next_mid + PROBE_READ_AHEAD_SIZE);
+    }
+
+    if (mid < high)
+    {
+        next_mid = mid + 1 + (high - mid - 1) / 2;
+        advise_bytes(ar->bd->in_fd, next_mid, next_mid + PROBE_READ_AHEAD_SIZE);
+    }
+}
+
+
+// Writes all the blocks of a time range. low is the same as for
+// find_range_first_blk().
+void extract_range(bz2_archive *ar, const time_range *range,
+                   blk_writer *writer, off_t *low)
+{
+    unsigned long long blk_pos;
+    unsigned long long prev_blk_pos = BLK_NOT_FOUND;
+    time_t first_dt_str_in_outbuf_time_t;
+    char first_dt_str_in_outbuf[DT_STR_SIZE];
+    // The first line fragment of a range is written as a line in the whole
+    // blocks mode, so it's taken from the first block even if it's skipped
+    bool prev_blk_written = !writer->exact;
+    bool blk_after_range = false;
+
+
+    blk_pos = find_range_first_blk(ar, range, low);
+
+    writer->max_skew = ar->max_skew;
+
+    // Uncompress the first block, where opt_f was found, and all the next
+    // blocks till the last one where first found datetime string = opt_to
+    while (!blk_after_range) {
+        // Read the next blocks while this one is uncompressed
+        prefetch_next_blks(ar, blk_pos, prev_blk_pos, writer->grep);
+        prev_blk_pos = blk_pos;
+
+        // Uncompress a block
+#if !DEBUG
+	    prev_blk_written = write_filtered_blk(ar, blk_pos, writer,
+                                              prev_blk_written);
+#endif
+        debug_print("block %llu\n", blk_pos);
+
+        // If an ucompressed block is the last one, then stop
+        if (blk_pos == ar->last_blk_pos)
+            return;
+
+        // The next block is taken from a complete index, otherwise it's
+        // searched from the byte next to the byte where current block was
+        // found
+	    blk_pos = find_next_known_blk_pos(ar, blk_pos);
+
+        // Uncompress the block and find the first datetime sting there
+	    get_blk_first_dt(ar, blk_pos, first_dt_str_in_outbuf,
+                         &first_dt_str_in_outbuf_time_t);
+        blk_after_range = is_blk_after_range(ar, blk_pos,
+                                             first_dt_str_in_outbuf_time_t,
+                                             range);
+    }
+
+    // The last line of the range can be continued in the next block. The
+    // writer stops at the first line of the next block which is after opt_to.
+    if (writer->exact && !writer->done)
+        write_filtered_blk(ar, blk_pos, writer, prev_blk_written);
+}
+
+
+bool is_blk_after_range(bz2_archive *ar, unsigned long long blk_pos,
+                        time_t first_time_t, const time_range *range)
+{
+    const blk_index_entry *entry;
+
+    if (ar->max_skew == 0)
+        return first_time_t > range->to_time_t;
+
+    // Out of order lines of a block are known by its minimal timestamp in a
+    // complete index, otherwise the first timestamp can be later than the
+    // minimal one by the skew
+    if (ar->index.complete &&
+        (entry = find_blk_index_entry(&ar->index, blk_pos)) != NULL &&
+        (entry->flags & (BLK_INDEX_STATS | BLK_INDEX_FIRST)) ==
+        (BLK_INDEX_STATS | BLK_INDEX_FIRST))
+        return entry->min_dt_time_t > range->to_time_t;
+
+    return first_time_t > range->to_time_t + ar->max_skew;
+}
+
+
+// Writes a block unless the Bloom filter of its tokens in the index shows that
+// none of its lines match a content filter (the context of matches needs all
+// the lines) or a block is counted by the count callback of a writer. The
+// first fragment of a skipped block is still uncompressed if the previous
+// block was written, it's the end of the last line of that block. Returns
+// true if a block was written.
+static bool write_filtered_blk(bz2_archive *ar, unsigned long long blk_pos,
+                               blk_writer *writer, bool prev_blk_written)
+{
+    const blk_index_entry *entry = NULL;
+
+    // A block which is known from a complete index can be counted without
+    // uncompressing
+    if (writer->count_cb != NULL && ar->index.complete &&
+        (entry = find_blk_index_entry(&ar->index, blk_pos)) != NULL &&
+        writer->count_cb(entry, entry > ar->index.blks ? entry - 1 : NULL,
+                         writer->line_len, writer->cb_arg))
+    {
+        blk_writer_counted_blk(writer, entry->last_dt_time_t);
+        return true;
+    }
+    entry = NULL;
+
+    if (writer->grep != NULL && writer->grep->context == 0 &&
+        ar->index.blooms != NULL)
+        entry = find_blk_index_entry(&ar->index, blk_pos);
+
+    if (entry == NULL || !is_blk_rejected(ar, writer->grep, entry))
+    {
+        write_blk(ar, blk_pos, writer);
+        return true;
+    }
+
+    if (prev_blk_written)
+    {
+        writer->first_line_only = true;
+        write_blk(ar, blk_pos, writer);
+        writer->first_line_only = false;
+
+        // A line is longer than a block, it's continued in the next block
+        if (!writer->blk_done)
+            return true;
+    }
+
+    blk_writer_skip_blk(writer, entry->flags & BLK_INDEX_LAST,
+                        entry->last_dt_time_t);
+
+    return false;
+}
+
+
+unsigned long long extract_bytes(bz2_archive *ar, unsigned long long offset,
+                                 unsigned long long len, blk_writer *writer)
+{
+    const blk_index_entry *first_entry, *last_entry;
+    unsigned long long prev_blk_pos = BLK_NOT_FOUND;
+
+    first_entry = find_blk_index_offset(&ar->index, offset);
+    last_entry = find_blk_index_offset(&ar->index, offset + len - 1);
+
+    set_blk_writer_bytes(writer, offset - first_entry->offset, len);
+
+    for (const blk_index_entry *entry = first_entry;
+         entry <= last_entry && !writer->done; entry++)
+    {
+        // Read the next blocks while this one is uncompressed
+        prefetch_next_blks(ar, entry->blk_pos, prev_blk_pos, NULL);
+        prev_blk_pos = entry->blk_pos;
+
+        write_blk(ar, entry->blk_pos, writer);
+    }
+
+    return len - writer->bytes_left;
+}
+
+
+// Returns an absolute position of the block before the block at blk_pos or
+// BLK_NOT_FOUND for the first block. The position is taken from a complete
+// index, otherwise the previous block is searched backwards.
+unsigned long long find_prev_known_blk_pos(bz2_archive *ar,
+                                           unsigned long long blk_pos)
+{
+    const blk_index_entry *entry;
+
+    if (ar->index.complete &&
+        (entry = find_blk_index_entry(&ar->index, blk_pos)) != NULL)
+        return entry > ar->index.blks ? (entry - 1)->blk_pos : BLK_NOT_FOUND;
+
+    return find_prev_blk_pos(ar->bd, blk_pos);
+}
+
+
+// Returns an absolute position of the block after the block at blk_pos or
+// BLK_NOT_FOUND for the last block. The position is taken from a complete
+// index, so the blocks which are skipped by their Bloom filters aren't read
+// by a search.
+unsigned long long find_next_known_blk_pos(bz2_archive *ar,
+                                           unsigned long long blk_pos)
+{
+    const blk_index_entry *entry;
+
+    if (ar->index.complete &&
+        (entry = find_blk_index_entry(&ar->index, blk_pos)) != NULL)
+        return entry + 1 < ar->index.blks + ar->index.n_blks ?
+               (entry + 1)->blk_pos : BLK_NOT_FOUND;
+
+    return find_blk_from(ar->bd, blk_pos / 8 + 1);
+}
+
+
+// Binary search of the first block which first timestamp is > opt_to_time_t
+// (+ --max-skew), i.e. the block next to the last block of a range. The search
+// starts from the byte low. Returns an absolute position of the block or
+// BLK_NOT_FOUND if a range lasts till the end of a file.
+unsigned long long opt_to_bin_search(bz2_archive *ar, off_t low,
+                                     time_t opt_to_time_t)
+{
+    bunzip_data *bd = ar->bd;
+    off_t mid, high = ar->file_size;
+    unsigned long long blk_pos, next_blk_pos = BLK_NOT_FOUND;
+    char first_dt_str[DT_STR_SIZE];
+    time_t first_dt_time_t;
+
+    while (low < high)
+    {
+        mid = low + (high - low) / 2;
+        advise_next_probes(ar, low, mid, high);
+
+        if ((blk_pos = find_blk_from(bd, mid)) == BLK_NOT_FOUND)
+        {
+            high = mid;
+            continue;
+        }
+
+        get_blk_first_dt(ar, blk_pos, first_dt_str, &first_dt_time_t);
+        debug_print("block %llu, first_dt_str = %s", blk_pos, first_dt_str);
+
+        if (first_dt_time_t > opt_to_time_t + ar->max_skew)
+        {
+            next_blk_pos = blk_pos;
+            high = mid;
+        }
+        else
+        {
+            // All the bytes till the found block lead to the same block
+            low = blk_pos / 8 + 1;
+        }
+    }
+
+    return next_blk_pos;
+}
+
+
+// Finds the blocks which extract_range() would uncompress for a range. Blocks
+// between the first and the last one are not read (see count_range_blks()).
+void plan_range(bz2_archive *ar, const time_range *range, off_t *low,
+                range_plan *plan)
+{
+    bunzip_data *bd = ar->bd;
+    unsigned long long next_blk_pos;
+    unsigned long long end_pos;
+
+    plan->first_blk_pos = find_range_first_blk(ar, range, low);
+
+    next_blk_pos = opt_to_bin_search(ar, plan->first_blk_pos / 8,
+                                     range->to_time_t);
+    if (next_blk_pos == BLK_NOT_FOUND)
+    {
+        plan->last_blk_pos = ar->last_blk_pos;
+        end_pos = ar->file_size * 8;
+    }
+    else
+    {
+        plan->last_blk_pos = find_prev_known_blk_pos(ar, next_blk_pos);
+        end_pos = next_blk_pos;
+    }
+
+    plan->compressed_bytes = (end_pos - plan->first_blk_pos + 7) / 8;
+
+    // A search reads only the beginnings of blocks and a search which was done
+    // by a partial index decodes no blocks, so the first block of a range is
+    // decoded whole as a sample of the uncompressed block sizes (a failure
+    // leaves the estimates without a sample)
+    if (bd->out_blks == 0 && !has_blk_index_stats(&ar->index))
+        decode_blk(bd, plan->first_blk_pos, &ar->decoded_cache);
+
+    plan->n_blks = count_range_blks(ar, plan->first_blk_pos,
+                                    plan->last_blk_pos, &plan->n_blks_exact);
+}
+
+
+// Counts the blocks from first_blk_pos to last_blk_pos by a complete index.
+// Without it the amount is estimated by the average compressed size of the
+// blocks which were decoded, so a plan doesn't read the blocks of a range.
+static unsigned long count_range_blks(bz2_archive *ar,
+                                      unsigned long long first_blk_pos,
+                                      unsigned long long last_blk_pos,
+                                      bool *exact)
+{
+    const blk_index_entry *first, *last;
+    bunzip_data *bd = ar->bd;
+
+    *exact = true;
+    if (first_blk_pos == last_blk_pos)
+        return 1;
+
+    if (ar->index.complete &&
+        (first = find_blk_index_entry(&ar->index, first_blk_pos)) != NULL &&
+        (last = find_blk_index_entry(&ar->index, last_blk_pos)) != NULL)
+        return last - first + 1;
+
+    // The search has decoded at least the first block of a range
+    *exact = false;
+    if (bd->decoded_blks == 0 || bd->decoded_blks_bits == 0)
+        return 2;
+
+    return 1 + (unsigned long)((double)(last_blk_pos - first_blk_pos) /
+                               ((double)bd->decoded_blks_bits /
+                                bd->decoded_blks) + 0.5);
+}
+
+
+
+
+// Returns an absolute position of the last block of a file
+static unsigned long long find_last_blk_pos(bunzip_data *bd)
+{
+    unsigned long long last_blk_pos;
+    int backward_offset_step = 512;
+    int backward_offset;
+    off_t file_size = get_file_size(bd);
+
+    last_blk_pos = BLK_NOT_FOUND;
+
+    // searching for the last bz2 block from file's end by backward_offset  
+    for (backward_offset = backward_offset_step; last_blk_pos == BLK_NOT_FOUND;
+        backward_offset += backward_offset_step)
+    {
+        // search for the block
+        last_blk_pos = find_blk_from(bd, file_size > backward_offset ?
+                                         file_size - backward_offset : 0);
+    }
+
+    return last_blk_pos;
+}
+
+
+// Steps back from the block at blk_pos while the previous blocks have lines
+// >= opt_f and returns the earliest of them. A block without timestamps gets
+// the last timestamp of a previous one, so the lines continued from a
+// previous block are not lost.
+static unsigned long long opt_from_first_blk_search(unsigned long long blk_pos,
+                                                    bz2_archive *ar,
+                                                    time_t opt_from_time_t)
+{
+    unsigned long long prev_blk_pos;
+    // the last datetime string of a previous block
+    char last_dt_str_in_blk[DT_STR_SIZE];
+    time_t last_dt_str_in_blk_time_t;
+
+
+    while ((prev_blk_pos = find_prev_known_blk_pos(ar, blk_pos)) !=
+           BLK_NOT_FOUND)
+    {
+        get_blk_last_dt(ar, prev_blk_pos, last_dt_str_in_blk,
+                        &last_dt_str_in_blk_time_t);
+        debug_print("block %llu, last_dt_str_in_blk = %s", prev_blk_pos,
+                    last_dt_str_in_blk);
+
+        if (last_dt_str_in_blk_time_t < opt_from_time_t)
+            break;
+
+        blk_pos = prev_blk_pos;
+    }
+
+    return blk_pos;
+}
+
+
+/* Function does bin search on the file's bytes level (lseek()). Then it searches
+for a bz2 block which is nearest from the current middle byte element.
+Then it finds the first datetime sting in the found bz2 block, converts it to 
+epoch format and compares it to the opt_from_time_t value to understand where it
+should continue searching the next middle byte. */
+static unsigned long long opt_from_bin_search(off_t low,
+                                              off_t high, 
+                                              time_t opt_from_time_t,
+                                              bz2_archive *ar,
+                                              const char *opt_f,
+                                              char *first_dt_str_in_outbuf)
+{
+    off_t mid;
+    unsigned long long mid_pos;
+    // the last found block which is returned if the loop ends without a break
+    unsigned long long found_pos = FIRST_BLK_POS;
+    time_t first_dt_str_in_outbuf_time_t;
+    time_t last_dt_str_in_blk_time_t;
+    char last_dt_str_in_blk[DT_STR_SIZE];
+
+
+    while (low <= high)
+    {
+        mid = low + (high - low) / 2;
+	    //printf("\n%s: low = %lu, mid = %lu, hig = %lu\n", 
+        //        __func__, low, mid, high);
+	    if (DEBUG) putchar('\n');
+	    debug_print("low = %luB, mid = %luB, hig = %luB", low, mid, high);
+        advise_next_probes(ar, low, mid, high);
+        
+        // Search for a block from the mid byte
+        mid_pos = find_blk_from(ar->bd, mid);
+
+        // No block starts after the mid byte, search before it
+        if (mid_pos == BLK_NOT_FOUND)
+        {
+            high = mid - 1;
+            continue;
+        }
+        found_pos = mid_pos;
+
+	    debug_print("block %llu", mid_pos);
+        
+        // Get the first datetime string from current block and convert it to
+        // epoch time
+	    get_blk_first_dt(ar, mid_pos, first_dt_str_in_outbuf,
+                         &first_dt_str_in_outbuf_time_t);
+        debug_print("first_dt_str_in_outbuf = %s", first_dt_str_in_outbuf);
+        
+	    //printf("opt_from_bin_search: first_dt_str_in_outbuf_time_t = %lu\n", 
+        //  first_dt_str_in_outbuf_time_t);
+	
+        // Get the last dt string from the block and convert it to epoch time
+        get_blk_last_dt(ar, mid_pos, last_dt_str_in_blk,
+                        &last_dt_str_in_blk_time_t);
+	    debug_print("last_dt_str_in_blk = %s", last_dt_str_in_blk);
+
+	    //printf("opt_from_bin_search: last_dt_str_in_blk_time_t = %lu\n", 
+        //  last_dt_str_in_blk_time_t);
+
+	    //printf("%s: opt_from_time_t = %lu\n", __func__, opt_from_time_t);
+	    //printf("%s: opt_from_time_t(%lu) - first_dt_str_in_outbuf_time_t(%lu) = %lu\n", 
+        //  __func__, opt_from_time_t, first_dt_str_in_outbuf_time_t, 
+        //  opt_from_time_t - first_dt_str_in_outbuf_time_t);
+	    if ( opt_from_time_t > first_dt_str_in_outbuf_time_t )
+        {
+            debug_print("opt_f (%s) > first_dt_str_in_outbuf (%s)", 
+                        opt_f, first_dt_str_in_outbuf);
+
+            if ( opt_from_time_t <= last_dt_str_in_blk_time_t )
+            {
+                // Break the loop and return the block position.
+                debug_print("opt_f (%s) <= last_dt_str_in_blk (%s)", 
+                            opt_f, last_dt_str_in_blk);
+                break;
+            }
+
+            debug_print("opt_f (%s) > last_dt_str_in_blk (%s)", 
+                        opt_f, last_dt_str_in_blk);
+	    
+	        // Set low to the byte next to the current byte where current bz2 
+            // block was found.
+            // So we convert mid_pos from bits to bytes by / 8 and add 1
+            //low = mid + mid_pos / 8 + 1;
+            low = mid + 1;
+
+	    } 
+        else if (opt_from_time_t < first_dt_str_in_outbuf_time_t)
+        {
+
+            debug_print("opt_f (%s) < first_dt_str_in_outbuf (%s)\n", 
+                        opt_f, first_dt_str_in_outbuf);
+
+            // Set high to the byte previous to the current byte where current 
+            // bz2 block was found.
+            // So we convert mid_pos from bits to bytes by / 8 and subtract 1 
+	        // high = mid + mid_pos / 8 - 1;
+	        high = mid - 1;
+
+	    }
+        else
+        {
+            // If opt_f == first_dt_str_in_outbuf_time_t then break the loop and
+            // return current block position
+	        debug_print("opt_f (%s) == first_dt_str_in_outbuf (%s)", 
+                    opt_f, first_dt_str_in_outbuf);
+
+            // printf("opt_from_bin_search: opt_f was found in the block with 
+            // starting bit %llu\n\n", mid_pos);
+            break;
+	    }
+    }
+
+    return found_pos;
+}
+
+// Returns the size of an input file
+off_t get_file_size(bunzip_data *bd)
+{
+    struct stat file_stat;
+
+    if (fstat(bd->in_fd, &file_stat) != 0)
+    {
+        error_print("fstat(bd->in_fd (%d)) failed\n%s", bd->in_fd,
+                    strerror(errno));
+        fatal_exit();
+    }
+
+    return file_stat.st_size;
+}
+
+
+/*
+ * Seek the bunzip_data `bz` to an absolute position in bits `pos` by moving
+ * the input offset of the decoder and priming the buffer with appropriate bits
+ * already consumed. This probably only makes sense for seeking to the start of
+ * a compressed block.
+ */
+void seek_bits(bunzip_data *bd, unsigned long long pos)
+{
+    off_t n_byte = pos / 8;
+    char n_bit = pos % 8;
+    
+    debug_print("pos = %llu, n_byte = %jd, n_bit = %d", pos, (intmax_t)n_byte,
+                n_bit);
+
+    seek_input(bd, n_byte);
+
+    // Streams of a concatenated file can have different block sizes
+    set_blk_dbuf_size(bd, pos);
+
+    get_bits(bd, n_bit);
+}
+
+
+/* Uncompresses a block buffer by buffer and calls line_cb for every line of
+   it until line_cb returns true. The first line fragment of a block is skipped
+   because it continues the last line of the previous block (except the first
+   block of a file). The last fragment is passed to line_cb, because it's the
+   beginning of a line. Lines which cross output buffers are stitched in a line
+   buffer (lines longer than MAX_LINE_SIZE are truncated). */
+int for_each_line_in_blk(unsigned long long blk_pos, bunzip_data *bd,
+                         line_cb_t line_cb, void *cb_arg)
+{
+    int status = 0;
+    int gotcount = 0;
+    char obuf[BUFFER_SIZE];
+    // a line which crosses output buffers
+    char *line = NULL;
+    int line_len = 0, line_size = 0;
+    // a first fragment of a block wasn't skipped yet
+    bool is_first_line = blk_pos != FIRST_BLK_POS;
+    bool stop = false;
+    const char *obuf_pos, *obuf_end, *nl;
+
+
+    seek_bits(bd, blk_pos);
+
+    /* Fill the decode buffer for the block */
+    if ((status = get_next_block(bd)))
+        goto for_each_line_finish;
+
+    /* Init the CRC for writing */
+    bd->writeCRC = 0xffffffffUL;
+
+    /* Zero this so the current byte from before the seek is not written */
+    bd->writeCopies = 0;
+
+    while (!stop && (gotcount = read_bunzip(bd, obuf, BUFFER_SIZE)) > 0)
+    {
+        obuf_end = obuf + gotcount;
+
+        for (obuf_pos = obuf; obuf_pos < obuf_end && !stop; obuf_pos = nl + 1)
+        {
+            nl = memchr(obuf_pos, '\n', obuf_end - obuf_pos);
+
+            if (is_first_line)
+            {
+                if (nl == NULL)
+                    break;
+                is_first_line = false;
+                continue;
+            }
+
+            // The end of a line is in the next buffer. Save its beginning.
+            if (nl == NULL)
+            {
+                append_to_line(&line, &line_len, &line_size, obuf_pos,
+                               obuf_end - obuf_pos);
+                break;
+            }
+
+            if (line_len == 0)
+            {
+                // A whole line is in obuf, no need to copy it
+                stop = line_cb(obuf_pos, nl - obuf_pos, cb_arg);
+            }
+            else
+            {
+                append_to_line(&line, &line_len, &line_size, obuf_pos,
+                               nl - obuf_pos);
+                stop = line_cb(line, line_len, cb_arg);
+                line_len = 0;
+            }
+        }
+    }
+
+    if (gotcount < 0)
+        status = gotcount;
+    else if (!stop && line_len > 0)
+        line_cb(line, line_len, cb_arg);
+
+for_each_line_finish:
+
+    free(line);
+
+    return status;
+}
+
+
+// line_cb_t for probe_first_dt_in_blk(): stops on the first timestamp
+static bool first_dt_line_cb(const char *line, int line_len, void *cb_arg)
+{
+    dt_probe *probe = cb_arg;
+
+    probe->found = probe->loc->find(probe->loc, line, line_len, probe->dt_str,
+                                    &probe->dt_time_t);
+
+    return probe->found;
+}
+
+
+// line_cb_t for probe_last_dt_in_blk(): remembers the last timestamp
+static bool last_dt_line_cb(const char *line, int line_len, void *cb_arg)
+{
+    dt_probe *probe = cb_arg;
+    char dt_str[DT_STR_SIZE];
+    time_t dt_time_t;
+
+    if (probe->loc->find(probe->loc, line, line_len, dt_str, &dt_time_t))
+    {
+        probe->found = true;
+        probe->dt_time_t = dt_time_t;
+        store_dt_str(probe->dt_str, dt_str);
+    }
+
+    return false;
+}
+
+
+// Searches the first timestamp of a block. A block is uncompressed only till
+// the line with the first timestamp, usually it's the first output buffer.
+static bool probe_first_dt_in_blk(unsigned long long blk_pos, bunzip_data *bd,
+                                  const dt_locator *loc, char *dt_str,
+                                  time_t *dt_time_t)
+{
+    dt_probe probe = { loc, dt_str, 0, false };
+    int status;
+
+    if ((status = for_each_line_in_blk(blk_pos, bd, first_dt_line_cb, &probe)))
+    {
+        error_print("Uncompressing the block %llu returned %s", blk_pos,
+                    bunzip_errors[-status]);
+        fatal_exit();
+    }
+
+    *dt_time_t = probe.dt_time_t;
+
+    return probe.found;
+}
+
+
+// Searches the last timestamp of a block. At first it looks into the last 2
+// output buffers of a block, if there is no timestamp (e.g. the block is
+// ended by a long stack trace), then the whole block is scanned.
+static bool probe_last_dt_in_blk(unsigned long long blk_pos, bunzip_data *bd,
+                                 const dt_locator *loc, char *dt_str,
+                                 time_t *dt_time_t)
+{
+    dt_probe probe = { loc, dt_str, 0, false };
+    int status;
+
+    if (probe_last_2_buffers_of_blk(blk_pos, bd, loc, dt_str, dt_time_t))
+        return true;
+
+    debug_print("no timestamp in the tail of the block %llu, scan a whole block",
+                blk_pos);
+
+    if ((status = for_each_line_in_blk(blk_pos, bd, last_dt_line_cb, &probe)))
+    {
+        error_print("Uncompressing the block %llu returned %s", blk_pos,
+                    bunzip_errors[-status]);
+        fatal_exit();
+    }
+
+    *dt_time_t = probe.dt_time_t;
+
+    return probe.found;
+}
+
+
+// Returns an absolute bit position of the block previous to the block at
+// blk_pos, or BLK_NOT_FOUND if blk_pos is the first block. A search window
+// before blk_pos is doubled until a block is found in it, so the amount of
+// read bytes is proportional to the size of the previous block.
+static unsigned long long find_prev_blk_pos(bunzip_data *bd,
+                                            unsigned long long blk_pos)
+{
+    unsigned long long found_pos, prev_pos = BLK_NOT_FOUND;
+    off_t backward_offset, offset;
+
+    if (blk_pos <= FIRST_BLK_POS)
+        return BLK_NOT_FOUND;
+
+    for (backward_offset = BUFFER_SIZE; prev_pos == BLK_NOT_FOUND;
+         backward_offset *= 2)
+    {
+        offset = (off_t)(blk_pos / 8) - backward_offset;
+        if (offset < FIRST_BLK_POS / 8)
+            offset = FIRST_BLK_POS / 8;
+
+        // Remember the last block which is before blk_pos
+        for (found_pos = find_blk_from(bd, offset);
+             found_pos != BLK_NOT_FOUND && found_pos < blk_pos;
+             found_pos = find_blk_from(bd, found_pos / 8 + 1))
+            prev_pos = found_pos;
+
+        if (offset == FIRST_BLK_POS / 8)
+            break;
+    }
+
+    return prev_pos;
+}
+
+
+/* A block without any timestamp (a long stack trace or a payload dump)
+   continues the last line of the nearest previous block which has a
+   timestamp, so that timestamp is used as both bounds of the block. If there
+   is no such previous block, the first timestamp of the nearest next block is
+   used. */
+static const char * get_dt_str_from_neighbour_blks(unsigned long long blk_pos,
+                                                   bunzip_data *bd,
+                                                   const dt_locator *loc,
+                                                   char *dt_str,
+                                                   time_t *dt_time_t)
+{
+    unsigned long long nb_pos;
+    bool found = false;
+
+    debug_print("no timestamp in the block %llu, use neighbour blocks", blk_pos);
+
+    for (nb_pos = find_prev_blk_pos(bd, blk_pos);
+         nb_pos != BLK_NOT_FOUND && !found;
+         nb_pos = find_prev_blk_pos(bd, nb_pos))
+        found = probe_last_dt_in_blk(nb_pos, bd, loc, dt_str, dt_time_t);
+
+    for (nb_pos = find_blk_from(bd, blk_pos / 8 + 1);
+         nb_pos != BLK_NOT_FOUND && !found;
+         nb_pos = find_blk_from(bd, nb_pos / 8 + 1))
+        found = probe_first_dt_in_blk(nb_pos, bd, loc, dt_str, dt_time_t);
+
+    if (!found)
+    {
+        error_print("There is no timestamp (%s locator) in the file",
+                    loc->name);
+        fatal_exit();
+    }
+
+    return dt_str;
+}
+
+
+static int uncompress_last_2_buffers_of_blk(unsigned long long blk_pos,
+    bunzip_data *bd, char *two_last_outbufs)
+{
+    int status;
+    int gotcount, prev_gotcount, last_gotcount, totalcount;
+    char prev_outbuf[BUFFER_SIZE + 1], last_outbuf[BUFFER_SIZE + 1];
+
+
+    gotcount = prev_gotcount = last_gotcount = totalcount = 0;
+    // Fill prev_outbuf and last_outbuf with 0s
+    memset(prev_outbuf, 0, BUFFER_SIZE); 
+    memset(last_outbuf, 0, BUFFER_SIZE); 
+    prev_outbuf[BUFFER_SIZE] = '\0';
+    last_outbuf[BUFFER_SIZE] = '\0';
+
+    seek_bits(bd, blk_pos);
+
+    /* Fill the decode buffer for the block */
+    if ((status = get_next_block( bd )))
+    {
+        error_print("get_next_block() returned %d, %s", status,
+                    bunzip_errors[-status]);
+        fatal_exit();
+    }
+
+    /* Init the CRC for writing */
+    bd->writeCRC = 0xffffffffUL;
+
+    /* Zero this so the current byte from before the seek is not written */
+    bd->writeCopies = 0;
+
+    for ( ;; )
+    {
+        /* Decompress the first buffer of block */
+        gotcount = read_bunzip(bd, last_outbuf, BUFFER_SIZE);
+
+    	// Sum up all gotcounts
+    	totalcount += gotcount;
+
+        if ( gotcount < 0 ) 
+        {
+            status = gotcount;
+            error_print("read_bunzip() returned %d, %s", 
+                gotcount, bunzip_errors[-status]);
+            fatal_exit();
+        }
+	    else if (gotcount == BUFFER_SIZE) 
+        {
+            // If gotcount == BUFFER_SIZE then this is not the last buffer.
+            // So store it into prev_outbuf
+	        memcpy (prev_outbuf, last_outbuf, BUFFER_SIZE);
+	        prev_gotcount = gotcount;
+	    }
+	    else if (gotcount > 0 && gotcount < BUFFER_SIZE) 
+        {
+            // if obuf was written not in full then this is the last buffer.
+	        // So store the content of prev_outbuf and last_outbuf into 
+            // two_last_oubufs
+	        last_gotcount = gotcount;
+	        memcpy(&two_last_outbufs[0], prev_outbuf, 
+                sizeof(char) * prev_gotcount);
+	        memcpy(&two_last_outbufs[prev_gotcount], last_outbuf, 
+                sizeof(char) * last_gotcount);
+            // Put null char after data end
+	        two_last_outbufs[prev_gotcount + last_gotcount] = '\0';
+            break;
+	    }
+	    else if (gotcount == 0 && totalcount == 0)
+        {
+	        // If the first read_bunzip() wrote 0 bytes into last_outbuf, exit
+            // with error.
+	        error_print("read_bunzip() returned no data uncompressing the "
+                        "block %llu", blk_pos);
+            fatal_exit();
+        }
+    }
+
+    //printf("%s: obuf = %s\n", __func__, obuf);
+    return prev_gotcount + last_gotcount;
+}
+
+
+// Function gets the first datetime string which the locator finds in a block
+// and its epoch value
+static const char* 
+get_first_dt_str_from_bz2_blk(  unsigned long long  blk_pos, 
+                                bunzip_data*        bd,
+                                const dt_locator*   loc,
+                                char*               first_dt_str_in_outbuf,
+                                time_t*             first_dt_time_t  )
+{
+    // Clean first_dt_str_in_outbuf from the previous value
+    memset(first_dt_str_in_outbuf, 0, DT_STR_SIZE);
+
+    if (probe_first_dt_in_blk(blk_pos, bd, loc, first_dt_str_in_outbuf,
+                              first_dt_time_t))
+        return first_dt_str_in_outbuf;
+
+    return get_dt_str_from_neighbour_blks(blk_pos, bd, loc,
+                                          first_dt_str_in_outbuf,
+                                          first_dt_time_t);
+}
+
+
+// Function searches for the last datetime substring in the end of a bz2 block
+static const char* 
+get_last_dt_str_from_bz2_blk(   unsigned long long  blk_pos,
+                                bunzip_data*        bd,
+                                const dt_locator*   loc,
+                                char*               last_dt_str_in_outbuf,
+                                time_t*             last_dt_time_t  )
+{
+    // Clean last_dt_str_in_outbuf from the previous value
+    memset(last_dt_str_in_outbuf, 0, DT_STR_SIZE);
+
+    if (probe_last_dt_in_blk(blk_pos, bd, loc, last_dt_str_in_outbuf,
+                             last_dt_time_t))
+        return last_dt_str_in_outbuf;
+
+    return get_dt_str_from_neighbour_blks(blk_pos, bd, loc,
+                                          last_dt_str_in_outbuf,
+                                          last_dt_time_t);
+}
+
+
+// Searches for the last datetime substring in the last 2 output buffers of a
+// block
+static bool probe_last_2_buffers_of_blk(unsigned long long  blk_pos,
+                                        bunzip_data*        bd,
+                                        const dt_locator*   loc,
+                                        char*               last_dt_str_in_outbuf,
+                                        time_t*             last_dt_time_t  )
+{
+    // byte/char position within obuf
+    int obuf_pos;
+    int last_char_pos;
+    // 2 last output buffers from which the last datetime string should be
+    // searched for
+    char obuf2 [BUFFER_SIZE * 2 + 1]; 	
+    // amount of uncompressed bytes which was read to obuf
+    int gotcount;
+    // Current string length in obuf2
+    int str_len;
+    // Previous position of a newline char in obuf2
+    int prev_nl_pos;
+
+
+// Clean obuf2 from the previous value
+    memset(obuf2, 0, BUFFER_SIZE * 2);
+
+// Get 2 last uncompressed output buffers from a block. Why 2? Becuase the last
+// buffer usually isn't full and it's possible that it doesn't contain the dt
+// string
+    gotcount = uncompress_last_2_buffers_of_blk(blk_pos, bd, obuf2);
+    //printf("%s(): gotcount = %d\n", __func__, gotcount);
+
+// Finish obuf2 with '\0' char
+    obuf2[gotcount] = '\0';
+
+    last_char_pos = gotcount - 1; //Why -1? Because if gotcount = 100 then an
+    // index of the last element in an obuf2 array is 100 - 1 = 99
+    prev_nl_pos = last_char_pos;
+
+// A string from obuf2. We don't know beforehand its size, so set it a max
+// possible size (gotcount bytes) to prevent buffer overflow 
+    char str[gotcount + 1];
+
+// Loop through obuf2 in reverse direction
+    for (obuf_pos = last_char_pos; obuf_pos >= 0; obuf_pos--)
+    {
+	    //printf("%c", obuf2[obuf_pos]);
+        
+	    if (obuf2[obuf_pos] != '\n')
+	        continue;
+
+	    prev_nl_pos = obuf_pos;
+
+        // Get a string from obuf
+        get_str(obuf2, &obuf_pos, str);
+        debug_print("str = \"%s\"", str);
+
+        str_len = strlen(str);
+
+        if (loc->find(loc, str, str_len, last_dt_str_in_outbuf,
+                      last_dt_time_t))
+            return true;
+
+        // go to the previous newline
+        obuf_pos = prev_nl_pos;
+    }
+
+    return false;
+}
+
+
+// Uncompresses a block to a writer. If a cache is set, an uncompressed block is
+// also saved there.
+static int uncompress_blk(unsigned long long blk_pos, bunzip_data *bd,
+                          blk_writer *writer, decoded_blk_cache *cache)
+{
+    int status = 0, i = 0;
+    int gotcount = 0;
+    char obuf[BUFFER_SIZE];
+    char *out;
+    int out_size;
+
+
+    if (cache != NULL)
+    {
+        cache->blk_pos = BLK_NOT_FOUND;
+        cache->len = 0;
+    }
+
+    seek_bits( bd, blk_pos );
+    
+    /* Fill the decode buffer for the block */
+    if (( status = get_next_block( bd ) ))
+        goto seek_bunzip_finish;
+
+    /* Init the CRC for writing */
+    bd->writeCRC = 0xffffffffUL;
+
+    /* Zero this so the current byte from before the seek is not written */
+    bd->writeCopies = 0;
+
+    /* Decompress the block and write to stdout */
+    for ( ; ; i++ )
+    {
+        // Whole blocks are decoded directly to the output buffer of a writer,
+        // the lines of the exact mode are filtered by a writer
+        if (writer->exact)
+        {
+            out = obuf;
+            out_size = BUFFER_SIZE;
+        }
+        else
+            out = blk_writer_buffer(writer, &out_size);
+
+        gotcount = read_bunzip( bd, out, out_size );
+        if ( gotcount < 0 )
+        {
+            status = gotcount;
+            break;
+        }
+        else if ( gotcount == 0 )
+        {
+            break;
+        }
+        else
+        {
+            // Here we have uncrompressed data in out
+            if (writer->exact)
+                blk_writer_write(writer, out, gotcount);
+            else
+                blk_writer_commit(writer, gotcount);
+
+            // The rest of a block is after the end of a range (or only its
+            // first line is needed). It's not needed and the block can't be
+            // cached.
+            if (writer->done || writer->blk_done)
+                goto seek_bunzip_finish;
+
+            if (cache != NULL)
+                cache_decoded_data(cache, out, gotcount);
+        }
+    }
+
+    if (cache != NULL && status == 0)
+        cache->blk_pos = blk_pos;
+
+seek_bunzip_finish:
+
+//    if ( bd->dbuf ) free( bd->dbuf );
+//    free( bd );
+    if ( status ) fprintf( stderr, "\n%s\n", bunzip_errors[-status] );
+
+    return status;
+}
+
+
+// Appends uncompressed data of a block to the decoded block cache
+// Uncompresses the whole block at an absolute position blk_pos to the data
+// of a cache. Returns a status of the decoder.
+int decode_blk(bunzip_data *bd, unsigned long long blk_pos,
+               decoded_blk_cache *cache)
+{
+    char obuf[BUFFER_SIZE];
+    int status, gotcount;
+
+    cache->blk_pos = BLK_NOT_FOUND;
+    cache->len = 0;
+
+    seek_bits(bd, blk_pos);
+
+    if ((status = get_next_block(bd)))
+        return status;
+
+    // Init the CRC for writing
+    bd->writeCRC = 0xffffffffUL;
+
+    // Zero this so the current byte from before the seek is not written
+    bd->writeCopies = 0;
+
+    while ((gotcount = read_bunzip(bd, obuf, BUFFER_SIZE)) > 0)
+        cache_decoded_data(cache, obuf, gotcount);
+
+    if (gotcount < 0)
+        return gotcount;
+
+    cache->blk_pos = blk_pos;
+
+    return 0;
+}
+
+
+static void cache_decoded_data(decoded_blk_cache *cache, const char *buf,
+                               int len)
+{
+    if (cache->len + len > cache->size)
+    {
+        cache->size = cache->size ? cache->size : BUFFER_SIZE * 16;
+        while (cache->size < cache->len + len)
+            cache->size *= 2;
+
+        if ((cache->data = realloc(cache->data, cache->size)) == NULL)
+        {
+            error_print("Can't allocate %d bytes for a decoded block",
+                        cache->size);
+            fatal_exit();
+        }
+    }
+
+    memcpy(cache->data + cache->len, buf, len);
+    cache->len += len;
+}
+
+
+// Returns an absolute bit position of the first bz2 block which is started
+// from the offset byte or later, or BLK_NOT_FOUND
+unsigned long long find_blk_from(bunzip_data *bd, off_t offset)
+{
+    // amount of bytes which was read to inbuf during one 'read' operation
+    int inbuf_read;
+    // amount of bytes which was read from inbuf in total
+    unsigned long long inbuf_read_total;
+    // input buffer where data is read from a file
+    unsigned char inbuf[BUFFER_SIZE];
+    // counter for bytes which is reading from ibuf
+    unsigned long long inbuf_byte_pos;
+    // 64 bits which are read from an input buffer. We search for a needle in
+    // this hay
+    unsigned long long hay;	
+    // all possible positions of bits of a needle within a hay
+    unsigned long long needle_shifted[9];
+    // all needed variants of masks. A mask ANDs with a hay
+    unsigned long long masks[9];
+    // magic sequence a new block is started from (BCD (pi))
+    unsigned long long const needle = 0x314159265359;
+   							// and compares with a needle
+    // byte number a needle was found in
+    unsigned long long position;
+
+    inbuf_read_total = 0;
+    hay = 0;
+    position = 0;
+
+    for (int i = 0; i <= 8; i++) {
+        needle_shifted[i] = needle << i;
+	    masks[i] = 0xffffffffffff << i;
+    }
+
+/* 	needle_shifted[0] =     0000000000000000001100010100000101011001001001100101001101011001
+	masks[0] =              0000000000000000111111111111111111111111111111111111111111111111
+
+	needle_shifted[1] =     0000000000000000011000101000001010110010010011001010011010110010
+	masks[1] =              0000000000000001111111111111111111111111111111111111111111111110
+
+	needle_shifted[2] =     0000000000000000110001010000010101100100100110010100110101100100
+	masks[2] =              0000000000000011111111111111111111111111111111111111111111111100
+
+	needle_shifted[3] =     0000000000000001100010100000101011001001001100101001101011001000
+	masks[3] =              0000000000000111111111111111111111111111111111111111111111111000
+
+	needle_shifted[4] =     0000000000000011000101000001010110010010011001010011010110010000
+	masks[4] =              0000000000001111111111111111111111111111111111111111111111110000
+
+	needle_shifted[5] =     0000000000000110001010000010101100100100110010100110101100100000
+	masks[5] =              0000000000011111111111111111111111111111111111111111111111100000
+
+	needle_shifted[6] =     0000000000001100010100000101011001001001100101001101011001000000
+	masks[6] =              0000000000111111111111111111111111111111111111111111111111000000
+
+	needle_shifted[7] =     0000000000011000101000001010110010010011001010011010110010000000
+	masks[7] =              0000000001111111111111111111111111111111111111111111111110000000
+
+	needle_shifted[8] =     0000000000110001010000010101100100100110010100110101100100000000
+	masks[8] =              0000000011111111111111111111111111111111111111111111111100000000 */
+
+/*    for (i = 0; i <= 8; i++)
+    {
+	printf("needle_shifted[%d] = \t%s\n", i, dec_to_bin_ll(needle_shifted[i]));
+	printf("masks[%d] = \t\t%s\n", i, dec_to_bin_ll(masks[i]));
+	putchar('\n');    
+    } */
+
+    // Search a needle starting from every next bit. Read BUFFER_SIZE bytes from
+    // an input file to an inbuf buffer.
+    while ((inbuf_read = read_input(bd, inbuf, BUFFER_SIZE,
+                                    offset + inbuf_read_total)) > 0)
+    {
+	// Take every byte from inbuf and put it into a hay. During every iteration
+    // the most right byte of a hay is shifted to the left and a new byte from
+    // inbuf is put to the hay. Inside hay shift every byte from right to left
+    // and is compared to every needle_shifted.
+	    for (inbuf_byte_pos = 0; inbuf_byte_pos < inbuf_read; inbuf_byte_pos++)
+	    {
+//	    printf("find_blk_from: inbuf_read_total = %d\n", inbuf_read_total);
+//          printf("hay = (hay << 8) | inbuf[%d] = \t", inbuf_byte_pos);
+            
+            // Shift the content of hay one byte to the left and put a new byte
+            // from inbuf to the most right position
+	        hay = (hay << 8) | inbuf[inbuf_byte_pos];
+	        //printf("%40s\n", dec_to_bin_ll(hay));
+	        // A needle needs 6 bytes in a hay (7 bytes if it's shifted). Count
+            // the bytes from the start of search, not from the start of inbuf,
+            // so a needle which crosses inbufs isn't missed.
+	        if (inbuf_read_total + inbuf_byte_pos >= 5)
+	        {
+                for (int i = 0; i <= 8; i++)
+                {
+                    if (i > 0 && inbuf_read_total + inbuf_byte_pos < 6)
+                        break;
+
+    //		    printf("hay = \t\t\t\t%s\n", dec_to_bin_ll(hay));
+    //		    printf("masks[%d] = \t\t\t%s\n", i, dec_to_bin_ll(masks[i]));
+    //		    printf("hay & masks[%d] = \t\t%s\n", i, dec_to_bin_ll(hay & masks[i]));
+    //		    printf("needle_shifted[%d] = \t\t%s\n", i, dec_to_bin_ll(needle_shifted[i]));
+
+                // if a needle was found, define correct position
+	            if ( (hay & masks[i]) == needle_shifted[i] )
+		        {
+		            if (i == 0) 
+                    {
+		                position = (inbuf_read_total + inbuf_byte_pos + 1 - 6) * 8;
+//			    printf("find_blk_from: inbuf_read_total = %llu, inbuf_byte_pos = %llu\n", inbuf_read_total, inbuf_byte_pos);
+		            }
+		            else if (i > 0 && i <= 8) 
+                    {
+			            position = (inbuf_read_total + inbuf_byte_pos + 1 - 7) * 8 + 8 - i;
+			    //printf("find_blk_from: position = (inbuf_read_total(%llu) + inbuf_byte_pos(%llu) + 1 - 7) * 8 + 8 - i(%d) = %lld\n", inbuf_read_total, inbuf_byte_pos, i, position);
+		            }
+		            else 
+                    {
+			            position = (inbuf_read_total + inbuf_byte_pos + 1 - 8) * 8 + 8 - i;
+//			    printf("find_blk_from: inbuf_read_total = %llu, inbuf_byte_pos = %llu\n", inbuf_read_total, inbuf_byte_pos);
+		            }
+
+		        //printf("find_blk_from: position = %llu\n", position);
+                    // A position of a needle from the start of a file
+                    position += (unsigned long long)offset * 8;
+
+                    // The magic number can occur in compressed data by
+                    // chance. Such a candidate isn't a block, search further.
+                    if (check_blk_header(bd, position) != RETVAL_OK)
+                    {
+                        debug_print("a false block magic at the bit %llu",
+                                    position);
+                        continue;
+                    }
+
+		        hay = 0; // to prevent from finding duplicates
+		        return position;
+		    }
+	        }
+	    }
+//	    putchar('\n');
+	}
+	inbuf_read_total += inbuf_read;
+        
+    }
+
+    // There is no block till the end of a file
+    return BLK_NOT_FOUND;
+}
+
+// Get a string from a buf strarting from buf_pos
+static char * get_str(char *buf, int *buf_pos, char *str)
+{
+    int str_pos = 0;
+
+    // Current char is the newline char. So go to the first char of a string.
+    // (*buf_pos)   first dereference buf_pos pointer to get obuf_pos value
+    // ++           and then increment that value 
+    (*buf_pos)++;
+
+    //debug_print("buf[%d] = '%c'\n", *buf_pos, buf[*buf_pos]);
+    while ( buf[*buf_pos] != '\n' && buf[*buf_pos] != '\0' )
+    {
+        str[str_pos++] = buf[(*buf_pos)++];
+        //debug_print("buf[%d] = '%c'", *buf_pos, buf[*buf_pos]);
+    }
+    //debug_print("str_pos = %d", str_pos);
+    
+    // Finish str with a null char
+    str[str_pos] = '\0';
+
+    return str;
+}
@@ -0,0 +1,161 @@
+#ifndef __BZ2_ARCHIVE_H__
+#define __BZ2_ARCHIVE_H__
+
+#include <stdbool.h>        // bool type
+#include <time.h>           // time_t
+#include <sys/types.h>      // off_t
+#include "micro-bunzip.h"
+#include "dt_locator.h"
+#include "blk_writer.h"
+#include "time_range.h"
+#include "blk_index.h"
+#include "blk_prefetch.h"
+
+// Bytes which are read ahead for a probe of a binary search (the bytes till
+// the next block and the block) or for a block of unknown size
+#define PROBE_READ_AHEAD_SIZE (MAX_DBUF_SIZE / 2)
+
+// The first and the last timestamps of a block which were already found
+typedef struct
+{
+    // absolute bit position of a block
+    unsigned long long blk_pos;
+    bool has_first, has_last;
+    char first_dt_str[DT_STR_SIZE], last_dt_str[DT_STR_SIZE];
+    time_t first_dt_time_t, last_dt_time_t;
+} blk_bounds;
+
+// Cache of block bounds sorted by blk_pos. It's shared by the searches of all
+// the ranges of a query, so the probes of a binary search which were made for
+// one range aren't repeated for the next one.
+typedef struct
+{
+    blk_bounds *blks;
+    int n_blks, size;
+    // bounds were found which are not in the index of a file yet
+    bool changed;
+} blk_bounds_cache;
+
+// The last uncompressed block. Ranges which are close to each other often
+// share a boundary block, it's uncompressed only once.
+typedef struct
+{
+    bool enabled;
+    // absolute bit position of a cached block or BLK_NOT_FOUND
+    unsigned long long blk_pos;
+    char *data;
+    int len, size;
+} decoded_blk_cache;
+
+// Blocks which would be extracted for a time range
+typedef struct
+{
+    // absolute bit positions of the first and the last blocks of a range
+    unsigned long long first_blk_pos, last_blk_pos;
+    // amount of blocks, it's counted by a complete index or estimated by the
+    // average compressed size of the decoded blocks (n_blks_exact is false)
+    unsigned long n_blks;
+    bool n_blks_exact;
+    // compressed bytes from the first block to the end of the last one
+    unsigned long long compressed_bytes;
+} range_plan;
+
+// An opened bz2 file with everything which is known about it
+typedef struct
+{
+    bunzip_data *bd;
+    const char *path;
+    // timestamp locator of log strings
+    dt_locator loc;
+    off_t file_size;
+    // absolute bit position of the last block
+    unsigned long long last_blk_pos;
+    // first/last dates in the file
+    char first_date[DT_STR_SIZE], last_date[DT_STR_SIZE];
+    time_t first_date_time_t, last_date_time_t;
+    blk_bounds_cache bounds_cache;
+    decoded_blk_cache decoded_cache;
+    // index of the blocks if there is a valid index file (n_blks is 0 if not).
+    // It can be partial, i.e. filled by previous queries.
+    blk_index index;
+    // amount of blocks which are read ahead of an extraction (0 disables a
+    // read-ahead and advices for probes)
+    int read_ahead;
+    blk_prefetcher prefetcher;
+    // print read bytes and I/O wait time when a file is closed
+    bool io_stats;
+    // timestamps of lines can be out of order by up to max_skew seconds
+    // (--max-skew), so the bounds of a range are searched wider
+    int max_skew;
+} bz2_archive;
+
+// Callback which is called for every line of an uncompressed block. A line
+// isn't null terminated. Returns true to stop uncompressing.
+typedef bool (*line_cb_t)(const char *line, int line_len, void *cb_arg);
+
+// Opens an input bz2 file and finds its first and last dates
+void open_archive(bz2_archive *, const char *, const dt_locator *);
+// Opens an input bz2 file without a search of its first and last dates
+void open_archive_file(bz2_archive *, const char *, const dt_locator *);
+void read_archive_dates(bz2_archive *);
+// Closes a file. Block bounds which were found by a query are saved to the
+// index of the file for the next queries.
+void close_archive(bz2_archive *);
+// Frees an archive which is open or half-open after a fatal error without
+// saving its block bounds
+void release_archive(bz2_archive *);
+// first/last timestamps of a block with an absolute position. They are cached
+// by the position.
+const char * get_blk_first_dt(bz2_archive *, unsigned long long, char *,
+                              time_t *);
+const char * get_blk_last_dt(bz2_archive *, unsigned long long, char *,
+                             time_t *);
+unsigned long long find_range_first_blk(bz2_archive *, const time_range *,
+                                        off_t *);
+// Checks if a block with an absolute position and its first timestamp is
+// after a range
+bool is_blk_after_range(bz2_archive *, unsigned long long, time_t,
+                        const time_range *);
+// Writes a block with an absolute position
+int write_blk(bz2_archive *, unsigned long long, blk_writer *);
+// writes all the blocks of a time range
+void extract_range(bz2_archive *, const time_range *, blk_writer *, off_t *);
+void plan_range(bz2_archive *, const time_range *, off_t *, range_plan *);
+// Writes len uncompressed bytes of a file from offset to a writer of whole
+// blocks. Only the blocks which cover them are uncompressed, they are found
+// by a complete index with stats (has_blk_index_stats()). Returns the amount
+// of written bytes, it's less than len at the end of a file.
+unsigned long long extract_bytes(bz2_archive *, unsigned long long,
+                                 unsigned long long, blk_writer *);
+// Binary search of the first block which first timestamp is after a time (+
+// --max-skew) from the byte low. Returns an absolute position of the block or
+// BLK_NOT_FOUND if there is no such block.
+unsigned long long opt_to_bin_search(bz2_archive *, off_t, time_t);
+// Requests the compressed bytes of the blocks which are read ahead after a
+// block (the previous block or BLK_NOT_FOUND is used for the estimation of a
+// block size). The indexed blocks which are skipped by the Bloom filters of a
+// grep filter (NULL if none) aren't requested.
+void prefetch_next_blks(bz2_archive *, unsigned long long, unsigned long long,
+                        const grep_filter *);
+// Returns the absolute position of the block before a block by a complete
+// index or by a backward search, BLK_NOT_FOUND for the first block
+unsigned long long find_prev_known_blk_pos(bz2_archive *, unsigned long long);
+// Returns the absolute position of the block after a block by a complete index
+// or by a search, BLK_NOT_FOUND for the last block
+unsigned long long find_next_known_blk_pos(bz2_archive *, unsigned long long);
+// Uncompresses a whole block with an absolute position to a cache. Returns a
+// status of micro-bunzip (0 if a block was uncompressed).
+int decode_blk(bunzip_data *, unsigned long long, decoded_blk_cache *);
+
+// Low level access to blocks. Bit positions are absolute, the input is read by
+// pread(), so the offset of the descriptor isn't used and a descriptor can be
+// shared by threads.
+// Calls a callback for every line of a block till it returns true
+int for_each_line_in_blk(unsigned long long, bunzip_data *, line_cb_t, void *);
+// Returns the position of the first block which is started from a byte or
+// later, or BLK_NOT_FOUND
+unsigned long long find_blk_from(bunzip_data *, off_t);
+off_t get_file_size(bunzip_data *);
+void seek_bits(bunzip_data *, unsigned long long);
+
+#endif
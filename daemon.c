@@ -0,0 +1,819 @@
+// Query daemon: serves the queries of a set of archives over a Unix socket
+// and its client.
+
+
+#include <stdio.h>
+#include <stdlib.h>			// exit(), malloc()
+#include <string.h>			// strcmp(), strrchr()
+#include <stdarg.h>			// va_list
+#include <stdint.h>			// uint32_t
+#include <errno.h>			// strerror()
+#include <unistd.h>			// read(), close(), unlink(), pipe()
+#include <fcntl.h>			// fcntl()
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>			// sockaddr_un
+#include <arpa/inet.h>		// htonl(), ntohl()
+#include "extract_time_blk_bz2.h"
+#include "blk_writer.h"
+#include "histogram.h"
+#include "daemon.h"
+
+
+// A file which is served by a daemon. Concurrent queries of a file need their
+// own handles, the handles which aren't used by queries are kept open with
+// their indexes and cached block bounds for the next queries.
+typedef struct
+{
+    const char *path;
+    etb_archive **idle;
+    int n_idle, size;
+    pthread_mutex_t lock;
+} served_archive;
+
+typedef struct
+{
+    served_archive *archives;
+    int n_archives;
+    const daemon_opts *opts;
+    // uncompressed blocks shared by all the handles
+    etb_blk_cache *blk_cache;
+    // a ring of connections with a query which wait for a worker
+    int conns[DAEMON_MAX_PENDING];
+    int first_conn, n_conns;
+    // connections which wait for the next query of a client, they are polled
+    // by the main thread. Workers return a connection after every query, so
+    // idle clients don't hold the workers.
+    int idle_conns[DAEMON_MAX_CONNS];
+    int n_idle_conns;
+    // all the open connections
+    int n_open_conns;
+    // a pipe which wakes the poll up when a connection is returned
+    int wake_fds[2];
+    pthread_mutex_t lock;
+    // signaled when a connection is added or taken
+    pthread_cond_t changed;
+} daemon_state;
+
+// Lines of a response which are collected to a data frame
+typedef struct
+{
+    int fd;
+    char data[DAEMON_FRAME_SIZE];
+    int len;
+    // a client has closed the connection
+    bool broken;
+} frame_writer;
+
+
+static void poll_conns(daemon_state *, int);
+static void queue_conn(daemon_state *, int);
+static void * daemon_worker(void *);
+static bool serve_conn(daemon_state *, int);
+static void return_conn(daemon_state *, int);
+static bool run_query(daemon_state *, int, char *);
+static bool run_archive_query(etb_archive *, int, const daemon_query *,
+                              int *);
+static const char * parse_query(char *, daemon_query *);
+static served_archive * find_served_archive(daemon_state *, const char *);
+static etb_archive * take_archive(daemon_state *, served_archive *, int *);
+static void return_archive(served_archive *, etb_archive *);
+static void add_query_field(char **, int *, int *, const char *,
+                            const char *);
+static void write_frame_data(frame_writer *, const char *, int);
+static void flush_frame_writer(frame_writer *);
+static bool send_error(int, const char *, ...);
+static bool send_frame(int, char, const char *, int);
+static bool recv_frame(int, char *, char **, int *);
+static bool send_all(int, const char *, int);
+static bool recv_all(int, char *, int);
+
+
+void serve_archives(const char *socket_path, const char * const *paths,
+                    int n_paths, const daemon_opts *opts)
+{
+    daemon_state d;
+    struct sockaddr_un addr;
+    pthread_t thread;
+    etb_archive *a;
+    int listen_fd, status;
+
+    memset(&d, 0, sizeof(d));
+    d.opts = opts;
+    d.n_archives = n_paths;
+    pthread_mutex_init(&d.lock, NULL);
+    pthread_cond_init(&d.changed, NULL);
+
+    if ((d.archives = calloc(n_paths, sizeof(served_archive))) == NULL ||
+        (d.blk_cache = etb_new_blk_cache(opts->cache_size)) == NULL)
+    {
+        error_print("%s", "Can't allocate memory for the served files");
+        exit(EXIT_FAILURE);
+    }
+
+    // Every file is opened at start, so its dates and index are in memory
+    // before the first query
+    for (int i = 0; i < n_paths; i++)
+    {
+        d.archives[i].path = paths[i];
+        pthread_mutex_init(&d.archives[i].lock, NULL);
+
+        if ((status = etb_open(paths[i], &opts->open_opts, &a)) != ETB_OK ||
+            (opts->build_index &&
+             (status = etb_attach_index(a, opts->n_threads)) != ETB_OK))
+        {
+            error_print("Can't open %s\n%s", paths[i], etb_strerror(status));
+            exit(EXIT_FAILURE);
+        }
+
+        etb_set_blk_cache(a, d.blk_cache);
+        return_archive(&d.archives[i], a);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        error_print("A socket path %s is too long", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // A socket of a previous daemon is replaced
+    unlink(socket_path);
+
+    if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0)
+    {
+        error_print("Can't listen on the socket %s\n%s", socket_path,
+                    strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // A worker never waits for a full pipe, one byte wakes the poll up
+    if (pipe(d.wake_fds) != 0 || fcntl(d.wake_fds[1], F_SETFL, O_NONBLOCK) != 0)
+    {
+        error_print("Can't create a pipe\n%s", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < opts->n_threads; i++)
+    {
+        if (pthread_create(&thread, NULL, daemon_worker, &d) != 0)
+        {
+            error_print("%s", "Can't create a thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    poll_conns(&d, listen_fd);
+}
+
+
+// Accepts connections and passes the connections with a query to the workers.
+// The listening socket isn't polled while DAEMON_MAX_CONNS are open.
+static void poll_conns(daemon_state *d, int listen_fd)
+{
+    struct pollfd fds[DAEMON_MAX_CONNS + 2];
+    int conns[DAEMON_MAX_CONNS];
+    int n_fds, n_conns, conn_fd;
+    char wake[64];
+
+    for (;;)
+    {
+        fds[0].fd = d->wake_fds[0];
+        fds[0].events = POLLIN;
+        n_fds = 1;
+
+        pthread_mutex_lock(&d->lock);
+        if (d->n_open_conns < DAEMON_MAX_CONNS)
+        {
+            fds[n_fds].fd = listen_fd;
+            fds[n_fds++].events = POLLIN;
+        }
+        n_conns = d->n_idle_conns;
+        memcpy(conns, d->idle_conns, n_conns * sizeof(int));
+        pthread_mutex_unlock(&d->lock);
+
+        for (int i = 0; i < n_conns; i++)
+        {
+            fds[n_fds + i].fd = conns[i];
+            fds[n_fds + i].events = POLLIN;
+        }
+
+        if (poll(fds, n_fds + n_conns, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            error_print("Can't poll the connections\n%s", strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+
+        if (fds[0].revents)
+            read(d->wake_fds[0], wake, sizeof(wake));
+
+        if (n_fds > 1 && fds[1].revents)
+        {
+            if ((conn_fd = accept(listen_fd, NULL, NULL)) >= 0)
+            {
+                pthread_mutex_lock(&d->lock);
+                d->idle_conns[d->n_idle_conns++] = conn_fd;
+                d->n_open_conns++;
+                pthread_mutex_unlock(&d->lock);
+            }
+            else if (errno != EINTR && errno != ECONNABORTED)
+            {
+                error_print("Can't accept a connection\n%s",
+                            strerror(errno));
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        // A query or the end of a connection goes to a worker
+        for (int i = 0; i < n_conns; i++)
+            if (fds[n_fds + i].revents)
+                queue_conn(d, conns[i]);
+    }
+}
+
+
+// Moves an idle connection to the ring of the connections for the workers
+static void queue_conn(daemon_state *d, int conn_fd)
+{
+    int i;
+
+    pthread_mutex_lock(&d->lock);
+
+    for (i = 0; d->idle_conns[i] != conn_fd; i++)
+        ;
+    d->idle_conns[i] = d->idle_conns[--d->n_idle_conns];
+
+    while (d->n_conns == DAEMON_MAX_PENDING)
+        pthread_cond_wait(&d->changed, &d->lock);
+
+    d->conns[(d->first_conn + d->n_conns) % DAEMON_MAX_PENDING] = conn_fd;
+    d->n_conns++;
+    pthread_cond_broadcast(&d->changed);
+
+    pthread_mutex_unlock(&d->lock);
+}
+
+
+bool query_daemon(const char *socket_path, const daemon_query *query,
+                  int out_fd)
+{
+    struct sockaddr_un addr;
+    char *request = NULL;
+    int request_len = 0, request_size = 0;
+    char histogram[32], max_skew[32];
+    char type;
+    char *payload = NULL;
+    int payload_len;
+    int fd;
+    bool ok;
+
+    add_query_field(&request, &request_len, &request_size, "file",
+                    query->file);
+    add_query_field(&request, &request_len, &request_size, "from",
+                    query->from);
+    add_query_field(&request, &request_len, &request_size, "to", query->to);
+    for (int i = 0; i < query->n_grep; i++)
+        add_query_field(&request, &request_len, &request_size, "grep",
+                        query->grep[i]);
+    snprintf(histogram, sizeof(histogram), "%d", query->histogram);
+    add_query_field(&request, &request_len, &request_size, "histogram",
+                    histogram);
+    snprintf(max_skew, sizeof(max_skew), "%d", query->max_skew);
+    add_query_field(&request, &request_len, &request_size, "max_skew",
+                    max_skew);
+
+    if (request_len > DAEMON_FRAME_SIZE)
+    {
+        error_print("A query is longer than %d bytes", DAEMON_FRAME_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path))
+    {
+        error_print("A socket path %s is too long", socket_path);
+        exit(EXIT_FAILURE);
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        !send_frame(fd, FRAME_QUERY, request, request_len))
+    {
+        error_print("Can't send a query to the daemon %s\n%s", socket_path,
+                    strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // Data is written as it comes till the end of a response
+    for (;;)
+    {
+        if (!recv_frame(fd, &type, &payload, &payload_len))
+        {
+            error_print("The daemon %s has closed the connection",
+                        socket_path);
+            exit(EXIT_FAILURE);
+        }
+
+        if (type == FRAME_DATA)
+        {
+            write_all(out_fd, payload, payload_len);
+            continue;
+        }
+
+        if (type == FRAME_ERROR)
+        {
+            error_print("%s", payload);
+        }
+        else if (type != FRAME_END)
+        {
+            error_print("Unknown frame type %c of a response", type);
+        }
+
+        ok = type == FRAME_END;
+        break;
+    }
+
+    close(fd);
+    free(request);
+    free(payload);
+
+    return ok;
+}
+
+
+static void * daemon_worker(void *arg)
+{
+    daemon_state *d = arg;
+    int conn_fd;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&d->lock);
+
+        while (d->n_conns == 0)
+            pthread_cond_wait(&d->changed, &d->lock);
+
+        conn_fd = d->conns[d->first_conn];
+        d->first_conn = (d->first_conn + 1) % DAEMON_MAX_PENDING;
+        d->n_conns--;
+        pthread_cond_broadcast(&d->changed);
+
+        pthread_mutex_unlock(&d->lock);
+
+        if (serve_conn(d, conn_fd))
+            return_conn(d, conn_fd);
+        else
+        {
+            close(conn_fd);
+
+            pthread_mutex_lock(&d->lock);
+            d->n_open_conns--;
+            pthread_mutex_unlock(&d->lock);
+            write(d->wake_fds[1], "", 1);
+        }
+    }
+
+    return NULL;
+}
+
+
+// Runs the next query of a connection. Returns false if a client has closed
+// a connection or it's broken.
+static bool serve_conn(daemon_state *d, int fd)
+{
+    char type;
+    char *payload = NULL;
+    int payload_len;
+    bool ok = false;
+
+    if (recv_frame(fd, &type, &payload, &payload_len))
+    {
+        if (type != FRAME_QUERY)
+            send_error(fd, "Unknown frame type %c of a request", type);
+        else
+            ok = run_query(d, fd, payload);
+    }
+
+    free(payload);
+
+    return ok;
+}
+
+
+// Returns a connection to the poll of the main thread till the next query
+static void return_conn(daemon_state *d, int conn_fd)
+{
+    pthread_mutex_lock(&d->lock);
+    d->idle_conns[d->n_idle_conns++] = conn_fd;
+    pthread_mutex_unlock(&d->lock);
+
+    write(d->wake_fds[1], "", 1);
+}
+
+
+// Runs a query and sends its response. Returns false if a connection is
+// broken.
+static bool run_query(daemon_state *d, int fd, char *payload)
+{
+    daemon_query query;
+    const char *err_msg;
+    served_archive *sa;
+    etb_archive *a;
+    int status;
+    bool ok;
+
+    if ((err_msg = parse_query(payload, &query)) != NULL)
+        ok = send_error(fd, "%s", err_msg);
+    else if ((sa = find_served_archive(d, query.file)) == NULL)
+        ok = send_error(fd, "The file %s isn't served", query.file);
+    else if ((a = take_archive(d, sa, &status)) == NULL)
+        ok = send_error(fd, "Can't open %s\n%s", sa->path,
+                        etb_strerror(status));
+    else
+    {
+        status = ETB_OK;
+        ok = run_archive_query(a, fd, &query, &status);
+
+        // A handle can be in any state after a fatal error
+        if (status == ETB_ERR_FAILED)
+            etb_close(a);
+        else
+            return_archive(sa, a);
+    }
+
+    free(query.grep);
+
+    return ok;
+}
+
+
+// Streams the lines or the histogram of a query of an archive. A status of an
+// error of the library is stored to status. Returns false if a connection is
+// broken.
+static bool run_archive_query(etb_archive *a, int fd,
+                              const daemon_query *query, int *status)
+{
+    time_t from_time_t, to_time_t;
+    etb_query_opts q_opts;
+    etb_query *q;
+    etb_line line;
+    histogram hist;
+    frame_writer *out;
+    char bucket[BUFFER_SIZE];
+    int bucket_len;
+    bool ok;
+
+    // A value of to without a year is anchored to from as by the CLI
+    if ((*status = etb_parse_range(a, query->from, query->to, &from_time_t,
+                                   &to_time_t)) != ETB_OK)
+        return send_error(fd, "%s: %s - %s", etb_strerror(*status),
+                          query->from, query->to);
+
+    // The histogram module exits on too many intervals
+    if (query->histogram > 0 && to_time_t >= from_time_t &&
+        (to_time_t - from_time_t) / query->histogram + 1 >=
+        HISTOGRAM_MAX_BUCKETS)
+        return send_error(fd, "A time range has more than %d intervals of %d "
+                          "seconds", HISTOGRAM_MAX_BUCKETS, query->histogram);
+
+    q_opts.max_skew = query->max_skew;
+    q_opts.grep = query->grep;
+    q_opts.n_grep = query->n_grep;
+
+    if ((*status = etb_query_range(a, from_time_t, to_time_t, &q_opts, &q)) !=
+        ETB_OK)
+        return send_error(fd, "%s", etb_strerror(*status));
+
+    if ((out = malloc(sizeof(*out))) == NULL)
+    {
+        error_print("%s", "Can't allocate memory for a response");
+        exit(EXIT_FAILURE);
+    }
+    out->fd = fd;
+    out->len = 0;
+    out->broken = false;
+
+    if (query->histogram > 0)
+        init_histogram(&hist, from_time_t, to_time_t, query->histogram);
+
+    // Frames are sent as soon as they are filled by the uncompressed lines
+    while (!out->broken && (*status = etb_next_line(q, &line)) == ETB_OK)
+    {
+        if (query->histogram > 0)
+        {
+            add_histogram_line(line.data, line.len, line.time, &hist);
+            continue;
+        }
+
+        write_frame_data(out, line.data, line.len);
+        write_frame_data(out, "\n", 1);
+    }
+
+    if (query->histogram > 0)
+    {
+        for (int i = 0; i < hist.n_buckets && *status == ETB_END; i++)
+        {
+            bucket_len = format_histogram_bucket(&hist, i, etb_dt_format(a),
+                                                 bucket, sizeof(bucket));
+            write_frame_data(out, bucket, bucket_len);
+        }
+        free_histogram(&hist);
+    }
+
+    etb_free_query(q);
+
+    if (out->broken)
+        ok = false;
+    else if (*status != ETB_END)
+        ok = send_error(fd, "%s", etb_strerror(*status));
+    else
+    {
+        flush_frame_writer(out);
+        ok = !out->broken && send_frame(fd, FRAME_END, NULL, 0);
+        *status = ETB_OK;
+    }
+
+    free(out);
+
+    return ok;
+}
+
+
+// Parses the "name=value" lines of a query (a null terminated payload) in
+// place. Returns an error message or NULL.
+static const char * parse_query(char *payload, daemon_query *query)
+{
+    char *field, *value, *next;
+    int n_fields = 1;
+
+    memset(query, 0, sizeof(*query));
+
+    for (const char *c = payload; *c != '\0'; c++)
+        if (*c == '\n')
+            n_fields++;
+
+    if ((query->grep = malloc(n_fields * sizeof(char *))) == NULL)
+    {
+        error_print("%s", "Can't allocate memory for a query");
+        exit(EXIT_FAILURE);
+    }
+
+    for (field = payload; field != NULL; field = next)
+    {
+        if ((next = strchr(field, '\n')) != NULL)
+            *next++ = '\0';
+
+        if (*field == '\0')
+            continue;
+
+        if ((value = strchr(field, '=')) == NULL)
+            return "A field of a query has no value";
+        *value++ = '\0';
+
+        if (strcmp(field, "file") == 0)
+            query->file = value;
+        else if (strcmp(field, "from") == 0)
+            query->from = value;
+        else if (strcmp(field, "to") == 0)
+            query->to = value;
+        else if (strcmp(field, "grep") == 0 && *value != '\0')
+            query->grep[query->n_grep++] = value;
+        else if (strcmp(field, "histogram") == 0 &&
+                 (query->histogram = atoi(value)) >= 0)
+            continue;
+        else if (strcmp(field, "max_skew") == 0 &&
+                 (query->max_skew = atoi(value)) >= 0)
+            continue;
+        else
+            return "Unknown or malformed field of a query";
+    }
+
+    if (query->file == NULL || query->from == NULL || query->to == NULL)
+        return "A query should have file, from and to";
+
+    return NULL;
+}
+
+
+// Finds a served file by its path or by its file name
+static served_archive * find_served_archive(daemon_state *d, const char *file)
+{
+    const char *name;
+
+    for (int i = 0; i < d->n_archives; i++)
+    {
+        name = strrchr(d->archives[i].path, '/');
+        name = name != NULL ? name + 1 : d->archives[i].path;
+
+        if (strcmp(d->archives[i].path, file) == 0 || strcmp(name, file) == 0)
+            return &d->archives[i];
+    }
+
+    return NULL;
+}
+
+
+// Takes an idle handle of a file or opens a new one if all the handles are
+// used by other queries. Returns NULL and an error status if a file can't be
+// opened.
+static etb_archive * take_archive(daemon_state *d, served_archive *sa,
+                                  int *status)
+{
+    etb_archive *a = NULL;
+
+    pthread_mutex_lock(&sa->lock);
+    if (sa->n_idle > 0)
+        a = sa->idle[--sa->n_idle];
+    pthread_mutex_unlock(&sa->lock);
+
+    if (a != NULL)
+        return a;
+
+    if ((*status = etb_open(sa->path, &d->opts->open_opts, &a)) != ETB_OK)
+        return NULL;
+
+    etb_set_blk_cache(a, d->blk_cache);
+
+    return a;
+}
+
+
+static void return_archive(served_archive *sa, etb_archive *a)
+{
+    etb_archive **new_idle;
+
+    pthread_mutex_lock(&sa->lock);
+
+    if (sa->n_idle == sa->size)
+    {
+        sa->size = sa->size ? sa->size * 2 : 4;
+        if ((new_idle = realloc(sa->idle, sa->size * sizeof(etb_archive *))) ==
+            NULL)
+        {
+            error_print("Can't allocate memory for %d handles", sa->size);
+            exit(EXIT_FAILURE);
+        }
+        sa->idle = new_idle;
+    }
+
+    sa->idle[sa->n_idle++] = a;
+
+    pthread_mutex_unlock(&sa->lock);
+}
+
+
+// Appends a "name=value" line to a query
+static void add_query_field(char **query, int *query_len, int *query_size,
+                            const char *name, const char *value)
+{
+    if (strchr(value, '\n') != NULL)
+    {
+        error_print("A value of %s of a query can't have a newline", name);
+        exit(EXIT_FAILURE);
+    }
+
+    append_to_line(query, query_len, query_size, name, strlen(name));
+    append_to_line(query, query_len, query_size, "=", 1);
+    append_to_line(query, query_len, query_size, value, strlen(value));
+    append_to_line(query, query_len, query_size, "\n", 1);
+}
+
+
+static void write_frame_data(frame_writer *out, const char *data, int len)
+{
+    int n;
+
+    while (len > 0 && !out->broken)
+    {
+        n = DAEMON_FRAME_SIZE - out->len;
+        if (n > len)
+            n = len;
+
+        memcpy(out->data + out->len, data, n);
+        out->len += n;
+        data += n;
+        len -= n;
+
+        if (out->len == DAEMON_FRAME_SIZE)
+            flush_frame_writer(out);
+    }
+}
+
+
+static void flush_frame_writer(frame_writer *out)
+{
+    if (out->len > 0 && !out->broken &&
+        !send_frame(out->fd, FRAME_DATA, out->data, out->len))
+        out->broken = true;
+
+    out->len = 0;
+}
+
+
+static bool send_error(int fd, const char *fmt, ...)
+{
+    char msg[BUFFER_SIZE];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+
+    return send_frame(fd, FRAME_ERROR, msg, strlen(msg));
+}
+
+
+static bool send_frame(int fd, char type, const char *payload, int len)
+{
+    char header[5];
+    uint32_t net_len = htonl(len);
+
+    header[0] = type;
+    memcpy(header + 1, &net_len, sizeof(net_len));
+
+    return send_all(fd, header, sizeof(header)) &&
+           send_all(fd, payload, len);
+}
+
+
+// Receives a frame to a payload buffer which is reallocated for it. A
+// payload is null terminated. Returns false at the end of a connection or if
+// a frame is too long.
+static bool recv_frame(int fd, char *type, char **payload, int *len)
+{
+    char header[5];
+    uint32_t net_len;
+
+    if (!recv_all(fd, header, sizeof(header)))
+        return false;
+
+    *type = header[0];
+    memcpy(&net_len, header + 1, sizeof(net_len));
+    if ((*len = ntohl(net_len)) > DAEMON_FRAME_SIZE || *len < 0)
+        return false;
+
+    if ((*payload = realloc(*payload, *len + 1)) == NULL)
+    {
+        error_print("Can't allocate %d bytes for a frame", *len + 1);
+        exit(EXIT_FAILURE);
+    }
+
+    if (!recv_all(fd, *payload, *len))
+        return false;
+    (*payload)[*len] = '\0';
+
+    return true;
+}
+
+
+// A client which has closed a connection doesn't get SIGPIPE
+static bool send_all(int fd, const char *buf, int len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = send(fd, buf, len, MSG_NOSIGNAL)) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return true;
+}
+
+
+static bool recv_all(int fd, char *buf, int len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        if ((n = read(fd, buf, len)) <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+
+        buf += n;
+        len -= n;
+    }
+
+    return true;
+}
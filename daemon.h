@@ -0,0 +1,64 @@
+#ifndef __DAEMON_H__
+#define __DAEMON_H__
+
+#include <stdbool.h>        // bool type
+#include "libextract_time_blk_bz2.h"
+
+// Protocol of a daemon. Requests and responses are frames of a type char, a
+// payload length (4 bytes, big-endian) and a payload. A client can send
+// several queries over one connection, one after another.
+//
+// a query of "name=value" lines: file (a path or a file name of a served
+// file), from, to, grep (can be repeated), histogram (seconds of intervals),
+// max_skew
+#define FRAME_QUERY 'Q'
+// lines of a range or of a histogram, every line ends with a newline
+#define FRAME_DATA 'D'
+// the end of a response
+#define FRAME_END 'Z'
+// an error message, it ends a response
+#define FRAME_ERROR 'E'
+// Max payload of a frame. Lines are sent as soon as a frame is filled, a
+// longer line is split to several frames.
+#define DAEMON_FRAME_SIZE (64 * 1024)
+// Max amount of connections which have a query and wait for a worker
+#define DAEMON_MAX_PENDING 256
+// Max amount of open connections, the next ones wait in the listen backlog
+#define DAEMON_MAX_CONNS 1024
+// The default size of the cache of uncompressed blocks in megabytes
+#define DEF_DAEMON_CACHE_SIZE 256
+
+// Options of a daemon
+typedef struct
+{
+    // how the archives are opened
+    etb_open_opts open_opts;
+    // workers which run queries
+    int n_threads;
+    // build the indexes of the archives which have no complete index at start
+    bool build_index;
+    // bytes of the cache of uncompressed blocks shared by all the queries
+    unsigned long long cache_size;
+} daemon_opts;
+
+// A query of a client
+typedef struct
+{
+    const char *file;
+    const char *from, *to;
+    const char **grep;
+    int n_grep;
+    // seconds of the intervals of a histogram or 0 for lines
+    int histogram;
+    int max_skew;
+} daemon_query;
+
+// Opens archives and serves the queries of the clients of a Unix socket by a
+// pool of threads till a daemon is killed
+void serve_archives(const char *, const char * const *, int,
+                    const daemon_opts *);
+// Sends a query to a daemon and writes its response to fd as it comes.
+// Returns false if a daemon responded with an error (it's printed).
+bool query_daemon(const char *, const daemon_query *, int);
+
+#endif
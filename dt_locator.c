@@ -0,0 +1,554 @@
+// Timestamp locators: text datetime substrings, JSON fields, epoch numbers.
+//
+// dt - abbreviation for datetime
+
+
+#define _XOPEN_SOURCE		// strptime()
+#include <stdio.h>
+#include <stdlib.h>			// exit()
+#include <string.h>			// strlen(), memchr()
+#include <ctype.h>          // isspace(), isdigit()
+#include <time.h>			// strptime(), tm structure
+#include "extract_time_blk_bz2.h"
+#include "dt_locator.h"
+#include "simd_search.h"
+
+// Supported datetime formats
+const char * DATETIME_FORMATS[] =
+	{"%Y-%m-%dT%H:%M:%S",	/* "2017-02-21T14:53:22" */
+     "%b %d %H:%M:%S",	    /* "Oct 30 05:54:01" */
+     "%Y-%m-%d %H:%M:%S",	/* "2017-02-21 14:53:22" */
+     "%d/%b/%Y:%H:%M:%S" }; /* "12/Dec/2015:18:39:27" */
+
+const short DATETIME_FORMATS_SIZE =
+    sizeof(DATETIME_FORMATS) / sizeof(DATETIME_FORMATS[0]);
+
+// Epoch numbers with less integer digits (before 1973) are not treated as
+// timestamps at the beginning of a line
+#define EPOCH_MIN_DIGITS 9
+
+
+static bool find_text_dt(const dt_locator *, const char *, int, char *,
+                         time_t *);
+static bool find_json_dt(const dt_locator *, const char *, int, char *,
+                         time_t *);
+static bool find_epoch_dt(const dt_locator *, const char *, int, char *,
+                          time_t *);
+static void copy_dt_str(char *, const char *, int);
+
+
+void init_text_dt_locator(dt_locator *loc, const char *dt_fmt, int dt_len)
+{
+    memset(loc, 0, sizeof(*loc));
+
+    if (dt_len >= DT_STR_SIZE)
+    {
+        error_print("A datetime string of %d chars is too long, max is %d",
+                    dt_len, DT_STR_SIZE - 1);
+        fatal_exit();
+    }
+
+    loc->name = "text";
+    loc->find = find_text_dt;
+    loc->dt_fmt = dt_fmt;
+    loc->dt_len = dt_len;
+}
+
+
+void init_json_dt_locator(dt_locator *loc, const char *key, const char *dt_fmt)
+{
+    memset(loc, 0, sizeof(*loc));
+
+    // +2 for quotes
+    if (strlen(key) + 2 >= DT_STR_SIZE)
+    {
+        error_print("A JSON key \"%s\" is too long, max is %d chars",
+                    key, DT_STR_SIZE - 3);
+        fatal_exit();
+    }
+
+    loc->name = "json";
+    loc->find = find_json_dt;
+    loc->dt_fmt = dt_fmt;
+    loc->json_needle_len = snprintf(loc->json_needle, DT_STR_SIZE,
+                                    "\"%s\"", key);
+}
+
+
+void init_epoch_dt_locator(dt_locator *loc)
+{
+    memset(loc, 0, sizeof(*loc));
+
+    loc->name = "epoch";
+    loc->find = find_epoch_dt;
+}
+
+
+bool detect_dt_fmt(dt_locator *loc, const char *str, int str_len)
+{
+    // A sample time to get the length of a datetime substring of a format
+    struct tm sample_tm = { .tm_year = 117, .tm_mon = 1, .tm_mday = 21 };
+    char sample[DT_STR_SIZE];
+    char dt_str[DT_STR_SIZE];
+    time_t dt_time_t;
+
+    // Epoch numbers don't need a format
+    if (loc->find == find_epoch_dt)
+        return loc->find(loc, str, str_len, dt_str, &dt_time_t);
+
+    // A JSON value is an epoch number (a whole value, not the year of a
+    // datetime string)
+    if (loc->find == find_json_dt &&
+        loc->find(loc, str, str_len, dt_str, &dt_time_t) &&
+        parse_epoch(dt_str, strlen(dt_str), &dt_time_t) == strlen(dt_str))
+        return true;
+
+    for (int i = 0; i < DATETIME_FORMATS_SIZE; i++)
+    {
+        loc->dt_fmt = DATETIME_FORMATS[i];
+        loc->dt_len = strftime(sample, sizeof(sample), loc->dt_fmt,
+                               &sample_tm);
+
+        if (loc->find(loc, str, str_len, dt_str, &dt_time_t))
+            return true;
+    }
+
+    loc->dt_fmt = NULL;
+    loc->dt_len = 0;
+
+    return false;
+}
+
+
+void describe_dt_locator(const dt_locator *loc, char *descr, int descr_size)
+{
+    int descr_len;
+
+    if (loc->find == find_text_dt)
+        descr_len = snprintf(descr, descr_size, "text:%s:%d",
+                             loc->dt_fmt != NULL ? loc->dt_fmt : "",
+                             loc->dt_len);
+    else if (loc->find == find_json_dt)
+        descr_len = snprintf(descr, descr_size, "json:%s:%s",
+                             loc->json_needle,
+                             loc->dt_fmt != NULL ? loc->dt_fmt : "epoch");
+    else
+        descr_len = snprintf(descr, descr_size, "%s", loc->name);
+
+    // Epoch values of a format without a year depend on the year source
+    if (is_dt_fmt_without_year(loc->dt_fmt) && descr_len < descr_size)
+    {
+        if (loc->last_year > 0)
+            snprintf(descr + descr_len, descr_size - descr_len, ":year=%d",
+                     loc->last_year);
+        else
+            snprintf(descr + descr_len, descr_size - descr_len,
+                     ":year=mtime");
+    }
+}
+
+
+// Sliding strptime() window over a string
+static bool find_text_dt(const dt_locator *loc, const char *str, int str_len,
+                         char *dt_str, time_t *dt_time_t)
+{
+    // A string shorter than a datetime substring can't contain it
+    if (str_len < loc->dt_len)
+        return false;
+
+    if (!is_dt_substr_in_str((char *)str, str_len, dt_str, loc->dt_len,
+                             loc->dt_fmt))
+        return false;
+
+    return convert_loc_dt_to_epoch(loc, dt_str, dt_time_t);
+}
+
+
+// Finds "key" followed by ':' with SIMD search and parses its value in place
+static bool find_json_dt(const dt_locator *loc, const char *str, int str_len,
+                         char *dt_str, time_t *dt_time_t)
+{
+    const char *str_end = str + str_len;
+    const char *key, *value, *value_end;
+
+    for (key = simd_memmem(str, str_len, loc->json_needle,
+                           loc->json_needle_len);
+         key != NULL;
+         key = simd_memmem(key + 1, str_end - key - 1, loc->json_needle,
+                           loc->json_needle_len))
+    {
+        value = key + loc->json_needle_len;
+        while (value < str_end && isspace((unsigned char)*value))
+            value++;
+
+        // The same text in a value of another key, search further
+        if (value == str_end || *value != ':')
+            continue;
+
+        value++;
+        while (value < str_end && isspace((unsigned char)*value))
+            value++;
+
+        if (value == str_end)
+            return false;
+
+        // A string value: datetime or quoted epoch number
+        if (*value == '"')
+        {
+            value++;
+            value_end = memchr(value, '"', str_end - value);
+            if (value_end == NULL)
+                return false;
+
+            copy_dt_str(dt_str, value, value_end - value);
+
+            if (loc->dt_fmt != NULL)
+                return convert_loc_dt_to_epoch(loc, dt_str, dt_time_t);
+
+            return value_end > value &&
+                   parse_epoch(value, value_end - value, dt_time_t) ==
+                   value_end - value;
+        }
+
+        // A number value
+        value_end = value + parse_epoch(value, str_end - value, dt_time_t);
+        if (value_end == value)
+            return false;
+
+        copy_dt_str(dt_str, value, value_end - value);
+
+        return true;
+    }
+
+    return false;
+}
+
+
+// Parses an epoch number at the beginning of a string
+static bool find_epoch_dt(const dt_locator *loc, const char *str, int str_len,
+                          char *dt_str, time_t *dt_time_t)
+{
+    int str_pos = 0;
+    int epoch_len, digits;
+
+    // Skip leading spaces and an opening bracket, e.g. "[1487635200.123] ..."
+    while (str_pos < str_len &&
+           (isspace((unsigned char)str[str_pos]) || str[str_pos] == '['))
+        str_pos++;
+
+    epoch_len = parse_epoch(str + str_pos, str_len - str_pos, dt_time_t);
+    if (epoch_len == 0)
+        return false;
+
+    // A number should be followed by a delimiter, not by a word
+    if (str_pos + epoch_len < str_len &&
+        isalnum((unsigned char)str[str_pos + epoch_len]))
+        return false;
+
+    for (digits = 0; digits < epoch_len &&
+                     isdigit((unsigned char)str[str_pos + digits]); digits++)
+        ;
+    if (digits < EPOCH_MIN_DIGITS)
+        return false;
+
+    copy_dt_str(dt_str, str + str_pos, epoch_len);
+
+    return true;
+}
+
+
+/* Parses an integer or fractional epoch number. A unit is defined by the
+   amount of integer digits: up to 11 digits are seconds, up to 14 are
+   milliseconds, up to 17 are microseconds, the longer ones are nanoseconds.
+   A fractional part is dropped because time_t has 1 second resolution.
+   Returns the amount of parsed chars or 0 if str isn't started from a digit */
+int parse_epoch(const char *str, int str_len, time_t *dt_time_t)
+{
+    int str_pos = 0;
+    int digits = 0;
+    long long value = 0;
+
+    for ( ; str_pos < str_len && isdigit((unsigned char)str[str_pos]);
+          str_pos++)
+    {
+        // Protect from overflow, such a number isn't an epoch time anyway
+        if (++digits <= 19)
+            value = value * 10 + (str[str_pos] - '0');
+    }
+
+    if (digits == 0)
+        return 0;
+
+    if (str_pos + 1 < str_len && str[str_pos] == '.' &&
+        isdigit((unsigned char)str[str_pos + 1]))
+    {
+        for (str_pos++; str_pos < str_len &&
+             isdigit((unsigned char)str[str_pos]); str_pos++)
+            ;
+    }
+
+    if (digits >= 18)
+        value /= 1000000000LL;
+    else if (digits >= 15)
+        value /= 1000000LL;
+    else if (digits >= 12)
+        value /= 1000LL;
+
+    *dt_time_t = (time_t)value;
+
+    return str_pos;
+}
+
+
+time_t convert_opt_dt_to_epoch(const char *opt_dt, const char **dt_fmt)
+{
+    int opt_dt_len = strlen(opt_dt);
+    time_t dt_time_t;
+
+    if (opt_dt_len > 0 && parse_epoch(opt_dt, opt_dt_len, &dt_time_t) ==
+                          opt_dt_len)
+    {
+        *dt_fmt = NULL;
+        return dt_time_t;
+    }
+
+    *dt_fmt = def_dt_fmt(opt_dt);
+
+    return convert_dt_str_to_epoch(opt_dt, *dt_fmt);
+}
+
+
+const char * def_dt_fmt(const char * dt_str)
+{
+    struct tm dt_tm = {0};
+
+    //printf("%s(): dt_str = %s\n", __func__, dt_str);
+
+// Define a datetime format
+    // check if opt_f, opt_to strings correspond to one of supported
+    // datetime formats
+    for (int i = 0; i < DATETIME_FORMATS_SIZE; i++)
+    {
+        if (strptime(dt_str, DATETIME_FORMATS[i], &dt_tm) != NULL)
+            return DATETIME_FORMATS[i];
+	}
+
+// A given dt_sting doesn't correspond to one of supported dt formats. Error.
+    error_print("%s", "The value of --from or --to arguments was set in "
+		        "unsupported datetime format.\n"
+	            "Supported datetime formats are:");
+    for (short i = 0; i < DATETIME_FORMATS_SIZE; i++)
+        printf("\t%s\n", DATETIME_FORMATS[i]);
+    printf("\n");
+    fatal_exit();
+}
+
+
+/* Converts char datetime string to epoch time (seconds since
+   Jan 1 1970 00:00:00 UTC) */
+time_t convert_dt_str_to_epoch(const char * dt_str, const char * dt_fmt)
+{
+    // dt data structures to which opt_f, opt_to should be converted
+    struct tm dt_tm = {0};
+    time_t dt_time_t;
+
+    // Convert string to tm structure format (tm structure from strings.h)
+    // struct tm {
+    //         int tm_sec;    /* Seconds (0-60) */
+    //         int tm_min;    /* Minutes (0-59) */
+    //         int tm_hour;   /* Hours (0-23) */
+    //         int tm_mday;   /* Day of the month (1-31) */
+    //         int tm_mon;    /* Month (0-11) */
+    //         int tm_year;   /* Year - 1900 */
+    //         int tm_wday;   /* Day of the week (0-6, Sunday = 0) */
+    //         int tm_yday;   /* Day in the year (0-365, 1 Jan = 0) */
+    //         int tm_isdst;  /* Daylight saving time */
+    // };
+
+    debug_print("dt_fmt = %s, dt_str = %s\n", dt_fmt, dt_str);
+    if ( NULL == strptime(dt_str, dt_fmt, &dt_tm) )
+    {
+        error_print("strptime(dt_str, dt_fmt, &dt_tm) "
+		    "can't convert received datetime string \"%s\" into tm "
+		    "structure properly", dt_str);
+	    fatal_exit();
+    }
+
+    // convert tm to time_t
+    if ( (dt_time_t = mktime(&dt_tm)) == -1 ) {
+        printf("mktime() returned -1. The specified broken-down dt(dt_time_t) cannot be "
+               "represented as calendar time a(seconds since Epoch)\n");
+        fatal_exit();
+    }
+    //printf("convert_dt_str_to_epoch: dt_time_t = %d\n", dt_time_t);
+
+
+    return dt_time_t;
+}
+
+
+void store_dt_str(char *dst, const char *src)
+{
+    strncpy(dst, src, DT_STR_SIZE - 1);
+    dst[DT_STR_SIZE - 1] = '\0';
+}
+
+
+bool is_dt_fmt_without_year(const char *dt_fmt)
+{
+    return dt_fmt != NULL && strstr(dt_fmt, "%Y") == NULL &&
+           strstr(dt_fmt, "%y") == NULL && strstr(dt_fmt, "%G") == NULL &&
+           strstr(dt_fmt, "%s") == NULL;
+}
+
+
+void set_dt_year_anchor(dt_locator *loc, const char *first_dt_str,
+                        const char *last_dt_str, time_t file_mtime)
+{
+    struct tm first_tm = {0}, last_tm = {0}, mtime_tm, tmp_tm;
+
+    if (!is_dt_fmt_without_year(loc->dt_fmt) ||
+        strptime(first_dt_str, loc->dt_fmt, &first_tm) == NULL ||
+        strptime(last_dt_str, loc->dt_fmt, &last_tm) == NULL)
+        return;
+
+    if (loc->last_year > 0)
+    {
+        last_tm.tm_year = loc->last_year - 1900;
+    }
+    else
+    {
+        // The last line is in the year of the modification time unless it
+        // would be later than the modification time (a day is allowed for
+        // a clock difference), then it's in the previous year
+        localtime_r(&file_mtime, &mtime_tm);
+        last_tm.tm_year = mtime_tm.tm_year;
+        tmp_tm = last_tm;
+        if (mktime(&tmp_tm) > file_mtime + 24 * 60 * 60)
+            last_tm.tm_year--;
+    }
+
+    // The months decrease only after a new year (a file should span less
+    // than 12 months)
+    loc->year_rollover = first_tm.tm_mon > last_tm.tm_mon;
+    loc->first_year = last_tm.tm_year - loc->year_rollover;
+    loc->first_mon = first_tm.tm_mon;
+    loc->year_anchored = true;
+}
+
+
+void set_dt_year_window(dt_locator *loc, time_t center)
+{
+    struct tm center_tm;
+
+    if (!is_dt_fmt_without_year(loc->dt_fmt))
+        return;
+
+    // The months from center - 6 to center + 5 are a "file" which rolled over
+    // a new year
+    localtime_r(&center, &center_tm);
+    loc->year_rollover = true;
+    loc->first_mon = (center_tm.tm_mon + 6) % 12;
+    loc->first_year = center_tm.tm_year - (center_tm.tm_mon < 6);
+    loc->year_anchored = true;
+}
+
+
+bool convert_loc_dt_to_epoch(const dt_locator *loc, const char *dt_str,
+                             time_t *dt_time_t)
+{
+    struct tm dt_tm = {0};
+
+    if (strptime(dt_str, loc->dt_fmt, &dt_tm) == NULL)
+        return false;
+
+    if (loc->year_anchored)
+        dt_tm.tm_year = loc->first_year +
+                        (loc->year_rollover && dt_tm.tm_mon < loc->first_mon);
+
+    return (*dt_time_t = mktime(&dt_tm)) != -1;
+}
+
+
+time_t convert_dt_str_to_recent_epoch(const char *dt_str, const char *dt_fmt,
+                                      time_t not_after)
+{
+    struct tm dt_tm = {0}, not_after_tm, tmp_tm;
+
+    // The same errors as of convert_dt_str_to_epoch()
+    if (strptime(dt_str, dt_fmt, &dt_tm) == NULL)
+        return convert_dt_str_to_epoch(dt_str, dt_fmt);
+
+    localtime_r(&not_after, &not_after_tm);
+    dt_tm.tm_year = not_after_tm.tm_year;
+    tmp_tm = dt_tm;
+    if (mktime(&tmp_tm) > not_after)
+        dt_tm.tm_year--;
+
+    return mktime(&dt_tm);
+}
+
+
+// Copies len chars of src to dt_str as a C string, truncating to DT_STR_SIZE
+static void copy_dt_str(char *dt_str, const char *src, int len)
+{
+    if (len > DT_STR_SIZE - 1)
+        len = DT_STR_SIZE - 1;
+
+    memcpy(dt_str, src, len);
+    dt_str[len] = '\0';
+}
+
+
+bool is_dt_substr_in_str(  char * str, int str_len, char * test_substr,
+                        int test_substr_len, const char * dt_fmt)
+{
+    // Char position in a string
+    int str_pos;
+    // Char position in test datetime substring
+    int test_substr_pos;
+    // dt data structures opt_f, opt_to should be converted to
+    struct tm dt_tm = {0};
+
+    // Loop through a string. A window never goes beyond str_len, so str is
+    // not required to be null terminated
+    for (str_pos = 0; str_pos + test_substr_len <= str_len; str_pos++)
+    {
+        // Take test_substr_len chars from a string into test_substr[].
+        for (test_substr_pos = 0; test_substr_pos < test_substr_len; test_substr_pos++)
+        {
+            // A datetime substring can't cross lines
+            if (str[str_pos] == '\n')
+                return false;
+
+            // copy a char from a string to test_substr
+            test_substr[test_substr_pos] = str[str_pos++];
+        }
+
+        // Add null char to the end of test_substr to make it C string
+        test_substr[test_substr_len] = '\0';
+
+        if (strlen(test_substr) < test_substr_len) return false;
+
+        //debug_print("obuf_pos = %d", obuf_pos);
+        //debug_print("test_substr = \"%s\"", test_substr);
+
+        // If test_substr doesn't match to the dt_fmt (strptime == NULL)
+        if ( strptime(test_substr, dt_fmt, &dt_tm) == NULL )
+        {
+            // Move str_pos test_substr_len chars back (i.e. to the char which
+            // is new start char. It is next char to the previous start char)
+            str_pos = str_pos - test_substr_len;
+            continue;
+        }
+        else
+        {
+            //printf("%s: first_dt_str_in_outbuf = %s\n",
+            //    __func__, first_dt_str_in_outbuf);
+            return true;
+        }
+
+    }
+
+    return false;
+}
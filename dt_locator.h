@@ -0,0 +1,99 @@
+#ifndef __DT_LOCATOR_H__
+#define __DT_LOCATOR_H__
+
+#include <stdbool.h>        // bool type
+#include <time.h>           // time_t
+
+// Max size of a datetime substring which a locator can return (+ null char)
+#define DT_STR_SIZE 64
+
+// Supported datetime formats
+extern const char * DATETIME_FORMATS[];
+extern const short DATETIME_FORMATS_SIZE;
+
+typedef struct dt_locator dt_locator;
+
+// Timestamp locator. It knows how to find a timestamp in a log string and how
+// to convert it to epoch time. The search, the main extraction loop and all
+// the probes of a block work through a locator only, so a new log layout
+// needs only a new find() function.
+struct dt_locator
+{
+    // locator name for messages
+    const char *name;
+    // Searches a timestamp in the str of str_len chars (str is not required
+    // to be null terminated). If a timestamp was found, copies it as a C
+    // string to dt_str (DT_STR_SIZE bytes), stores its epoch value to
+    // dt_time_t and returns true.
+    bool (*find)(const dt_locator *, const char *str, int str_len,
+                 char *dt_str, time_t *dt_time_t);
+    // strptime() format of datetime values. NULL if values are epoch numbers
+    const char *dt_fmt;
+    // length of a datetime substring (text locator)
+    int dt_len;
+    // "key" with quotes which is searched for in a JSON line (JSON locator)
+    char json_needle[DT_STR_SIZE];
+    int json_needle_len;
+    // Years of values of a format without a year (e.g. syslog
+    // "%b %d %H:%M:%S") are inferred by the first and the last dates of a
+    // file (set_dt_year_anchor()). Values of the months from first_mon are in
+    // first_year (tm_year), values of the earlier months are in the next year
+    // if a file rolled over a new year. Without an anchor the year is 1900.
+    bool year_anchored, year_rollover;
+    int first_year, first_mon;
+    // year of the last line of a file (--year) or 0 to infer it by the
+    // modification time of a file
+    int last_year;
+};
+
+// Locator of datetime substrings in the dt_fmt format of dt_len chars
+// (a sliding strptime() window). This is the default one.
+void init_text_dt_locator(dt_locator *, const char *, int);
+// Locator of a value of the named key in JSON lines. The value can be a
+// string in the dt_fmt format or an epoch number (dt_fmt can be NULL).
+void init_json_dt_locator(dt_locator *, const char *, const char *);
+// Locator of epoch seconds/milliseconds/microseconds/nanoseconds, integer or
+// fractional, at the beginning of a line.
+void init_epoch_dt_locator(dt_locator *);
+// Finds a supported datetime format of a timestamp in the str of str_len chars
+// for a locator which was initialized without a format (a text locator with a
+// NULL format, a JSON locator of string values). Returns false if there is no
+// timestamp in any format.
+bool detect_dt_fmt(dt_locator *, const char *, int);
+// Describes a locator with its parameters as a C string, e.g.
+// "text:%Y-%m-%d %H:%M:%S:19". Indexes are valid for the same locator only.
+void describe_dt_locator(const dt_locator *, char *, int);
+
+// Checks if values of a datetime format have no year
+bool is_dt_fmt_without_year(const char *);
+// Infers the years of the values of a format without a year by the first and
+// the last dates of a file and its modification time. A file is written after
+// its last line, the first line is a year earlier if the month decreases.
+void set_dt_year_anchor(dt_locator *, const char *, const char *, time_t);
+// Infers the years of the values of a format without a year when the dates of
+// a file are unknown (a stream): a value is in the year which puts it within
+// half a year of the center time
+void set_dt_year_window(dt_locator *, time_t);
+// converts a datetime string of the format of a locator to epoch time, the
+// year of a format without a year is taken from the anchor of a locator.
+// Returns false if a string is malformed.
+bool convert_loc_dt_to_epoch(const dt_locator *, const char *, time_t *);
+// converts --from/--to value of a format without a year to epoch time of the
+// latest year in which it isn't later than not_after
+time_t convert_dt_str_to_recent_epoch(const char *, const char *, time_t);
+
+const char * def_dt_fmt(const char *);
+// converts char string to epoch time (seconds since Jan 1 1970 00:00:00 UTC)
+time_t convert_dt_str_to_epoch(const char *, const char *);
+// converts --from/--to value which is either a datetime in one of supported
+// formats or an epoch number. Stores the format to dt_fmt (NULL for epoch).
+time_t convert_opt_dt_to_epoch(const char *, const char **);
+// parses an epoch number from str, returns amount of parsed chars or 0
+int parse_epoch(const char *, int, time_t *);
+// Copies a datetime C string to a DT_STR_SIZE buffer and zeroes the rest of
+// it, so the bytes after a string which are saved to an index are the same
+// for every build
+void store_dt_str(char *, const char *);
+bool is_dt_substr_in_str(char *, int, char *, int, const char *);
+
+#endif
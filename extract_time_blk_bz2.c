@@ -3,11 +3,12 @@
 // dt - abbreviation for datetime
 
 
-#define _XOPEN_SOURCE		// strptime() 
+#define _GNU_SOURCE			// strptime(), fallocate()
 #include <stdio.h>
 #include <stdlib.h>			// exit()
 #include <fcntl.h>
-#include <unistd.h>			// lseek(), read(), getopt()
+#include <sys/stat.h>		// fstat()
+#include <unistd.h>			// pread(), getopt()
 //#include "dec_to_bin.c"	// dec_to_bin_ll()
 //#include "../binbit.c"
 #include <getopt.h>			// getopt_long()
@@ -18,307 +19,493 @@
 #include <string.h>			// strstr()
 #include <stdint.h>         // intmax_t
 #include <ctype.h>          // isspace()
-
-#define BUFFER_SIZE 8192
-#define FIRST_BLK_POS 32
-
-// debug switch
-#define DEBUG 0
-
-// macro for debug printing
-#define debug_print(fmt, ...) \
-        do { if (DEBUG) fprintf(stderr, "%d:%s(): " fmt "\n",\
-                                __LINE__, __func__, __VA_ARGS__); } while (0)
-// macro for errors printing
-#define error_print(err_msg, ...) \
-	fprintf(stderr, "\nLine %d, function %s(), ERROR:\n" err_msg "\n", \
-				__LINE__, __func__, __VA_ARGS__);
-
-// Supported datetime formats
-const char * DATETIME_FORMATS[] = 
-	{"%Y-%m-%dT%H:%M:%S",	/* "2017-02-21T14:53:22" */
-     "%b %d %H:%M:%S",	    /* "Oct 30 05:54:01" */ 
-     "%Y-%m-%d %H:%M:%S",	/* "2017-02-21 14:53:22" */
-     "%d/%b/%Y:%H:%M:%S" }; /* "12/Dec/2015:18:39:27" */
+#include <limits.h>         // LLONG_MIN
+#include "extract_time_blk_bz2.h"
+#include "dt_locator.h"
+#include "blk_writer.h"
+#include "time_range.h"
+#include "bz2_archive.h"
+#include "file_set.h"
+#include "merge.h"
+#include "stream.h"
+#include "grep_filter.h"
+#include "histogram.h"
+#include "sample.h"
+#include "line_tail.h"
+#include "daemon.h"
+
+// Command line options
+typedef struct
+{
+    // --from, --to values. They can be repeated to set several ranges.
+    time_range *ranges;
+    int n_ranges;
+    // --file
+    const char *input_file;
+    // --files: a glob pattern or a directory of rotated logs
+    const char *input_files;
+    // --threads: the maximum amount of files processed at the same time
+    int n_threads;
+    // --merge: merge the lines of all the files of --files by time
+    bool merge;
+    // --source-prefix: print a file name before every merged line
+    bool source_prefix;
+    // --ranges-file: a file with time ranges, one per line
+    const char *ranges_file;
+    // --split-output: a pattern of output file names, "%d" is replaced by a
+    // number of a range
+    const char *split_output;
+    // --exact: trim the output to the lines within a range
+    bool exact;
+    // --plan: print a plan of a query instead of extracting it
+    bool plan;
+    // --json-key: search timestamps in a value of this key of JSON lines
+    const char *json_key;
+    // --epoch: lines are started from epoch numbers
+    bool epoch;
+    // --build-index: build an index of all the blocks of --file
+    bool build_index;
+    // --progress: print the progress of an index build
+    bool progress;
+    // --read-ahead: amount of blocks which are read ahead of an extraction
+    int read_ahead;
+    // --io-stats: print read bytes and I/O wait time of every file
+    bool io_stats;
+    // --stream: read a bz2 stream from stdin sequentially
+    bool stream;
+    // --output: a file which is written instead of stdout
+    const char *output;
+    // --grep, --grep-regex, --keyword, --context: write only the matched
+    // lines
+    grep_filter grep;
+    // --bloom, --bloom-fp, --bloom-max-size: build Bloom filters of the
+    // tokens of blocks
+    bool build_bloom;
+    bloom_opts bloom;
+    // --histogram: seconds of the intervals of a summary of line counts and
+    // bytes which is written instead of the lines (0 if it's not set)
+    int histogram;
+    // --lines: numbers (from 1) of the first and the last lines which are
+    // written instead of a time range (0 if it's not set)
+    unsigned long long from_line, to_line;
+    // --bytes: an offset and a length of uncompressed data which is written
+    // instead of a time range (0 bytes if it's not set)
+    unsigned long long byte_offset, n_bytes;
+    // --sample: only every N-th block of a range is uncompressed
+    int sample_blks;
+    // --sample-lines: a reservoir sample of K lines is written
+    int sample_lines;
+    // --tail: the last N lines before --to are written
+    int tail_lines;
+    // --max-skew: seconds by which timestamps of lines can be out of order
+    int max_skew;
+    // --year: the year of the last line of a log without years in timestamps
+    // (0 if it's inferred by the modification time of a file)
+    int last_year;
+    // --serve: a Unix socket on which a daemon serves the files of --file or
+    // --files
+    const char *serve;
+    // --connect: a Unix socket of a daemon which runs a query
+    const char *connect;
+    // --cache-size: megabytes of uncompressed blocks cached by a daemon
+    int cache_size;
+} cmd_opts;
+
+// A block which was uncompressed by a --tail query
+typedef struct
+{
+    unsigned long long blk_pos;
+    decoded_blk_cache data;
+} tail_blk;
 
 // Functions declaration
-void process_opts(int, char *[], const char **, const char **, const char **);
+void process_opts(int, char *[], cmd_opts *);
 void usage(char *);
-long long unsigned search_start_bit_of_bz2_blk(bunzip_data *);
-// converts char string to epoch time (seconds since Jan 1 1970 00:00:00 UTC)
-time_t convert_dt_str_to_epoch(const char *, const char *);
-int uncompress_first_buf_of_blk(unsigned long, bunzip_data *, char *);
-int uncompress_last_2_buffers_of_blk(unsigned long, bunzip_data *, char *);
-const char * get_first_dt_str_from_bz2_blk(unsigned long, int, bunzip_data *,
-                                            char *, const char *);
-const char * get_last_dt_str_from_bz2_blk(unsigned long, int, bunzip_data *,
-                                            char *, const char *);
-bool is_dt_substr_in_str(char *, int, char *, int, const char *);
-unsigned long opt_from_bin_search(off_t, off_t, time_t, bunzip_data *, 
-                                const char *, int, char *, const char *);
-bool is_dt_str_in_obuf(const char *, int , const char *);
-int seek_dt_str_in_blk(unsigned long, bunzip_data *, const char *, bool *);
-int uncompress_blk(unsigned long, bunzip_data *);
-const char * def_dt_fmt(const char *);
-unsigned long long opt_from_first_blk_search(unsigned long long, bunzip_data *,
-                                             const char *);
-long long find_last_blk_pos(bunzip_data *);
-off_t lseek_set(bunzip_data *, off_t);
-char * get_str(char *, int *, char *);
-
+void init_dt_locator(dt_locator *, const cmd_opts *, const char *,
+                     const char *);
+const char * convert_time_ranges(const cmd_opts *, time_range *, int);
+void check_time_range(const cmd_opts *, const time_range *);
+void anchor_time_ranges(const cmd_opts *, time_range *, int, const char *,
+                        time_t);
+bool is_same_dt_fmt(const char *, const char *);
+void print_plan(bz2_archive *, const char *, const time_range *, int);
+void print_json_str(const char *);
+void build_file_index(const cmd_opts *, dt_locator *);
+double estimate_uncompressed_bytes(bz2_archive *, const range_plan *);
+void preallocate_output(bz2_archive *, const time_range *, int);
+void open_output(const char *);
+bool detect_dt_line_cb(const char *, int, void *);
+void print_index_progress(const blk_index_progress *);
+void write_range_histogram(bz2_archive *, const time_range *, int,
+                           const cmd_opts *, off_t *);
+void write_range_sample(bz2_archive *, const time_range *, int,
+                        const cmd_opts *, off_t *);
+void write_file_tail(bz2_archive *, time_t, const cmd_opts *);
+void add_tail_blk(bz2_archive *, unsigned long long, tail_blk **, int *,
+                  int *);
+void detect_file_dt_fmt(const cmd_opts *, dt_locator *);
+void open_indexed_archive(bz2_archive *, const cmd_opts *, const dt_locator *,
+                          const char *);
+void extract_file_lines(const cmd_opts *, const dt_locator *);
+void extract_file_bytes(const cmd_opts *, const dt_locator *);
+void parse_line_range(const char *, cmd_opts *);
+void parse_byte_range(const char *, cmd_opts *);
+void serve_files(const cmd_opts *);
+bool run_daemon_query(const cmd_opts *);
 
 int main(int argc, char *argv[])
 {
-    // Variables declaration:
-    int ifd, status, dt_substr_len;
-    off_t file_size;
-    // options --from, --to, --file
-    const char *opt_f, *opt_to, *opt_input_file;	
-    bunzip_data *bd;
-    // bit position of start of a block where opt_from/opt_to string was found
-    off_t opt_from_pos, opt_to_pos;
-    unsigned long long next_blk_pos;
-    off_t cur_rel_bz2_blk_pos;
-    // last bz2 block position in a file
-    off_t last_blk_pos;
-    // stores the time_t values of opt_f, opt_to strings
-    time_t opt_from_time_t, opt_to_time_t, first_dt_str_in_outbuf_time_t;
-    const char *opt_from_dt_fmt;
-    const char *opt_to_dt_fmt;
+    // command line options
+    cmd_opts opts = {0};
+    // an input bz2 file
+    bz2_archive ar;
+    // timestamp locator of log strings
+    dt_locator loc;
+    // input files of --files
+    file_set set;
+    file_set_opts set_opts;
+    merge_opts m_opts;
+    // amount of time ranges after merge
+    int n_ranges;
     const char *dt_fmt;
-    bool is_dt_str_found = false;
-    // first/last dates in the input file
-    const char *file_first_date, *file_last_date;	
-    // first/last dates converted to time_t
-    time_t file_first_date_time_t, file_last_date_time_t;		
+    // byte from which the search of the next range starts
+    off_t low = 0;
+    blk_writer writer;
+    int out_fd;
+    histogram hist;
+    time_range stream_range;
 
 
     // Process arguments
-    process_opts(argc, argv, &opt_f, &opt_to, &opt_input_file);
+    process_opts(argc, argv, &opts);
+
+    // All the modes write to stdout
+    if (opts.output != NULL)
+        open_output(opts.output);
 
-    // Open an input bz2 file
-    if ((ifd = open(opt_input_file ,O_RDONLY)) < 0)
+    // A daemon serves the queries of its clients till it's killed
+    if (opts.serve != NULL)
     {
-	    //printf("main(), ERROR: open(opt_input_file ,O_RDONLY) < 0\n");
-	    error_print("Can't open the file %s\n%s\n",
-                    opt_input_file, strerror(errno));
-	    exit(EXIT_FAILURE);
+        serve_files(&opts);
+        return 0;
     }
 
-    // Check if the input file is in bzip2 format, prepare bd structure for
-    // work.
-    if (status = start_bunzip(&bd, ifd, 0, 0))
+    if (opts.connect != NULL)
+        return run_daemon_query(&opts) ? 0 : EXIT_FAILURE;
+
+    // An index is built without ranges, a datetime format of a text locator
+    // is detected by the file
+    if (opts.build_index && opts.n_ranges == 0)
     {
-        error_print("start_bunzip() returned: %s\n", bunzip_errors[-status]);
-	    exit(EXIT_FAILURE);
+        init_dt_locator(&loc, &opts, NULL, "");
+        build_file_index(&opts, &loc);
+        return 0;
     }
 
-    // Define datetime formats of --from and --to arguments and check if they
-    // are equal.
-    opt_from_dt_fmt = def_dt_fmt(opt_f);
-    // printf("%s(): opt_f = \"%s\", datetime format = \"%s\"\n",
-    //     __func__, opt_f, opt_from_dt_fmt);
-    opt_to_dt_fmt = def_dt_fmt(opt_to);
-    // printf("%s(): opt_to =   \"%s\", dt format = \"%s\"\n",
-    //  __func__, opt_to, opt_to_dt_fmt);
-    
-    // Check if opt_f datetime format equals to opt_to datetime format
-    if ( strcmp(opt_from_dt_fmt, opt_to_dt_fmt) != 0 ) 
+    // Lines and bytes are found by the stats of an index, its locator is
+    // chosen as for an index build
+    if (opts.from_line > 0 || opts.n_bytes > 0)
     {
-	    error_print("%s\n", "Values of --from and --to were not set in the same"
-            " datetime format");
-        exit(EXIT_FAILURE);
+        init_dt_locator(&loc, &opts, NULL, "");
+        detect_file_dt_fmt(&opts, &loc);
+        if (opts.from_line > 0)
+            extract_file_lines(&opts, &loc);
+        else
+            extract_file_bytes(&opts, &loc);
+        free_grep_filter(&opts.grep);
+        return 0;
     }
-    dt_fmt = opt_from_dt_fmt;
-    //exit(EXIT_SUCCESS
 
-    // Convert opt_f, opt_to strings to epoch time to compare them
-    opt_from_time_t = convert_dt_str_to_epoch(opt_f, dt_fmt);
-    opt_to_time_t = convert_dt_str_to_epoch(opt_to, dt_fmt);
+    // Define datetime formats of all --from and --to values, check if they
+    // are equal and convert them to epoch time
+    dt_fmt = convert_time_ranges(&opts, opts.ranges, opts.n_ranges);
 
-    // Check if opt_f >= opt_to
-    if ( opt_from_time_t >= opt_to_time_t )
+    // Choose a timestamp locator for log strings
+    init_dt_locator(&loc, &opts, dt_fmt, opts.ranges[0].from);
+
+    if (opts.build_index)
     {
-        error_print("%s\n", "Value of --from shouldn't be >= value of --to");
-        exit(EXIT_FAILURE);
+        build_file_index(&opts, &loc);
+        return 0;
     }
 
-    // Determine a length of a datetime substring.
-    dt_substr_len = strlen(opt_f);
-    //printf("dt_substr_len = %d\n", dt_substr_len);
-
-    // first datetime substring which is started from a newline and was found in
-    // an output buffer. +1 for null char.
-    char first_dt_str_in_outbuf[dt_substr_len + 1];     
-    // last datetime substring that was found in the last output buffer 
-    char last_dt_str_in_outbuf[dt_substr_len + 1];
-
-    // Check if opt_f, opt_to are not outside the period, covered by an input
-    // file get the first datetime substring (first_dt_str_in_outbuf) from the 
-    // first block of a file
-
-    file_first_date = get_first_dt_str_from_bz2_blk(FIRST_BLK_POS, dt_substr_len, 
-        bd, first_dt_str_in_outbuf, dt_fmt);
-    debug_print("file_first_date (block %d) is: %s", FIRST_BLK_POS,
-        file_first_date);
-    
-    file_first_date_time_t = convert_dt_str_to_epoch(file_first_date, dt_fmt);
-    //debug_print("file_first_date_time_t = %d", file_first_date_time_t);
-
-    if (opt_from_time_t < file_first_date_time_t) 
-    {
-	    error_print("A value of --from shouldn't be < the first date in the file"
-            	    " (%s)", file_first_date);
-	    exit(EXIT_FAILURE);
-    }
-
-    // get the last datetime value from the last block of a file
-    cur_rel_bz2_blk_pos = find_last_blk_pos(bd);
-    //printf("%s: last block position = %llu\n", 
-    //         __func__, cur_rel_bz2_blk_pos + bd->cur_file_offset * 8);
-    //printf("%s: file_last_date (block %llu) is: %s\n", 
-    //        __func__, cur_rel_bz2_blk_pos, file_first_date);
-    file_last_date = get_last_dt_str_from_bz2_blk(cur_rel_bz2_blk_pos, 
-        dt_substr_len, bd, last_dt_str_in_outbuf, dt_fmt);
-    last_blk_pos = bd->cur_file_offset * 8 + cur_rel_bz2_blk_pos;
-    debug_print("file_last_date (block %llu) is: %s\n",
-                 last_blk_pos, file_last_date);
-    file_last_date_time_t = convert_dt_str_to_epoch(file_last_date, dt_fmt);
-    //printf("%s(): file_last_date_time_t = %d\n", __func__, file_last_date_time_t);
-
-    if (opt_to_time_t > file_last_date_time_t)
-    {
-	    error_print("A value of --to shouldn't be > the last date in the file (%s)",
-                    file_last_date);
-        exit(EXIT_FAILURE);
-    }
+    // A bz2 stream of stdin is filtered in one pass
+    // The blocks of a stream are chosen by a range widened by --max-skew
+    if (opts.stream)
+    {
+        // Values without a year are in the last year till now, timestamps
+        // of lines are in the year around the range
+        if (is_dt_fmt_without_year(dt_fmt))
+        {
+            anchor_time_ranges(&opts, opts.ranges, opts.n_ranges, dt_fmt,
+                               time(NULL));
+            set_dt_year_window(&loc, opts.ranges[0].from_time_t);
+        }
 
-    // Define a file size 
-    file_size = lseek(bd->in_fd, 0, SEEK_END);
-    
-    //printf("%s(): lseek position BEFORE opt_from_bin_search = %lu\n",
-    //        __func__, lseek(bd->in_fd, 0, SEEK_CUR ));
+        stream_range = opts.ranges[0];
+        stream_range.from_time_t -= opts.max_skew;
+        stream_range.to_time_t += opts.max_skew;
+    }
 
-    // Search a block where opt_f is located
-    opt_from_pos = opt_from_bin_search(0, file_size, opt_from_time_t, bd, opt_f,
-        dt_substr_len, first_dt_str_in_outbuf, dt_fmt);
-                                       
-    debug_print("opt_from_pos = %llu", opt_from_pos);
-    debug_print("bd->cur_file_offset = %llu", bd->cur_file_offset);
-    //debug_print("lseek position AFTER opt_from_bin_search = %lu", 
-    //             lseek(bd->in_fd, 0, SEEK_CUR ));
+    if (opts.stream && opts.histogram > 0)
+    {
+        init_histogram(&hist, opts.ranges[0].from_time_t,
+                       opts.ranges[0].to_time_t, opts.histogram);
+        init_blk_line_writer(&writer, &loc, opts.ranges[0].from_time_t,
+                             opts.ranges[0].to_time_t, add_histogram_line,
+                             &hist);
+        writer.max_skew = opts.max_skew;
+        if (opts.grep.n_patterns > 0)
+            set_blk_writer_grep(&writer, &opts.grep);
+        extract_stream(0, &loc, &stream_range, &writer);
+        blk_writer_flush(&writer);
+        free_blk_writer(&writer);
+
+        write_histogram(1, &hist, loc.dt_fmt);
+        free_histogram(&hist);
+
+        return 0;
+    }
 
-    if (opt_from_pos + bd->cur_file_offset * 8 != FIRST_BLK_POS)
+    if (opts.stream)
     {
-        // Search for the very first block where opt_f is located
-        opt_from_pos = opt_from_first_blk_search(opt_from_pos, bd, opt_f);
-        //debug_print("The very first opt_from_pos = %llu", 
-        //    bd->cur_file_offset * 8 + opt_from_pos);
-        //printf("opt_from_pos + bd->cur_file_offset * 8 = %lu\n",
-        //        opt_from_pos + bd->cur_file_offset * 8);
+        init_blk_writer(&writer, 1, &loc, opts.exact,
+                        opts.ranges[0].from_time_t, opts.ranges[0].to_time_t);
+        writer.max_skew = opts.max_skew;
+        if (opts.grep.n_patterns > 0)
+            set_blk_writer_grep(&writer, &opts.grep);
+        extract_stream(0, &loc, &stream_range, &writer);
+        blk_writer_flush(&writer);
+        free_blk_writer(&writer);
+
+        if (!opts.exact && opts.grep.n_patterns == 0)
+            write_all(1, "\n", 1);
+
+        return 0;
     }
 
-    // Save current relative position
-    cur_rel_bz2_blk_pos = opt_from_pos;
+    // Open input files, find their first and last dates
+    if (opts.input_files != NULL)
+    {
+        read_file_set(&set, opts.input_files, &loc);
+    }
+    else
+    {
+        open_archive(&ar, opts.input_file, &loc);
+        ar.read_ahead = opts.read_ahead;
+        ar.io_stats = opts.io_stats;
+        ar.max_skew = opts.max_skew;
+    }
 
-    //exit(EXIT_SUCCESS);
+    // Values without a year get the years of the lines of input files
+    if (is_dt_fmt_without_year(dt_fmt))
+        anchor_time_ranges(&opts, opts.ranges, opts.n_ranges, dt_fmt,
+                           opts.input_files != NULL ?
+                           get_file_set_last_date(&set) : ar.last_date_time_t);
 
-    // Set first_dt_str_in_outbuf_time_t of the first bz2 block, where opt_f
-    // was found, to opt_from_time_t 
-    first_dt_str_in_outbuf_time_t = opt_from_time_t;
+    // Extract overlapping ranges only once and in the order of a file
+    n_ranges = merge_time_ranges(opts.ranges, opts.n_ranges);
 
-    // Uncompress the first block, where opt_f was found, and all the next
-    // blocks till the last one where first found datetime string = opt_to
-    while (first_dt_str_in_outbuf_time_t <= opt_to_time_t) {
-        // Uncompress a block
-#if !DEBUG
-	    uncompress_blk(cur_rel_bz2_blk_pos, bd);
-#endif
-        debug_print("block %llu\n", bd->cur_file_offset * 8 + 
-            cur_rel_bz2_blk_pos);
+    // A set of rotated files. Ranges are clamped to the files instead of
+    // the check of the file's dates.
+    if (opts.input_files != NULL)
+    {
+        // Every file is a source of lines (e.g. archives of several hosts)
+        if (opts.merge)
+        {
+            m_opts.source_prefix = opts.source_prefix;
+            m_opts.split_output = opts.split_output;
+            m_opts.read_ahead = opts.read_ahead;
+            m_opts.io_stats = opts.io_stats;
+            m_opts.grep = opts.grep.n_patterns > 0 ? &opts.grep : NULL;
+            m_opts.max_skew = opts.max_skew;
+            merge_file_set(&set, &loc, opts.ranges, n_ranges, &m_opts);
+            free_file_set(&set);
+            return 0;
+        }
 
-        // If an ucompressed block is the last one, then break a cycle
-        if (bd->cur_file_offset * 8 + cur_rel_bz2_blk_pos == last_blk_pos)
-            goto the_end;
+        set_opts.exact = opts.exact;
+        set_opts.split_output = opts.split_output;
+        set_opts.n_threads = opts.n_threads;
+        set_opts.read_ahead = opts.read_ahead;
+        set_opts.io_stats = opts.io_stats;
+        set_opts.grep = opts.grep.n_patterns > 0 ? &opts.grep : NULL;
+        set_opts.max_skew = opts.max_skew;
+        extract_file_set(&set, &loc, opts.ranges, n_ranges, &set_opts);
+        free_file_set(&set);
+        return 0;
+    }
 
-        // Move file offset to the byte where current bz2 block was found + 1 
-        // (i.e. next block)
-	    bd->cur_file_offset = lseek_set(bd, bd->cur_file_offset +
-            cur_rel_bz2_blk_pos / 8 + 1);
+    // The lines before --to can be searched from the end of a file
+    if (opts.tail_lines > 0)
+    {
+        if (opts.ranges[0].to_time_t < ar.first_date_time_t)
+        {
+            error_print("A value of --to shouldn't be < the first date in the "
+                        "file (%s)", ar.first_date);
+            exit(EXIT_FAILURE);
+        }
 
-        // Search bit position of the next block
-	    cur_rel_bz2_blk_pos = search_start_bit_of_bz2_blk(bd);
-	    //printf("main(): next block position = %llu, bd->cur_file_offset = %llu\n",
-        //        cur_rel_bz2_blk_pos, bd->cur_file_offset);
+        write_file_tail(&ar, opts.ranges[0].to_time_t, &opts);
+        close_archive(&ar);
+        free_grep_filter(&opts.grep);
+        return 0;
+    }
 
-        // Uncompress the block and find the first datetime sting there
-	    get_first_dt_str_from_bz2_blk(cur_rel_bz2_blk_pos, dt_substr_len, bd,
-                                      first_dt_str_in_outbuf, dt_fmt);
-	    //printf("main(): first_dt_str_in_outbuf in the block %llu = %s\n", 
-        //  bd->cur_file_offset * 8 + cur_rel_bz2_blk_pos, first_dt_str_in_outbuf);
+    // Check if ranges are not outside the period, covered by an input file
+    for (int i = 0; i < n_ranges; i++)
+    {
+        if (opts.ranges[i].from_time_t < ar.first_date_time_t) 
+        {
+	        error_print("A value of --from shouldn't be < the first date in the"
+                        " file (%s)", ar.first_date);
+	        exit(EXIT_FAILURE);
+        }
 
-        // Convert previously found diatetime string into epoch time format
-	    first_dt_str_in_outbuf_time_t = 
-            convert_dt_str_to_epoch(first_dt_str_in_outbuf, dt_fmt);
-	    // printf("main(): first_dt_str_in_outbuf_time_t = %d\n",
-        //  first_dt_str_in_outbuf_time_t);
+        if (opts.ranges[i].to_time_t > ar.last_date_time_t)
+        {
+	        error_print("A value of --to shouldn't be > the last date in the "
+                        "file (%s)", ar.last_date);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    // Check if opt_to exists in a whole block
-    status = seek_dt_str_in_blk(cur_rel_bz2_blk_pos, bd, opt_to, &is_dt_str_found);
-    if (status) 
+    // Only report which blocks would be extracted
+    if (opts.plan)
     {
-	    error_print("seek_dt_str_in_blk() returned %s", bunzip_errors[-status]);
-	    exit(EXIT_FAILURE);
+        print_plan(&ar, opts.input_file, opts.ranges, n_ranges);
+        close_archive(&ar);
+        return 0;
     }
 
-    //printf("%s(): is_dt_str_found = %d\n", __func__, is_dt_str_found);
+    // Ranges share a boundary block only in a multi-range query
+    ar.decoded_cache.enabled = n_ranges > 1;
+
+    // The blocks of a plan are found by the same probes as the extraction,
+    // they are cached. The size of filtered lines is unknown.
+    if (opts.output != NULL && opts.grep.n_patterns == 0 &&
+        opts.histogram == 0 && opts.sample_blks == 0 &&
+        opts.sample_lines == 0)
+        preallocate_output(&ar, opts.ranges, n_ranges);
 
-    // Find the last block where opt_to exists
-    while (is_dt_str_found) 
+    for (int i = 0; i < n_ranges; i++)
     {
-        debug_print("opt_to value %s was found in the block %llu", 
-                    opt_to, cur_rel_bz2_blk_pos + bd->cur_file_offset * 8);
-	    bd->cur_file_offset = lseek(bd->in_fd, bd->cur_file_offset + 
-            cur_rel_bz2_blk_pos / 8 + 1, SEEK_SET);
-	    cur_rel_bz2_blk_pos = search_start_bit_of_bz2_blk(bd);
-	    seek_dt_str_in_blk(cur_rel_bz2_blk_pos, bd, opt_to, &is_dt_str_found);
-    }
+        if (opts.split_output != NULL)
+        {
+            out_fd = open_range_output(opts.split_output, i + 1);
+        }
+        else
+        {
+            out_fd = 1;
+            if (n_ranges > 1)
+                write_range_header(out_fd, &opts.ranges[i]);
+        }
 
-    //printf("main(): opt_to value was not found in the block %llu\n", cur_rel_bz2_blk_pos + bd->cur_file_offset * 8);
+        if (opts.histogram > 0)
+        {
+            write_range_histogram(&ar, &opts.ranges[i], out_fd, &opts, &low);
+            continue;
+        }
 
-the_end:
+        if (opts.sample_blks > 0 || opts.sample_lines > 0)
+        {
+            write_range_sample(&ar, &opts.ranges[i], out_fd, &opts, &low);
+            if (out_fd != 1)
+                close(out_fd);
+            continue;
+        }
 
-    // Print a newline at the end
-    printf("\n");
+        init_blk_writer(&writer, out_fd, &ar.loc, opts.exact,
+                        opts.ranges[i].from_time_t, opts.ranges[i].to_time_t);
+        if (opts.grep.n_patterns > 0)
+            set_blk_writer_grep(&writer, &opts.grep);
+
+        extract_range(&ar, &opts.ranges[i], &writer, &low);
+
+        blk_writer_flush(&writer);
+        free_blk_writer(&writer);
+
+        // Whole blocks are ended not by a newline, so print a newline at the
+        // end
+        if (!opts.exact && opts.grep.n_patterns == 0)
+            write_all(out_fd, "\n", 1);
+
+        if (out_fd != 1)
+            close(out_fd);
+    }
+
+    close_archive(&ar);
+    free_grep_filter(&opts.grep);
 
     return 0;
 }
 
 
-void process_opts(int argc, char *argv[], const char **opt_f,
-                    const char **opt_to, const char **opt_input_file)
+void process_opts(int argc, char *argv[], cmd_opts *opts)
 {
     int getopt_res;
     struct opt {
         bool is_set;    // was option set?
         char *name;     // option name
     };
-    
+    // values of repeated --from and --to options in the order they were set
+    const char *froms[argc], *tos[argc];
+    int n_froms = 0, n_tos = 0;
+
     const struct option long_options[] = {
-        {"from",   required_argument,  NULL,   'b'},
-        {"to",     required_argument,  NULL,   'e'},
-        {"file",   required_argument,  NULL,   'f'},
-        {NULL,     0,                  NULL,   0  }
+        {"from",         required_argument,  NULL,   'b'},
+        {"to",           required_argument,  NULL,   'e'},
+        {"file",         required_argument,  NULL,   'f'},
+        {"files",        required_argument,  NULL,   'F'},
+        {"threads",      required_argument,  NULL,   't'},
+        {"merge",        no_argument,        NULL,   'm'},
+        {"source-prefix", no_argument,       NULL,   'P'},
+        {"ranges-file",  required_argument,  NULL,   'r'},
+        {"split-output", required_argument,  NULL,   'o'},
+        {"exact",        no_argument,        NULL,   'x'},
+        {"plan",         no_argument,        NULL,   'p'},
+        {"json-key",     required_argument,  NULL,   'j'},
+        {"epoch",        no_argument,        NULL,   'E'},
+        {"build-index",  no_argument,        NULL,   'I'},
+        {"progress",     no_argument,        NULL,   'G'},
+        {"read-ahead",   required_argument,  NULL,   'A'},
+        {"io-stats",     no_argument,        NULL,   'S'},
+        {"stream",       no_argument,        NULL,   'R'},
+        {"output",       required_argument,  NULL,   'O'},
+        {"grep",         required_argument,  NULL,   'g'},
+        {"grep-regex",   required_argument,  NULL,   'X'},
+        {"context",      required_argument,  NULL,   'C'},
+        {"keyword",      required_argument,  NULL,   'k'},
+        {"bloom",        optional_argument,  NULL,   'B'},
+        {"bloom-fp",     required_argument,  NULL,   'y'},
+        {"bloom-max-size", required_argument, NULL,  'z'},
+        {"histogram",    required_argument,  NULL,   'H'},
+        {"lines",        required_argument,  NULL,   'L'},
+        {"bytes",        required_argument,  NULL,   'Y'},
+        {"sample",       required_argument,  NULL,   'N'},
+        {"sample-lines", required_argument,  NULL,   'K'},
+        {"tail",         required_argument,  NULL,   'T'},
+        {"max-skew",     required_argument,  NULL,   'W'},
+        {"year",         required_argument,  NULL,   'Z'},
+        {"serve",        required_argument,  NULL,   'V'},
+        {"connect",      required_argument,  NULL,   'Q'},
+        {"cache-size",   required_argument,  NULL,   'M'},
+        {NULL,           0,                  NULL,   0  }
     };
 
-    struct opt mandat_opts[] = { 
+    struct opt mandat_opts[] = {
         {false, ""      },
         {false, "--from"},
         {false, "--to"  },
-        {false, "--file"} 
+        {false, "--file or --files"}
     };
 
+    opts->read_ahead = DEF_READ_AHEAD;
+    opts->bloom.tokens = BLOOM_TOKEN_ALL;
+    opts->bloom.fp_rate = DEF_BLOOM_FP_RATE;
+    opts->bloom.max_size = DEF_BLOOM_MAX_SIZE;
+    opts->cache_size = DEF_DAEMON_CACHE_SIZE;
+
     // Parse the options and assign its values to variables
     while ((getopt_res = getopt_long(argc, argv, "", long_options, NULL)) != -1)
     {
@@ -326,1122 +513,1209 @@ void process_opts(int argc, char *argv[], const char **opt_f,
         switch (getopt_res)
 	    {
             case 'b':
-                *opt_f = optarg;
+                froms[n_froms++] = optarg;
                 mandat_opts[1].is_set = true;
                 break;
             case 'e':
-                *opt_to = optarg;
+                tos[n_tos++] = optarg;
                 mandat_opts[2].is_set = true;
 		        break;
             case 'f':
-                *opt_input_file = optarg;
+                opts->input_file = optarg;
+                mandat_opts[3].is_set = true;
+                break;
+            case 'F':
+                opts->input_files = optarg;
                 mandat_opts[3].is_set = true;
                 break;
+            case 't':
+                if ((opts->n_threads = atoi(optarg)) < 1)
+                {
+                    error_print("%s", "A value of --threads should be > 0");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                opts->ranges_file = optarg;
+                break;
+            case 'o':
+                opts->split_output = optarg;
+                break;
+            case 'x':
+                opts->exact = true;
+                break;
+            case 'm':
+                opts->merge = true;
+                break;
+            case 'P':
+                opts->source_prefix = true;
+                break;
+            case 'p':
+                opts->plan = true;
+                break;
+            case 'j':
+                opts->json_key = optarg;
+                break;
+            case 'E':
+                opts->epoch = true;
+                break;
+            case 'I':
+                opts->build_index = true;
+                break;
+            case 'G':
+                opts->progress = true;
+                break;
+            case 'A':
+                if ((opts->read_ahead = atoi(optarg)) < 0)
+                {
+                    error_print("%s", "A value of --read-ahead should be >= 0");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'S':
+                opts->io_stats = true;
+                break;
+            case 'R':
+                opts->stream = true;
+                mandat_opts[3].is_set = true;
+                break;
+            case 'O':
+                opts->output = optarg;
+                break;
+            case 'g':
+                add_grep_pattern(&opts->grep, optarg, GREP_LITERAL);
+                break;
+            case 'X':
+                add_grep_pattern(&opts->grep, optarg, GREP_REGEX);
+                break;
+            case 'k':
+                add_grep_pattern(&opts->grep, optarg, GREP_KEYWORD);
+                break;
+            case 'B':
+                opts->build_bloom = true;
+                if (optarg != NULL &&
+                    (opts->bloom.tokens = parse_bloom_tokens(optarg)) == 0)
+                {
+                    error_print("%s", "A value of --bloom should be a list of "
+                                "uuid, num, word");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'y':
+                opts->bloom.fp_rate = atof(optarg);
+                if (opts->bloom.fp_rate <= 0 || opts->bloom.fp_rate >= 1)
+                {
+                    error_print("%s", "A value of --bloom-fp should be > 0 and "
+                                "< 1");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'z':
+                if ((opts->bloom.max_size = atoi(optarg)) < 8)
+                {
+                    error_print("%s", "A value of --bloom-max-size should be "
+                                ">= 8");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'H':
+                if ((opts->histogram = parse_histogram_interval(optarg)) == 0)
+                {
+                    error_print("%s", "A value of --histogram should be a "
+                                "number of seconds with an optional unit s, "
+                                "m, h or d (e.g. 1m)");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L':
+                parse_line_range(optarg, opts);
+                break;
+            case 'Y':
+                parse_byte_range(optarg, opts);
+                break;
+            case 'N':
+                if ((opts->sample_blks = atoi(optarg)) < 1)
+                {
+                    error_print("%s", "A value of --sample should be > 0");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'K':
+                if ((opts->sample_lines = atoi(optarg)) < 1)
+                {
+                    error_print("%s", "A value of --sample-lines should be > 0");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'W':
+                if ((opts->max_skew = atoi(optarg)) < 0)
+                {
+                    error_print("%s", "A value of --max-skew should be >= 0");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'Z':
+                if ((opts->last_year = atoi(optarg)) < 1970)
+                {
+                    error_print("%s", "A value of --year should be >= 1970");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'V':
+                opts->serve = optarg;
+                break;
+            case 'Q':
+                opts->connect = optarg;
+                break;
+            case 'M':
+                if ((opts->cache_size = atoi(optarg)) < 1)
+                {
+                    error_print("%s", "A value of --cache-size should be > 0");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'T':
+                if ((opts->tail_lines = atoi(optarg)) < 1)
+                {
+                    error_print("%s", "A value of --tail should be > 0");
+                    exit(EXIT_FAILURE);
+                }
+                mandat_opts[1].is_set = true;
+                break;
+            case 'C':
+                if ((opts->grep.context = atoi(optarg)) < 0)
+                {
+                    error_print("%s", "A value of --context should be >= 0");
+                    exit(EXIT_FAILURE);
+                }
+                break;
             default: /* '?' */
 		        usage(argv[0]);
                 exit(EXIT_FAILURE);
         }
     }
 
+    // Ranges can be set by a ranges file instead of --from/--to. An index is
+    // built without ranges, --lines doesn't need them, the ranges of a daemon
+    // are set by its clients.
+    if (opts->ranges_file != NULL || opts->build_index || opts->from_line > 0 ||
+        opts->n_bytes > 0 || opts->serve != NULL)
+        mandat_opts[1].is_set = mandat_opts[2].is_set = true;
+
     for (int i = 1; i <= 3; i++)
     {
-        if (mandat_opts[i].is_set == false) 
+        if (mandat_opts[i].is_set == false)
         {
             error_print("missing %s option", mandat_opts[i].name);
             usage(argv[0]);
             exit(EXIT_FAILURE);
         }
     }
-    
-}
 
+    if (opts->input_file != NULL && opts->input_files != NULL)
+    {
+        error_print("%s", "--file and --files can't be used together");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
 
-long long find_last_blk_pos(bunzip_data *bd)
-{
-    long long last_blk_pos = 0;
-    int backward_offset_step = 512;
-    int backward_offset;
+    if (opts->merge && opts->input_files == NULL)
+    {
+        error_print("%s", "--merge requires --files");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
 
-    // searching for the last bz2 block from file's end by backward_offset  
-    for (backward_offset = backward_offset_step; last_blk_pos == 0;
-        backward_offset += backward_offset_step)
+    if (opts->input_files != NULL && opts->plan)
     {
-        bd->cur_file_offset = lseek(bd->in_fd, -backward_offset, SEEK_END);
-        // search for the block
-        last_blk_pos = search_start_bit_of_bz2_blk(bd);
-        //debuf_print("last block position = %llu\n", 
-        //    last_blk_pos + bd->cur_file_offset * 8);
+        error_print("%s", "--plan isn't supported with --files");
+        exit(EXIT_FAILURE);
     }
 
-    return last_blk_pos;
-}
+    if (opts->build_index && opts->input_file == NULL && opts->serve == NULL)
+    {
+        error_print("%s", "--build-index requires --file");
+        exit(EXIT_FAILURE);
+    }
 
+    if (opts->build_bloom && !opts->build_index)
+    {
+        error_print("%s", "--bloom requires --build-index");
+        exit(EXIT_FAILURE);
+    }
 
-unsigned long long opt_from_first_blk_search(unsigned long long opt_from_pos, 
-                                             bunzip_data        *bd,
-                                             const char         *opt_f)
-{
-    long long prev_rel_bz2_blk_pos, cur_rel_bz2_blk_pos;
-    long long prev_abs_bz2_blk_pos, cur_abs_bz2_blk_pos;
-    long long backward_offset_step, abs_backward_offset_B;
-    int status;
-    bool is_dt_str_found = true;
-    long prev_file_offset;
+    if (opts->stream && (opts->input_file != NULL ||
+                         opts->input_files != NULL || opts->plan ||
+                         opts->build_index || opts->split_output != NULL))
+    {
+        error_print("%s", "--stream can't be used with --file, --files, "
+                    "--plan, --build-index or --split-output");
+        exit(EXIT_FAILURE);
+    }
 
+    // All the CPUs by default
+    if (opts->n_threads == 0 &&
+        (opts->n_threads = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+        opts->n_threads = 1;
 
-    backward_offset_step = 0;
-    cur_rel_bz2_blk_pos = prev_rel_bz2_blk_pos = opt_from_pos;
-    cur_abs_bz2_blk_pos = prev_abs_bz2_blk_pos = bd->cur_file_offset * 8 + opt_from_pos;
+    // The only range of --tail ends at --to
+    if (opts->tail_lines > 0)
+    {
+        if (n_froms > 0 || n_tos != 1 || opts->ranges_file != NULL)
+        {
+            error_print("%s", "--tail requires one --to and can't be used with "
+                        "--from or --ranges-file");
+            exit(EXIT_FAILURE);
+        }
+        froms[n_froms++] = tos[0];
+    }
 
-    //printf("opt_from_first_blk_search(): current file offset start of a function = %llu\n", lseek(bd->in_fd, 0, SEEK_CUR));
+    if (n_froms != n_tos)
+    {
+        error_print("%s", "Every --from option should have a pair --to option");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n_froms; i++)
+        add_time_range(&opts->ranges, &opts->n_ranges, froms[i], tos[i]);
+
+    if (opts->ranges_file != NULL)
+        read_ranges_file(opts->ranges_file, &opts->ranges, &opts->n_ranges);
+
+    if (opts->n_ranges == 0 && !opts->build_index && opts->from_line == 0 &&
+        opts->n_bytes == 0 && opts->serve == NULL)
+    {
+        error_print("The ranges file %s has no time ranges", opts->ranges_file);
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts->json_key != NULL && opts->epoch)
+    {
+        error_print("%s", "--json-key and --epoch can't be used together");
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts->output != NULL && (opts->split_output != NULL || opts->plan ||
+                                 opts->build_index))
+    {
+        error_print("%s", "--output can't be used with --split-output, --plan "
+                    "or --build-index");
+        exit(EXIT_FAILURE);
+    }
 
-    //printf("opt_from_first_blk_search(lseek(INFO)): %llu B\n", lseek(bd->in_fd, 0, SEEK_SET));
+    // A stream is read once
+    if (opts->stream && opts->n_ranges > 1)
+    {
+        error_print("%s", "--stream supports only one time range");
+        exit(EXIT_FAILURE);
+    }
 
-// Search for the previous block
-// Set file offset BUFFER_SIZE bytes backward
-    while (is_dt_str_found == true)
+    if (opts->grep.context > 0 && opts->grep.n_patterns == 0)
     {
-        // Preserve cur_file_offset for prev_rel_bz2_blk_pos
-        prev_file_offset = bd->cur_file_offset;
+        error_print("%s", "--context requires --grep, --grep-regex or "
+                    "--keyword");
+        exit(EXIT_FAILURE);
+    }
 
-	// Loop to find the previous block. 
-        while (cur_abs_bz2_blk_pos == prev_abs_bz2_blk_pos)
+    for (int i = 0; i < opts->grep.n_patterns; i++)
+    {
+        if (opts->grep.patterns[i].len == 0)
         {
-            if ((bd->cur_file_offset - BUFFER_SIZE) <= 0) 
-            {
-		        bd->cur_file_offset = lseek(bd->in_fd, 4, SEEK_SET);
-	        }
-	        else 
-            {
-                // Set file position to -BUFFER_SIZE byte
-                bd->cur_file_offset = lseek(bd->in_fd, -BUFFER_SIZE, SEEK_CUR);
-	        }
-
-	        //printf("%s: lseek offset = %lld\n", __func__, bd->cur_file_offset);
-            if (bd->cur_file_offset == -1) 
-            {
-                error_print("bd->cur_file_offset = lseek(bd->in_fd,"
-                            " -BUFFER_SIZE, SEEK_CUR) = %lu",
-                            bd->cur_file_offset);
-                exit(EXIT_FAILURE);
-            }
-            //printf("opt_from_first_blk_search(): lseek(bd->in_fd, -%d, SEEK_CUR) = %llu\n", BUFFER_SIZE, bd->cur_file_offset);
-
-        // Searching for the block starting from the abs_backward_offset_B byte
-            cur_rel_bz2_blk_pos = search_start_bit_of_bz2_blk(bd);
-	    // Convert found block position into absolute value
-            cur_abs_bz2_blk_pos = bd->cur_file_offset * 8 + cur_rel_bz2_blk_pos;
-
-	    //printf("search_start_bit_of_bz2_blk(): cur_rel_bz2_blk_pos %lli, prev_rel_bz2_blk_pos %lli\n\n", cur_rel_bz2_blk_pos, prev_rel_bz2_blk_pos);
-	    //printf("opt_from_first_blk_search(): current file offset = %llu\n", lseek(bd->in_fd, 0, SEEK_CUR));
-        //printf("opt_from_first_blk_search: cur_abs_bz2_blk_pos = %lli b, prev_abs_bz2_blk_pos = %lli b\n",\
-			                                                  cur_abs_bz2_blk_pos, prev_abs_bz2_blk_pos);
-	    //printf("%s: prev_file_offset = %lu\n", __func__, prev_file_offset);
+            error_print("%s", "A pattern of --grep/--grep-regex/--keyword "
+                        "can't be empty");
+            exit(EXIT_FAILURE);
         }
+    }
 
-        // Check if opt_f exists in the current block
-        status = seek_dt_str_in_blk(cur_rel_bz2_blk_pos, bd, opt_f, &is_dt_str_found);
-        if (status)
+    if (opts->from_line > 0 && (n_froms > 0 || opts->ranges_file != NULL ||
+                                opts->input_file == NULL || opts->plan ||
+                                opts->build_index ||
+                                opts->split_output != NULL ||
+                                opts->histogram > 0))
+    {
+        error_print("%s", "--lines requires --file and can't be used with "
+                    "--from/--to, --ranges-file, --plan, --build-index, "
+                    "--split-output or --histogram");
+        exit(EXIT_FAILURE);
+    }
+
+    // Bytes are written as is
+    if (opts->n_bytes > 0 && (n_froms > 0 || opts->ranges_file != NULL ||
+                              opts->input_file == NULL || opts->plan ||
+                              opts->build_index ||
+                              opts->split_output != NULL ||
+                              opts->histogram > 0 || opts->from_line > 0 ||
+                              opts->exact || opts->grep.n_patterns > 0))
+    {
+        error_print("%s", "--bytes requires --file and can't be used with "
+                    "--from/--to, --ranges-file, --plan, --build-index, "
+                    "--split-output, --histogram, --lines, --exact or --grep");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts->tail_lines > 0 &&
+        (opts->input_file == NULL || opts->plan || opts->build_index ||
+         opts->split_output != NULL || opts->histogram > 0 ||
+         opts->sample_blks > 0 || opts->sample_lines > 0 ||
+         opts->from_line > 0 || opts->n_bytes > 0 || opts->grep.context > 0))
+    {
+        error_print("%s", "--tail requires --file and can't be used with "
+                    "--plan, --build-index, --split-output, --histogram, "
+                    "--sample, --sample-lines, --lines, --bytes or --context");
+        exit(EXIT_FAILURE);
+    }
+
+    if ((opts->sample_blks > 0 || opts->sample_lines > 0) &&
+        (opts->input_files != NULL || opts->stream || opts->plan ||
+         opts->build_index || opts->histogram > 0 || opts->from_line > 0 ||
+         opts->n_bytes > 0 || opts->grep.context > 0))
+    {
+        error_print("%s", "--sample and --sample-lines can't be used with "
+                    "--files, --stream, --plan, --build-index, --histogram, "
+                    "--lines, --bytes or --context");
+        exit(EXIT_FAILURE);
+    }
+
+    if (opts->histogram > 0 && (opts->input_files != NULL || opts->plan ||
+                                opts->build_index ||
+                                opts->split_output != NULL ||
+                                opts->grep.context > 0))
+    {
+        error_print("%s", "--histogram can't be used with --files, --plan, "
+                    "--build-index, --split-output or --context");
+        exit(EXIT_FAILURE);
+    }
+
+    // A daemon opens the files and builds the missing indexes, the rest of
+    // the options are set by the queries of clients
+    if (opts->serve != NULL &&
+        (n_froms > 0 || opts->ranges_file != NULL || opts->connect != NULL ||
+         opts->stream || opts->merge || opts->plan || opts->output != NULL ||
+         opts->split_output != NULL || opts->exact ||
+         opts->grep.n_patterns > 0 || opts->histogram > 0 ||
+         opts->from_line > 0 || opts->n_bytes > 0 || opts->sample_blks > 0 ||
+         opts->sample_lines > 0 || opts->max_skew > 0))
+    {
+        error_print("%s", "--serve can be used only with --file or --files, "
+                    "--threads, --build-index, --cache-size, --json-key, "
+                    "--epoch, --year and --read-ahead");
+        exit(EXIT_FAILURE);
+    }
+
+    // --file of a query is a file of a daemon, its lines are always exact
+    if (opts->connect != NULL &&
+        (opts->input_file == NULL || opts->n_ranges != 1 || opts->plan ||
+         opts->build_index || opts->split_output != NULL ||
+         opts->from_line > 0 || opts->n_bytes > 0 || opts->sample_blks > 0 ||
+         opts->sample_lines > 0 || opts->tail_lines > 0 ||
+         opts->grep.context > 0))
+    {
+        error_print("%s", "--connect requires --file and one range and can't "
+                    "be used with --files, --stream, --plan, --build-index, "
+                    "--split-output, --lines, --bytes, --sample, "
+                    "--sample-lines, --tail or --context");
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; opts->connect != NULL && i < opts->grep.n_patterns; i++)
+    {
+        if (opts->grep.patterns[i].type != GREP_LITERAL)
         {
-            error_print("seek_dt_str_in_blk(ERROR): %s", bunzip_errors[-status]);
+            error_print("%s", "--connect supports only --grep patterns");
             exit(EXIT_FAILURE);
         }
-	    
-        lseek_set(bd, bd->cur_file_offset);
-
-        // If opt_f is found in current block then save it in prev_abs_bz2_blk_pos and search for the previous block
-	    if (is_dt_str_found == true)
-	    {
-            prev_abs_bz2_blk_pos = cur_abs_bz2_blk_pos;
-	        prev_rel_bz2_blk_pos = cur_rel_bz2_blk_pos;
-
-	        // If current block is the first block (located in FIRST_BLOCK_POSnd bit) then stop searching for a previous block
-	        debug_print("cur_abs_bz2_blk_pos = %lu", cur_abs_bz2_blk_pos);
-	        if (cur_abs_bz2_blk_pos == FIRST_BLK_POS)
-            {
-                prev_file_offset = 4;
-                break;
-	        }
-	    }
     }
-    //printf("opt_from_first_blk_search: cur_rel_bz2_blk_pos = %lli b, prev_rel_bz2_blk_pos = %lli\n", cur_rel_bz2_blk_pos, prev_rel_bz2_blk_pos);
-    //printf("opt_from_first_blk_search: cur_abs_bz2_blk_pos = %lli b, prev_abs_bz2_blk_pos = %lli\n", cur_abs_bz2_blk_pos, prev_abs_bz2_blk_pos);
 
-    bd->cur_file_offset = lseek(bd->in_fd, prev_file_offset, SEEK_SET);
-    //printf("opt_from_first_blk_search(INFO): return %lli cur_file_offset = %lli\n", prev_rel_bz2_blk_pos, bd->cur_file_offset);
-    return prev_rel_bz2_blk_pos;
 }
 
 
-const char * def_dt_fmt(const char * dt_str)
+// Initializes a timestamp locator chosen by command line options. dt_fmt is
+// the datetime format of --from/--to values (NULL if they are epoch numbers),
+// dt_str is one of these values.
+void init_dt_locator(dt_locator *loc, const cmd_opts *opts, const char *dt_fmt,
+                     const char *dt_str)
 {
-    struct tm dt_tm = {0};
-    short dt_fmts_arr_size;
-
-    //printf("%s(): dt_str = %s\n", __func__, dt_str);
-
-// Define a datetime format
-    // 1. know an amount of supported dt formats (amount of elements
-    // in DATETIME_FORMATS[])
-    dt_fmts_arr_size = sizeof(DATETIME_FORMATS) / sizeof(DATETIME_FORMATS[0]);
-    //printf("DATETIME_FORMATS size = %d\n", dt_fmts_arr_size);
-    
-    // 2. check if opt_f, opt_to strings correspond to one of supported
-    // datetime formats
-    for (int i = 0; i < dt_fmts_arr_size; i++)
-    {
-        if (strptime(dt_str, DATETIME_FORMATS[i], &dt_tm) != NULL)
-            return DATETIME_FORMATS[i];
-	}
-
-// A given dt_sting doesn't correspond to one of supported dt formats. Error.
-    error_print("%s", "The value of --from or --to arguments was set in "
-		        "unsupported datetime format.\n"
-	            "Supported datetime formats are:");
-    for (short i = 0; i < dt_fmts_arr_size; i++)
-        printf("\t%s\n", DATETIME_FORMATS[i]);
-    printf("\n");
-    exit(EXIT_FAILURE);
+    if (opts->json_key != NULL)
+        init_json_dt_locator(loc, opts->json_key, dt_fmt);
+    else if (opts->epoch)
+        init_epoch_dt_locator(loc);
+    else
+        init_text_dt_locator(loc, dt_fmt, strlen(dt_str));
+
+    loc->last_year = opts->last_year;
 }
 
 
-/* Function does bin search on the file's bytes level (lseek()). Then it searches
-for a bz2 block which is nearest from the current middle byte element.
-Then it finds the first datetime sting in the found bz2 block, converts it to 
-epoch format and compares it to the opt_from_time_t value to understand where it
-should continue searching the next middle byte. */
-unsigned long opt_from_bin_search(off_t low,
-                                  off_t high, 
-                                  time_t opt_from_time_t,
-                                  bunzip_data *bd,
-                                  const char *opt_f,
-                                  int dt_length,
-                                  char *first_dt_str_in_outbuf,
-                                  const char *dt_fmt)
+// Defines datetime formats of --from and --to values of all the ranges, checks
+// if they are equal and converts the values to epoch time. Returns the common
+// datetime format (NULL if the values are epoch numbers).
+const char * convert_time_ranges(const cmd_opts *opts, time_range *ranges,
+                                 int n_ranges)
 {
-    off_t mid, mid_pos;
-    unsigned int mid_pos_in_bytes;
-    time_t middle_time_t;
-    time_t first_dt_str_in_outbuf_time_t;
-    time_t last_dt_str_in_blk_time_t;
-    char last_dt_str_in_blk[dt_length];
-
-
-    while (low <= high)
-    {
-        mid = low + (high - low) / 2;
-	    //printf("\n%s: low = %lu, mid = %lu, hig = %lu\n", 
-        //        __func__, low, mid, high);
-	    if (DEBUG) putchar('\n');
-	    debug_print("low = %luB, mid = %luB, hig = %luB", low, mid, high);
-        // Set file offset to mid byte
-        bd->cur_file_offset = lseek_set(bd, mid);
-/*        bd->cur_file_offset = lseek(bd->in_fd, mid, SEEK_SET);
-        if (bd->cur_file_offset != mid){
-            printf("%s(): ERROR. lseek(bd->in_fd, mid, SEEK_SET) returned %llu"
-                   " which is not equal to mid (%llu)\n", 
-                   __func__, bd->cur_file_offset, mid);
-            exit(EXIT_FAILURE);
-        }
-*/
-        //debug_print("lseek position = %lu", lseek(bd->in_fd, 0, SEEK_CUR ));
-        
-        mid_pos = search_start_bit_of_bz2_blk(bd);
-
-	    debug_print("block %jd", (intmax_t)(bd->cur_file_offset * 8 + mid_pos));
-        
-        // Get the first datetime string from current block and convert it to
-        // epoch time
-	    get_first_dt_str_from_bz2_blk(mid_pos, dt_length, bd,
-                                      first_dt_str_in_outbuf, dt_fmt);
-        debug_print("first_dt_str_in_outbuf = %s", first_dt_str_in_outbuf);
-        
-        //debug_print("lseek position = %lu", lseek(bd->in_fd, 0, SEEK_CUR ));
-
-	    first_dt_str_in_outbuf_time_t = convert_dt_str_to_epoch(first_dt_str_in_outbuf, dt_fmt);
-	    //printf("opt_from_bin_search: first_dt_str_in_outbuf_time_t = %lu\n", 
-        //  first_dt_str_in_outbuf_time_t);
-	
-        // Get the last dt string from the block and convert it to epoch time
-        get_last_dt_str_from_bz2_blk(mid_pos, dt_length, bd, 
-                                     last_dt_str_in_blk, dt_fmt);
-	    debug_print("last_dt_str_in_blk = %s", last_dt_str_in_blk);
-
-        // Set file offset back to the value which was before a call of the
-        // function get_last_dt_str_from_bz2_blk.
-        lseek_set(bd, bd->cur_file_offset);
-        debug_print("lseek position = %lu", lseek(bd->in_fd, 0, SEEK_CUR ));
-
-        last_dt_str_in_blk_time_t = convert_dt_str_to_epoch(last_dt_str_in_blk,
-                                                            dt_fmt);
-	    //printf("opt_from_bin_search: last_dt_str_in_blk_time_t = %lu\n", 
-        //  last_dt_str_in_blk_time_t);
-
-	    //printf("%s: opt_from_time_t = %lu\n", __func__, opt_from_time_t);
-	    //printf("%s: opt_from_time_t(%lu) - first_dt_str_in_outbuf_time_t(%lu) = %lu\n", 
-        //  __func__, opt_from_time_t, first_dt_str_in_outbuf_time_t, 
-        //  opt_from_time_t - first_dt_str_in_outbuf_time_t);
-	    if ( opt_from_time_t > first_dt_str_in_outbuf_time_t )
+    const char *opt_from_dt_fmt;
+    const char *opt_to_dt_fmt;
+    const char *dt_fmt = NULL;
+
+    for (int i = 0; i < n_ranges; i++)
+    {
+        // JSON and epoch logs also accept epoch numbers
+        if (opts->json_key != NULL || opts->epoch)
         {
-            debug_print("opt_f (%s) > first_dt_str_in_outbuf (%s)", 
-                        opt_f, first_dt_str_in_outbuf);
-
-            if ( opt_from_time_t <= last_dt_str_in_blk_time_t )
-            {
-                // Break the loop and return the block position.
-                debug_print("opt_f (%s) <= last_dt_str_in_blk (%s)", 
-                            opt_f, last_dt_str_in_blk);
-                //debug_print("lseek position = %lu", lseek(bd->in_fd, 0, SEEK_CUR));
-                break;
-            }
-
-            debug_print("opt_f (%s) > last_dt_str_in_blk (%s)", 
-                        opt_f, last_dt_str_in_blk);
-	    
-	        // Set low to the byte next to the current byte where current bz2 
-            // block was found.
-            // So we convert mid_pos from bits to bytes by / 8 and add 1
-            //low = mid + mid_pos / 8 + 1;
-            low = mid + 1;
-
-	    } 
-        else if (opt_from_time_t < first_dt_str_in_outbuf_time_t)
+            ranges[i].from_time_t = convert_opt_dt_to_epoch(ranges[i].from,
+                                                            &opt_from_dt_fmt);
+            ranges[i].to_time_t = convert_opt_dt_to_epoch(ranges[i].to,
+                                                          &opt_to_dt_fmt);
+        }
+        else
         {
+            opt_from_dt_fmt = def_dt_fmt(ranges[i].from);
+            opt_to_dt_fmt = def_dt_fmt(ranges[i].to);
+        }
 
-            debug_print("opt_f (%s) < first_dt_str_in_outbuf (%s)\n", 
-                        opt_f, first_dt_str_in_outbuf);
+        if (i == 0)
+            dt_fmt = opt_from_dt_fmt;
 
-            // Set high to the byte previous to the current byte where current 
-            // bz2 block was found.
-            // So we convert mid_pos from bits to bytes by / 8 and subtract 1 
-	        // high = mid + mid_pos / 8 - 1;
-	        high = mid - 1;
+        // Check if all the values are set in the same datetime format
+        if (!is_same_dt_fmt(opt_from_dt_fmt, opt_to_dt_fmt) ||
+            !is_same_dt_fmt(opt_from_dt_fmt, dt_fmt))
+        {
+	        error_print("%s\n", "Values of --from and --to were not set in the "
+                        "same datetime format");
+            exit(EXIT_FAILURE);
+        }
 
-	    }
-        else
+        if (opts->json_key == NULL && !opts->epoch)
         {
-            // If opt_f == first_dt_str_in_outbuf_time_t then break the loop and
-            // return current block position
-	        debug_print("opt_f (%s) == first_dt_str_in_outbuf (%s)", 
-                    opt_f, first_dt_str_in_outbuf);
-
-            // printf("opt_from_bin_search: opt_f was found in the block with 
-            // starting bit %llu\n\n", mid_pos + bd->cur_file_offset * 8);
-            // to uncompress the block in which opt_f was found it's needed to
-            // move lseek to the previous position
-
-            lseek_set(bd, bd->cur_file_offset);
- /*           lseek_result = lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET); 
-            if (lseek_result != bd->cur_file_offset) {
-                printf("\nERROR: line %d, function %s():\n"
-		               "lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET) returned %llu,"
-	       	           "which is not equal to bd->cur_file_offset(%llu)\n\n",
-		                __LINE__, __func__, lseek_result, bd->cur_file_offset);
-                exit(EXIT_FAILURE);
-            }
-*/
-            break;
-	    }
+            ranges[i].from_time_t = convert_dt_str_to_epoch(ranges[i].from,
+                                                            dt_fmt);
+            ranges[i].to_time_t = convert_dt_str_to_epoch(ranges[i].to, dt_fmt);
+        }
+
+        // Values without a year get the years of a file by
+        // anchor_time_ranges(), a range can cross a new year
+        if (!is_dt_fmt_without_year(dt_fmt))
+            check_time_range(opts, &ranges[i]);
     }
 
-    return mid_pos;
+    return dt_fmt;
 }
 
-off_t lseek_set(bunzip_data *bd, off_t offset)
-{
-    off_t result = 0;
 
-    result = lseek(bd->in_fd, offset, SEEK_SET);
-    if (result != offset)
+// Checks if opt_f >= opt_to. A range of --tail has only --to.
+void check_time_range(const cmd_opts *opts, const time_range *range)
+{
+    if (range->from_time_t >= range->to_time_t && opts->tail_lines == 0)
     {
-        error_print("lseek(bd->in_fd (%d), offset (%jd), SEEK_SET) returned %jd,"
-	       	        " which is not equal to offset",
-                    bd->in_fd, (intmax_t)offset, (intmax_t)result);
+        error_print("Value of --from (%s) shouldn't be >= value of --to "
+                    "(%s)\n", range->from, range->to);
         exit(EXIT_FAILURE);
     }
-
-    return result;
 }
 
 
-/*
- * Seek the bunzip_data `bz` to a specific position in bits `pos` by lseeking
- * the underlying file descriptor and priming the buffer with appropriate
- * bits already consumed. This probably only makes sense for seeking to the
- * start of a compressed block.
- */
-unsigned int seek_bits(bunzip_data *bd, unsigned long pos)
+// Converts --from/--to values of a format without a year to epoch time by the
+// last date of a file (or of a set of files): --from is in the latest year in
+// which it isn't later than the last date, --to is the nearest time after
+// --from, so a range can cross a new year.
+void anchor_time_ranges(const cmd_opts *opts, time_range *ranges,
+                        int n_ranges, const char *dt_fmt, time_t last_time_t)
 {
-    long n_byte = pos / 8;
-    char n_bit = pos % 8;
-    
-    debug_print("pos = %lu, n_byte = %d, n_bit = %d", pos, n_byte, n_bit);
-    debug_print("lseek position = %lu, n_byte(%lu) + bd->cur_file_offset(%lu)", 
-        lseek(bd->in_fd, 0, SEEK_CUR), n_byte, bd->cur_file_offset);
- 
-    // Seek the underlying file descriptor + bd->cur_file_offset because lseek
-    // returns the amount of bytes from the beginning of a file
-    if ( (lseek( bd->in_fd, n_byte, SEEK_CUR)) != n_byte + bd->cur_file_offset) 
-    {
-    //if ( (lseek( bd->in_fd, n_byte, SEEK_CUR)) != n_byte) {
-        debug_print("current file offset AFTER lseek = %ld", 
-                    lseek(bd->in_fd, 0, SEEK_CUR));
-        
-	    error_print("lseek( bd->in_fd, n_byte(%lu), SEEK_CUR)) != "
-                    "n_byte(%lu) + bd->cur_file_offset(%lu)",
-                    n_byte, n_byte, bd->cur_file_offset);
-        exit(EXIT_FAILURE);
+    for (int i = 0; i < n_ranges; i++)
+    {
+        ranges[i].from_time_t = convert_dt_str_to_recent_epoch(ranges[i].from,
+                                                               dt_fmt,
+                                                               last_time_t);
+        // A year later is the same --from (and an error)
+        ranges[i].to_time_t = convert_dt_str_to_recent_epoch(ranges[i].to,
+            dt_fmt, ranges[i].from_time_t + 365 * 24 * 60 * 60 - 1);
+
+        check_time_range(opts, &ranges[i]);
     }
+}
 
-    bd->inbufBitCount = bd->inbufPos = bd->inbufCount = 0;
 
-    get_bits(bd, n_bit);
+// Compares datetime formats, NULL means an epoch number
+bool is_same_dt_fmt(const char *dt_fmt1, const char *dt_fmt2)
+{
+    if (dt_fmt1 == NULL || dt_fmt2 == NULL)
+        return dt_fmt1 == dt_fmt2;
 
-    return pos;
+    return strcmp(dt_fmt1, dt_fmt2) == 0;
 }
 
 
-int uncompress_first_buf_of_blk(unsigned long pos, bunzip_data *bd, char *obuf)
+// Writes the line counts and bytes of a time range per --histogram interval.
+// Without a content filter the blocks which are fully inside one interval are
+// counted by a complete index with their stats without uncompressing. The
+// blocks of a range are taken from the entries of such an index, so only the
+// blocks across the bounds of intervals are read and uncompressed.
+void write_range_histogram(bz2_archive *ar, const time_range *range,
+                           int out_fd, const cmd_opts *opts, off_t *low)
 {
-    int status;
-    int gotcount = 0;
+    histogram hist;
+    blk_writer writer;
 
+    init_histogram(&hist, range->from_time_t, range->to_time_t,
+                   opts->histogram);
+    init_blk_line_writer(&writer, &ar->loc, range->from_time_t,
+                         range->to_time_t, add_histogram_line, &hist);
+    if (opts->grep.n_patterns > 0)
+        set_blk_writer_grep(&writer, &opts->grep);
+    else
+        writer.count_cb = add_histogram_blk;
 
-    seek_bits(bd, pos);
+    extract_range(ar, range, &writer, low);
 
-    /* Fill the decode buffer for the block */
-    if (status = get_next_block( bd ))
-    {
-        error_print("get_next_block() returned %d, bunzip_errors[-status]",
-                     status);
-        exit(EXIT_FAILURE);
-    }
+    blk_writer_flush(&writer);
+    free_blk_writer(&writer);
+
+    write_histogram(out_fd, &hist, ar->loc.dt_fmt);
+    free_histogram(&hist);
+}
+
+
+// Writes a sample of a time range: the lines of every --sample-th block of a
+// range or a reservoir sample of --sample-lines lines of such blocks. Without
+// --sample the lines are sampled from DEF_SAMPLE_BLKS blocks spread over a
+// range. The blocks are taken from a complete index, otherwise they are found
+// at the compressed offsets which are apart by the size of the first block of
+// a range, so the blocks between the chosen ones are neither read nor
+// uncompressed. The line fragments at the bounds of a chosen block belong to
+// the skipped neighbours, they are dropped.
+void write_range_sample(bz2_archive *ar, const time_range *range, int out_fd,
+                        const cmd_opts *opts, off_t *low)
+{
+    bunzip_data *bd = ar->bd;
+    blk_writer writer;
+    line_sample sample;
+    const blk_index_entry *entry = NULL;
+    unsigned long long blk_pos, end_pos, next_blk_pos, blk_size;
+    unsigned long long n_blks = 0, step;
 
-    /* Init the CRC for writing */
-    bd->writeCRC = 0xffffffffUL;
- 
-    /* Zero this so the current byte from before the seek is not written */
-    bd->writeCopies = 0;
+    blk_pos = find_range_first_blk(ar, range, low);
 
-    /* Decompress the first buffer of block */
-    gotcount = read_bunzip(bd, obuf, BUFFER_SIZE);
+    // The blocks of a range end before the first block after it
+    if ((end_pos = opt_to_bin_search(ar, blk_pos / 8, range->to_time_t)) ==
+        BLK_NOT_FOUND)
+        end_pos = ar->file_size * 8;
 
-    bd->cur_file_offset = lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET);
+    if (ar->index.complete)
+        entry = find_blk_index_entry(&ar->index, blk_pos);
 
-    if (gotcount < 0)
+    next_blk_pos = entry != NULL ? BLK_NOT_FOUND :
+                   find_blk_from(bd, blk_pos / 8 + 1);
+    blk_size = next_blk_pos != BLK_NOT_FOUND && next_blk_pos > blk_pos ?
+               next_blk_pos - blk_pos : end_pos - blk_pos;
+
+    if ((step = opts->sample_blks) == 0)
     {
-        status = gotcount;
-	    error_print("read_bunzip() returned %d, %s",
-            gotcount, bunzip_errors[-status]);
-	    exit(EXIT_FAILURE);
+        if (entry != NULL)
+            for (const blk_index_entry *e = entry;
+                 e < ar->index.blks + ar->index.n_blks && e->blk_pos < end_pos;
+                 e++)
+                n_blks++;
+        else
+            n_blks = (end_pos - blk_pos + blk_size - 1) / blk_size;
+
+        step = (n_blks + DEF_SAMPLE_BLKS - 1) / DEF_SAMPLE_BLKS;
+        if (step == 0)
+            step = 1;
     }
-    else if (gotcount == 0)
+
+    if (opts->sample_lines > 0)
     {
-	    status = gotcount;
-        error_print("read_bunzip() returned %d, %s", 
-            gotcount, bunzip_errors[-status]);
-        exit(EXIT_FAILURE);
+        init_line_sample(&sample, opts->sample_lines);
+        init_blk_line_writer(&writer, &ar->loc, range->from_time_t,
+                             range->to_time_t, add_sample_line, &sample);
     }
+    else
+    {
+        init_blk_writer(&writer, out_fd, &ar->loc, true, range->from_time_t,
+                        range->to_time_t);
+    }
+    writer.max_skew = ar->max_skew;
+    if (opts->grep.n_patterns > 0)
+        set_blk_writer_grep(&writer, &opts->grep);
 
-    return gotcount;
-}
-
+    while (blk_pos < end_pos && !writer.done)
+    {
+        if (blk_pos != FIRST_BLK_POS)
+            blk_writer_skip_blk(&writer, false, 0);
 
-int uncompress_last_2_buffers_of_blk(unsigned long pos, bunzip_data *bd,
-    char *two_last_outbufs)
-{
-    int status;
-    int gotcount, prev_gotcount, last_gotcount, totalcount;
-    char prev_outbuf[BUFFER_SIZE + 1], last_outbuf[BUFFER_SIZE + 1];
+        write_blk(ar, blk_pos, &writer);
 
+        if (entry != NULL)
+        {
+            if (entry + step >= ar->index.blks + ar->index.n_blks)
+                break;
+            entry += step;
+            blk_pos = entry->blk_pos;
+            continue;
+        }
 
-    gotcount = prev_gotcount = last_gotcount = totalcount = 0;
-    // Fill prev_outbuf and last_outbuf with 0s
-    memset(prev_outbuf, 0, BUFFER_SIZE); 
-    memset(last_outbuf, 0, BUFFER_SIZE); 
-    prev_outbuf[BUFFER_SIZE] = '\0';
-    last_outbuf[BUFFER_SIZE] = '\0';
+        // The offset of the next chosen block is estimated unless it's the
+        // next block. Blocks can be larger than the first one, so the next
+        // block is taken at least.
+        next_blk_pos = step == 1 ? BLK_NOT_FOUND :
+                       find_blk_from(bd, (blk_pos + step * blk_size) / 8);
+        if (next_blk_pos == BLK_NOT_FOUND || next_blk_pos <= blk_pos)
+            next_blk_pos = find_blk_from(bd, blk_pos / 8 + 1);
+        blk_pos = next_blk_pos;
+    }
 
-    seek_bits(bd, pos);
+    // The end of the last line of a chosen block is in a skipped block
+    writer.line_len = 0;
+    blk_writer_flush(&writer);
+    free_blk_writer(&writer);
 
-    /* Fill the decode buffer for the block */
-    if ((status = get_next_block( bd )))
+    if (opts->sample_lines > 0)
     {
-        error_print("get_next_block() returned %d, bunzip_errors[-status]\n",
-            __func__, status);
-        exit(EXIT_FAILURE);
+        write_line_sample(out_fd, &sample);
+        free_line_sample(&sample);
     }
+}
 
-    /* Init the CRC for writing */
-    bd->writeCRC = 0xffffffffUL;
-
-    /* Zero this so the current byte from before the seek is not written */
-    bd->writeCopies = 0;
 
-    for ( ;; )
+// Writes the last --tail lines with timestamps <= to_time_t. The blocks are
+// uncompressed backwards from the block where to_time_t is, till they have
+// enough newline chars for the lines, so the cost is proportional to the
+// amount of lines instead of a range. Then the kept blocks are filtered in
+// the order of a file. If less lines pass (--grep, lines after to_time_t),
+// twice as many newline chars are collected.
+void write_file_tail(bz2_archive *ar, time_t to_time_t, const cmd_opts *opts)
+{
+    tail_blk *blks = NULL;
+    int n_blks = 0, blks_size = 0;
+    unsigned long long blk_pos, next_blk_pos = BLK_NOT_FOUND;
+    unsigned long long n_newlines = 0, wanted;
+    const decoded_blk_cache *data;
+    line_tail tail;
+    blk_writer writer;
+
+    // The block after the last block of a range has the end of its last line
+    if (to_time_t < ar->last_date_time_t)
+        next_blk_pos = opt_to_bin_search(ar, 0, to_time_t);
+
+    if (next_blk_pos != BLK_NOT_FOUND)
     {
-        /* Decompress the first buffer of block */
-        gotcount = read_bunzip(bd, last_outbuf, BUFFER_SIZE);
-
-    	// Sum up all gotcounts
-    	totalcount += gotcount;
+        add_tail_blk(ar, next_blk_pos, &blks, &n_blks, &blks_size);
+        blk_pos = find_prev_known_blk_pos(ar, next_blk_pos);
+    }
+    else
+        blk_pos = ar->last_blk_pos;
 
-        //lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET);
+    init_line_tail(&tail, opts->tail_lines);
 
-        if ( gotcount < 0 ) 
+    // A line ends by a newline char and starts after the previous one
+    for (wanted = opts->tail_lines + 1; ; wanted *= 2)
+    {
+        while (blk_pos != BLK_NOT_FOUND && n_newlines < wanted)
         {
-            status = gotcount;
-            error_print("read_bunzip() returned %d, %s", 
-                gotcount, bunzip_errors[-status]);
-            exit(EXIT_FAILURE);
+            add_tail_blk(ar, blk_pos, &blks, &n_blks, &blks_size);
+            data = &blks[n_blks - 1].data;
+            for (const char *nl = data->data;
+                 (nl = memchr(nl, '\n', data->data + data->len - nl)) != NULL;
+                 nl++)
+                n_newlines++;
+
+            blk_pos = find_prev_known_blk_pos(ar, blk_pos);
         }
-	    else if (gotcount == BUFFER_SIZE) 
-        {
-            // If gotcount == BUFFER_SIZE then this is not the last buffer.
-            // So store it into prev_outbuf
-	        memcpy (prev_outbuf, last_outbuf, BUFFER_SIZE);
-	        prev_gotcount = gotcount;
-	    }
-	    else if (gotcount > 0 && gotcount < BUFFER_SIZE) 
-        {
-            // if obuf was written not in full then this is the last buffer.
-	        // So store the content of prev_outbuf and last_outbuf into 
-            // two_last_oubufs
-	        last_gotcount = gotcount;
-	        memcpy(&two_last_outbufs[0], prev_outbuf, 
-                sizeof(char) * prev_gotcount);
-	        memcpy(&two_last_outbufs[BUFFER_SIZE], last_outbuf, 
-                sizeof(char) * last_gotcount);
-            // Put null char after data end
-	        two_last_outbufs[prev_gotcount + last_gotcount] = '\0';
+
+        // The blocks are kept from the last one back
+        reset_line_tail(&tail);
+        init_blk_line_writer(&writer, &ar->loc, (time_t)LLONG_MIN, to_time_t,
+                             add_tail_line, &tail);
+        writer.max_skew = ar->max_skew;
+        if (opts->grep.n_patterns > 0)
+            set_blk_writer_grep(&writer, &opts->grep);
+
+        // The first fragment of the earliest block is the end of a line of a
+        // block which wasn't uncompressed
+        writer.skip_first_line = blks[n_blks - 1].blk_pos != FIRST_BLK_POS;
+
+        for (int i = n_blks - 1; i >= 0 && !writer.done; i--)
+            blk_writer_write(&writer, blks[i].data.data, blks[i].data.len);
+
+        blk_writer_flush(&writer);
+        free_blk_writer(&writer);
+
+        if (tail.n_lines == tail.size || blk_pos == BLK_NOT_FOUND)
             break;
-	    }
-	    else if (gotcount == 0 && totalcount == 0)
-        {
-	        // If the first read_bunzip() wrote 0 bytes into last_outbuf, exit
-            // with error.
-	        status = gotcount;
-	        debug_print("read_bunzip() returned %d uncompressing the block %llu. %s",
-                gotcount, bd->cur_file_offset * 8 + pos, bunzip_errors[-status]);
-            exit(EXIT_FAILURE);
-        }
     }
 
-    //printf("%s: obuf = %s\n", __func__, obuf);
-    return prev_gotcount + last_gotcount;
+    write_line_tail(1, &tail);
+
+    free_line_tail(&tail);
+    for (int i = 0; i < n_blks; i++)
+        free(blks[i].data.data);
+    free(blks);
 }
 
 
-int seek_dt_str_in_blk(unsigned long pos, bunzip_data *bd, const char * opt_f,
-    bool * is_dt_str_found)
+// Uncompresses a block of --tail and appends it to the kept blocks
+void add_tail_blk(bz2_archive *ar, unsigned long long blk_pos, tail_blk **blks,
+                  int *n_blks, int *blks_size)
 {
-    int status = 0, i = 0;
-    int gotcount = 0;
-    char obuf[BUFFER_SIZE];
-    int seek_bits_return;
+    int status;
 
+    if (*n_blks == *blks_size)
+    {
+        *blks_size = *blks_size ? *blks_size * 2 : 16;
+        if ((*blks = realloc(*blks, *blks_size * sizeof(tail_blk))) == NULL)
+        {
+            error_print("Can't allocate memory for %d blocks", *blks_size);
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    //printf("seek_dt_str_in_blk: &bd = %p, bd = %p\n", &bd, bd);
-    
-    seek_bits_return = seek_bits( bd, pos );
-    //printf("seek_dt_str_in_blk: seek_bits returned %d\n", seek_bits_return);
-    //printf("seek_dt_str_in_blk: opt_f = %s\n", opt_f);
+    memset(&(*blks)[*n_blks], 0, sizeof(tail_blk));
+    (*blks)[*n_blks].blk_pos = blk_pos;
 
-    /* Fill the decode buffer for the block */
-    if ( ( status = get_next_block( bd ) ) )
-        goto seek_bunzip_finish;
-    /* Init the CRC for writing */
-    bd->writeCRC = 0xffffffffUL;
+    if ((status = decode_blk(ar->bd, blk_pos, &(*blks)[*n_blks].data)))
+    {
+        error_print("Uncompressing the block %llu returned %s", blk_pos,
+                    bunzip_errors[-status]);
+        exit(EXIT_FAILURE);
+    }
 
-    /* Zero this so the current byte from before the seek is not written */
-    bd->writeCopies = 0;
+    (*n_blks)++;
+}
 
-    /* Decompress the block and write to stdout */
-    for ( ; ; i++ )
-    {
-        gotcount = read_bunzip( bd, obuf, BUFFER_SIZE );
-    //printf("seek_dt_str_in_blk: read_bunzip returned %d\n", gotcount);
-        if ( gotcount < 0 )
-        {
-            status = gotcount;
-            break;
-        }
-        else if ( gotcount == 0 )
-        {
-            break;
-        }
-        else
-        {
-            // Here we have uncrompressed data in obuf
 
-            //printf("seek_dt_str_in_blk: iteration %d\n", i);
-            // Search from/to strings in obuf. As soon as stings was found - stop checking further blocks.
-            if (*is_dt_str_found = is_dt_str_in_obuf(opt_f, gotcount, obuf))
-            {
-		        //printf("seek_dt_str_in_blk: is_dt_str_found = %d\n", is_dt_str_found);
-		        goto seek_bunzip_finish;
-		    }
-            //printf("seek_dt_str_in_blk: iteration %d, gotcount = %d\n", i, gotcount);
+// Estimates an uncompressed size of a planned range. Sizes of the blocks with
+// stats in an index are summed up exactly, the rest of the blocks get the
+// average size of the blocks which were decoded for the search (or of the
+// blocks with stats if nothing was decoded).
+double estimate_uncompressed_bytes(bz2_archive *ar, const range_plan *plan)
+{
+    double uncompressed_bytes = 0, avg_blk_size = 0;
+    unsigned long n_stats_blks = 0, n_range_stats_blks = 0;
+    double stats_bytes = 0;
+    const blk_index_entry *entry;
 
+    for (unsigned long j = 0; j < ar->index.n_blks; j++)
+    {
+        entry = &ar->index.blks[j];
+        if (!(entry->flags & BLK_INDEX_STATS))
+            continue;
 
-                //write( 1, obuf, gotcount );
-                //exit(EXIT_SUCCESS);
+        n_stats_blks++;
+        stats_bytes += entry->size;
+        if (entry->blk_pos >= plan->first_blk_pos &&
+            entry->blk_pos <= plan->last_blk_pos)
+        {
+            n_range_stats_blks++;
+            uncompressed_bytes += entry->size;
         }
     }
 
-seek_bunzip_finish:
+    if (ar->bd->out_blks)
+        avg_blk_size = (double)ar->bd->out_blks_size / ar->bd->out_blks;
+    else if (n_stats_blks)
+        avg_blk_size = stats_bytes / n_stats_blks;
+
+    if (plan->n_blks > n_range_stats_blks)
+        uncompressed_bytes += (plan->n_blks - n_range_stats_blks) *
+                              avg_blk_size;
 
-//    if ( bd->dbuf ) free( bd->dbuf );
-//    free( bd );
-    return status;
+    return uncompressed_bytes;
 }
 
 
-// Function gets the first datetime string which corresponds to one of known 
-// datetime formats
-const char* 
-get_first_dt_str_from_bz2_blk(  unsigned long   pos, 
-                                int             test_substr_len,
-                                bunzip_data*    bd,
-                                char*           first_dt_str_in_outbuf,
-                                const char*     dt_fmt  )
+// Preallocates the space of --output for all the ranges (the file size isn't
+// changed), so a big output isn't fragmented
+void preallocate_output(bz2_archive *ar, const time_range *ranges,
+                        int n_ranges)
 {
-    // byte/char position within obuf
-    int obuf_pos;
-    // sting with the same size as opt_f/opt_to to check if it matches to dt_fmt
-    // + 1 for null char
-    char test_substr [test_substr_len + 1];
-    // first obuf from which first dt string should be searched
-    char obuf[BUFFER_SIZE + 1];
-    // amount of uncompressed bytes which was read to obuf
-    int gotcount;
-    // string length
-    int str_len;
-
-    
-    //debug_print("pos = %u, bd->cur_file_offset = %lu, abs_pos = %lu\n", 
-    //    pos, bd->cur_file_offset, bd->cur_file_offset * 8 + pos);
-
-    // Clean first_dt_str_in_outbuf from the previous value
-    memset(first_dt_str_in_outbuf, 0, test_substr_len);
-
-    // Get the first uncompressed obuf from a block
-    gotcount = uncompress_first_buf_of_blk(pos, bd, obuf);
-
-    // Finish obuf with '\0' char
-    obuf[gotcount] = '\0';
-
-    // A string from obuf. We don't know beforehand its size, so set it a max
-    // possible size (gotcount bytes) to prevent buffer overflow. +1 for null
-    // char
-    char str[gotcount + 1];
-
-    // As a buffer usually starts not from the beginning of a string but from
-    // arbitrary char, search for the first newline char (beginning of the
-    // next string)
-    for (obuf_pos = 0; obuf_pos < gotcount; obuf_pos++) 
-    {
-        //printf("obuf[%d] = %c\n", obuf_pos, obuf[obuf_pos]);
-        if (obuf[obuf_pos] == '\n')
-            break;
+    range_plan plan;
+    off_t low = 0;
+    double size = 0;
+
+    for (int i = 0; i < n_ranges; i++)
+    {
+        plan_range(ar, &ranges[i], &low, &plan);
+        size += estimate_uncompressed_bytes(ar, &plan);
     }
 
-    // Loop through obuf
-    while (obuf_pos < gotcount) 
+    // A file system without fallocate() support gets the output as is
+    if (size > 0)
+        fallocate(1, FALLOC_FL_KEEP_SIZE, 0, (off_t)size);
+}
+
+
+// Opens --output instead of stdout
+void open_output(const char *path)
+{
+    int fd;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
     {
-        // Get a string from obuf
-        get_str(obuf, &obuf_pos, str);
-        debug_print("str = \"%s\"", str);
-        
-        //debug_print("obuf[%d] = '%c'", obuf_pos, obuf[obuf_pos]);
-        
-        str_len = strlen(str);
-        //debug_print("str_len = %d", str_len);
-        if (str_len <= test_substr_len)
-            continue;
+        error_print("Can't open the output file %s\n%s", path,
+                    strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-        bool status = is_dt_substr_in_str(str, str_len, test_substr,
-            test_substr_len, dt_fmt);
-        if (status)
-        {
-            // Copy test_substr to first_dt_str_in_outbuf and return it.
-            strncpy(first_dt_str_in_outbuf, test_substr, test_substr_len + 1);
-            break;
-        }
+    if (dup2(fd, 1) < 0)
+    {
+        error_print("dup2() of the output file %s failed\n%s", path,
+                    strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
-    return first_dt_str_in_outbuf;
+    close(fd);
 }
 
 
-// Function searches for the last datetime substring in the end of the last bz2
-// block
-const char* 
-get_last_dt_str_from_bz2_blk(   unsigned long   pos,
-                                int             test_substr_len, 
-                                bunzip_data*    bd,
-                                char*           last_dt_str_in_outbuf,
-                                const char*     dt_fmt  )
+// Prints plans of all the ranges as JSON. An uncompressed size of a range is
+// estimated by estimate_uncompressed_bytes().
+void print_plan(bz2_archive *ar, const char *input_file,
+                const time_range *ranges, int n_ranges)
 {
-    // byte/char position within obuf
-    int obuf_pos;
-    int last_char_pos;
-    // sting with the same size as opt_f/opt_to to check if it matches to dt_fmt
-    // + 1 for null char
-    char test_substr [test_substr_len + 1]; 
-    // 2 last output buffers from which the last datetime string should be
-    // searched for
-    char obuf2 [BUFFER_SIZE * 2 + 1]; 	
-    // amount of uncompressed bytes which was read to obuf
-    int gotcount;
-    // Current string length in obuf2
-    int str_len;
-    // Previous position of a newline char in obuf2
-    int prev_nl_pos;
-
-
-// Clean last_dt_str_in_outbuf from the previous value
-    memset(last_dt_str_in_outbuf, 0, test_substr_len);
-
-// Clean obuf2 from the previous value
-    memset(obuf2, 0, BUFFER_SIZE * 2);
-
-// Get 2 last uncompressed output buffers from a block. Why 2? Becuase the last
-// buffer usually isn't full and it's possible that it doesn't contain the dt
-// string
-    gotcount = uncompress_last_2_buffers_of_blk(pos, bd, obuf2);
-    //printf("%s(): gotcount = %d\n", __func__, gotcount);
-
-// Finish obuf2 with '\0' char
-    obuf2[gotcount] = '\0';
-
-    last_char_pos = gotcount - 1; //Why -1? Because if gotcount = 100 then an
-    // index of the last element in an obuf2 array is 100 - 1 = 99
-    prev_nl_pos = last_char_pos;
-
-// A string from obuf2. We don't know beforehand its size, so set it a max
-// possible size (gotcount bytes) to prevent buffer overflow 
-    char str[gotcount + 1];
-
-// Loop through obuf2 in reverse direction
-    for (obuf_pos = last_char_pos; obuf_pos >= 0; obuf_pos--)
-    {
-	    //printf("%c", obuf2[obuf_pos]);
-        
-	    if (obuf2[obuf_pos] != '\n')
-	        continue;
-
-	    prev_nl_pos = obuf_pos;
-
-        // Get a string from obuf
-        get_str(obuf2, &obuf_pos, str);
-        debug_print("str = \"%s\"", str);
-
-        // If string length is less or equal to datetime substring length then
-        // go to the previous string
-        str_len = strlen(str);
-        if (str_len <= test_substr_len)
-        {   debug_print("str_len = %d\n", str_len);
-            // go to the previous newline
-            obuf_pos = prev_nl_pos; 
-            continue;
-        }
+    range_plan plans[n_ranges];
+    double uncompressed_bytes[n_ranges];
+    off_t low = 0;
 
-        bool status = is_dt_substr_in_str(str, str_len, test_substr,
-                            test_substr_len, dt_fmt);
-        if (status)
-        {
-            // Copy test_substr to first_dt_str_in_outbuf and return it.
-            strncpy(last_dt_str_in_outbuf, test_substr, test_substr_len + 1);
-            break;
-        }
-        else
-        {
-            // go to the previous newline
-            obuf_pos = prev_nl_pos;
-            continue;
-        }
+    for (int i = 0; i < n_ranges; i++)
+        plan_range(ar, &ranges[i], &low, &plans[i]);
+
+    for (int i = 0; i < n_ranges; i++)
+        uncompressed_bytes[i] = estimate_uncompressed_bytes(ar, &plans[i]);
+
+    printf("{\"file\": ");
+    print_json_str(input_file);
+    printf(", \"ranges\": [");
+
+    for (int i = 0; i < n_ranges; i++)
+    {
+        printf("%s{\"from\": ", i ? ", " : "");
+        print_json_str(ranges[i].from);
+        printf(", \"to\": ");
+        print_json_str(ranges[i].to);
+        printf(", \"first_blk_pos\": %llu, \"last_blk_pos\": %llu, "
+               "\"blocks\": %lu, \"blocks_exact\": %s, "
+               "\"compressed_bytes\": %llu, "
+               "\"uncompressed_bytes_estimate\": %.0f}",
+               plans[i].first_blk_pos, plans[i].last_blk_pos,
+               plans[i].n_blks, plans[i].n_blks_exact ? "true" : "false",
+               plans[i].compressed_bytes,
+               uncompressed_bytes[i]);
     }
 
-    return last_dt_str_in_outbuf;
+    printf("], \"blocks_decoded\": %lu}\n", ar->bd->decoded_blks);
 }
 
 
-bool is_dt_str_in_obuf(const char * dt_str, int gotcount, const char * obuf)
+// Prints a string as a JSON string literal
+void print_json_str(const char *str)
 {
-    int obuf_pos, dt_byte_pos;
-    int len_dt_str = strlen(dt_str);
-    char found_dt_str[len_dt_str];
+    putchar('"');
 
-//    printf("is_dt_str_in_obuf: dt_str = %s\n\n", dt_str);
+    for (; *str != '\0'; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            printf("\\%c", *str);
+        else if ((unsigned char)*str < 0x20)
+            printf("\\u%04x", *str);
+        else
+            putchar(*str);
+    }
 
-    dt_byte_pos = 0;
+    putchar('"');
+}
 
-    // Loop to check every character from obuf to find dt_sting(s)
-    for (obuf_pos = 0; obuf_pos < gotcount; obuf_pos++) 
+
+// Builds an index of --file by --threads threads and saves it next to the
+// file. A locator without a datetime format gets it from the first lines of
+// the file.
+void build_file_index(const cmd_opts *opts, dt_locator *loc)
+{
+    blk_index index;
+    unsigned long long n_lines = 0, size = 0;
+    char *index_path;
+    bz2_archive ar;
+
+    // Text timestamps need a format detected by the file
+    if (opts->n_ranges == 0)
+        detect_file_dt_fmt(opts, loc);
+
+    // Timestamps without a year get the years which queries infer by the
+    // first and the last dates of the file
+    if (is_dt_fmt_without_year(loc->dt_fmt))
     {
-        // Search the substring in a buffer that matches to from argument
-        if (obuf[obuf_pos] == dt_str[dt_byte_pos]) 
-        {
-            //if (obuf_pos == 0)
-    	    found_dt_str[dt_byte_pos] = dt_str[dt_byte_pos];
-	        //printf("found_dt_str[%d] = %c\n", dt_byte_pos, found_dt_str[dt_byte_pos]);
-
-            // If the first character was matched and this is the first character
-            // of a line - increase dt_byte_pos index to check if the next 
-            // characters are matched on the next iteration the statement 
-            // '&& obuf_pos != 0' protects from going before the obuf
-            if (obuf[obuf_pos - 1] == '\n' && obuf_pos > 0) 
-            {
-                //printf("dt_str[%d] = obuf[%d] = %c\n",
-                //        dt_byte_pos, obuf_pos, obuf[obuf_pos]);
-                dt_byte_pos = 1;
-                continue;	// go to the next cycle
-            }
-
-            // if the first character in a line was already matched continue to
-            // check if the rest are also matched
-            if (dt_byte_pos >= 1 && dt_byte_pos <= len_dt_str ) 
-            {
-                //printf("is_dt_str_in_obuf: dt_str[%d] = obuf[%d] = %c\n",
-                //        dt_byte_pos, obuf_pos, obuf[obuf_pos]);
-                dt_byte_pos++;
-
-                if (dt_byte_pos == len_dt_str)
-		        {
-                    //printf("is_dt_str_in_obuf: match! dt_str = %s\n", dt_str);
-                    return true;
-                }
-	       
-                continue;	// go to the next cycle
-            }
-        }
-        else 
-        {
-            dt_byte_pos = 0;
-        }
+        open_archive(&ar, opts->input_file, loc);
+        *loc = ar.loc;
+        close_archive(&ar);
+    }
+
+    build_blk_index(&index, opts->input_file, loc, opts->n_threads,
+                    opts->build_bloom ? &opts->bloom : NULL,
+                    opts->progress ? print_index_progress : NULL);
+    index_path = blk_index_path(opts->input_file);
+    if (!write_blk_index(&index, opts->input_file, loc))
+    {
+        error_print("Can't save the index file %s\n%s", index_path,
+                    strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-        //printf("dt_byte_pos = %d, obuf[%d] = %c\n",
-        //        dt_byte_pos, obuf_pos, obuf[obuf_pos]);
+    for (unsigned long i = 0; i < index.n_blks; i++)
+    {
+        n_lines += index.blks[i].n_lines;
+        size += index.blks[i].size;
     }
 
-    return false;
+    printf("%s: %lu blocks, %llu lines, %llu bytes", index_path,
+           index.n_blks, n_lines, size);
+    if (opts->build_bloom)
+        printf(", %llu bytes of Bloom filters", index.blooms_size);
+    printf("\n");
+
+    free(index_path);
+    free_blk_index(&index);
 }
 
 
-int uncompress_blk(unsigned long pos, bunzip_data *bd)
+// Detects the datetime format of a locator by the first block of --file.
+// Text timestamps need a format, JSON values can be epoch numbers.
+void detect_file_dt_fmt(const cmd_opts *opts, dt_locator *loc)
 {
-    int status = 0, i = 0;
-    int gotcount = 0;
-    char obuf[BUFFER_SIZE];
+    bz2_archive ar;
 
+    if (opts->epoch)
+        return;
 
-    seek_bits( bd, pos );
-    
-    /* Fill the decode buffer for the block */
-    if (( status = get_next_block( bd ) ))
-        goto seek_bunzip_finish;
+    open_archive_file(&ar, opts->input_file, loc);
+    for_each_line_in_blk(FIRST_BLK_POS, ar.bd, detect_dt_line_cb, loc);
+    close_archive(&ar);
 
-    /* Init the CRC for writing */
-    bd->writeCRC = 0xffffffffUL;
+    if (loc->dt_fmt == NULL && opts->json_key == NULL)
+    {
+        error_print("Can't find a timestamp of a supported datetime format"
+                    " in the first block of %s", opts->input_file);
+        exit(EXIT_FAILURE);
+    }
+}
 
-    /* Zero this so the current byte from before the seek is not written */
-    bd->writeCopies = 0;
 
-    /* Decompress the block and write to stdout */
-    for ( ; ; i++ )
+// Writes the lines --lines of --file. Only the blocks from the one where the
+// first line starts to the one where the last line ends are uncompressed,
+// they are found by the line counts of a complete index.
+void extract_file_lines(const cmd_opts *opts, const dt_locator *loc)
+{
+    bz2_archive ar;
+    blk_writer writer;
+    const blk_index_entry *first_entry, *last_entry;
+    unsigned long long prev_blk_pos = BLK_NOT_FOUND;
+
+    open_indexed_archive(&ar, opts, loc, "--lines");
+
+    // The first line starts after the newline char of the previous one
+    first_entry = opts->from_line > 1 ?
+                  find_blk_index_line(&ar.index, opts->from_line - 1) :
+                  &ar.index.blks[0];
+    last_entry = find_blk_index_line(&ar.index, opts->to_line);
+
+    init_blk_writer(&writer, 1, &ar.loc, true, 0, 0);
+    set_blk_writer_lines(&writer, first_entry->lines_before, opts->from_line,
+                         opts->to_line);
+    if (opts->grep.n_patterns > 0)
+        set_blk_writer_grep(&writer, &opts->grep);
+
+    for (const blk_index_entry *entry = first_entry;
+         entry <= last_entry && !writer.done; entry++)
     {
-        gotcount = read_bunzip( bd, obuf, BUFFER_SIZE );
-        if ( gotcount < 0 )
-        {
-            status = gotcount;
-            break;
-        }
-        else if ( gotcount == 0 )
-        {
-            break;
-        }
-        else
-        {
-            // Here we have uncrompressed data in obuf
-            write( 1, obuf, gotcount );
-        }
+        // Read the next blocks while this one is uncompressed
+        prefetch_next_blks(&ar, entry->blk_pos, prev_blk_pos, NULL);
+        prev_blk_pos = entry->blk_pos;
+
+        write_blk(&ar, entry->blk_pos, &writer);
     }
 
-seek_bunzip_finish:
+    blk_writer_flush(&writer);
+    free_blk_writer(&writer);
+    close_archive(&ar);
+}
+
+
+// Writes the uncompressed bytes --bytes of --file
+void extract_file_bytes(const cmd_opts *opts, const dt_locator *loc)
+{
+    bz2_archive ar;
+    blk_writer writer;
+
+    open_indexed_archive(&ar, opts, loc, "--bytes");
 
-//    if ( bd->dbuf ) free( bd->dbuf );
-//    free( bd );
-    if ( status ) fprintf( stderr, "\n%s\n", bunzip_errors[-status] );
+    init_blk_writer(&writer, 1, &ar.loc, false, 0, 0);
+    extract_bytes(&ar, opts->byte_offset, opts->n_bytes, &writer);
 
-    return status;
+    blk_writer_flush(&writer);
+    free_blk_writer(&writer);
+    close_archive(&ar);
 }
 
 
-/* Converts char datetime string to epoch time (seconds since 
-   Jan 1 1970 00:00:00 UTC) */
-time_t convert_dt_str_to_epoch(const char * dt_str, const char * dt_fmt)
+// Opens --file which has a complete index with stats, exits otherwise. opt is
+// an option which needs an index for a message.
+void open_indexed_archive(bz2_archive *ar, const cmd_opts *opts,
+                          const dt_locator *loc, const char *opt)
 {
-    // dt data structures to which opt_f, opt_to should be converted
-    struct tm dt_tm = {0}; 
-    time_t dt_time_t;
-
-    // Convert string to tm structure format (tm structure from strings.h)
-    // struct tm {
-    //         int tm_sec;    /* Seconds (0-60) */
-    //         int tm_min;    /* Minutes (0-59) */
-    //         int tm_hour;   /* Hours (0-23) */
-    //         int tm_mday;   /* Day of the month (1-31) */
-    //         int tm_mon;    /* Month (0-11) */
-    //         int tm_year;   /* Year - 1900 */
-    //         int tm_wday;   /* Day of the week (0-6, Sunday = 0) */
-    //         int tm_yday;   /* Day in the year (0-365, 1 Jan = 0) */
-    //         int tm_isdst;  /* Daylight saving time */
-    // };
-
-    debug_print("dt_fmt = %s, dt_str = %s\n", dt_fmt, dt_str);
-    if ( NULL == strptime(dt_str, dt_fmt, &dt_tm) )
-    {
-        error_print("strptime(dt_str, dt_fmt, &dt_tm) "
-		    "can't convert received datetime string \"%s\" into tm "
-		    "structure properly", dt_str);
-	    exit(EXIT_FAILURE);
-    }
-
-//    printf("%s(): dt_tm.tm_sec (Seconds (0-60)) =\t%d\n", __func__, dt_tm.tm_sec);
-//    printf("%s(): dt_tm.tm_min (Minutes (0-59)) =\t%d\n", __func__, dt_tm.tm_min);
-//    printf("%s(): dt_tm.tm_hour (Hours (0-23)) =\t%d\n", __func__, dt_tm.tm_hour);
-//    printf("%s(): dt_tm.tm_mday (Day of the month (1-31)) =\t%d\n", __func__, dt_tm.tm_mday);
-//    printf("%s(): dt_tm.tm_mon (Month (0-11)) =\t%d\n", __func__, dt_tm.tm_mon);
-//    printf("%s(): dt_tm.tm_year (Year - 1900) =\t%d\n", __func__, dt_tm.tm_year);
-
-    // convert tm to time_t
-    if ( (dt_time_t = mktime(&dt_tm)) == -1 ) {
-        printf("mktime() returned -1. The specified broken-down dt(dt_time_t) cannot be "
-               "represented as calendar time a(seconds since Epoch)\n");
+    open_archive_file(ar, opts->input_file, loc);
+    ar->read_ahead = opts->read_ahead;
+    ar->io_stats = opts->io_stats;
+
+    if (!has_blk_index_stats(&ar->index))
+    {
+        error_print("%s requires an index of %s, build it by --build-index",
+                    opt, opts->input_file);
         exit(EXIT_FAILURE);
     }
-    //printf("convert_dt_str_to_epoch: dt_time_t = %d\n", dt_time_t);
-    
-
-    return dt_time_t;
 }
 
 
-// Function searches for a bit number of the nearest bz2 block starting from
-// current lseek position
-unsigned long long search_start_bit_of_bz2_blk(bunzip_data *bd)
+// Parses a --lines value "first:last"
+void parse_line_range(const char *str, cmd_opts *opts)
 {
-    // amount of bytes which was read to inbuf during one 'read' operation
-    int inbuf_read;
-    // amount of bytes which was read from inbuf in total
-    unsigned long long inbuf_read_total;
-    // input buffer where data is read from a file
-    unsigned char inbuf[BUFFER_SIZE];
-    // counter for bytes which is reading from ibuf
-    unsigned long long inbuf_byte_pos;
-    // 64 bits which are read from an input buffer. We search for a needle in
-    // this hay
-    unsigned long long hay;	
-    // all possible positions of bits of a needle within a hay
-    unsigned long long needle_shifted[9];
-    // all needed variants of masks. A mask ANDs with a hay
-    unsigned long long masks[9];
-    // magic sequence a new block is started from (BCD (pi))
-    unsigned long long const needle = 0x314159265359;
-   							// and compares with a needle
-    // byte number a needle was found in
-    unsigned long long position;
-
-    inbuf_read_total = 0;
-    hay = 0;
-    position = 0;
-
-    for (int i = 0; i <= 8; i++) {
-        needle_shifted[i] = needle << i;
-	    masks[i] = 0xffffffffffff << i;
-    }
-
-/* 	needle_shifted[0] =     0000000000000000001100010100000101011001001001100101001101011001
-	masks[0] =              0000000000000000111111111111111111111111111111111111111111111111
-
-	needle_shifted[1] =     0000000000000000011000101000001010110010010011001010011010110010
-	masks[1] =              0000000000000001111111111111111111111111111111111111111111111110
-
-	needle_shifted[2] =     0000000000000000110001010000010101100100100110010100110101100100
-	masks[2] =              0000000000000011111111111111111111111111111111111111111111111100
-
-	needle_shifted[3] =     0000000000000001100010100000101011001001001100101001101011001000
-	masks[3] =              0000000000000111111111111111111111111111111111111111111111111000
-
-	needle_shifted[4] =     0000000000000011000101000001010110010010011001010011010110010000
-	masks[4] =              0000000000001111111111111111111111111111111111111111111111110000
-
-	needle_shifted[5] =     0000000000000110001010000010101100100100110010100110101100100000
-	masks[5] =              0000000000011111111111111111111111111111111111111111111111100000
-
-	needle_shifted[6] =     0000000000001100010100000101011001001001100101001101011001000000
-	masks[6] =              0000000000111111111111111111111111111111111111111111111111000000
-
-	needle_shifted[7] =     0000000000011000101000001010110010010011001010011010110010000000
-	masks[7] =              0000000001111111111111111111111111111111111111111111111110000000
-
-	needle_shifted[8] =     0000000000110001010000010101100100100110010100110101100100000000
-	masks[8] =              0000000011111111111111111111111111111111111111111111111100000000 */
-
-/*    for (i = 0; i <= 8; i++)
-    {
-	printf("needle_shifted[%d] = \t%s\n", i, dec_to_bin_ll(needle_shifted[i]));
-	printf("masks[%d] = \t\t%s\n", i, dec_to_bin_ll(masks[i]));
-	putchar('\n');    
-    } */
-
-    // Search a needle starting from every next bit. Read BUFFER_SIZE bytes from
-    // an input file to an inbuf buffer.
-    while ((inbuf_read = read(bd->in_fd, inbuf, BUFFER_SIZE)) > 0)
-    {
-	// Take every byte from inbuf and put it into a hay. During every iteration
-    // the most right byte of a hay is shifted to the left and a new byte from
-    // inbuf is put to the hay. Inside hay shift every byte from right to left
-    // and is compared to every needle_shifted.
-	    for (inbuf_byte_pos = 0; inbuf_byte_pos < inbuf_read; inbuf_byte_pos++)
-	    {
-//	    printf("search_start_bit_of_bz2_blk: inbuf_read_total = %d\n", inbuf_read_total);
-//          printf("hay = (hay << 8) | inbuf[%d] = \t", inbuf_byte_pos);
-            
-            // Shift the content of hay one byte to the left and put a new byte
-            // from inbuf to the most right position
-	        hay = (hay << 8) | inbuf[inbuf_byte_pos];
-	        //printf("%40s\n", dec_to_bin_ll(hay));
-	        if (inbuf_byte_pos >= 6)
-	        {
-                for (int i = 0; i <= 8; i++)
-                {
-    //		    printf("hay = \t\t\t\t%s\n", dec_to_bin_ll(hay));
-    //		    printf("masks[%d] = \t\t\t%s\n", i, dec_to_bin_ll(masks[i]));
-    //		    printf("hay & masks[%d] = \t\t%s\n", i, dec_to_bin_ll(hay & masks[i]));
-    //		    printf("needle_shifted[%d] = \t\t%s\n", i, dec_to_bin_ll(needle_shifted[i]));
-
-                // if a needle was found, define correct position
-	            if ( (hay & masks[i]) == needle_shifted[i] )
-		        {
-		            if (i == 0) 
-                    {
-		                position = (inbuf_read_total + inbuf_byte_pos + 1 - 6) * 8;
-//			    printf("search_start_bit_of_bz2_blk: inbuf_read_total = %llu, inbuf_byte_pos = %llu\n", inbuf_read_total, inbuf_byte_pos);
-		            }
-		            else if (i > 0 && i <= 8) 
-                    {
-			            position = (inbuf_read_total + inbuf_byte_pos + 1 - 7) * 8 + 8 - i;
-			    //printf("search_start_bit_of_bz2_blk: position = (inbuf_read_total(%llu) + inbuf_byte_pos(%llu) + 1 - 7) * 8 + 8 - i(%d) = %lld\n", inbuf_read_total, inbuf_byte_pos, i, position);
-		            }
-		            else 
-                    {
-			            position = (inbuf_read_total + inbuf_byte_pos + 1 - 8) * 8 + 8 - i;
-//			    printf("search_start_bit_of_bz2_blk: inbuf_read_total = %llu, inbuf_byte_pos = %llu\n", inbuf_read_total, inbuf_byte_pos);
-		            }
-
-		        //printf("search_start_bit_of_bz2_blk: position = %llu\n", position);
-		        hay = 0; // to prevent from finding duplicates
-                        //printf("search_start_bit_of_bz2_blk: lseek position BEFORE lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET) = %lu, bd->cur_file_offset = %lu\n", lseek(bd->in_fd, 0, SEEK_CUR), bd->cur_file_offset);
-                    // set file offset back to the value which was before call
-                    // of this function. Because the found position is correct
-                    // relatively to that file offset.
-                    lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET);
-		        //break;
-                        //printf("search_start_bit_of_bz2_blk: lseek position BEFORE lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET) = %lu, bd->cur_file_offset = %lu\n", lseek(bd->in_fd, 0, SEEK_CUR), bd->cur_file_offset);
-                        //printf("search_start_bit_of_bz2_blk: lseek position AFTER lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET) = %lu, bd->cur_file_offset = %lu\n", lseek(bd->in_fd, 0, SEEK_CUR), bd->cur_file_offset);
-		        //printf("search_start_bit_of_bz2_blk: position = %llu bits\n\n", position);
-		        return position;
-		    }
-	        }
-	    }
-//	    putchar('\n');
-	}
-	inbuf_read_total += inbuf_read;
-        
+    char *end;
+
+    opts->from_line = strtoull(str, &end, 10);
+    if (*end == ':')
+        opts->to_line = strtoull(end + 1, &end, 10);
+
+    if (*end != '\0' || opts->from_line == 0 ||
+        opts->to_line < opts->from_line)
+    {
+        error_print("%s", "A value of --lines should be first:last line "
+                    "numbers from 1, first <= last");
+        exit(EXIT_FAILURE);
     }
 }
 
-// Get a string from a buf strarting from buf_pos
-char * get_str(char *buf, int *buf_pos, char *str)
+
+// Parses a --bytes value "offset:length"
+void parse_byte_range(const char *str, cmd_opts *opts)
 {
-    int str_pos = 0;
+    char *end;
 
-    // Current char is the newline char. So go to the first char of a string.
-    // (*buf_pos)   first dereference buf_pos pointer to get obuf_pos value
-    // ++           and then increment that value 
-    (*buf_pos)++;
+    opts->byte_offset = strtoull(str, &end, 10);
+    if (end != str && *end == ':')
+        opts->n_bytes = strtoull(end + 1, &end, 10);
 
-    //debug_print("buf[%d] = '%c'\n", *buf_pos, buf[*buf_pos]);
-    while ( buf[*buf_pos] != '\n' && buf[*buf_pos] != '\0' )
+    if (*end != '\0' || opts->n_bytes == 0)
     {
-        str[str_pos++] = buf[(*buf_pos)++];
-        //debug_print("buf[%d] = '%c'", *buf_pos, buf[*buf_pos]);
+        error_print("%s", "A value of --bytes should be offset:length of "
+                    "uncompressed data, length > 0");
+        exit(EXIT_FAILURE);
     }
-    //debug_print("str_pos = %d", str_pos);
-    
-    // Finish str with a null char
-    str[str_pos] = '\0';
+}
+
 
-    return str;
+// line_cb_t for build_file_index(): stops on the first line with a timestamp
+bool detect_dt_line_cb(const char *line, int line_len, void *cb_arg)
+{
+    return detect_dt_fmt(cb_arg, line, line_len);
 }
 
 
-bool is_dt_substr_in_str(  char * str, int str_len, char * test_substr,
-                        int test_substr_len, const char * dt_fmt)
+void print_index_progress(const blk_index_progress *progress)
 {
-    // Char position in a string
-    int str_pos;
-    // Char position in test datetime substring
-    int test_substr_pos;
-    // dt data structures opt_f, opt_to should be converted to
-    struct tm dt_tm = {0};
-
-    // Loop through a string
-    for (str_pos = 0; str_pos < str_len; str_pos++)
-    {
-        // Take test_substr_len chars from a string into test_substr[]. 
-        for (test_substr_pos = 0; test_substr_pos < test_substr_len; test_substr_pos++)
-        {
-            if (test_substr[test_substr_pos] == '\n')
-                return false;
+    fprintf(stderr, "\r%lu/%lu blocks, %.1f MB/s compressed, %.1f MB/s "
+            "uncompressed", progress->n_done, progress->n_blks,
+            progress->elapsed > 0 ?
+            progress->compressed_bytes / progress->elapsed / 1e6 : 0,
+            progress->elapsed > 0 ?
+            progress->uncompressed_bytes / progress->elapsed / 1e6 : 0);
+
+    if (progress->n_done == progress->n_blks)
+        fputc('\n', stderr);
+}
 
-            // copy a char from a string to test_substr
-            test_substr[test_substr_pos] = str[str_pos++];
-        }
 
-        // Add null char to the end of test_substr to make it C string
-        test_substr[test_substr_len] = '\0';
-    
-        if (strlen(test_substr) < test_substr_len) return false;
+// Serves the files of --file or --files by a daemon
+void serve_files(const cmd_opts *opts)
+{
+    daemon_opts d_opts;
+    file_set set;
+
+    memset(&d_opts, 0, sizeof(d_opts));
+    d_opts.open_opts.json_key = opts->json_key;
+    d_opts.open_opts.epoch = opts->epoch;
+    d_opts.open_opts.year = opts->last_year;
+    d_opts.open_opts.read_ahead = opts->read_ahead;
+    d_opts.n_threads = opts->n_threads;
+    d_opts.build_index = opts->build_index;
+    d_opts.cache_size = (unsigned long long)opts->cache_size * 1024 * 1024;
+
+    if (opts->input_file != NULL)
+    {
+        serve_archives(opts->serve, &opts->input_file, 1, &d_opts);
+        return;
+    }
 
-        //debug_print("obuf_pos = %d", obuf_pos);
-        //debug_print("test_substr = \"%s\"", test_substr);
+    // The files are opened by a daemon
+    read_file_set(&set, opts->input_files, NULL);
+    {
+        const char *paths[set.n_files];
 
-        // If test_substr doesn't match to the dt_fmt (strptime == NULL)
-        if ( strptime(test_substr, dt_fmt, &dt_tm) == NULL )
-        {
-            // Move str_pos test_substr_len chars back (i.e. to the char which
-            // is new start char. It is next char to the previous start char)
-            str_pos = str_pos - test_substr_len;
-            continue;
-        }
-        else
-        {
-            //printf("%s: first_dt_str_in_outbuf = %s\n", 
-            //    __func__, first_dt_str_in_outbuf);
-            return true;
-        }
+        for (int i = 0; i < set.n_files; i++)
+            paths[i] = set.files[i].path;
 
+        serve_archives(opts->serve, paths, set.n_files, &d_opts);
     }
+}
 
-    return false;
+
+// Runs the query of the options by a daemon of --connect
+bool run_daemon_query(const cmd_opts *opts)
+{
+    daemon_query query;
+    const char *grep[opts->grep.n_patterns + 1];
+
+    for (int i = 0; i < opts->grep.n_patterns; i++)
+        grep[i] = opts->grep.patterns[i].pattern;
+
+    query.file = opts->input_file;
+    query.from = opts->ranges[0].from;
+    query.to = opts->ranges[0].to;
+    query.grep = grep;
+    query.n_grep = opts->grep.n_patterns;
+    query.histogram = opts->histogram;
+    query.max_skew = opts->max_skew;
+
+    return query_daemon(opts->connect, &query, 1);
 }
 
 
 void usage(char * program_name)
 {
     printf("Usage: %s --from=\"datetime\" --to=\"datetime\""
-        " --file=/path/to/file.bz2\n", program_name);
-}
\ No newline at end of file
+        " [--from=\"datetime\" --to=\"datetime\" ...]"
+        " --file=/path/to/file.bz2\n"
+        "       %s --ranges-file=/path/to/ranges.txt"
+        " --file=/path/to/file.bz2\n"
+        "       %s --from=\"datetime\" --to=\"datetime\""
+        " --files=\"/path/to/app.log.*.bz2\" [--threads=N]"
+        " [--merge [--source-prefix]]\n"
+        "       %s --build-index [--threads=N] [--progress]"
+        " --file=/path/to/file.bz2\n"
+        "       %s --from=\"datetime\" --to=\"datetime\" --stream"
+        " < /path/to/file.bz2\n"
+        "       %s --lines=first:last --file=/path/to/file.bz2\n"
+        "       %s --tail=N --to=\"datetime\" --file=/path/to/file.bz2\n"
+        "       %s --bytes=offset:length --file=/path/to/file.bz2\n"
+        "       %s --serve=/path/to/socket [--threads=N] [--build-index]"
+        " [--cache-size=MB] --files=\"/path/to/*.bz2\"\n"
+        "       %s --connect=/path/to/socket --from=\"datetime\""
+        " --to=\"datetime\" --file=file.bz2\n"
+        "Options: [--exact] [--split-output=pattern | --output=file] [--plan]"
+        " [--json-key=key | --epoch] [--read-ahead=N] [--io-stats]\n"
+        "         [--grep=string ...] [--grep-regex=regex ...]"
+        " [--keyword=token ...] [--context=N]\n"
+        "         [--histogram=interval] [--sample=N] [--sample-lines=K]"
+        " [--max-skew=seconds] [--year=YYYY]\n"
+        "Index options: [--bloom[=uuid,num,word]] [--bloom-fp=rate]"
+        " [--bloom-max-size=bytes]\n",
+        program_name, program_name, program_name, program_name, program_name,
+        program_name, program_name, program_name, program_name, program_name);
+}
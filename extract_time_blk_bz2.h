@@ -0,0 +1,36 @@
+#ifndef __EXTRACT_TIME_BLK_BZ2_H__
+#define __EXTRACT_TIME_BLK_BZ2_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+#define BUFFER_SIZE 8192
+// Lines which are longer are truncated when they cross output buffers
+#define MAX_LINE_SIZE (1024 * 1024)
+#define FIRST_BLK_POS 32
+// find_blk_from() returns it if there is no block till EOF
+#define BLK_NOT_FOUND (~0ULL)
+
+// debug switch
+#define DEBUG 0
+
+// macro for debug printing
+#define debug_print(fmt, ...) \
+        do { if (DEBUG) fprintf(stderr, "%d:%s(): " fmt "\n",\
+                                __LINE__, __func__, __VA_ARGS__); } while (0)
+// macro for errors printing
+#define error_print(err_msg, ...) \
+	fprintf(stderr, "\nLine %d, function %s(), ERROR:\n" err_msg "\n", \
+				__LINE__, __func__, __VA_ARGS__);
+
+// Error trap of a thread. A fatal error of the engine exits the program, but
+// the functions of the library API set a trap, so an error returns to them
+// and a service which uses the library keeps running.
+extern __thread jmp_buf *error_trap;
+// macro for exiting on a fatal error (after error_print())
+#define fatal_exit() \
+        do { if (error_trap != NULL) longjmp(*error_trap, 1); \
+             exit(EXIT_FAILURE); } while (0)
+
+#endif
@@ -0,0 +1,423 @@
+// Queries over a set of rotated log files.
+
+
+#define _GNU_SOURCE                 // splice()
+#include <stdio.h>
+#include <stdlib.h>			// exit(), qsort()
+#include <string.h>			// strdup(), strcmp()
+#include <errno.h>			// strerror()
+#include <glob.h>			// glob()
+#include <dirent.h>			// opendir(), readdir()
+#include <sys/stat.h>		// stat()
+#include <unistd.h>			// lseek(), read()
+#include <fcntl.h>			// splice()
+#include <limits.h>			// PATH_MAX
+#include <pthread.h>
+#include <sys/socket.h>		// socketpair()
+#include "extract_time_blk_bz2.h"
+#include "bz2_archive.h"
+#include "blk_writer.h"
+#include "file_set.h"
+
+
+// A range of one file. Tasks are processed by a pool of threads, their output
+// is written in the order of tasks. A task writes to a socket, whose buffers
+// are a ring of a fixed size: a task which is ahead of the output waits till
+// the previous tasks are written instead of buffering its whole output.
+typedef struct
+{
+    const set_file *file;
+    // a range clamped to the first and last dates of a file
+    time_range range;
+    // an index of a range in a list of ranges
+    int range_num;
+    // the ends of a socket pair of an output of a task: a task writes to
+    // out_fd, the main thread reads in_fd
+    int out_fd, in_fd;
+    bool started;
+} file_task;
+
+typedef struct
+{
+    file_task *tasks;
+    int n_tasks;
+    // the next task which isn't taken by a thread yet
+    int next_task;
+    const file_set_opts *opts;
+    pthread_mutex_t lock;
+    // signaled when a task is started
+    pthread_cond_t task_started;
+} file_task_queue;
+
+
+static void add_set_file(file_set *, const char *, const dt_locator *);
+static void read_dir_files(file_set *, const char *, const dt_locator *);
+static int compare_set_files(const void *, const void *);
+static void * file_task_worker(void *);
+static void run_file_task(file_task_queue *, file_task *);
+static void copy_task_output(file_task_queue *, file_task *, int);
+
+
+void read_file_set(file_set *set, const char *pattern, const dt_locator *loc)
+{
+    struct stat pattern_stat;
+    glob_t glob_res;
+    int status;
+
+    memset(set, 0, sizeof(*set));
+
+    if (stat(pattern, &pattern_stat) == 0 && S_ISDIR(pattern_stat.st_mode))
+    {
+        read_dir_files(set, pattern, loc);
+    }
+    else
+    {
+        if ((status = glob(pattern, 0, NULL, &glob_res)) != 0)
+        {
+            error_print("No files match %s%s", pattern,
+                        status == GLOB_NOMATCH ? "" : " (glob() error)");
+            fatal_exit();
+        }
+
+        for (size_t i = 0; i < glob_res.gl_pathc; i++)
+            add_set_file(set, glob_res.gl_pathv[i], loc);
+
+        globfree(&glob_res);
+    }
+
+    if (set->n_files == 0)
+    {
+        error_print("No .bz2 files were found in %s", pattern);
+        fatal_exit();
+    }
+
+    qsort(set->files, set->n_files, sizeof(set_file), compare_set_files);
+}
+
+
+// Adds all the *.bz2 files of a directory
+static void read_dir_files(file_set *set, const char *dir_path,
+                           const dt_locator *loc)
+{
+    DIR *dir;
+    struct dirent *entry;
+    struct stat entry_stat;
+    char path[PATH_MAX];
+    int name_len;
+
+    if ((dir = opendir(dir_path)) == NULL)
+    {
+        error_print("Can't open the directory %s\n%s", dir_path,
+                    strerror(errno));
+        fatal_exit();
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        name_len = strlen(entry->d_name);
+        if (name_len <= 4 || strcmp(entry->d_name + name_len - 4, ".bz2") != 0)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir_path, entry->d_name);
+        if (stat(path, &entry_stat) != 0 || !S_ISREG(entry_stat.st_mode))
+            continue;
+
+        add_set_file(set, path, loc);
+    }
+
+    closedir(dir);
+}
+
+
+// Reads the first and last dates of a file and adds it to a set
+static void add_set_file(file_set *set, const char *path,
+                         const dt_locator *loc)
+{
+    bz2_archive ar;
+    set_file *file;
+    set_file *new_files;
+
+    if ((new_files = realloc(set->files, (set->n_files + 1) * sizeof(set_file)))
+        == NULL)
+    {
+        error_print("Can't allocate memory for %d files", set->n_files + 1);
+        fatal_exit();
+    }
+    set->files = new_files;
+    file = &set->files[set->n_files++];
+    memset(file, 0, sizeof(*file));
+
+    if ((file->path = strdup(path)) == NULL)
+    {
+        error_print("%s", "Can't allocate memory for a file path");
+        fatal_exit();
+    }
+
+    // Files of a daemon are opened by it
+    if (loc == NULL)
+        return;
+
+    // Only the first and the last blocks are uncompressed
+    open_archive(&ar, path, loc);
+    memcpy(file->first_date, ar.first_date, DT_STR_SIZE);
+    memcpy(file->last_date, ar.last_date, DT_STR_SIZE);
+    file->first_date_time_t = ar.first_date_time_t;
+    file->last_date_time_t = ar.last_date_time_t;
+    file->last_blk_pos = ar.last_blk_pos;
+    file->loc = ar.loc;
+    close_archive(&ar);
+
+    debug_print("%s: %s - %s", path, file->first_date, file->last_date);
+}
+
+
+static int compare_set_files(const void *a, const void *b)
+{
+    const set_file *file_a = a, *file_b = b;
+
+    if (file_a->first_date_time_t != file_b->first_date_time_t)
+        return file_a->first_date_time_t < file_b->first_date_time_t ? -1 : 1;
+
+    return strcmp(file_a->path, file_b->path);
+}
+
+
+void extract_file_set(const file_set *set, const dt_locator *loc,
+                      const time_range *ranges, int n_ranges,
+                      const file_set_opts *opts)
+{
+    file_task_queue queue = {0};
+    file_task *task;
+    int n_threads;
+    int task_num = 0;
+    int out_fd;
+
+    // A task for every file which overlaps a range. Ranges are sorted and
+    // files are sorted, so tasks are in the order of time.
+    queue.tasks = calloc(set->n_files * n_ranges, sizeof(file_task));
+    if (queue.tasks == NULL)
+    {
+        error_print("Can't allocate memory for %d tasks",
+                    set->n_files * n_ranges);
+        fatal_exit();
+    }
+
+    for (int i = 0; i < n_ranges; i++)
+        for (int j = 0; j < set->n_files; j++)
+        {
+            if (set->files[j].first_date_time_t > ranges[i].to_time_t ||
+                set->files[j].last_date_time_t < ranges[i].from_time_t)
+                continue;
+
+            // Boundaries outside a file are clamped to its dates
+            task = &queue.tasks[queue.n_tasks++];
+            task->file = &set->files[j];
+            task->range = ranges[i];
+            task->range_num = i;
+            if (task->range.from_time_t < task->file->first_date_time_t)
+            {
+                task->range.from_time_t = task->file->first_date_time_t;
+                task->range.from = task->file->first_date;
+            }
+            if (task->range.to_time_t > task->file->last_date_time_t)
+            {
+                task->range.to_time_t = task->file->last_date_time_t;
+                task->range.to = task->file->last_date;
+            }
+        }
+
+    if (queue.n_tasks == 0)
+    {
+        error_print("%s", "No files overlap the time ranges");
+        fatal_exit();
+    }
+
+    queue.opts = opts;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.task_started, NULL);
+
+    n_threads = opts->n_threads < queue.n_tasks ? opts->n_threads :
+                                                  queue.n_tasks;
+    if (n_threads < 1)
+        n_threads = 1;
+    pthread_t threads[n_threads];
+
+    for (int i = 0; i < n_threads; i++)
+        if (pthread_create(&threads[i], NULL, file_task_worker, &queue) != 0)
+        {
+            error_print("%s", "Can't create a thread");
+            fatal_exit();
+        }
+
+    // Write outputs of tasks in their order as soon as they are done
+    for (int i = 0; i < n_ranges; i++)
+    {
+        if (opts->split_output != NULL)
+        {
+            out_fd = open_range_output(opts->split_output, i + 1);
+        }
+        else
+        {
+            out_fd = 1;
+            if (n_ranges > 1)
+                write_range_header(out_fd, &ranges[i]);
+        }
+
+        for (; task_num < queue.n_tasks &&
+               queue.tasks[task_num].range_num == i; task_num++)
+            copy_task_output(&queue, &queue.tasks[task_num], out_fd);
+
+        if (out_fd != 1)
+            close(out_fd);
+    }
+
+    for (int i = 0; i < n_threads; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&queue.lock);
+    pthread_cond_destroy(&queue.task_started);
+    free(queue.tasks);
+}
+
+
+static void * file_task_worker(void *arg)
+{
+    file_task_queue *queue = arg;
+    file_task *task;
+    int fds[2];
+
+    for (;;)
+    {
+        pthread_mutex_lock(&queue->lock);
+        task = queue->next_task < queue->n_tasks ?
+               &queue->tasks[queue->next_task++] : NULL;
+        pthread_mutex_unlock(&queue->lock);
+
+        if (task == NULL)
+            return NULL;
+
+        // Tasks are taken in their order, so the task which output is being
+        // written is always run by a thread and the waiting tasks are after it
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        {
+            error_print("Can't create a socket pair\n%s", strerror(errno));
+            fatal_exit();
+        }
+
+        pthread_mutex_lock(&queue->lock);
+        task->in_fd = fds[0];
+        task->out_fd = fds[1];
+        task->started = true;
+        pthread_cond_broadcast(&queue->task_started);
+        pthread_mutex_unlock(&queue->lock);
+
+        run_file_task(queue, task);
+
+        // The end of an output
+        close(task->out_fd);
+    }
+}
+
+
+// Extracts a range of one file to the output socket of a task
+static void run_file_task(file_task_queue *queue, file_task *task)
+{
+    bz2_archive ar;
+    blk_writer writer;
+    off_t low = 0;
+
+    // The dates were already found by read_file_set()
+    open_archive_file(&ar, task->file->path, &task->file->loc);
+    memcpy(ar.first_date, task->file->first_date, DT_STR_SIZE);
+    memcpy(ar.last_date, task->file->last_date, DT_STR_SIZE);
+    ar.first_date_time_t = task->file->first_date_time_t;
+    ar.last_date_time_t = task->file->last_date_time_t;
+    ar.last_blk_pos = task->file->last_blk_pos;
+    ar.read_ahead = queue->opts->read_ahead;
+    ar.max_skew = queue->opts->max_skew;
+    ar.io_stats = queue->opts->io_stats;
+
+    init_blk_writer(&writer, task->out_fd, &ar.loc, queue->opts->exact,
+                    task->range.from_time_t, task->range.to_time_t);
+    if (queue->opts->grep != NULL)
+        set_blk_writer_grep(&writer, queue->opts->grep);
+
+    extract_range(&ar, &task->range, &writer, &low);
+
+    blk_writer_flush(&writer);
+    free_blk_writer(&writer);
+
+    // Whole blocks are ended not by a newline
+    if (!queue->opts->exact && queue->opts->grep == NULL)
+        write_all(task->out_fd, "\n", 1);
+
+    close_archive(&ar);
+}
+
+
+// Waits for a task to start and copies its output to fd as it comes
+static void copy_task_output(file_task_queue *queue, file_task *task, int fd)
+{
+    char buf[BUFFER_SIZE * 8];
+    int got;
+    ssize_t spliced;
+
+    pthread_mutex_lock(&queue->lock);
+    while (!task->started)
+        pthread_cond_wait(&queue->task_started, &queue->lock);
+    pthread_mutex_unlock(&queue->lock);
+
+    // A pipe gets the pages of a socket by splice() without a copy to user
+    // space
+    while ((spliced = splice(task->in_fd, NULL, fd, NULL,
+                             WRITER_OUT_BUFFER_SIZE, SPLICE_F_MOVE)) > 0)
+        ;
+
+    if (spliced == 0)
+    {
+        close(task->in_fd);
+        return;
+    }
+
+    // fd isn't a pipe
+    if (errno != EINVAL && errno != ESPIPE)
+    {
+        error_print("splice() of the output of a task failed\n%s",
+                    strerror(errno));
+        fatal_exit();
+    }
+
+    while ((got = read(task->in_fd, buf, sizeof(buf))) > 0)
+        write_all(fd, buf, got);
+
+    if (got < 0)
+    {
+        error_print("Can't read the output of a task\n%s", strerror(errno));
+        fatal_exit();
+    }
+
+    close(task->in_fd);
+}
+
+
+time_t get_file_set_last_date(const file_set *set)
+{
+    time_t last_date_time_t = set->files[0].last_date_time_t;
+
+    for (int i = 1; i < set->n_files; i++)
+        if (set->files[i].last_date_time_t > last_date_time_t)
+            last_date_time_t = set->files[i].last_date_time_t;
+
+    return last_date_time_t;
+}
+
+
+void free_file_set(file_set *set)
+{
+    for (int i = 0; i < set->n_files; i++)
+        free(set->files[i].path);
+
+    free(set->files);
+    set->files = NULL;
+    set->n_files = 0;
+}
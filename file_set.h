@@ -0,0 +1,61 @@
+#ifndef __FILE_SET_H__
+#define __FILE_SET_H__
+
+#include <stdbool.h>        // bool type
+#include <time.h>           // time_t
+#include <sys/types.h>      // off_t
+#include "dt_locator.h"
+#include "time_range.h"
+#include "grep_filter.h"
+
+// A file of a set of rotated logs and its first and last dates
+typedef struct
+{
+    char *path;
+    char first_date[DT_STR_SIZE], last_date[DT_STR_SIZE];
+    time_t first_date_time_t, last_date_time_t;
+    // absolute bit position of the last block
+    unsigned long long last_blk_pos;
+    // the locator of a query with the years which were inferred for the lines
+    // of a file (a format without a year)
+    dt_locator loc;
+} set_file;
+
+// Files of rotated logs sorted by their first dates
+typedef struct
+{
+    set_file *files;
+    int n_files;
+} file_set;
+
+// Options of an extraction from a set of files
+typedef struct
+{
+    bool exact;
+    // a pattern of output file names of ranges or NULL for stdout
+    const char *split_output;
+    // the maximum amount of files which are processed at the same time
+    int n_threads;
+    // blocks which are read ahead of an extraction of every file
+    int read_ahead;
+    // print I/O statistics of every file
+    bool io_stats;
+    // a content filter of lines (--grep) or NULL
+    const grep_filter *grep;
+    // seconds by which timestamps of lines can be out of order (--max-skew)
+    int max_skew;
+} file_set_opts;
+
+// Finds the files of a glob pattern or of a directory (*.bz2 files) and their
+// first and last dates. Only the paths are found if a locator is NULL, the
+// files are sorted by them then.
+void read_file_set(file_set *, const char *, const dt_locator *);
+// Extracts time ranges from all the files which overlap them. The output is
+// in the order of time.
+void extract_file_set(const file_set *, const dt_locator *, const time_range *,
+                      int, const file_set_opts *);
+// Returns the latest of the last dates of the files of a set
+time_t get_file_set_last_date(const file_set *);
+void free_file_set(file_set *);
+
+#endif
@@ -0,0 +1,313 @@
+// Content filter of extracted lines (--grep, --grep-regex).
+
+
+#include <stdio.h>
+#include <stdlib.h>			// exit(), realloc()
+#include <string.h>			// strlen(), memcpy()
+#include "extract_time_blk_bz2.h"
+#include "simd_search.h"
+#include "blk_bloom.h"
+#include "grep_filter.h"
+
+
+static void find_regex_literal(grep_pattern *);
+static void find_pattern_tokens(grep_pattern *);
+static bool match_keyword(const grep_pattern *, const char *, int);
+static bool match_regex(const char *, const char *, const char *);
+static bool match_regex_here(const char *, const char *, const char *,
+                             const char *);
+static bool match_regex_star(const char *, const char *, const char *,
+                             const char *, const char *);
+static int regex_char_len(const char *);
+
+
+void add_grep_pattern(grep_filter *filter, const char *pattern, int type)
+{
+    grep_pattern *new_patterns, *p;
+
+    if ((new_patterns = realloc(filter->patterns, (filter->n_patterns + 1) *
+                                sizeof(grep_pattern))) == NULL)
+    {
+        error_print("Can't allocate memory for %d patterns",
+                    filter->n_patterns + 1);
+        fatal_exit();
+    }
+    filter->patterns = new_patterns;
+
+    // A pattern which failed to be added can be freed by free_grep_filter()
+    p = &filter->patterns[filter->n_patterns++];
+    memset(p, 0, sizeof(*p));
+    p->pattern = pattern;
+    p->len = strlen(pattern);
+    p->type = type;
+
+    if ((p->literal = malloc(p->len + 1)) == NULL)
+    {
+        error_print("Can't allocate %d bytes for a pattern", p->len + 1);
+        fatal_exit();
+    }
+
+    if (type == GREP_REGEX)
+        find_regex_literal(p);
+    else
+    {
+        memcpy(p->literal, pattern, p->len);
+        p->literal_len = p->len;
+    }
+
+    find_pattern_tokens(p);
+}
+
+
+const char * find_grep_candidate(const grep_filter *filter, const char **hits,
+                                 const char *from, const char *end)
+{
+    const grep_pattern *p;
+    const char *first = NULL;
+
+    for (int i = 0; i < filter->n_patterns; i++)
+    {
+        p = &filter->patterns[i];
+
+        // Every line is a candidate of a regex without a literal part
+        if (p->literal_len == 0)
+            return from;
+
+        // The cached occurrence is before the search start, search again.
+        // end means there is no occurrence.
+        if (hits[i] == NULL || hits[i] < from)
+        {
+            hits[i] = simd_memmem(from, end - from, p->literal,
+                                  p->literal_len);
+            if (hits[i] == NULL)
+                hits[i] = end;
+        }
+
+        if (hits[i] != end && (first == NULL || hits[i] < first))
+            first = hits[i];
+    }
+
+    return first;
+}
+
+
+bool grep_match_line(const grep_filter *filter, const char *line, int line_len)
+{
+    const grep_pattern *p;
+
+    for (int i = 0; i < filter->n_patterns; i++)
+    {
+        p = &filter->patterns[i];
+
+        if (p->literal_len > 0 &&
+            simd_memmem(line, line_len, p->literal, p->literal_len) == NULL)
+            continue;
+
+        if (p->type == GREP_KEYWORD ? match_keyword(p, line, line_len) :
+            p->type == GREP_LITERAL ||
+            match_regex(p->pattern, line, line + line_len))
+            return true;
+    }
+
+    return false;
+}
+
+
+bool grep_may_match_blk(const grep_filter *filter, const unsigned char *bloom,
+                        int bloom_size, int n_hashes, int tokens)
+{
+    const grep_pattern *p;
+    bool may_match;
+
+    for (int i = 0; i < filter->n_patterns; i++)
+    {
+        p = &filter->patterns[i];
+        may_match = true;
+
+        // Tokens of the classes which are not in a filter can't be checked
+        for (int j = 0; j < p->n_tokens && may_match; j++)
+            if (p->token_classes[j] & tokens)
+                may_match = bloom_may_contain(bloom, bloom_size, n_hashes,
+                                              p->token_hashes[j]);
+
+        if (may_match)
+            return true;
+    }
+
+    return false;
+}
+
+
+void free_grep_filter(grep_filter *filter)
+{
+    for (int i = 0; i < filter->n_patterns; i++)
+    {
+        free(filter->patterns[i].literal);
+        free(filter->patterns[i].token_hashes);
+        free(filter->patterns[i].token_classes);
+    }
+
+    free(filter->patterns);
+    filter->patterns = NULL;
+    filter->n_patterns = 0;
+}
+
+
+// Finds the longest run of chars of a regex which every match contains: chars
+// which are not special and are not followed by '*'
+static void find_regex_literal(grep_pattern *p)
+{
+    char run[p->len + 1];
+    int run_len = 0, char_len;
+    const char *re = p->pattern;
+
+    p->literal_len = 0;
+
+    while (true)
+    {
+        char_len = regex_char_len(re);
+
+        // A run is ended by a special char, a starred char or the end
+        if (*re == '\0' || re[char_len] == '*' || *re == '.' || *re == '^' ||
+            *re == '$')
+        {
+            if (run_len > p->literal_len)
+            {
+                memcpy(p->literal, run, run_len);
+                p->literal_len = run_len;
+            }
+            run_len = 0;
+
+            if (*re == '\0')
+                break;
+            re += char_len + (re[char_len] == '*');
+            continue;
+        }
+
+        run[run_len++] = re[char_len - 1];
+        re += char_len;
+    }
+}
+
+
+// Finds the tokens of a literal part of a pattern which are whole tokens of
+// a matched line. A token at a bound of a literal can be a part of a longer
+// token, except the bounds of a keyword.
+static void find_pattern_tokens(grep_pattern *p)
+{
+    const char *lit = p->literal;
+    int len = p->literal_len, start, end;
+    bool is_keyword = p->type == GREP_KEYWORD;
+
+    p->n_tokens = 0;
+    if ((p->token_hashes = malloc((len / 2 + 1) *
+                                  sizeof(unsigned long long))) == NULL ||
+        (p->token_classes = malloc((len / 2 + 1) * sizeof(int))) == NULL)
+    {
+        error_print("%s", "Can't allocate memory for the tokens of a pattern");
+        fatal_exit();
+    }
+
+    for (start = 0; start < len; start = end + 1)
+    {
+        while (start < len && !is_token_char(lit[start]))
+            start++;
+        for (end = start; end < len && is_token_char(lit[end]); end++)
+            ;
+
+        if (end - start < BLOOM_MIN_TOKEN_LEN ||
+            (!is_keyword && (start == 0 || end == len)))
+            continue;
+
+        p->token_hashes[p->n_tokens] = hash_token(lit + start, end - start);
+        p->token_classes[p->n_tokens++] = token_class(lit + start,
+                                                      end - start);
+    }
+}
+
+
+// Searches a keyword which isn't a part of a longer token
+static bool match_keyword(const grep_pattern *p, const char *line,
+                          int line_len)
+{
+    const char *line_end = line + line_len, *pos = line;
+
+    while ((pos = simd_memmem(pos, line_end - pos, p->pattern, p->len)) !=
+           NULL)
+    {
+        if ((pos == line || !is_token_char(pos[-1]) ||
+             !is_token_char(p->pattern[0])) &&
+            (pos + p->len == line_end || !is_token_char(pos[p->len]) ||
+             !is_token_char(p->pattern[p->len - 1])))
+            return true;
+
+        pos++;
+    }
+
+    return false;
+}
+
+
+// The length of a char of a regex: a quoted char has 2 chars
+static int regex_char_len(const char *re)
+{
+    return re[0] == '\\' && re[1] != '\0' ? 2 : 1;
+}
+
+
+// A matcher of "The Practice of Programming" (Kernighan, Pike) for a string
+// which isn't null terminated and with quoted chars
+static bool match_regex(const char *re, const char *str, const char *end)
+{
+    if (re[0] == '^')
+        return match_regex_here(re + 1, str, end, str);
+
+    do
+    {
+        if (match_regex_here(re, str, end, str))
+            return true;
+    } while (str++ < end);
+
+    return false;
+}
+
+
+static bool match_regex_here(const char *re, const char *str, const char *end,
+                             const char *start)
+{
+    int char_len;
+
+    if (re[0] == '\0')
+        return true;
+
+    char_len = regex_char_len(re);
+
+    if (re[char_len] == '*')
+        return match_regex_star(re, re + char_len + 1, str, end, start);
+
+    if (re[0] == '$' && re[1] == '\0')
+        return str == end;
+
+    if (str < end && ((re[0] == '.' && char_len == 1) ||
+                      re[char_len - 1] == *str))
+        return match_regex_here(re + char_len, str + 1, end, start);
+
+    return false;
+}
+
+
+// Matches c* (c is the char at re) and then the rest of a regex
+static bool match_regex_star(const char *re, const char *rest, const char *str,
+                             const char *end, const char *start)
+{
+    int char_len = regex_char_len(re);
+    bool is_any = re[0] == '.' && char_len == 1;
+
+    do
+    {
+        if (match_regex_here(rest, str, end, start))
+            return true;
+    } while (str < end && (is_any || *str == re[char_len - 1]) && str++ < end);
+
+    return false;
+}
@@ -0,0 +1,60 @@
+#ifndef __GREP_FILTER_H__
+#define __GREP_FILTER_H__
+
+#include <stdbool.h>        // bool type
+
+// Types of patterns
+// --grep: a literal string
+#define GREP_LITERAL 0
+// --grep-regex: a subset of the syntax: c (a char), \c (a quoted char), . (any
+// char), * (zero or more of the previous char), ^ and $ (the start and the
+// end of a line)
+#define GREP_REGEX 1
+// --keyword: a literal string which starts and ends at the bounds of tokens
+// (is_token_char())
+#define GREP_KEYWORD 2
+
+typedef struct
+{
+    const char *pattern;
+    int len;
+    // GREP_* type
+    int type;
+    // a literal part of a pattern which is searched in uncompressed buffers
+    // (a whole literal pattern or the longest literal run of a regex). Lines
+    // without it can't match. Its length is 0 if a regex has no literal run.
+    char *literal;
+    int literal_len;
+    // whole tokens which every matched line contains. They are checked by the
+    // Bloom filters of blocks.
+    unsigned long long *token_hashes;
+    int *token_classes;
+    int n_tokens;
+} grep_pattern;
+
+// Lines which match any of the patterns are written
+typedef struct
+{
+    grep_pattern *patterns;
+    int n_patterns;
+    // --context: lines which are written before and after a matched line
+    int context;
+} grep_filter;
+
+void add_grep_pattern(grep_filter *, const char *, int);
+// Finds the first candidate of a match in [from, end): an occurrence of a
+// literal part of any pattern. hits are the next occurrences of the patterns
+// (n_patterns pointers) which are cached between the calls for the same
+// buffer, they are set to NULL before the first call. Returns NULL if there
+// is no candidate.
+const char * find_grep_candidate(const grep_filter *, const char **,
+                                 const char *, const char *);
+// Checks if a line (without '\n') matches any of the patterns
+bool grep_match_line(const grep_filter *, const char *, int);
+// Checks by the Bloom filter of a block (of size bytes, n_hashes hashes of
+// the tokens of classes) if a line of a block can match any of the patterns
+bool grep_may_match_blk(const grep_filter *, const unsigned char *, int, int,
+                        int);
+void free_grep_filter(grep_filter *);
+
+#endif
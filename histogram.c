@@ -0,0 +1,175 @@
+// Aggregation of the lines of a time range to per-interval counts.
+
+
+#include <stdio.h>
+#include <stdlib.h>			// exit(), calloc(), strtol()
+#include <string.h>			// strlen()
+#include "extract_time_blk_bz2.h"
+#include "blk_writer.h"
+#include "histogram.h"
+
+
+static int find_bucket(const histogram *, time_t);
+
+
+int parse_histogram_interval(const char *str)
+{
+    char *end;
+    long value = strtol(str, &end, 10);
+
+    if (end == str || value <= 0)
+        return 0;
+
+    if (*end == '\0' || strcmp(end, "s") == 0)
+        return value;
+    if (strcmp(end, "m") == 0)
+        return value * 60;
+    if (strcmp(end, "h") == 0)
+        return value * 3600;
+    if (strcmp(end, "d") == 0)
+        return value * 86400;
+
+    return 0;
+}
+
+
+void init_histogram(histogram *hist, time_t from_time_t, time_t to_time_t,
+                    int interval)
+{
+    struct tm from_tm;
+    long long n_buckets;
+
+    memset(hist, 0, sizeof(*hist));
+    hist->from_time_t = from_time_t;
+    hist->to_time_t = to_time_t;
+    hist->interval = interval;
+
+    // Align the intervals to the local time
+    localtime_r(&from_time_t, &from_tm);
+    hist->base_time_t = from_time_t -
+        ((from_time_t + from_tm.tm_gmtoff) % interval + interval) % interval;
+
+    n_buckets = (to_time_t - hist->base_time_t) / interval + 1;
+    if (n_buckets > HISTOGRAM_MAX_BUCKETS)
+    {
+        error_print("A time range has more than %d intervals of %d seconds",
+                    HISTOGRAM_MAX_BUCKETS, interval);
+        fatal_exit();
+    }
+    hist->n_buckets = n_buckets;
+
+    if ((hist->n_lines = calloc(n_buckets, sizeof(unsigned long long))) ==
+        NULL ||
+        (hist->bytes = calloc(n_buckets, sizeof(unsigned long long))) == NULL)
+    {
+        error_print("Can't allocate memory for %d intervals", hist->n_buckets);
+        fatal_exit();
+    }
+}
+
+
+void add_histogram_line(const char *line, int line_len, time_t line_time_t,
+                        void *cb_arg)
+{
+    histogram *hist = cb_arg;
+    int bucket = find_bucket(hist, line_time_t);
+
+    hist->n_lines[bucket]++;
+    hist->bytes[bucket] += line_len + 1;
+}
+
+
+bool add_histogram_blk(const blk_index_entry *entry,
+                       const blk_index_entry *prev_entry, int line_len,
+                       void *cb_arg)
+{
+    histogram *hist = cb_arg;
+    int bucket;
+
+    if ((entry->flags & (BLK_INDEX_STATS | BLK_INDEX_FIRST)) !=
+        (BLK_INDEX_STATS | BLK_INDEX_FIRST))
+        return false;
+
+    // The first line which ends in a block started in the previous one
+    if (prev_entry != NULL && !(prev_entry->flags & BLK_INDEX_LAST))
+        return false;
+
+    if (entry->min_dt_time_t < hist->from_time_t ||
+        entry->max_dt_time_t > hist->to_time_t ||
+        (prev_entry != NULL && prev_entry->last_dt_time_t < hist->from_time_t))
+        return false;
+
+    bucket = find_bucket(hist, entry->min_dt_time_t);
+    if (bucket != find_bucket(hist, entry->max_dt_time_t) ||
+        (prev_entry != NULL &&
+         bucket != find_bucket(hist, prev_entry->last_dt_time_t)))
+        return false;
+
+    // The beginning of the first line was uncompressed with the previous
+    // block, the rest of it is in the size of a block
+    hist->n_lines[bucket] += entry->n_lines;
+    hist->bytes[bucket] += entry->size + line_len;
+
+    return true;
+}
+
+
+void write_histogram(int fd, const histogram *hist, const char *dt_fmt)
+{
+    char line[BUFFER_SIZE];
+    int line_len;
+
+    for (int i = 0; i < hist->n_buckets; i++)
+    {
+        line_len = format_histogram_bucket(hist, i, dt_fmt, line,
+                                           sizeof(line));
+        write_all(fd, line, line_len);
+    }
+}
+
+
+int format_histogram_bucket(const histogram *hist, int bucket,
+                            const char *dt_fmt, char *line, int line_size)
+{
+    char dt_str[DT_STR_SIZE];
+    time_t bucket_time_t;
+    struct tm bucket_tm;
+
+    bucket_time_t = hist->base_time_t + (time_t)bucket * hist->interval;
+
+    if (dt_fmt != NULL)
+    {
+        localtime_r(&bucket_time_t, &bucket_tm);
+        strftime(dt_str, sizeof(dt_str), dt_fmt, &bucket_tm);
+    }
+    else
+        snprintf(dt_str, sizeof(dt_str), "%lld", (long long)bucket_time_t);
+
+    snprintf(line, line_size, "%s %llu %llu\n", dt_str, hist->n_lines[bucket],
+             hist->bytes[bucket]);
+
+    return strlen(line);
+}
+
+
+void free_histogram(histogram *hist)
+{
+    free(hist->n_lines);
+    free(hist->bytes);
+    hist->n_lines = hist->bytes = NULL;
+}
+
+
+// Lines out of the range can't be passed by an exact writer, the check is
+// for safety
+static int find_bucket(const histogram *hist, time_t line_time_t)
+{
+    long long bucket = (line_time_t - hist->base_time_t) / hist->interval;
+
+    if (bucket < 0)
+        return 0;
+    if (bucket >= hist->n_buckets)
+        return hist->n_buckets - 1;
+
+    return bucket;
+}
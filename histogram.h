@@ -0,0 +1,43 @@
+#ifndef __HISTOGRAM_H__
+#define __HISTOGRAM_H__
+
+#include <stdbool.h>        // bool type
+#include <time.h>           // time_t
+#include "blk_index.h"
+
+// The maximal amount of intervals of a histogram
+#define HISTOGRAM_MAX_BUCKETS (10 * 1000 * 1000)
+
+// Line counts and bytes per interval of a time range (--histogram). The
+// intervals are aligned to the local time, e.g. to the start of a minute.
+typedef struct
+{
+    time_t from_time_t, to_time_t;
+    int interval;
+    // the start of the first interval
+    time_t base_time_t;
+    unsigned long long *n_lines, *bytes;
+    int n_buckets;
+} histogram;
+
+// Parses an interval of a number and a unit (s, m, h, d). Returns seconds or
+// 0 if a value is malformed.
+int parse_histogram_interval(const char *);
+void init_histogram(histogram *, time_t, time_t, int);
+// Line callback of a writer (blk_line_cb_t) which counts a line
+void add_histogram_line(const char *, int, time_t, void *);
+// Block callback of a writer (blk_count_cb_t) which counts all the lines
+// which end in a block by its index entry if all of them are in one interval
+// of the range
+bool add_histogram_blk(const blk_index_entry *, const blk_index_entry *, int,
+                       void *);
+// Writes "TIME LINES BYTES" lines of all the intervals. Times are formatted
+// by dt_fmt, epoch numbers are written if it's NULL.
+void write_histogram(int, const histogram *, const char *);
+// Formats the "TIME LINES BYTES" line of an interval to a buffer of a size.
+// Returns the length of a line.
+int format_histogram_bucket(const histogram *, int, const char *, char *,
+                            int);
+void free_histogram(histogram *);
+
+#endif
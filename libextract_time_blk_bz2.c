@@ -0,0 +1,633 @@
+// Library API: handles of archives and pull iterators of range queries over
+// the engine of bz2_archive.c.
+
+
+#define _GNU_SOURCE			// strptime(), strdup()
+#include <stdio.h>
+#include <stdlib.h>			// malloc(), free()
+#include <string.h>			// memchr(), strdup()
+#include <time.h>			// strptime()
+#include <fcntl.h>			// open()
+#include <unistd.h>			// read(), close()
+#include <setjmp.h>
+#include <sys/stat.h>		// fstat()
+#include "extract_time_blk_bz2.h"
+#include "dt_locator.h"
+#include "bz2_archive.h"
+#include "blk_index.h"
+#include "blk_writer.h"
+#include "grep_filter.h"
+#include "blk_cache.h"
+#include "libextract_time_blk_bz2.h"
+
+// Sets the error trap of a thread in an API function. A fatal error of the
+// engine returns ETB_ERR_FAILED from the function.
+#define set_error_trap(trap) \
+        do { if (setjmp(trap) != 0) { error_trap = NULL; \
+                                      return ETB_ERR_FAILED; } \
+             error_trap = &(trap); } while (0)
+
+__thread jmp_buf *error_trap;
+
+struct etb_archive
+{
+    bz2_archive ar;
+    // a copy of the path which ar refers to
+    char *path;
+    // a shared cache of uncompressed blocks (or NULL) and the device and the
+    // inode of a file in it
+    etb_blk_cache *blk_cache;
+    dev_t dev;
+    ino_t ino;
+};
+
+struct etb_blk_cache
+{
+    blk_cache cache;
+};
+
+// A state of extract_range() between the calls of an iterator
+struct etb_query
+{
+    etb_archive *archive;
+    // a range clamped to the dates of a file
+    time_range range;
+    grep_filter grep;
+    // the first block of a range was searched
+    bool started;
+    // byte from which the search of the first block starts
+    off_t low;
+    // absolute positions of the next block to uncompress (BLK_NOT_FOUND
+    // after the last one) and of the previous one
+    unsigned long long blk_pos, prev_blk_pos;
+    // the next block is after a range, only the end of the last line of a
+    // range can be there
+    bool next_after_range;
+    // the last uncompressed block and the position of its next line
+    decoded_blk_cache blk;
+    int line_pos;
+    // a line which crosses blocks
+    char *line;
+    int line_len, line_size;
+    // timestamp of the current line (or of the previous one if it has none)
+    time_t line_time_t;
+    bool has_line_time;
+    // a line after a range (+ max_skew) was met or the file is over
+    bool done;
+};
+
+
+static int check_bz2_file(const char *);
+static int parse_time(const etb_archive *, const char *, time_t, time_t *);
+static bool detect_fmt_line_cb(const char *, int, void *);
+static int decode_next_blk(etb_query *);
+static bool is_query_line(etb_query *, const char *, int);
+
+
+int etb_open(const char *path, const etb_open_opts *opts,
+             etb_archive **archive)
+{
+    etb_open_opts def_opts = {0};
+    etb_archive *a;
+    bz2_archive detect_ar;
+    dt_locator loc;
+    struct stat file_stat;
+    jmp_buf trap;
+    int status;
+
+    *archive = NULL;
+    if (opts == NULL)
+        opts = &def_opts;
+
+    if ((status = check_bz2_file(path)) != ETB_OK)
+        return status;
+
+    if ((a = calloc(1, sizeof(*a))) == NULL ||
+        (a->path = strdup(path)) == NULL)
+    {
+        free(a);
+        return ETB_ERR_FAILED;
+    }
+
+    // A fatal error in the middle of the opening frees what was opened
+    memset(&detect_ar, 0, sizeof(detect_ar));
+    if (setjmp(trap) != 0)
+    {
+        error_trap = NULL;
+        release_archive(&detect_ar);
+        release_archive(&a->ar);
+        free(a->path);
+        free(a);
+        return ETB_ERR_FAILED;
+    }
+    error_trap = &trap;
+
+    if (opts->json_key != NULL)
+        init_json_dt_locator(&loc, opts->json_key, NULL);
+    else if (opts->epoch)
+        init_epoch_dt_locator(&loc);
+    else
+        init_text_dt_locator(&loc, NULL, 0);
+    loc.last_year = opts->year;
+
+    // A datetime format is detected by the first block as by the CLI
+    if (!opts->epoch)
+    {
+        open_archive_file(&detect_ar, a->path, &loc);
+        for_each_line_in_blk(FIRST_BLK_POS, detect_ar.bd, detect_fmt_line_cb,
+                             &loc);
+        close_archive(&detect_ar);
+
+        if (loc.dt_fmt == NULL && opts->json_key == NULL)
+        {
+            error_trap = NULL;
+            free(a->path);
+            free(a);
+            return ETB_ERR_NO_TIMESTAMP;
+        }
+    }
+
+    open_archive(&a->ar, a->path, &loc);
+    if (opts->read_ahead > 0)
+        a->ar.read_ahead = opts->read_ahead;
+
+    if (fstat(a->ar.bd->in_fd, &file_stat) == 0)
+    {
+        a->dev = file_stat.st_dev;
+        a->ino = file_stat.st_ino;
+    }
+
+    error_trap = NULL;
+    *archive = a;
+
+    return ETB_OK;
+}
+
+
+int etb_attach_index(etb_archive *a, int n_threads)
+{
+    blk_index index;
+    dt_locator loc;
+    int read_ahead;
+    jmp_buf trap;
+    // the archive is being opened again, it's changed after setjmp()
+    volatile bool reopening = false;
+
+    if (a->ar.index.complete)
+        return ETB_OK;
+
+    // A fatal error of a build (of any of its threads) or of a saving leaves
+    // the archive open as it was. An archive which failed to be opened again
+    // is released, the handle can only be closed then.
+    memset(&index, 0, sizeof(index));
+    if (setjmp(trap) != 0)
+    {
+        error_trap = NULL;
+        free_blk_index(&index);
+        if (reopening)
+            release_archive(&a->ar);
+        return ETB_ERR_FAILED;
+    }
+    error_trap = &trap;
+
+    build_blk_index(&index, a->path, &a->ar.loc, n_threads > 0 ? n_threads : 1,
+                    NULL, NULL);
+    if (!write_blk_index(&index, a->path, &a->ar.loc))
+    {
+        error_trap = NULL;
+        free_blk_index(&index);
+        return ETB_ERR_INDEX;
+    }
+    free_blk_index(&index);
+
+    // The archive is opened again with the new index, the years of its
+    // locator are already anchored
+    loc = a->ar.loc;
+    read_ahead = a->ar.read_ahead;
+    close_archive(&a->ar);
+    reopening = true;
+    open_archive(&a->ar, a->path, &loc);
+    a->ar.read_ahead = read_ahead;
+
+    error_trap = NULL;
+
+    return a->ar.index.complete ? ETB_OK : ETB_ERR_INDEX;
+}
+
+
+void etb_archive_dates(const etb_archive *a, time_t *first, time_t *last)
+{
+    *first = a->ar.first_date_time_t;
+    *last = a->ar.last_date_time_t;
+}
+
+
+const char * etb_dt_format(const etb_archive *a)
+{
+    return a->ar.loc.dt_fmt;
+}
+
+
+int etb_parse_time(const etb_archive *a, const char *str, time_t *t)
+{
+    return parse_time(a, str, a->ar.last_date_time_t, t);
+}
+
+
+int etb_parse_range(const etb_archive *a, const char *from, const char *to,
+                    time_t *from_t, time_t *to_t)
+{
+    int status;
+
+    if ((status = parse_time(a, from, a->ar.last_date_time_t, from_t)) !=
+        ETB_OK)
+        return status;
+
+    // A year later is the same from (as --to of the CLI)
+    return parse_time(a, to, *from_t + 365 * 24 * 60 * 60 - 1, to_t);
+}
+
+
+// Converts a datetime string in the format of a file or an epoch number to
+// epoch time. A value without a year is in the latest year which isn't after
+// not_after.
+static int parse_time(const etb_archive *a, const char *str, time_t not_after,
+                      time_t *t)
+{
+    const dt_locator *loc = &a->ar.loc;
+    struct tm tm = {0};
+    int len = strlen(str);
+
+    if (len > 0 && parse_epoch(str, len, t) == len)
+        return ETB_OK;
+
+    if (loc->dt_fmt == NULL || strptime(str, loc->dt_fmt, &tm) == NULL)
+        return ETB_ERR_DATETIME;
+
+    if (is_dt_fmt_without_year(loc->dt_fmt))
+    {
+        *t = convert_dt_str_to_recent_epoch(str, loc->dt_fmt, not_after);
+        return ETB_OK;
+    }
+
+    return convert_loc_dt_to_epoch(loc, str, t) ? ETB_OK : ETB_ERR_DATETIME;
+}
+
+
+int etb_query_range(etb_archive *a, time_t from, time_t to,
+                    const etb_query_opts *opts, etb_query **query)
+{
+    etb_query *q;
+    jmp_buf trap;
+
+    *query = NULL;
+
+    if (from > to)
+        return ETB_ERR_RANGE;
+
+    if ((q = calloc(1, sizeof(*q))) == NULL)
+        return ETB_ERR_FAILED;
+
+    q->archive = a;
+    q->range.from = q->range.to = "";
+    q->range.from_time_t = from > a->ar.first_date_time_t ?
+                           from : a->ar.first_date_time_t;
+    q->range.to_time_t = to < a->ar.last_date_time_t ?
+                         to : a->ar.last_date_time_t;
+    q->prev_blk_pos = BLK_NOT_FOUND;
+    q->blk.blk_pos = BLK_NOT_FOUND;
+
+    // A range outside a file is empty
+    if (from > a->ar.last_date_time_t || to < a->ar.first_date_time_t)
+        q->done = true;
+
+    if (opts != NULL)
+    {
+        // A query which failed to be made is freed
+        if (setjmp(trap) != 0)
+        {
+            error_trap = NULL;
+            etb_free_query(q);
+            return ETB_ERR_FAILED;
+        }
+        error_trap = &trap;
+
+        a->ar.max_skew = opts->max_skew;
+        for (int i = 0; i < opts->n_grep; i++)
+            add_grep_pattern(&q->grep, opts->grep[i], GREP_LITERAL);
+
+        error_trap = NULL;
+    }
+    else
+        a->ar.max_skew = 0;
+
+    *query = q;
+
+    return ETB_OK;
+}
+
+
+int etb_next_chunk(etb_query *q, etb_chunk *chunk)
+{
+    jmp_buf trap;
+    int status;
+
+    // The block after a range has only the end of the last line of a range
+    if (q->done || q->next_after_range)
+        return ETB_END;
+
+    set_error_trap(trap);
+    status = decode_next_blk(q);
+    error_trap = NULL;
+
+    if (status != ETB_OK)
+        return status;
+
+    chunk->data = q->blk.data;
+    chunk->len = q->blk.len;
+    chunk->blk_pos = q->prev_blk_pos;
+
+    return ETB_OK;
+}
+
+
+int etb_next_line(etb_query *q, etb_line *line)
+{
+    const char *start, *nl;
+    int len;
+    jmp_buf trap;
+    int status;
+
+    set_error_trap(trap);
+
+    while (!q->done)
+    {
+        if (q->line_pos >= q->blk.len)
+        {
+            // The last line of a file can have no newline char
+            if ((status = decode_next_blk(q)) == ETB_END)
+            {
+                q->done = true;
+                if (q->line_len > 0 &&
+                    is_query_line(q, q->line, q->line_len))
+                {
+                    line->data = q->line;
+                    line->len = q->line_len;
+                    line->time = q->line_time_t;
+                    q->line_len = 0;
+                    error_trap = NULL;
+                    return ETB_OK;
+                }
+                break;
+            }
+            if (status != ETB_OK)
+            {
+                error_trap = NULL;
+                return status;
+            }
+            q->line_pos = 0;
+        }
+
+        start = q->blk.data + q->line_pos;
+        len = q->blk.len - q->line_pos;
+
+        // A line which crosses blocks is collected in the line buffer
+        if ((nl = memchr(start, '\n', len)) == NULL)
+        {
+            append_to_line(&q->line, &q->line_len, &q->line_size, start, len);
+            q->line_pos = q->blk.len;
+            continue;
+        }
+
+        q->line_pos += nl - start + 1;
+        line->data = start;
+        line->len = nl - start;
+        if (q->line_len > 0)
+        {
+            append_to_line(&q->line, &q->line_len, &q->line_size, start,
+                           nl - start);
+            line->data = q->line;
+            line->len = q->line_len;
+            q->line_len = 0;
+        }
+
+        if (is_query_line(q, line->data, line->len))
+        {
+            line->time = q->line_time_t;
+            error_trap = NULL;
+            return ETB_OK;
+        }
+    }
+
+    error_trap = NULL;
+
+    return ETB_END;
+}
+
+
+void etb_free_query(etb_query *q)
+{
+    if (q == NULL)
+        return;
+
+    free_grep_filter(&q->grep);
+    free(q->blk.data);
+    free(q->line);
+    free(q);
+}
+
+
+void etb_close(etb_archive *a)
+{
+    jmp_buf trap;
+
+    if (a == NULL)
+        return;
+
+    // A fatal error leaves the file as it is, the handle is freed anyway. An
+    // archive which failed to be opened again by etb_attach_index() is
+    // already released.
+    if (a->ar.bd != NULL && setjmp(trap) == 0)
+    {
+        error_trap = &trap;
+        close_archive(&a->ar);
+    }
+    error_trap = NULL;
+    release_archive(&a->ar);
+
+    free(a->path);
+    free(a);
+}
+
+
+etb_blk_cache * etb_new_blk_cache(size_t max_bytes)
+{
+    etb_blk_cache *cache;
+
+    if ((cache = malloc(sizeof(*cache))) == NULL)
+        return NULL;
+
+    init_blk_cache(&cache->cache, max_bytes);
+
+    return cache;
+}
+
+
+void etb_set_blk_cache(etb_archive *a, etb_blk_cache *cache)
+{
+    a->blk_cache = cache;
+}
+
+
+void etb_free_blk_cache(etb_blk_cache *cache)
+{
+    if (cache == NULL)
+        return;
+
+    free_blk_cache(&cache->cache);
+    free(cache);
+}
+
+
+const char * etb_strerror(int code)
+{
+    switch (code)
+    {
+        case ETB_OK:
+            return "Success";
+        case ETB_END:
+            return "No more items";
+        case ETB_ERR_OPEN:
+            return "Can't open a file";
+        case ETB_ERR_FORMAT:
+            return "Not a bz2 file";
+        case ETB_ERR_NO_TIMESTAMP:
+            return "No timestamp of a supported datetime format";
+        case ETB_ERR_DATETIME:
+            return "Unsupported datetime format";
+        case ETB_ERR_RANGE:
+            return "The beginning of a range is after its end";
+        case ETB_ERR_DATA:
+            return "A block can't be uncompressed";
+        case ETB_ERR_INDEX:
+            return "An index can't be built";
+        case ETB_ERR_FAILED:
+            return "Fatal error";
+        default:
+            return "Unknown error";
+    }
+}
+
+
+// Checks if a file can be opened and starts with the bz2 magic "BZh"
+static int check_bz2_file(const char *path)
+{
+    char magic[3];
+    int fd, len;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return ETB_ERR_OPEN;
+
+    len = read(fd, magic, sizeof(magic));
+    close(fd);
+
+    if (len != sizeof(magic) || memcmp(magic, "BZh", sizeof(magic)) != 0)
+        return ETB_ERR_FORMAT;
+
+    return ETB_OK;
+}
+
+
+static bool detect_fmt_line_cb(const char *line, int line_len, void *cb_arg)
+{
+    return detect_dt_fmt(cb_arg, line, line_len);
+}
+
+
+// Uncompresses the next block of a query and finds the block after it as
+// extract_range() does. The first block is searched at the first call.
+static int decode_next_blk(etb_query *q)
+{
+    etb_archive *a = q->archive;
+    bz2_archive *ar = &a->ar;
+    bunzip_data *bd = ar->bd;
+    char dt_str[DT_STR_SIZE];
+    time_t dt_time_t;
+
+    if (!q->started)
+    {
+        q->started = true;
+        q->blk_pos = find_range_first_blk(ar, &q->range, &q->low);
+    }
+
+    if (q->blk_pos == BLK_NOT_FOUND)
+        return ETB_END;
+
+    // Read the next blocks while this one is uncompressed
+    prefetch_next_blks(ar, q->blk_pos, q->prev_blk_pos, NULL);
+    q->prev_blk_pos = q->blk_pos;
+
+    // A block of a shared cache was uncompressed by another query
+    if (a->blk_cache == NULL ||
+        !get_cached_blk(&a->blk_cache->cache, a->dev, a->ino, q->blk_pos,
+                        &q->blk))
+    {
+        if (decode_blk(bd, q->blk_pos, &q->blk) != 0)
+        {
+            q->done = true;
+            return ETB_ERR_DATA;
+        }
+
+        // A block which isn't cached is uncompressed by the other queries
+        // again
+        if (a->blk_cache != NULL)
+            put_cached_blk(&a->blk_cache->cache, a->dev, a->ino, &q->blk);
+    }
+
+    if (q->blk_pos == ar->last_blk_pos || q->next_after_range)
+    {
+        q->blk_pos = BLK_NOT_FOUND;
+        return ETB_OK;
+    }
+
+    q->blk_pos = find_next_known_blk_pos(ar, q->blk_pos);
+    get_blk_first_dt(ar, q->blk_pos, dt_str, &dt_time_t);
+    q->next_after_range = is_blk_after_range(ar, q->blk_pos, dt_time_t,
+                                             &q->range);
+
+    return ETB_OK;
+}
+
+
+// Checks if a line is within the range of a query and matches its patterns.
+// The rules are the ones of an exact writer.
+static bool is_query_line(etb_query *q, const char *line, int line_len)
+{
+    const dt_locator *loc = &q->archive->ar.loc;
+    char dt_str[DT_STR_SIZE];
+    time_t line_time_t;
+
+    if (loc->find(loc, line, line_len, dt_str, &line_time_t))
+    {
+        q->line_time_t = line_time_t;
+        q->has_line_time = true;
+    }
+
+    // A fragment of a line before the first timestamp belongs to a line of
+    // a previous block, which is out of the range
+    if (!q->has_line_time)
+        return false;
+
+    if (q->line_time_t > q->range.to_time_t)
+    {
+        if (q->line_time_t > q->range.to_time_t + q->archive->ar.max_skew)
+            q->done = true;
+        return false;
+    }
+
+    if (q->line_time_t < q->range.from_time_t)
+        return false;
+
+    return q->grep.n_patterns == 0 ||
+           grep_match_line(&q->grep, line, line_len);
+}
@@ -0,0 +1,137 @@
+#ifndef __LIBEXTRACT_TIME_BLK_BZ2_H__
+#define __LIBEXTRACT_TIME_BLK_BZ2_H__
+
+// Library API of the search and extraction of time ranges in bz2 logs. A
+// service opens an archive once and runs queries on its handle instead of
+// starting a process per query and parsing its stdout.
+//
+// Functions return ETB_OK or an error code (< 0), iterators return ETB_END
+// after the last item. A handle isn't thread safe: queries of one archive run
+// one after another, archives are independent. Data and lines which are
+// returned by iterators point into the buffers of a query, they are valid
+// till the next call of an iterator.
+
+#include <stdbool.h>        // bool type
+#include <stddef.h>         // size_t
+#include <time.h>           // time_t
+
+// Return codes
+#define ETB_OK 0
+// an iterator has no more items
+#define ETB_END 1
+// a file can't be opened (errno is set)
+#define ETB_ERR_OPEN (-1)
+// a file isn't a bz2 file
+#define ETB_ERR_FORMAT (-2)
+// no timestamp of a supported format was found in a file
+#define ETB_ERR_NO_TIMESTAMP (-3)
+// a datetime string of etb_parse_time() or etb_parse_range() is in an
+// unsupported format
+#define ETB_ERR_DATETIME (-4)
+// the beginning of a range is after its end
+#define ETB_ERR_RANGE (-5)
+// a block of a file can't be uncompressed
+#define ETB_ERR_DATA (-6)
+// an index can't be built
+#define ETB_ERR_INDEX (-7)
+// a fatal error inside the engine (e.g. no memory), its details are printed
+// to stderr. A handle should be closed after it.
+#define ETB_ERR_FAILED (-8)
+
+typedef struct etb_archive etb_archive;
+typedef struct etb_query etb_query;
+typedef struct etb_blk_cache etb_blk_cache;
+
+// Timestamp locator of the lines of an archive (see README)
+typedef struct
+{
+    // take a timestamp from the value of this key of JSON lines (or NULL)
+    const char *json_key;
+    // lines are started from epoch numbers
+    bool epoch;
+    // the year of the last line of a log without years in timestamps (0 to
+    // infer it by the modification time of a file)
+    int year;
+    // blocks which are read ahead of an extraction (0 for the default)
+    int read_ahead;
+} etb_open_opts;
+
+// Options of a query
+typedef struct
+{
+    // timestamps of lines can be out of order by up to max_skew seconds
+    int max_skew;
+    // etb_next_line() returns only the lines which match any of these literal
+    // strings (they should be valid till the query is freed)
+    const char * const *grep;
+    int n_grep;
+} etb_query_opts;
+
+// Uncompressed data of a block
+typedef struct
+{
+    const char *data;
+    size_t len;
+    // bit position of a block in a file
+    unsigned long long blk_pos;
+} etb_chunk;
+
+// A line without the newline char
+typedef struct
+{
+    const char *data;
+    size_t len;
+    // timestamp of a line (or of the previous line if it has none)
+    time_t time;
+} etb_line;
+
+// Opens a bz2 file and finds its first and last dates. The datetime format of
+// text timestamps is detected by the first block. A valid index of a file is
+// used if it exists. opts can be NULL.
+int etb_open(const char *path, const etb_open_opts *opts, etb_archive **);
+// Builds an index of all the blocks by n_threads threads and saves it next to
+// a file if there is no complete index yet. The next queries are answered by
+// the index without uncompressing the probes of a search. A failed build
+// leaves the handle as it was, except when the file can't be opened again
+// with the new index: only etb_close() can be called then.
+int etb_attach_index(etb_archive *, int n_threads);
+// The first and the last timestamps of a file
+void etb_archive_dates(const etb_archive *, time_t *first, time_t *last);
+// The datetime format of the timestamps of a file (NULL for epoch numbers)
+const char * etb_dt_format(const etb_archive *);
+// Converts a datetime string in the format of a file (a value without a year
+// gets the year by the dates of a file) or an epoch number to epoch time
+int etb_parse_time(const etb_archive *, const char *, time_t *);
+// Converts the from and to strings of a range as etb_parse_time(), except
+// that a to value without a year is in the year after from, so a range can
+// cross a new year
+int etb_parse_range(const etb_archive *, const char *from, const char *to,
+                    time_t *from_t, time_t *to_t);
+// Starts a query of the lines with timestamps in [from, to]. A range is
+// clamped to the dates of a file. opts can be NULL.
+int etb_query_range(etb_archive *, time_t from, time_t to,
+                    const etb_query_opts *opts, etb_query **);
+// Returns the next whole uncompressed block of a range. The first and the
+// last blocks contain the lines around a range too.
+int etb_next_chunk(etb_query *, etb_chunk *);
+// Returns the next line within a range. Lines are views of the uncompressed
+// blocks, only a line which crosses blocks is copied. A query is iterated
+// either by chunks or by lines.
+int etb_next_line(etb_query *, etb_line *);
+void etb_free_query(etb_query *);
+// Closes a file. Timestamps of blocks which were found by queries are saved
+// to the index of a file.
+void etb_close(etb_archive *);
+// Creates a cache of uncompressed blocks of up to max_bytes. It's thread safe,
+// so it can be shared by the handles of concurrent queries (e.g. several
+// handles of one file), they take the blocks which were uncompressed by each
+// other from it. Returns NULL if there is no memory.
+etb_blk_cache * etb_new_blk_cache(size_t max_bytes);
+// The queries of a handle take the blocks from a cache and add them to it. A
+// cache should be freed after all of its handles were closed.
+void etb_set_blk_cache(etb_archive *, etb_blk_cache *);
+void etb_free_blk_cache(etb_blk_cache *);
+// Returns a message of a return code
+const char * etb_strerror(int);
+
+#endif
@@ -0,0 +1,99 @@
+// The last lines of a range.
+
+
+#include <stdio.h>
+#include <stdlib.h>			// exit(), calloc()
+#include <string.h>			// memcpy()
+#include "extract_time_blk_bz2.h"
+#include "blk_writer.h"
+#include "line_tail.h"
+
+
+void init_line_tail(line_tail *tail, int size)
+{
+    tail->size = size;
+    tail->first = tail->n_lines = 0;
+
+    if ((tail->lines = calloc(size, sizeof(char *))) == NULL ||
+        (tail->lens = calloc(size, sizeof(int))) == NULL ||
+        (tail->sizes = calloc(size, sizeof(int))) == NULL)
+    {
+        error_print("Can't allocate memory for %d lines", size);
+        fatal_exit();
+    }
+}
+
+
+void add_tail_line(const char *line, int line_len, time_t line_time_t,
+                   void *cb_arg)
+{
+    line_tail *tail = cb_arg;
+    int slot;
+
+    if (tail->n_lines < tail->size)
+    {
+        slot = (tail->first + tail->n_lines++) % tail->size;
+    }
+    else
+    {
+        slot = tail->first;
+        tail->first = (tail->first + 1) % tail->size;
+    }
+
+    tail->lens[slot] = 0;
+    append_to_line(&tail->lines[slot], &tail->lens[slot], &tail->sizes[slot],
+                   line, line_len);
+}
+
+
+void write_line_tail(int fd, const line_tail *tail)
+{
+    char obuf[WRITER_BUFFER_SIZE];
+    int obuf_len = 0;
+    const char *line;
+    int line_len, slot;
+
+    for (int i = 0; i < tail->n_lines; i++)
+    {
+        slot = (tail->first + i) % tail->size;
+        line = tail->lines[slot];
+        line_len = tail->lens[slot];
+
+        if (obuf_len + line_len + 1 > WRITER_BUFFER_SIZE)
+        {
+            write_all(fd, obuf, obuf_len);
+            obuf_len = 0;
+        }
+
+        // A line which doesn't fit to the output buffer is written directly
+        if (line_len + 1 > WRITER_BUFFER_SIZE)
+        {
+            write_all(fd, line, line_len);
+            write_all(fd, "\n", 1);
+            continue;
+        }
+
+        memcpy(obuf + obuf_len, line, line_len);
+        obuf_len += line_len;
+        obuf[obuf_len++] = '\n';
+    }
+
+    write_all(fd, obuf, obuf_len);
+}
+
+
+void reset_line_tail(line_tail *tail)
+{
+    tail->first = tail->n_lines = 0;
+}
+
+
+void free_line_tail(line_tail *tail)
+{
+    for (int i = 0; i < tail->size; i++)
+        free(tail->lines[i]);
+    free(tail->lines);
+    free(tail->lens);
+    free(tail->sizes);
+    tail->lines = NULL;
+}
@@ -0,0 +1,24 @@
+#ifndef __LINE_TAIL_H__
+#define __LINE_TAIL_H__
+
+#include <time.h>           // time_t
+
+// A ring of the last lines which were passed to it (--tail)
+typedef struct
+{
+    char **lines;
+    int *lens, *sizes;
+    int size, first, n_lines;
+} line_tail;
+
+void init_line_tail(line_tail *, int);
+// Line callback of a writer (blk_line_cb_t) which adds a line to the ring,
+// the oldest line is dropped when it's full
+void add_tail_line(const char *, int, time_t, void *);
+// Writes the lines of the ring in their order
+void write_line_tail(int, const line_tail *);
+// Drops all the lines
+void reset_line_tail(line_tail *);
+void free_line_tail(line_tail *);
+
+#endif
@@ -0,0 +1,388 @@
+// Time ordered merge of ranges of several archives.
+
+
+#include <stdio.h>
+#include <stdlib.h>			// exit(), malloc()
+#include <string.h>			// memcpy(), strrchr()
+#include <unistd.h>			// close()
+#include <pthread.h>
+#include "extract_time_blk_bz2.h"
+#include "bz2_archive.h"
+#include "blk_writer.h"
+#include "merge.h"
+
+
+// A header of a line in a chunk. It's followed by line_len chars and padding
+// to the alignment of chunk_line.
+typedef struct
+{
+    time_t line_time_t;
+    int line_len;
+} chunk_line;
+
+// Lines of a source in the order of a file
+typedef struct
+{
+    char *data;
+    int len, size;
+} merge_chunk;
+
+// A file which lines are merged. Its range is uncompressed by a separate
+// thread to chunks, at most MERGE_MAX_CHUNKS of them wait for the merge.
+typedef struct
+{
+    const set_file *file;
+    // a name of a source for --source-prefix
+    const char *name;
+    // a range clamped to the dates of a file
+    time_range range;
+    const merge_opts *opts;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    // signaled when a chunk is added or taken and when a source is finished
+    pthread_cond_t changed;
+    // a queue of filled chunks
+    merge_chunk chunks[MERGE_MAX_CHUNKS];
+    int first_chunk, n_chunks;
+    // all the lines were added to the queue
+    bool finished;
+    // a chunk which is being filled by a thread
+    merge_chunk filling;
+    // a chunk which is being merged and a position of its current line
+    merge_chunk merging;
+    int merging_pos;
+    // the current line of a source
+    const char *line;
+    int line_len;
+    time_t line_time_t;
+} merge_source;
+
+
+static void * merge_source_worker(void *);
+static void add_source_line(const char *, int, time_t, void *);
+static void push_filling_chunk(merge_source *);
+static bool next_source_line(merge_source *);
+static void merge_sources(merge_source *, int, int, bool);
+static bool is_source_before(const merge_source *, const merge_source *);
+static void sift_down(merge_source **, int, int);
+static void write_merged(int, char *, int *, const char *, int);
+
+
+void merge_file_set(const file_set *set, const dt_locator *loc,
+                    const time_range *ranges, int n_ranges,
+                    const merge_opts *opts)
+{
+    merge_source *sources;
+    merge_source *source;
+    int n_sources;
+    int out_fd;
+    const char *name;
+
+    if ((sources = calloc(set->n_files, sizeof(merge_source))) == NULL)
+    {
+        error_print("Can't allocate memory for %d sources", set->n_files);
+        fatal_exit();
+    }
+
+    for (int i = 0; i < n_ranges; i++)
+    {
+        if (opts->split_output != NULL)
+        {
+            out_fd = open_range_output(opts->split_output, i + 1);
+        }
+        else
+        {
+            out_fd = 1;
+            if (n_ranges > 1)
+                write_range_header(out_fd, &ranges[i]);
+        }
+
+        // Every file which overlaps a range is a source, boundaries outside
+        // a file are clamped to its dates
+        n_sources = 0;
+        for (int j = 0; j < set->n_files; j++)
+        {
+            if (set->files[j].first_date_time_t > ranges[i].to_time_t ||
+                set->files[j].last_date_time_t < ranges[i].from_time_t)
+                continue;
+
+            source = &sources[n_sources++];
+            memset(source, 0, sizeof(*source));
+            source->file = &set->files[j];
+            name = strrchr(source->file->path, '/');
+            source->name = name != NULL ? name + 1 : source->file->path;
+            source->opts = opts;
+            source->range = ranges[i];
+            if (source->range.from_time_t < source->file->first_date_time_t)
+                source->range.from_time_t = source->file->first_date_time_t;
+            if (source->range.to_time_t > source->file->last_date_time_t)
+                source->range.to_time_t = source->file->last_date_time_t;
+
+            pthread_mutex_init(&source->lock, NULL);
+            pthread_cond_init(&source->changed, NULL);
+
+            // Every source needs its own thread, the merge waits for the
+            // next line of each of them
+            if (pthread_create(&source->thread, NULL, merge_source_worker,
+                               source) != 0)
+            {
+                error_print("%s", "Can't create a thread");
+                fatal_exit();
+            }
+        }
+
+        merge_sources(sources, n_sources, out_fd, opts->source_prefix);
+
+        for (int j = 0; j < n_sources; j++)
+        {
+            pthread_join(sources[j].thread, NULL);
+            pthread_mutex_destroy(&sources[j].lock);
+            pthread_cond_destroy(&sources[j].changed);
+        }
+
+        if (out_fd != 1)
+            close(out_fd);
+    }
+
+    free(sources);
+}
+
+
+// Uncompresses a range of a source to chunks of lines
+static void * merge_source_worker(void *arg)
+{
+    merge_source *source = arg;
+    bz2_archive ar;
+    blk_writer writer;
+    off_t low = 0;
+
+    // The dates were already found by read_file_set()
+    open_archive_file(&ar, source->file->path, &source->file->loc);
+    memcpy(ar.first_date, source->file->first_date, DT_STR_SIZE);
+    memcpy(ar.last_date, source->file->last_date, DT_STR_SIZE);
+    ar.first_date_time_t = source->file->first_date_time_t;
+    ar.last_date_time_t = source->file->last_date_time_t;
+    ar.last_blk_pos = source->file->last_blk_pos;
+    ar.read_ahead = source->opts->read_ahead;
+    ar.max_skew = source->opts->max_skew;
+    ar.io_stats = source->opts->io_stats;
+
+    init_blk_line_writer(&writer, &ar.loc, source->range.from_time_t,
+                         source->range.to_time_t, add_source_line, source);
+    if (source->opts->grep != NULL)
+        set_blk_writer_grep(&writer, source->opts->grep);
+
+    extract_range(&ar, &source->range, &writer, &low);
+
+    blk_writer_flush(&writer);
+    free_blk_writer(&writer);
+    close_archive(&ar);
+
+    if (source->filling.len > 0)
+        push_filling_chunk(source);
+
+    pthread_mutex_lock(&source->lock);
+    source->finished = true;
+    pthread_cond_broadcast(&source->changed);
+    pthread_mutex_unlock(&source->lock);
+
+    return NULL;
+}
+
+
+// Line callback of a source writer. Adds a line to the chunk which is being
+// filled.
+static void add_source_line(const char *line, int line_len,
+                            time_t line_time_t, void *cb_arg)
+{
+    merge_source *source = cb_arg;
+    merge_chunk *chunk = &source->filling;
+    chunk_line *header;
+    int rec_size;
+
+    // The size of a line record aligned to the next header
+    rec_size = sizeof(chunk_line) + (line_len + sizeof(chunk_line) - 1) /
+               sizeof(chunk_line) * sizeof(chunk_line);
+
+    if (chunk->len + rec_size > chunk->size && chunk->len > 0)
+        push_filling_chunk(source);
+
+    if (chunk->data == NULL)
+    {
+        chunk->size = rec_size > MERGE_CHUNK_SIZE ? rec_size : MERGE_CHUNK_SIZE;
+        if ((chunk->data = malloc(chunk->size)) == NULL)
+        {
+            error_print("Can't allocate %d bytes for a chunk", chunk->size);
+            fatal_exit();
+        }
+    }
+
+    header = (chunk_line *)(chunk->data + chunk->len);
+    header->line_time_t = line_time_t;
+    header->line_len = line_len;
+    memcpy(header + 1, line, line_len);
+    chunk->len += rec_size;
+}
+
+
+// Moves the filled chunk to the queue. Waits if the queue is full.
+static void push_filling_chunk(merge_source *source)
+{
+    pthread_mutex_lock(&source->lock);
+
+    while (source->n_chunks == MERGE_MAX_CHUNKS)
+        pthread_cond_wait(&source->changed, &source->lock);
+
+    source->chunks[(source->first_chunk + source->n_chunks) %
+                   MERGE_MAX_CHUNKS] = source->filling;
+    source->n_chunks++;
+    pthread_cond_broadcast(&source->changed);
+
+    pthread_mutex_unlock(&source->lock);
+
+    memset(&source->filling, 0, sizeof(merge_chunk));
+}
+
+
+// Moves a source to its next line. Waits for the next chunk if it's needed.
+// Returns false if there are no more lines.
+static bool next_source_line(merge_source *source)
+{
+    chunk_line *header;
+
+    if (source->merging_pos >= source->merging.len)
+    {
+        free(source->merging.data);
+        memset(&source->merging, 0, sizeof(merge_chunk));
+        source->merging_pos = 0;
+
+        pthread_mutex_lock(&source->lock);
+
+        while (source->n_chunks == 0 && !source->finished)
+            pthread_cond_wait(&source->changed, &source->lock);
+
+        if (source->n_chunks == 0)
+        {
+            pthread_mutex_unlock(&source->lock);
+            return false;
+        }
+
+        source->merging = source->chunks[source->first_chunk];
+        source->first_chunk = (source->first_chunk + 1) % MERGE_MAX_CHUNKS;
+        source->n_chunks--;
+        pthread_cond_broadcast(&source->changed);
+
+        pthread_mutex_unlock(&source->lock);
+    }
+
+    header = (chunk_line *)(source->merging.data + source->merging_pos);
+    source->line = (const char *)(header + 1);
+    source->line_len = header->line_len;
+    source->line_time_t = header->line_time_t;
+    source->merging_pos += sizeof(chunk_line) +
+        (header->line_len + sizeof(chunk_line) - 1) / sizeof(chunk_line) *
+        sizeof(chunk_line);
+
+    return true;
+}
+
+
+// Merges the lines of sources by a min-heap of their current lines
+static void merge_sources(merge_source *sources, int n_sources, int out_fd,
+                          bool source_prefix)
+{
+    merge_source *heap[n_sources];
+    int heap_len = 0;
+    merge_source *source;
+    char *obuf;
+    int obuf_len = 0;
+
+    if ((obuf = malloc(WRITER_BUFFER_SIZE)) == NULL)
+    {
+        error_print("Can't allocate %d bytes for an output buffer",
+                    WRITER_BUFFER_SIZE);
+        fatal_exit();
+    }
+
+    for (int i = 0; i < n_sources; i++)
+        if (next_source_line(&sources[i]))
+            heap[heap_len++] = &sources[i];
+
+    for (int i = heap_len / 2 - 1; i >= 0; i--)
+        sift_down(heap, heap_len, i);
+
+    while (heap_len > 0)
+    {
+        source = heap[0];
+
+        if (source_prefix)
+        {
+            write_merged(out_fd, obuf, &obuf_len, source->name,
+                         strlen(source->name));
+            write_merged(out_fd, obuf, &obuf_len, ": ", 2);
+        }
+        write_merged(out_fd, obuf, &obuf_len, source->line, source->line_len);
+        write_merged(out_fd, obuf, &obuf_len, "\n", 1);
+
+        // A finished source leaves the heap
+        if (!next_source_line(source))
+            heap[0] = heap[--heap_len];
+
+        sift_down(heap, heap_len, 0);
+    }
+
+    write_all(out_fd, obuf, obuf_len);
+    free(obuf);
+}
+
+
+// Lines with equal timestamps keep the order of sources
+static bool is_source_before(const merge_source *a, const merge_source *b)
+{
+    if (a->line_time_t != b->line_time_t)
+        return a->line_time_t < b->line_time_t;
+
+    return a < b;
+}
+
+
+static void sift_down(merge_source **heap, int heap_len, int pos)
+{
+    merge_source *tmp;
+    int child;
+
+    for (; (child = pos * 2 + 1) < heap_len; pos = child)
+    {
+        if (child + 1 < heap_len && is_source_before(heap[child + 1],
+                                                     heap[child]))
+            child++;
+
+        if (!is_source_before(heap[child], heap[pos]))
+            break;
+
+        tmp = heap[pos];
+        heap[pos] = heap[child];
+        heap[child] = tmp;
+    }
+}
+
+
+// Appends chars to an output buffer and writes it when it's full
+static void write_merged(int fd, char *obuf, int *obuf_len, const char *buf,
+                         int len)
+{
+    if (*obuf_len + len > WRITER_BUFFER_SIZE)
+    {
+        write_all(fd, obuf, *obuf_len);
+        *obuf_len = 0;
+    }
+
+    if (len > WRITER_BUFFER_SIZE)
+    {
+        write_all(fd, buf, len);
+        return;
+    }
+
+    memcpy(obuf + *obuf_len, buf, len);
+    *obuf_len += len;
+}
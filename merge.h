@@ -0,0 +1,36 @@
+#ifndef __MERGE_H__
+#define __MERGE_H__
+
+#include <stdbool.h>        // bool type
+#include "dt_locator.h"
+#include "time_range.h"
+#include "file_set.h"
+
+// Size of a chunk of lines which a source passes to the merge at once
+#define MERGE_CHUNK_SIZE (64 * 1024)
+// The maximum amount of chunks buffered by every source
+#define MERGE_MAX_CHUNKS 16
+
+// Options of a merge of several sources
+typedef struct
+{
+    // print a name of a source before every line
+    bool source_prefix;
+    // a pattern of output file names of ranges or NULL for stdout
+    const char *split_output;
+    // blocks which are read ahead of an extraction of every source
+    int read_ahead;
+    // print I/O statistics of every source
+    bool io_stats;
+    // a content filter of lines (--grep) or NULL
+    const grep_filter *grep;
+    // seconds by which timestamps of lines can be out of order (--max-skew)
+    int max_skew;
+} merge_opts;
+
+// Extracts time ranges from every file of a set (e.g. archives of several
+// hosts) and merges their lines in the order of their timestamps
+void merge_file_set(const file_set *, const dt_locator *, const time_range *,
+                    int, const merge_opts *);
+
+#endif
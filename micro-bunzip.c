@@ -37,14 +37,35 @@
 clock_t time_sample;
 double cpu_time_used, cpu_time_used_total;
 
+/* eugenyuk@gmail.com: a header of a candidate block is read by chunks of
+   BLK_HEADER_READ_SIZE bytes, the longest possible header (32767 selectors
+   and 6 tables of 258 symbols) fits the buffer */
+#define BLK_HEADER_READ_SIZE 4096
+#define BLK_HEADER_BUF_SIZE (BLK_HEADER_READ_SIZE * 10)
+
+/* Bits of a block header which is checked by check_blk_header() */
+typedef struct
+{
+    int fd;
+    /* file offset of buf[0] */
+    off_t offset;
+    /* the next bit of buf */
+    unsigned long bitPos;
+    unsigned char buf[BLK_HEADER_BUF_SIZE];
+    int len;
+    int status;
+} header_bits;
+
+static unsigned int get_blk_dbuf_size(bunzip_data *, unsigned long long);
+static long get_header_bits(header_bits *, int);
+static unsigned long long get_input_bit_pos(bunzip_data *);
+
 /* Return the next nnn bits of input.  All reads from the compressed input
    are done through this function.  All reads are big endian */
 unsigned int get_bits(bunzip_data *bd, char bits_wanted)
 {
     unsigned int bits = 0;
 
-    //printf("LSEEK POS = %lu\n", lseek(bd->in_fd, 0, SEEK_CUR ));
-
     /* If we need to get more data from the byte buffer, do so.  (Loop getting
      one byte at a time to enforce endianness and avoid unaligned access.) */
     while (bd->inbufBitCount < bits_wanted)
@@ -52,9 +73,11 @@ unsigned int get_bits(bunzip_data *bd, char bits_wanted)
         /* If we need to read more data from file into byte buffer, do so */
         if ( bd->inbufPos == bd->inbufCount )
         {
-            if ((bd->inbufCount = read(bd->in_fd, bd->inbuf, IOBUF_SIZE)) <= 0)
+            if (bd->in_fd == -1 || (bd->inbufCount = read_input(bd,
+                    bd->inbuf, IOBUF_SIZE, bd->inbufOffset)) <= 0)
                 longjmp(bd->jmpbuf, RETVAL_UNEXPECTED_INPUT_EOF);
 
+            bd->inbufOffset += bd->inbufCount;
             bd->inbufPos = 0;
         }
         /* Avoid 32-bit overflow (dump bit buffer to top of output) */
@@ -85,10 +108,12 @@ int get_next_block(bunzip_data *bd)
     i, j, k, t, runPos, symCount, symTotal, nSelectors, byteCount[256];
     unsigned char uc, symToByte[256], mtfSymbol[256], *selectors;
     unsigned int *dbuf, origPtr;
+    unsigned long long blk_start_bit_pos;
 
     dbuf = bd->dbuf;
     dbufSize = bd->dbufSize;
     selectors = bd->selectors;
+    blk_start_bit_pos = get_input_bit_pos(bd);
     /* Reset longjmp I/O error handling */
     i = setjmp( bd->jmpbuf );
     if ( i ) return i;
@@ -455,9 +480,9 @@ got_huff_bits:
     //    fprintf(pf, "byteCount[%d] = %d\n", i, byteCount[i]);
     //fclose(pf);
 
-/*=== START */
+/*=== START (a global isn't safe when files are decoded by several threads)
 time_sample = clock(); 
-/* ===*/
+===*/
     /* Figure out what order dbuf would be in if we sorted it. 
        
        eugenyuk@gmail.com: it does the following:
@@ -507,6 +532,12 @@ time_sample = clock();
         bd->writeRunCountdown = 5;
     }
     bd->writeCount = dbufCount;
+    bd->blkWritePos = bd->writePos;
+    bd->blkWriteCurrent = bd->writeCurrent;
+    bd->blkWriteCount = bd->writeCount;
+    bd->blk_out_bytes = 0;
+    bd->decoded_blks++;
+    bd->decoded_blks_bits += get_input_bit_pos(bd) - blk_start_bit_pos;
 
 
 // TOOK ~8ms/call
@@ -557,6 +588,7 @@ int read_bunzip(bunzip_data *bd, char *outbuf, int len)
                 bd->writePos = pos;
                 bd->writeCurrent = current;
                 bd->writeCopies++;
+                bd->blk_out_bytes += len;
                 return len;
             }
             outbuf[gotcount++] = current;
@@ -603,6 +635,11 @@ decode_next_byte:
             bd->totalCRC = bd->headerCRC + 1;
             return RETVAL_LAST_BLOCK;
         }
+        /* eugenyuk@gmail.com: the size of a block after the run length
+           decoding is known only when its output is over */
+        bd->blk_out_bytes += gotcount;
+        bd->out_blks++;
+        bd->out_blks_size += bd->blk_out_bytes;
         /* james@jamestaylor.org -- rather than falling through we return here */
         return gotcount;
     }
@@ -633,11 +670,14 @@ int start_bunzip(bunzip_data **bdp, int in_fd, char *inbuf, int len)
     /* Setup input buffer */
     if ( -1 == (bd->in_fd = in_fd) )
     {
-        bd->inbuf = inbuf;
+        bd->inbuf = (unsigned char *)inbuf;
         bd->inbufCount = len;
     }
     else bd->inbuf = (unsigned char *)(bd + 1);
 
+    /* eugenyuk@gmail.com: a pipe can't be read by pread() */
+    if ( in_fd != -1 && lseek( in_fd, 0, SEEK_CUR ) < 0 ) bd->in_seq = 1;
+
     /* Init the CRC32 table (big endian) */
     for (i = 0; i < 256; i++)
     {
@@ -659,11 +699,253 @@ int start_bunzip(bunzip_data **bdp, int in_fd, char *inbuf, int len)
        uncompressed data.  Allocate intermediate buffer for block. */
     bd->dbufSize = 100000 * ( i - BZh0 );
 
-    if ( !( bd->dbuf = malloc( bd->dbufSize * sizeof( int ) ) ) )
+    /* eugenyuk@gmail.com: the next streams of a concatenated file (pbzip2,
+       appended archives) can have bigger blocks than the first one */
+    if ( !( bd->dbuf = malloc( MAX_DBUF_SIZE * sizeof( int ) ) ) )
         return RETVAL_OUT_OF_MEMORY;
 
-    // Set file offset back to the value which was before a call of this function.
-    lseek(bd->in_fd, bd->cur_file_offset, SEEK_SET);
+    return RETVAL_OK;
+}
+
+
+ssize_t read_input(bunzip_data *bd, void *buf, size_t len, off_t offset)
+{
+    struct timespec start_time, end_time;
+    ssize_t got;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    got = bd->in_seq ? read(bd->in_fd, buf, len) :
+                       pread(bd->in_fd, buf, len, offset);
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+    bd->io_wait_ns += (end_time.tv_sec - start_time.tv_sec) * 1000000000ULL +
+                      end_time.tv_nsec - start_time.tv_nsec;
+    if (got > 0)
+        bd->io_bytes += got;
+
+    return got;
+}
+
+
+void restart_blk_output(bunzip_data *bd)
+{
+    bd->writePos = bd->blkWritePos;
+    bd->writeCurrent = bd->blkWriteCurrent;
+    bd->writeCount = bd->blkWriteCount;
+    bd->writeRunCountdown = 5;
+    bd->writeCopies = 0;
+    bd->writeCRC = 0xffffffffUL;
+    bd->blk_out_bytes = 0;
+}
+
+
+// Returns the absolute bit position of the next bit of the input
+static unsigned long long get_input_bit_pos(bunzip_data *bd)
+{
+    return (unsigned long long)(bd->inbufOffset - bd->inbufCount +
+                                bd->inbufPos) * 8 - bd->inbufBitCount;
+}
+
+
+int start_next_stream(bunzip_data *bd)
+{
+    unsigned int i;
+    const unsigned int BZh0 = ( ( (unsigned int)'B' ) << 24 ) +
+                              ( ( (unsigned int)'Z' ) << 16 ) +
+                              ( ( (unsigned int)'h' ) << 8 ) +
+                                  (unsigned int)'0';
+
+    i = setjmp( bd->jmpbuf );
+    if ( i ) return i;
+
+    /* A stream is padded to a byte after its CRC */
+    bd->inbufBitCount -= bd->inbufBitCount % 8;
+
+    i = get_bits( bd, 32 );
+    if ( ( (unsigned int)(i - BZh0 - 1) ) >= 9 ) return RETVAL_NOT_BZIP_DATA;
+    bd->dbufSize = 100000 * ( i - BZh0 );
 
     return RETVAL_OK;
+}
+
+
+void seek_input(bunzip_data *bd, off_t offset)
+{
+    off_t inbuf_start = bd->inbufOffset - bd->inbufCount;
+
+    if (offset >= inbuf_start && offset < bd->inbufOffset)
+        bd->inbufPos = offset - inbuf_start;
+    else
+    {
+        bd->inbufOffset = offset;
+        bd->inbufPos = bd->inbufCount = 0;
+    }
+
+    bd->inbufBitCount = 0;
+}
+
+
+/* The first block of every stream follows the "BZh1".."BZh9" stream header
+   which defines the block size of a stream. A stream of other blocks can't be
+   known without a scan from its header, so their size is limited by the
+   biggest one. The header is read by pread(), the file offset isn't
+   changed. */
+void set_blk_dbuf_size(bunzip_data *bd, unsigned long long blk_pos)
+{
+    bd->dbufSize = get_blk_dbuf_size(bd, blk_pos);
+}
+
+
+static unsigned int get_blk_dbuf_size(bunzip_data *bd,
+                                      unsigned long long blk_pos)
+{
+    unsigned char header[4];
+
+    // A stream header is byte aligned and a block follows it immediately
+    if (blk_pos % 8 != 0 || blk_pos < 32)
+        return MAX_DBUF_SIZE;
+
+    if (pread(bd->in_fd, header, sizeof(header), blk_pos / 8 - 4) ==
+        sizeof(header) && header[0] == 'B' && header[1] == 'Z' &&
+        header[2] == 'h' && header[3] >= '1' && header[3] <= '9')
+        return 100000 * (header[3] - '0');
+
+    return MAX_DBUF_SIZE;
+}
+
+
+/* eugenyuk@gmail.com: the 48 bits of a block magic number can occur inside
+   compressed data by chance. A candidate block is checked by its header
+   before it's decoded: the randomised bit, origPtr, the symbol map, the
+   amount of Huffman groups and selectors, the selectors themselves and the
+   code lengths of all the Huffman tables (they should form a prefix code).
+   Only these bits are read (by pread(), the file offset isn't changed), so a
+   check takes microseconds. Returns RETVAL_OK or an error of get_next_block()
+   which a block would cause. */
+int check_blk_header(bunzip_data *bd, unsigned long long blk_pos)
+{
+    header_bits hb = { bd->in_fd, blk_pos / 8, blk_pos % 8 };
+    long i, j, k, t;
+    int groupCount, nSelectors, symTotal = 0, symCount;
+    unsigned long kraftSum;
+
+    if (get_header_bits(&hb, 24) != 0x314159 ||
+        get_header_bits(&hb, 24) != 0x265359)
+        return RETVAL_NOT_BZIP_DATA;
+
+    // CRC can be anything
+    get_header_bits(&hb, 16);
+    get_header_bits(&hb, 16);
+
+    if ((t = get_header_bits(&hb, 1)) != 0)
+        return t < 0 ? hb.status : RETVAL_OBSOLETE_INPUT;
+
+    if ((t = get_header_bits(&hb, 24)) < 0)
+        return hb.status;
+    if (t >= get_blk_dbuf_size(bd, blk_pos))
+        return RETVAL_DATA_ERROR;
+
+    // A used range of 16 byte values has at least one used value
+    if ((t = get_header_bits(&hb, 16)) <= 0)
+        return t < 0 ? hb.status : RETVAL_DATA_ERROR;
+    for (i = 0; i < 16; i++)
+    {
+        if (!(t & (1 << (15 - i))))
+            continue;
+
+        if ((k = get_header_bits(&hb, 16)) <= 0)
+            return k < 0 ? hb.status : RETVAL_DATA_ERROR;
+        for (j = 0; j < 16; j++)
+            if (k & (1 << j))
+                symTotal++;
+    }
+
+    groupCount = get_header_bits(&hb, 3);
+    if (groupCount < 0)
+        return hb.status;
+    if (groupCount < 2 || groupCount > MAX_GROUPS)
+        return RETVAL_DATA_ERROR;
+
+    if ((nSelectors = get_header_bits(&hb, 15)) <= 0)
+        return nSelectors < 0 ? hb.status : RETVAL_DATA_ERROR;
+
+    // Selectors are MTF encoded unary numbers < groupCount
+    for (i = 0; i < nSelectors; i++)
+        for (j = 0; (t = get_header_bits(&hb, 1)) != 0; j++)
+        {
+            if (t < 0)
+                return hb.status;
+            if (j >= groupCount - 1)
+                return RETVAL_DATA_ERROR;
+        }
+
+    // Delta encoded code lengths of every group should be within
+    // [1, MAX_HUFCODE_BITS] and satisfy the Kraft inequality
+    symCount = symTotal + 2;
+    for (j = 0; j < groupCount; j++)
+    {
+        if ((t = get_header_bits(&hb, 5)) < 0)
+            return hb.status;
+
+        kraftSum = 0;
+        for (i = 0; i < symCount; i++)
+        {
+            for ( ;; )
+            {
+                if (t < 1 || t > MAX_HUFCODE_BITS)
+                    return RETVAL_DATA_ERROR;
+                if ((k = get_header_bits(&hb, 1)) <= 0)
+                    break;
+                if ((k = get_header_bits(&hb, 1)) < 0)
+                    break;
+                t += k ? -1 : 1;
+            }
+            if (k < 0)
+                return hb.status;
+
+            kraftSum += 1UL << (MAX_HUFCODE_BITS - t);
+        }
+
+        if (kraftSum > 1UL << MAX_HUFCODE_BITS)
+            return RETVAL_DATA_ERROR;
+    }
+
+    return RETVAL_OK;
+}
+
+
+/* Returns the next bits of a block header or -1 if there are no more bits.
+   hb->status is RETVAL_UNEXPECTED_INPUT_EOF at the end of a file (a block
+   can't be there) and RETVAL_OK if the header is longer than the buffer (it
+   isn't checked further). */
+static long get_header_bits(header_bits *hb, int bits_wanted)
+{
+    long bits = 0;
+    int got;
+
+    for ( ; bits_wanted > 0; bits_wanted--, hb->bitPos++)
+    {
+        if (hb->bitPos / 8 == hb->len)
+        {
+            if (hb->len + BLK_HEADER_READ_SIZE > sizeof(hb->buf))
+            {
+                hb->status = RETVAL_OK;
+                return -1;
+            }
+
+            got = pread(hb->fd, hb->buf + hb->len, BLK_HEADER_READ_SIZE,
+                        hb->offset + hb->len);
+            if (got <= 0)
+            {
+                hb->status = RETVAL_UNEXPECTED_INPUT_EOF;
+                return -1;
+            }
+            hb->len += got;
+        }
+
+        bits = (bits << 1) |
+               ((hb->buf[hb->bitPos / 8] >> (7 - hb->bitPos % 8)) & 1);
+    }
+
+    return bits;
 }
\ No newline at end of file
@@ -30,7 +30,11 @@
 #define RETVAL_OBSOLETE_INPUT           (-7)
 
 /* Other housekeeping constants */
-#define IOBUF_SIZE   4096
+// eugenyuk@gmail.com: the input buffer is a read-ahead buffer of pread(), a
+// compressed block (up to ~1MB) is read by a few calls
+#define IOBUF_SIZE   65536
+// Block size of the biggest streams ("BZh9")
+#define MAX_DBUF_SIZE       900000
 
 /* This is what we know about each huffman coding group */
 struct group_data
@@ -54,17 +58,38 @@ typedef struct
     //// james@jamestaylor.org: track relative position in input so we don't need tell
     //off_t position;
     unsigned char *inbuf /*,*outbuf*/;
+    // eugenyuk@gmail.com: input is read by pread() at absolute offsets, the
+    // offset of in_fd isn't used, so decoders of several threads can share a
+    // descriptor. inbufOffset is the file offset of the byte after inbuf.
+    off_t inbufOffset;
+    // input is a pipe which is read sequentially by read() (--stream)
+    int in_seq;
     unsigned int inbufBitCount, inbufBits;
     /* The CRC values stored in the block header and calculated from the data */
     unsigned int crc32Table[256], headerCRC, totalCRC, writeCRC;
-    /* Intermediate buffer and its size (in bytes) */
+    /* Intermediate buffer and its size (in bytes). The buffer is allocated for
+       MAX_DBUF_SIZE, dbufSize is the block size of the stream of a block. */
     unsigned int *dbuf, dbufSize;
     /* These things are a bit too big to go on the stack */
     unsigned char selectors[32768];   /* nSelectors=15 bits */
     struct group_data groups[MAX_GROUPS]; /* huffman coding tables */
     /* For I/O error handling */
     jmp_buf jmpbuf;
-    off_t cur_file_offset; // current file offset (lseek()) in bytes
+    // amount of blocks decoded by get_next_block() and the sum of their
+    // compressed sizes in bits
+    unsigned long decoded_blks;
+    unsigned long long decoded_blks_bits;
+    // bytes which read_bunzip() has output since the start of a block, the
+    // amount of the blocks which were output whole and the sum of their
+    // uncompressed sizes
+    unsigned long long blk_out_bytes;
+    unsigned long out_blks;
+    unsigned long long out_blks_size;
+    // bytes read by read_input() and the time of the reads (I/O wait)
+    unsigned long long io_bytes, io_wait_ns;
+    // output state of the last block after get_next_block(), the output of a
+    // block is restarted from it
+    int blkWritePos, blkWriteCurrent, blkWriteCount;
 } bunzip_data;
 
 static char * const bunzip_errors[] =
@@ -82,5 +107,23 @@ int get_next_block(bunzip_data *);
 int start_bunzip(bunzip_data **, int, char *, int);
 unsigned int get_bits(bunzip_data *, char);
 int read_bunzip(bunzip_data *, char *, int);
+// Moves the input to an absolute byte offset of a file. The read-ahead buffer
+// is kept if the offset is in it (e.g. a block is probed several times).
+void seek_input(bunzip_data *, off_t);
+// pread() of the input of a decoder which counts read bytes and I/O wait time
+ssize_t read_input(bunzip_data *, void *, size_t, off_t);
+// Makes read_bunzip() return the output of the last block from its start
+// again (dbuf isn't changed by read_bunzip())
+void restart_blk_output(bunzip_data *);
+// Reads the header of the next stream of a concatenated file after
+// get_next_block() returned RETVAL_LAST_BLOCK. Returns
+// RETVAL_UNEXPECTED_INPUT_EOF at the end of input.
+int start_next_stream(bunzip_data *);
+// Sets dbufSize for a block at an absolute bit position of a file which can be
+// a concatenation of streams with different block sizes
+void set_blk_dbuf_size(bunzip_data *, unsigned long long);
+// Checks the header of a candidate block at an absolute bit position without
+// decoding it. Returns RETVAL_OK or an error.
+int check_blk_header(bunzip_data *, unsigned long long);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+// Reservoir sampling of the lines of a range.
+
+
+#define _GNU_SOURCE                 // qsort_r()
+#include <stdio.h>
+#include <stdlib.h>			// exit(), calloc(), qsort_r()
+#include <string.h>			// memcpy()
+#include "extract_time_blk_bz2.h"
+#include "blk_writer.h"
+#include "sample.h"
+
+
+static unsigned long long next_rand(line_sample *);
+static int cmp_sample_lines(const void *, const void *, void *);
+
+
+void init_line_sample(line_sample *sample, int size)
+{
+    sample->size = size;
+    sample->n_lines = 0;
+    sample->n_seen = 0;
+    sample->rand_state = 0x9e3779b97f4a7c15ULL;
+
+    if ((sample->lines = calloc(size, sizeof(char *))) == NULL ||
+        (sample->lens = calloc(size, sizeof(int))) == NULL ||
+        (sample->sizes = calloc(size, sizeof(int))) == NULL ||
+        (sample->nums = calloc(size, sizeof(unsigned long long))) == NULL)
+    {
+        error_print("Can't allocate memory for a sample of %d lines", size);
+        fatal_exit();
+    }
+}
+
+
+void add_sample_line(const char *line, int line_len, time_t line_time_t,
+                     void *cb_arg)
+{
+    line_sample *sample = cb_arg;
+    unsigned long long slot;
+
+    // The first lines fill the reservoir, the n-th line replaces a random
+    // one with the probability size / n
+    if (sample->n_lines < sample->size)
+    {
+        slot = sample->n_lines++;
+    }
+    else
+    {
+        slot = next_rand(sample) % (sample->n_seen + 1);
+        if (slot >= sample->size)
+        {
+            sample->n_seen++;
+            return;
+        }
+    }
+
+    sample->lens[slot] = 0;
+    append_to_line(&sample->lines[slot], &sample->lens[slot],
+                   &sample->sizes[slot], line, line_len);
+    sample->nums[slot] = sample->n_seen++;
+}
+
+
+void write_line_sample(int fd, line_sample *sample)
+{
+    int *order;
+    char obuf[WRITER_BUFFER_SIZE];
+    int obuf_len = 0;
+    const char *line;
+    int line_len;
+
+    if ((order = malloc((sample->n_lines + 1) * sizeof(int))) == NULL)
+    {
+        error_print("Can't allocate memory for a sample of %d lines",
+                    sample->n_lines);
+        fatal_exit();
+    }
+
+    for (int i = 0; i < sample->n_lines; i++)
+        order[i] = i;
+    qsort_r(order, sample->n_lines, sizeof(int), cmp_sample_lines, sample);
+
+    for (int i = 0; i < sample->n_lines; i++)
+    {
+        line = sample->lines[order[i]];
+        line_len = sample->lens[order[i]];
+
+        if (obuf_len + line_len + 1 > WRITER_BUFFER_SIZE)
+        {
+            write_all(fd, obuf, obuf_len);
+            obuf_len = 0;
+        }
+
+        // A line which doesn't fit to the output buffer is written directly
+        if (line_len + 1 > WRITER_BUFFER_SIZE)
+        {
+            write_all(fd, line, line_len);
+            write_all(fd, "\n", 1);
+            continue;
+        }
+
+        memcpy(obuf + obuf_len, line, line_len);
+        obuf_len += line_len;
+        obuf[obuf_len++] = '\n';
+    }
+    write_all(fd, obuf, obuf_len);
+
+    free(order);
+    sample->n_lines = 0;
+    sample->n_seen = 0;
+}
+
+
+void free_line_sample(line_sample *sample)
+{
+    for (int i = 0; i < sample->size; i++)
+        free(sample->lines[i]);
+    free(sample->lines);
+    free(sample->lens);
+    free(sample->sizes);
+    free(sample->nums);
+    sample->lines = NULL;
+}
+
+
+// xorshift64*
+static unsigned long long next_rand(line_sample *sample)
+{
+    sample->rand_state ^= sample->rand_state >> 12;
+    sample->rand_state ^= sample->rand_state << 25;
+    sample->rand_state ^= sample->rand_state >> 27;
+
+    return sample->rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+
+static int cmp_sample_lines(const void *a, const void *b, void *arg)
+{
+    const line_sample *sample = arg;
+    unsigned long long num_a = sample->nums[*(const int *)a];
+    unsigned long long num_b = sample->nums[*(const int *)b];
+
+    return num_a < num_b ? -1 : num_a > num_b;
+}
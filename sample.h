@@ -0,0 +1,33 @@
+#ifndef __SAMPLE_H__
+#define __SAMPLE_H__
+
+#include <time.h>           // time_t
+
+// Amount of blocks of a range which are uncompressed for --sample-lines
+// without --sample
+#define DEF_SAMPLE_BLKS 32
+
+// A reservoir sample of lines (--sample-lines). Every line which was passed
+// to it is kept with the same probability, the sample is written in the
+// order of the lines. The random numbers are seeded by a constant, so the
+// same query gives the same sample.
+typedef struct
+{
+    char **lines;
+    int *lens, *sizes;
+    // the numbers of the kept lines in the order they were passed
+    unsigned long long *nums;
+    int size, n_lines;
+    // amount of the passed lines
+    unsigned long long n_seen;
+    unsigned long long rand_state;
+} line_sample;
+
+void init_line_sample(line_sample *, int);
+// Line callback of a writer (blk_line_cb_t) which adds a line to a sample
+void add_sample_line(const char *, int, time_t, void *);
+// Writes the lines of a sample in their order and empties it
+void write_line_sample(int, line_sample *);
+void free_line_sample(line_sample *);
+
+#endif
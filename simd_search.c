@@ -0,0 +1,60 @@
+// SIMD substring search used by the timestamp locators.
+//
+// The search compares the first and the last byte of a needle with 16
+// positions of a hay at once (SSE2) and runs memcmp() only for positions where
+// both bytes match. Platforms without SSE2 use the scalar loop only.
+
+#include <string.h>         // memcmp()
+#ifdef __SSE2__
+#include <emmintrin.h>      // SSE2 intrinsics
+#endif
+#include "simd_search.h"
+
+
+const char * simd_memmem(const char *hay, int hay_len,
+                         const char *needle, int needle_len)
+{
+    // position of the current candidate in hay
+    int pos = 0;
+
+    if (needle_len <= 0)
+        return hay;
+    if (needle_len > hay_len)
+        return NULL;
+
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+
+    // Check 16 candidate positions per iteration while both the first and the
+    // last bytes of all of them are inside hay
+    for ( ; pos + needle_len - 1 + 16 <= hay_len; pos += 16)
+    {
+        __m128i blk_first = _mm_loadu_si128((const __m128i *)(hay + pos));
+        __m128i blk_last = _mm_loadu_si128((const __m128i *)
+                                           (hay + pos + needle_len - 1));
+        unsigned int mask = _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, blk_first),
+                          _mm_cmpeq_epi8(last, blk_last)));
+
+        // Every set bit is a position where the first and the last bytes match
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+
+            if (memcmp(hay + pos + bit, needle, needle_len) == 0)
+                return hay + pos + bit;
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // Check the rest of positions one by one
+    for ( ; pos + needle_len <= hay_len; pos++)
+    {
+        if (hay[pos] == needle[0] && memcmp(hay + pos, needle, needle_len) == 0)
+            return hay + pos;
+    }
+
+    return NULL;
+}
@@ -0,0 +1,8 @@
+#ifndef __SIMD_SEARCH_H__
+#define __SIMD_SEARCH_H__
+
+// Searches for the first occurrence of needle (needle_len bytes) in hay
+// (hay_len bytes). Returns a pointer to the occurrence or NULL.
+const char * simd_memmem(const char *, int, const char *, int);
+
+#endif
@@ -0,0 +1,271 @@
+// Time filter of a bz2 stream which is read sequentially.
+
+
+#define _GNU_SOURCE                 // memrchr()
+#include <stdio.h>
+#include <stdlib.h>			// exit(), realloc()
+#include <string.h>			// memmove(), memrchr()
+#include <stdbool.h>		// bool type
+#include "extract_time_blk_bz2.h"
+#include "micro-bunzip.h"
+#include "stream.h"
+
+
+static bool next_stream_blk(bunzip_data *);
+static bool find_stream_blk_last_dt(bunzip_data *, const dt_locator *, bool,
+                                    time_t *);
+static bool find_last_dt_in_buf(const dt_locator *, const char *, int, bool,
+                                time_t *);
+static bool find_first_dt_in_buf(const dt_locator *, const char *, int,
+                                 time_t *);
+static bool write_stream_blk(bunzip_data *, const dt_locator *, blk_writer *,
+                             bool, time_t);
+
+
+void extract_stream(int in_fd, const dt_locator *loc, const time_range *range,
+                    blk_writer *writer)
+{
+    bunzip_data *bd;
+    int status;
+    // the first block of a stream has no line fragment of a previous block
+    bool is_first_blk = true;
+    bool writing = false, has_last = false;
+    time_t last_time_t = 0, blk_last_time_t;
+
+    if ((status = start_bunzip(&bd, in_fd, 0, 0)))
+    {
+        error_print("start_bunzip() returned: %s", bunzip_errors[-status]);
+        fatal_exit();
+    }
+
+    while (next_stream_blk(bd))
+    {
+        if (!writing)
+        {
+            // A block without timestamps continues the last line of the
+            // previous one
+            if (find_stream_blk_last_dt(bd, loc, is_first_blk,
+                                        &blk_last_time_t))
+            {
+                last_time_t = blk_last_time_t;
+                has_last = true;
+            }
+
+            is_first_blk = false;
+            if (!has_last || last_time_t < range->from_time_t)
+                continue;
+
+            // The first block of a range is written from its start
+            writing = true;
+            restart_blk_output(bd);
+            write_stream_blk(bd, loc, writer, false, range->to_time_t);
+        }
+        else if (!write_stream_blk(bd, loc, writer, true, range->to_time_t))
+            break;
+
+        if (writer->done)
+            break;
+    }
+
+    free(bd->dbuf);
+    free(bd);
+}
+
+
+// Decodes the next block of a stream. Streams of a concatenated file are
+// passed through. Returns false at the end of input.
+static bool next_stream_blk(bunzip_data *bd)
+{
+    int status;
+
+    while ((status = get_next_block(bd)) == RETVAL_LAST_BLOCK)
+    {
+        if ((status = start_next_stream(bd)) == RETVAL_UNEXPECTED_INPUT_EOF)
+            return false;
+
+        if (status)
+        {
+            error_print("The next stream of the input is broken: %s",
+                        bunzip_errors[-status]);
+            fatal_exit();
+        }
+    }
+
+    if (status)
+    {
+        error_print("get_next_block() returned: %s", bunzip_errors[-status]);
+        fatal_exit();
+    }
+
+    /* Init the CRC for writing */
+    bd->writeCRC = 0xffffffffUL;
+    /* Zero this so the current byte of a previous block is not written */
+    bd->writeCopies = 0;
+
+    return true;
+}
+
+
+// Finds the timestamp of the last line of a decoded block. Only the tail of
+// the output is kept, the whole output is searched only if there is no
+// timestamp in the tail (e.g. a block ends with a long stack trace).
+static bool find_stream_blk_last_dt(bunzip_data *bd, const dt_locator *loc,
+                                    bool is_first_blk, time_t *dt_time_t)
+{
+    char tail[STREAM_TAIL_SIZE * 2];
+    int tail_len = 0, gotcount;
+    unsigned long long total = 0;
+    char *data = NULL;
+    int data_len = 0, data_size = 0;
+    bool found;
+
+    for ( ;; )
+    {
+        // Keep the last STREAM_TAIL_SIZE bytes
+        if (tail_len > STREAM_TAIL_SIZE)
+        {
+            memmove(tail, tail + tail_len - STREAM_TAIL_SIZE, STREAM_TAIL_SIZE);
+            tail_len = STREAM_TAIL_SIZE;
+        }
+
+        if ((gotcount = read_bunzip(bd, tail + tail_len, STREAM_TAIL_SIZE)) < 0)
+        {
+            error_print("read_bunzip() returned: %s", bunzip_errors[-gotcount]);
+            fatal_exit();
+        }
+        if (gotcount == 0)
+            break;
+
+        tail_len += gotcount;
+        total += gotcount;
+    }
+
+    // The first fragment of a tail is a line of a block only if the tail is
+    // the whole output of the first block
+    if ((found = find_last_dt_in_buf(loc, tail, tail_len,
+                                     total == tail_len && is_first_blk,
+                                     dt_time_t)) || total == tail_len)
+        return found;
+
+    restart_blk_output(bd);
+    for ( ;; )
+    {
+        if (data_size - data_len < STREAM_TAIL_SIZE)
+        {
+            data_size = data_size ? data_size * 2 : STREAM_TAIL_SIZE * 16;
+            if ((data = realloc(data, data_size)) == NULL)
+            {
+                error_print("Can't allocate %d bytes for a block", data_size);
+                fatal_exit();
+            }
+        }
+
+        if ((gotcount = read_bunzip(bd, data + data_len, STREAM_TAIL_SIZE)) < 0)
+        {
+            error_print("read_bunzip() returned: %s", bunzip_errors[-gotcount]);
+            fatal_exit();
+        }
+        if (gotcount == 0)
+            break;
+
+        data_len += gotcount;
+    }
+
+    found = find_last_dt_in_buf(loc, data, data_len, is_first_blk, dt_time_t);
+    free(data);
+
+    return found;
+}
+
+
+// Searches lines of a buf from its end. The first fragment (before the first
+// newline) is searched only if has_line_start is set.
+static bool find_last_dt_in_buf(const dt_locator *loc, const char *buf,
+                                int len, bool has_line_start,
+                                time_t *dt_time_t)
+{
+    char dt_str[DT_STR_SIZE];
+    const char *nl;
+    int start, end = len;
+
+    for ( ;; )
+    {
+        nl = end > 0 ? memrchr(buf, '\n', end) : NULL;
+        if (nl == NULL && !has_line_start)
+            return false;
+
+        start = nl != NULL ? nl - buf + 1 : 0;
+        if (end > start &&
+            loc->find(loc, buf + start, end - start, dt_str, dt_time_t))
+            return true;
+
+        if (nl == NULL)
+            return false;
+        end = nl - buf;
+    }
+}
+
+
+// Searches the first timestamp of the lines of a buf which are started in it,
+// i.e. after its first newline
+static bool find_first_dt_in_buf(const dt_locator *loc, const char *buf,
+                                 int len, time_t *dt_time_t)
+{
+    char dt_str[DT_STR_SIZE];
+    const char *line = memchr(buf, '\n', len), *nl;
+    const char *end = buf + len;
+
+    while (line != NULL && ++line < end)
+    {
+        nl = memchr(line, '\n', end - line);
+        if (loc->find(loc, line, (nl != NULL ? nl : end) - line, dt_str,
+                      dt_time_t))
+            return true;
+        line = nl;
+    }
+
+    return false;
+}
+
+
+// Writes the output of a decoded block. If check_to is set, a block which
+// first timestamp (in its first buffer) is after to_time_t isn't written and
+// false is returned. In the exact mode it's written anyway, the last line of a
+// range can be continued in it and the writer stops at the first line after
+// the range.
+static bool write_stream_blk(bunzip_data *bd, const dt_locator *loc,
+                             blk_writer *writer, bool check_to,
+                             time_t to_time_t)
+{
+    char obuf[STREAM_TAIL_SIZE];
+    int gotcount;
+    bool is_after_to = false;
+    time_t first_time_t;
+
+    while ((gotcount = read_bunzip(bd, obuf, sizeof(obuf))) > 0)
+    {
+        if (check_to)
+        {
+            check_to = false;
+            if (find_first_dt_in_buf(loc, obuf, gotcount, &first_time_t) &&
+                first_time_t > to_time_t)
+            {
+                if (!writer->exact)
+                    return false;
+                is_after_to = true;
+            }
+        }
+
+        blk_writer_write(writer, obuf, gotcount);
+        if (writer->done)
+            break;
+    }
+
+    if (gotcount < 0)
+    {
+        error_print("read_bunzip() returned: %s", bunzip_errors[-gotcount]);
+        fatal_exit();
+    }
+
+    return !is_after_to;
+}
@@ -0,0 +1,18 @@
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include "dt_locator.h"
+#include "time_range.h"
+#include "blk_writer.h"
+
+// Size of a decoded tail of a block which is searched for its last timestamp
+#define STREAM_TAIL_SIZE (BUFFER_SIZE * 8)
+
+// Extracts a time range from a bz2 stream which can't be seeked (stdin, a
+// pipe). Blocks are read sequentially, a block before the range is decoded
+// only till its last timestamp is known and isn't written. Reading is stopped
+// at the first block which is started after the range.
+void extract_stream(int, const dt_locator *, const time_range *,
+                    blk_writer *);
+
+#endif
@@ -0,0 +1,35 @@
+#!/bin/sh
+# A histogram which is counted by a complete index is the same as the one of
+# an unindexed file, whose lines are all uncompressed
+
+BIN=${BIN:-./extract_time_blk_bz2}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# A log of several hundred 100k blocks with stack traces between timestamps
+awk 'BEGIN {
+    t = 1487635200
+    for (i = 0; i < 200000; i++) {
+        print strftime("%Y-%m-%d %H:%M:%S", t + int(i / 4), 1) \
+              " INFO worker-" i % 8 " request id=" i
+        if (i % 1000 == 0)
+            for (j = 0; j < 20; j++)
+                print "\tat com.example.Foo" j ".bar(Foo.java:" i + j ")"
+    }
+}' > "$DIR/t.log" || exit 1
+bzip2 -1 "$DIR/t.log" || exit 1
+cp -p "$DIR/t.log.bz2" "$DIR/i.log.bz2"
+"$BIN" --build-index --file="$DIR/i.log.bz2" > /dev/null || exit 1
+
+for range in "00:00:00 13:00:00" "01:10:00 12:40:30"; do
+    set -- $range
+    for f in t i; do
+        "$BIN" --from="2017-02-21 $1" --to="2017-02-21 $2" --histogram=1800 \
+            --file="$DIR/$f.log.bz2" > "$DIR/$f.hist" || exit 1
+    done
+    if ! cmp "$DIR/t.hist" "$DIR/i.hist"; then
+        echo "FAIL: histograms of $1 - $2 differ with an index"
+        exit 1
+    fi
+done
+echo "ok: histogram_index"
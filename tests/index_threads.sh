@@ -0,0 +1,32 @@
+#!/bin/sh
+# An index which is built by one thread and by several threads is the same
+# file byte for byte
+
+BIN=${BIN:-./extract_time_blk_bz2}
+DIR=$(mktemp -d)
+trap 'rm -rf "$DIR"' EXIT
+
+# A log of several hundred 100k blocks with stack traces between timestamps
+awk 'BEGIN {
+    t = 1487635200
+    for (i = 0; i < 200000; i++) {
+        print strftime("%Y-%m-%d %H:%M:%S", t + int(i / 4), 1) \
+              " INFO worker-" i % 8 " request id=" i
+        if (i % 1000 == 0)
+            for (j = 0; j < 20; j++)
+                print "\tat com.example.Foo" j ".bar(Foo.java:" i + j ")"
+    }
+}' > "$DIR/t.log" || exit 1
+bzip2 -1 "$DIR/t.log" || exit 1
+
+for n in 1 4; do
+    cp -p "$DIR/t.log.bz2" "$DIR/t$n.log.bz2"
+    "$BIN" --build-index --threads=$n --bloom --file="$DIR/t$n.log.bz2" \
+        > /dev/null || exit 1
+done
+
+if ! cmp "$DIR/t1.log.bz2.idx" "$DIR/t4.log.bz2.idx"; then
+    echo "FAIL: indexes of 1 and 4 threads differ"
+    exit 1
+fi
+echo "ok: index_threads"
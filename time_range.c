@@ -0,0 +1,136 @@
+// Lists of time ranges for multi-range queries.
+
+
+#include <stdio.h>
+#include <stdlib.h>			// exit(), qsort()
+#include <string.h>			// strdup(), strpbrk()
+#include <errno.h>			// strerror()
+#include "extract_time_blk_bz2.h"
+#include "time_range.h"
+
+
+static char * trim_spaces(char *);
+static int compare_time_ranges(const void *, const void *);
+
+
+void add_time_range(time_range **ranges, int *n_ranges, const char *from,
+                    const char *to)
+{
+    time_range *new_ranges;
+
+    if ((new_ranges = realloc(*ranges, (*n_ranges + 1) * sizeof(time_range)))
+        == NULL)
+    {
+        error_print("Can't allocate memory for %d time ranges", *n_ranges + 1);
+        fatal_exit();
+    }
+
+    *ranges = new_ranges;
+    (*ranges)[*n_ranges].from = from;
+    (*ranges)[*n_ranges].to = to;
+    (*ranges)[*n_ranges].from_time_t = (*ranges)[*n_ranges].to_time_t = 0;
+    (*n_ranges)++;
+}
+
+
+void read_ranges_file(const char *path, time_range **ranges, int *n_ranges)
+{
+    FILE *ranges_file;
+    char line[BUFFER_SIZE];
+    char *from, *to, *delim;
+    int line_num = 0;
+
+    if ((ranges_file = fopen(path, "r")) == NULL)
+    {
+        error_print("Can't open the ranges file %s\n%s", path, strerror(errno));
+        fatal_exit();
+    }
+
+    while (fgets(line, sizeof(line), ranges_file) != NULL)
+    {
+        line_num++;
+
+        from = trim_spaces(line);
+        if (*from == '\0' || *from == '#')
+            continue;
+
+        // Datetime formats have spaces, so a delimiter is a tab or a comma
+        if ((delim = strpbrk(from, "\t,")) == NULL)
+        {
+            error_print("%s:%d: a range should be set as \"FROM<TAB>TO\" or "
+                        "\"FROM,TO\"", path, line_num);
+            fatal_exit();
+        }
+
+        *delim = '\0';
+        from = trim_spaces(from);
+        to = trim_spaces(delim + 1);
+
+        if ((from = strdup(from)) == NULL || (to = strdup(to)) == NULL)
+        {
+            error_print("%s", "Can't allocate memory for a time range");
+            fatal_exit();
+        }
+
+        add_time_range(ranges, n_ranges, from, to);
+    }
+
+    fclose(ranges_file);
+}
+
+
+int merge_time_ranges(time_range *ranges, int n_ranges)
+{
+    int merged = 0;
+
+    if (n_ranges == 0)
+        return 0;
+
+    qsort(ranges, n_ranges, sizeof(time_range), compare_time_ranges);
+
+    for (int i = 1; i < n_ranges; i++)
+    {
+        // Overlapping ranges are extracted as one range
+        if (ranges[i].from_time_t <= ranges[merged].to_time_t)
+        {
+            if (ranges[i].to_time_t > ranges[merged].to_time_t)
+            {
+                ranges[merged].to_time_t = ranges[i].to_time_t;
+                ranges[merged].to = ranges[i].to;
+            }
+            continue;
+        }
+
+        ranges[++merged] = ranges[i];
+    }
+
+    return merged + 1;
+}
+
+
+static int compare_time_ranges(const void *a, const void *b)
+{
+    const time_range *range_a = a, *range_b = b;
+
+    if (range_a->from_time_t != range_b->from_time_t)
+        return range_a->from_time_t < range_b->from_time_t ? -1 : 1;
+
+    return 0;
+}
+
+
+// Trims leading and trailing spaces (and a newline) in place
+static char * trim_spaces(char *str)
+{
+    char *str_end;
+
+    while (*str == ' ' || *str == '\t')
+        str++;
+
+    str_end = str + strlen(str);
+    while (str_end > str && (str_end[-1] == ' ' || str_end[-1] == '\t' ||
+                             str_end[-1] == '\n' || str_end[-1] == '\r'))
+        *--str_end = '\0';
+
+    return str;
+}
@@ -0,0 +1,24 @@
+#ifndef __TIME_RANGE_H__
+#define __TIME_RANGE_H__
+
+#include <time.h>           // time_t
+
+// A requested period of a log
+typedef struct
+{
+    // --from/--to values as they were set
+    const char *from, *to;
+    // --from/--to values converted to epoch time
+    time_t from_time_t, to_time_t;
+} time_range;
+
+// Appends a range to a growing array of ranges
+void add_time_range(time_range **, int *, const char *, const char *);
+// Reads ranges from a file of "FROM<TAB>TO" or "FROM,TO" lines. Empty lines
+// and lines started from '#' are skipped.
+void read_ranges_file(const char *, time_range **, int *);
+// Sorts converted ranges by from_time_t and merges the overlapping ones.
+// Returns the new amount of ranges.
+int merge_time_ranges(time_range *, int);
+
+#endif